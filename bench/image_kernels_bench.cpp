@@ -0,0 +1,203 @@
+// Microbenchmark for the pixel processing kernels in src/image_kernels.hpp.
+//
+// Usage: image_kernels_bench [-i ITERATIONS] [-w WIDTH]
+//
+// Every kernel is run row by row over a WIDTH x 1080 image (default width 1920)
+// ITERATIONS times (default 50) after one warmup pass, once for each
+// implementation available on the CPU (only once for blit and compareAndCopy,
+// which are not vectorized by the implementations). Before timing, the output
+// of each implementation is checked against the scalar implementation. The results
+// (throughput in megapixels per second and the speedup compared to the scalar
+// implementation) are written to stdout as JSON.
+
+#include "../src/image_kernels.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace browservice;
+
+namespace {
+
+const int Height = 1080;
+
+void check(bool cond, const char* msg) {
+    if(!cond) {
+        fprintf(stderr, "ERROR: %s\n", msg);
+        exit(1);
+    }
+}
+
+struct Buffers {
+    int width;
+    vector<uint8_t> dest;
+    vector<uint8_t> src;
+    vector<uint8_t> mask;
+
+    Buffers(int width) : width(width) {
+        size_t pixelCount = (size_t)width * (size_t)Height;
+        dest.resize(4 * pixelCount);
+        src.resize(4 * pixelCount);
+        mask.resize(pixelCount);
+
+        mt19937 gen(1234);
+        uniform_int_distribution<int> dist(0, 255);
+        for(size_t i = 0; i < pixelCount; ++i) {
+            // Mostly black and white pixels with some colored ones, similarly
+            // to the rendered text
+            uint8_t value = dist(gen) < 128 ? 0 : 255;
+            bool colored = dist(gen) < 32;
+            for(int c = 0; c < 4; ++c) {
+                dest[4 * i + c] = colored ? (uint8_t)dist(gen) : value;
+                src[4 * i + c] = (uint8_t)dist(gen);
+            }
+            mask[i] = (uint8_t)dist(gen);
+        }
+    }
+};
+
+struct Kernel {
+    const char* name;
+
+    // False if the kernel runs the same code in all the implementations.
+    bool vectorized;
+
+    // Runs the kernel over the whole image; src may be modified by the
+    // kernel for the compare kernels.
+    function<void(Buffers&)> run;
+};
+
+vector<Kernel> kernels() {
+    return {
+        {"fill", true, [](Buffers& bufs) {
+            for(int y = 0; y < Height; ++y) {
+                image_kernels::fill(
+                    &bufs.dest[4 * (size_t)y * bufs.width], bufs.width,
+                    12, 34, 56
+                );
+            }
+        }},
+        {"blit", false, [](Buffers& bufs) {
+            image_kernels::blit(
+                bufs.dest.data(), bufs.width,
+                bufs.src.data(), bufs.width,
+                bufs.width - 1, Height
+            );
+        }},
+        {"blendMask", true, [](Buffers& bufs) {
+            for(int y = 0; y < Height; ++y) {
+                image_kernels::blendMask(
+                    &bufs.dest[4 * (size_t)y * bufs.width],
+                    &bufs.mask[(size_t)y * bufs.width],
+                    bufs.width,
+                    200, 100, 50
+                );
+            }
+        }},
+        {"compareAndCopyChanged", false, [](Buffers& bufs) {
+            for(int y = 0; y < Height; ++y) {
+                size_t offset = 4 * (size_t)y * bufs.width;
+                bufs.src[offset + 2 * (size_t)bufs.width] ^= 1;
+                check(
+                    image_kernels::compareAndCopy(
+                        &bufs.dest[offset], &bufs.src[offset], 4 * bufs.width
+                    ),
+                    "compareAndCopy did not detect a change"
+                );
+            }
+        }},
+        {"compareAndCopyUnchanged", false, [](Buffers& bufs) {
+            for(int y = 0; y < Height; ++y) {
+                size_t offset = 4 * (size_t)y * bufs.width;
+                image_kernels::compareAndCopy(
+                    &bufs.dest[offset], &bufs.src[offset], 4 * bufs.width
+                );
+            }
+        }},
+        {"recolor", true, [](Buffers& bufs) {
+            for(int y = 0; y < Height; ++y) {
+                image_kernels::recolor(
+                    &bufs.dest[4 * (size_t)y * bufs.width], bufs.width,
+                    255, 255, 255,
+                    0, 0, 128
+                );
+            }
+        }},
+    };
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = 50;
+    int width = 1920;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if((arg == "-i" || arg == "-w") && i + 1 < argc) {
+            int value = atoi(argv[++i]);
+            check(value > 0, "Invalid argument value");
+            (arg == "-i" ? iterations : width) = value;
+        } else {
+            fprintf(stderr, "Usage: %s [-i ITERATIONS] [-w WIDTH]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    vector<string> impls = image_kernels::availableImplementations();
+    check(!impls.empty() && impls[0] == "scalar", "Scalar implementation missing");
+
+    cout << "{\n";
+    cout << "  \"width\": " << width << ",\n";
+    cout << "  \"height\": " << Height << ",\n";
+    cout << "  \"iterations\": " << iterations << ",\n";
+    cout << "  \"kernels\": [";
+
+    bool firstKernel = true;
+    for(const Kernel& kernel : kernels()) {
+        cout << (firstKernel ? "\n" : ",\n");
+        firstKernel = false;
+        cout << "    {\"name\": \"" << kernel.name << "\", \"results\": [";
+
+        // Reference output using the scalar implementation
+        check(image_kernels::selectImplementation("scalar"), "Selection failed");
+        Buffers reference(width);
+        kernel.run(reference);
+
+        double scalarMPixPerSec = 0.0;
+        size_t implCount = kernel.vectorized ? impls.size() : 1;
+        for(size_t implIdx = 0; implIdx < implCount; ++implIdx) {
+            const string& impl = impls[implIdx];
+            check(image_kernels::selectImplementation(impl), "Selection failed");
+
+            Buffers bufs(width);
+            kernel.run(bufs);
+            check(
+                bufs.dest == reference.dest,
+                (impl + " output differs from scalar for " + kernel.name).c_str()
+            );
+
+            steady_clock::time_point start = steady_clock::now();
+            for(int iter = 0; iter < iterations; ++iter) {
+                kernel.run(bufs);
+            }
+            double seconds = std::chrono::duration<double>(
+                steady_clock::now() - start
+            ).count();
+
+            double mpixPerSec =
+                (double)width * Height * iterations / 1e6 / seconds;
+            if(implIdx == 0) {
+                scalarMPixPerSec = mpixPerSec;
+            }
+
+            cout << (implIdx ? ", " : "");
+            cout << "{\"implementation\": \"" << impl << "\", ";
+            cout << "\"mpixPerSec\": " << mpixPerSec << ", ";
+            cout << "\"speedup\": " << mpixPerSec / scalarMPixPerSec << "}";
+        }
+        cout << "]}";
+    }
+    cout << "\n  ]\n}\n";
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+// Benchmark for the request blocking engine in src/request_filter.hpp.
+//
+// Usage: request_filter_bench [-i ITERATIONS] URL_LIST FILTER_LIST...
+//
+// Each line of URL_LIST describes a recorded request as TYPE URL
+// [DOCUMENT_URL], where TYPE is document, subdocument, stylesheet, script,
+// image, font, object, xmlhttprequest, ping, media, websocket or other. The
+// filter lists are loaded as in browservice, after which every request is
+// matched ITERATIONS times (default 20) after one warmup pass, timing each
+// query separately. The results (rule counts, loading time, number of blocked
+// requests and the query latency distribution in nanoseconds) are written to
+// stdout as JSON. Before the benchmark, the classification of third-party
+// requests is checked on a few fixed cases.
+
+#include "../src/request_filter.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace browservice;
+
+namespace {
+
+typedef RequestFilter::ResourceType ResourceType;
+
+void check(bool cond, const char* msg) {
+    if(!cond) {
+        fprintf(stderr, "ERROR: %s\n", msg);
+        exit(1);
+    }
+}
+
+const map<string, ResourceType> typeNames = {
+    {"document", ResourceType::Document},
+    {"subdocument", ResourceType::Subdocument},
+    {"stylesheet", ResourceType::Stylesheet},
+    {"script", ResourceType::Script},
+    {"image", ResourceType::Image},
+    {"font", ResourceType::Font},
+    {"object", ResourceType::Object},
+    {"xmlhttprequest", ResourceType::XMLHttpRequest},
+    {"ping", ResourceType::Ping},
+    {"media", ResourceType::Media},
+    {"websocket", ResourceType::WebSocket},
+    {"other", ResourceType::Other}
+};
+
+vector<RequestFilter::Request> readRequests(const char* filename) {
+    ifstream fp(filename);
+    check(fp.good(), "Could not open URL list");
+
+    vector<RequestFilter::Request> requests;
+    string line;
+    while(getline(fp, line)) {
+        stringstream ss(line);
+        string type;
+        RequestFilter::Request request;
+        if(!(ss >> type >> request.url)) {
+            continue;
+        }
+        ss >> request.documentURL;
+
+        auto it = typeNames.find(type);
+        check(it != typeNames.end(), "Invalid request type in URL list");
+        request.type = it->second;
+        requests.push_back(move(request));
+    }
+    check(!requests.empty(), "URL list is empty");
+    return requests;
+}
+
+// Checks that requests between the subdomains of a site are first-party and
+// requests to other sites under the same country code TLD are third-party.
+void checkThirdParty() {
+    shared_ptr<RequestFilter> filter = RequestFilter::create(
+        vector<string>{"/thirdpartycheck.$third-party"}
+    );
+
+    auto blocked = [&](string host, string documentHost) {
+        RequestFilter::Request request;
+        request.url = "https://" + host + "/thirdpartycheck.js";
+        request.documentURL = "https://" + documentHost + "/";
+        request.type = ResourceType::Script;
+        return filter->shouldBlock(request);
+    };
+
+    struct Case {
+        string host;
+        string documentHost;
+        bool thirdParty;
+    };
+    const vector<Case> cases = {
+        {"img.ard.de", "www.ard.de", false},
+        {"ard.de", "www.ard.de", false},
+        {"static.bbc.co.uk", "www.bbc.co.uk", false},
+        {"cdn.example.com", "www.example.com", false},
+        {"www.ard.de", "www.zdf.de", true},
+        {"ads.other.co.uk", "www.bbc.co.uk", true},
+        {"ads.example.net", "www.example.com", true}
+    };
+    for(const Case& c : cases) {
+        check(
+            blocked(c.host, c.documentHost) == c.thirdParty,
+            "Third-party classification check failed"
+        );
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = 20;
+    vector<string> files;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if(arg == "-i" && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            check(iterations > 0, "Invalid argument value");
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if(files.size() < 2) {
+        fprintf(
+            stderr,
+            "Usage: %s [-i ITERATIONS] URL_LIST FILTER_LIST...\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    checkThirdParty();
+
+    vector<RequestFilter::Request> requests = readRequests(files[0].c_str());
+    files.erase(files.begin());
+
+    steady_clock::time_point loadStart = steady_clock::now();
+    shared_ptr<RequestFilter> filter = RequestFilter::load(files);
+    double loadSeconds = std::chrono::duration<double>(
+        steady_clock::now() - loadStart
+    ).count();
+    check((bool)filter, "Loading filter lists failed");
+
+    // Warmup pass
+    size_t blocked = 0;
+    for(const RequestFilter::Request& request : requests) {
+        if(filter->shouldBlock(request)) {
+            ++blocked;
+        }
+    }
+
+    size_t timedBlocked = 0;
+    vector<double> times;
+    times.reserve(requests.size() * (size_t)iterations);
+    for(int iter = 0; iter < iterations; ++iter) {
+        for(const RequestFilter::Request& request : requests) {
+            steady_clock::time_point start = steady_clock::now();
+            bool result = filter->shouldBlock(request);
+            double nanoseconds = std::chrono::duration<double, std::nano>(
+                steady_clock::now() - start
+            ).count();
+            if(result) {
+                ++timedBlocked;
+            }
+            times.push_back(nanoseconds);
+        }
+    }
+    check(timedBlocked == blocked * (size_t)iterations, "Results not stable");
+    sort(times.begin(), times.end());
+
+    double total = 0.0;
+    for(double time : times) {
+        total += time;
+    }
+    auto percentile = [&](double p) {
+        return times[(size_t)(p * (double)(times.size() - 1))];
+    };
+
+    cout << "{\n";
+    cout << "  \"rules\": " << filter->ruleCount() << ",\n";
+    cout << "  \"skippedRules\": " << filter->skippedRuleCount() << ",\n";
+    cout << "  \"loadTimeMs\": " << loadSeconds * 1e3 << ",\n";
+    cout << "  \"requests\": " << requests.size() << ",\n";
+    cout << "  \"blocked\": " << blocked << ",\n";
+    cout << "  \"iterations\": " << iterations << ",\n";
+    cout << "  \"meanNs\": " << total / (double)times.size() << ",\n";
+    cout << "  \"p50Ns\": " << percentile(0.5) << ",\n";
+    cout << "  \"p99Ns\": " << percentile(0.99) << ",\n";
+    cout << "  \"maxNs\": " << times.back() << "\n";
+    cout << "}\n";
+
+    return 0;
+}
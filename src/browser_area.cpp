@@ -1,5 +1,6 @@
 #include "browser_area.hpp"
 
+#include "image_kernels.hpp"
 #include "key.hpp"
 #include "text.hpp"
 
@@ -157,15 +158,43 @@ public:
     ) override {
         REQUIRE_UI_THREAD();
 
+        steady_clock::time_point startTime = steady_clock::now();
+        paint_(type, dirtyRects, buffer, bufWidth, bufHeight);
+        browserArea_->paintTime_ += steady_clock::now() - startTime;
+
+        if(type == PET_VIEW) {
+            browserArea_->painted_ = true;
+        }
+    }
+
+private:
+    void paint_(
+        PaintElementType type,
+        const RectList& dirtyRects,
+        const void* buffer,
+        int bufWidth,
+        int bufHeight
+    ) {
         ImageSlice viewport = browserArea_->getViewport();
-        bool updated = false;
+
+        // The changed tiles are tracked in the global coordinates of the root
+        // image.
+        TileMap changedTiles(
+            viewport.globalX() + viewport.width(),
+            viewport.globalY() + viewport.height()
+        );
 
         if(browserArea_->errorActive_) {
             viewport.fill(0, viewport.width(), 0, viewport.height(), 255);
             browserArea_->errorLayout_->render(
                 viewport.splitY(20).first, 7, 0, 96, 0, 0
             );
-            updated = true;
+            changedTiles.markRect(Rect(
+                viewport.globalX(),
+                viewport.globalX() + viewport.width(),
+                viewport.globalY(),
+                viewport.globalY() + viewport.height()
+            ));
         } else {
             int offsetX = 0;
             int offsetY = 0;
@@ -187,22 +216,28 @@ public:
                 return;
             }
 
+            // Copy the range in pieces split at the tile boundaries to find
+            // out which tiles changed.
             auto copyRange = [&](int y, int ax, int bx) {
-                if(ax >= bx) {
-                    return;
-                }
-
-                uint8_t* src = &((uint8_t*)buffer)[4 * (y * bufWidth + ax)];
-                uint8_t* dest = viewport.getPixelPtr(ax + offsetX, y + offsetY);
-                int byteCount = 4 * (bx - ax);
-
-                if(updated) {
-                    memcpy(dest, src, byteCount);
-                } else {
-                    if(memcmp(src, dest, byteCount)) {
-                        updated = true;
-                        memcpy(dest, src, byteCount);
+                int globalOffsetX = viewport.globalX() + offsetX;
+                int globalY = viewport.globalY() + offsetY + y;
+                int tileY = globalY / TileMap::TileSize;
+
+                while(ax < bx) {
+                    int tileX = (globalOffsetX + ax) / TileMap::TileSize;
+                    int tileEndX = (tileX + 1) * TileMap::TileSize - globalOffsetX;
+                    int pieceEndX = min(bx, tileEndX);
+
+                    const uint8_t* src =
+                        &((const uint8_t*)buffer)[4 * (y * bufWidth + ax)];
+                    uint8_t* dest = viewport.getPixelPtr(ax + offsetX, y + offsetY);
+                    if(image_kernels::compareAndCopy(
+                        dest, src, 4 * (pieceEndX - ax)
+                    )) {
+                        changedTiles.mark(tileX, tileY);
                     }
+
+                    ax = pieceEndX;
                 }
             };
 
@@ -228,15 +263,18 @@ public:
             }
         }
 
-        if(updated) {
-            postTask(
-                browserArea_->eventHandler_,
-                &BrowserAreaEventHandler::onBrowserAreaViewDirty
-            );
+        // The pixels have already been written to the viewport, so the changed
+        // tiles must be recorded before any other task gets to fetch the view.
+        if(!changedTiles.isEmpty()) {
+            if(
+                shared_ptr<BrowserAreaEventHandler> eventHandler =
+                    browserArea_->eventHandler_.lock()
+            ) {
+                eventHandler->onBrowserAreaViewDirty(move(changedTiles));
+            }
         }
     }
 
-private:
     shared_ptr<BrowserArea> browserArea_;
 
     IMPLEMENT_REFCOUNTING(RenderHandler);
@@ -252,6 +290,8 @@ BrowserArea::BrowserArea(CKey,
     eventHandler_ = eventHandler;
     popupOpen_ = false;
     eventModifiers_ = 0;
+    paintTime_ = steady_clock::duration::zero();
+    painted_ = false;
     errorActive_ = false;
     errorLayout_ = TextLayout::create();
 }
@@ -313,6 +353,16 @@ void BrowserArea::setCursor(int cursor) {
     setCursor_(cursor);
 }
 
+steady_clock::duration BrowserArea::paintTime() {
+    REQUIRE_UI_THREAD();
+    return paintTime_;
+}
+
+bool BrowserArea::hasPainted() {
+    REQUIRE_UI_THREAD();
+    return painted_;
+}
+
 void BrowserArea::widgetViewportUpdated_() {
     REQUIRE_UI_THREAD();
 
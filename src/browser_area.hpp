@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rect.hpp"
+#include "tile_map.hpp"
 #include "widget.hpp"
 
 class CefBrowser;
@@ -10,7 +11,12 @@ namespace browservice {
 
 class BrowserAreaEventHandler {
 public:
-    virtual void onBrowserAreaViewDirty() = 0;
+    // changedTiles marks the tiles of the root image (the image buffer shared
+    // by the viewport of the browser area, sized such that it extends to the
+    // bottom right corner of the viewport) whose contents changed. Called
+    // directly from CefRenderHandler::OnPaint, so the implementation may not
+    // call back into the browser synchronously.
+    virtual void onBrowserAreaViewDirty(TileMap changedTiles) = 0;
 };
 
 class TextLayout;
@@ -52,6 +58,14 @@ public:
     // Notify the browser area that the browser has changed the cursor type.
     void setCursor(int cursor);
 
+    // Total time spent copying the frames painted by the browser to the
+    // viewport.
+    steady_clock::duration paintTime();
+
+    // Returns true if the browser has painted its view at least once (until
+    // then, the viewport only shows the initial blank image).
+    bool hasPainted();
+
 private:
     class RenderHandler;
 
@@ -77,6 +91,9 @@ private:
 
     uint32_t eventModifiers_;
 
+    steady_clock::duration paintTime_;
+    bool painted_;
+
     bool errorActive_;
     shared_ptr<TextLayout> errorLayout_;
 };
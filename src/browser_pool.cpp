@@ -0,0 +1,185 @@
+#include "browser_pool.hpp"
+
+#include "globals.hpp"
+
+namespace browservice {
+
+BrowserPool::BrowserPool(CKey,
+    weak_ptr<BrowserPoolEventHandler> eventHandler
+) {
+    REQUIRE_UI_THREAD();
+
+    eventHandler_ = eventHandler;
+    state_ = Running;
+    nextPoolHandle_ = 1;
+    refillPending_ = false;
+    creationFailed_ = false;
+}
+
+shared_ptr<Window> BrowserPool::tryClaim(
+    shared_ptr<WindowEventHandler> eventHandler,
+    uint64_t handle
+) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(eventHandler);
+    REQUIRE(handle);
+
+    if(state_ != Running) {
+        return {};
+    }
+
+    // A failed creation is retried when the next window is requested
+    creationFailed_ = false;
+
+    if(pooledWindows_.empty()) {
+        scheduleRefill_();
+        return {};
+    }
+
+    auto it = pooledWindows_.begin();
+    uint64_t poolHandle = it->first;
+    shared_ptr<Window> window = it->second;
+    pooledWindows_.erase(it);
+    scheduleRefill_();
+
+    INFO_LOG("Claiming pooled window ", poolHandle, " as window ", handle);
+    window->claim(eventHandler, handle);
+
+    return window;
+}
+
+int BrowserPool::size() {
+    REQUIRE_UI_THREAD();
+    return (int)pooledWindows_.size();
+}
+
+void BrowserPool::shutdown() {
+    REQUIRE_UI_THREAD();
+
+    if(state_ == Running) {
+        state_ = WaitWindows;
+
+        map<uint64_t, shared_ptr<Window>> windows;
+        swap(windows, pooledWindows_);
+        for(pair<uint64_t, shared_ptr<Window>> p : windows) {
+            p.second->close();
+            REQUIRE(cleanupWindows_.insert(p).second);
+        }
+
+        checkShutdownComplete_();
+    }
+}
+
+void BrowserPool::onWindowClose(uint64_t handle) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ != ShutdownComplete);
+
+    auto it = pooledWindows_.find(handle);
+    REQUIRE(it != pooledWindows_.end());
+
+    INFO_LOG("Pooled window ", handle, " closed, dropping it from the pool");
+
+    shared_ptr<Window> window = it->second;
+    pooledWindows_.erase(it);
+    REQUIRE(cleanupWindows_.emplace(handle, window).second);
+}
+
+void BrowserPool::onWindowCleanupComplete(uint64_t handle) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ != ShutdownComplete);
+
+    REQUIRE(cleanupWindows_.erase(handle));
+    checkShutdownComplete_();
+}
+
+void BrowserPool::onWindowViewImageChanged(uint64_t handle) {}
+void BrowserPool::onWindowCursorChanged(uint64_t handle, int cursor) {}
+
+optional<pair<vector<string>, size_t>> BrowserPool::onWindowQualitySelectorQuery(
+    uint64_t handle
+) {
+    // The query is repeated when the window is claimed
+    return {};
+}
+
+void BrowserPool::onWindowQualityChanged(uint64_t handle, size_t idx) {}
+
+bool BrowserPool::onWindowNeedsClipboardButtonQuery(uint64_t handle) {
+    return false;
+}
+
+void BrowserPool::onWindowClipboardButtonPressed(uint64_t handle) {}
+
+void BrowserPool::onWindowDownloadCompleted(
+    uint64_t handle, shared_ptr<CompletedDownload> file
+) {}
+
+bool BrowserPool::onWindowStartFileUpload(uint64_t handle) {
+    return false;
+}
+
+void BrowserPool::onWindowCancelFileUpload(uint64_t handle) {}
+
+void BrowserPool::onWindowCreatePopupRequest(
+    uint64_t handle,
+    function<shared_ptr<Window>(uint64_t)> accept
+) {
+    INFO_LOG("Denying popup window request from pooled window ", handle);
+}
+
+void BrowserPool::afterConstruct_(shared_ptr<BrowserPool> self) {
+    scheduleRefill_();
+}
+
+void BrowserPool::scheduleRefill_() {
+    if(
+        !refillPending_ &&
+        (int)pooledWindows_.size() < globals->config->browserPoolSize
+    ) {
+        refillPending_ = true;
+        postTask(shared_from_this(), &BrowserPool::refill_);
+    }
+}
+
+void BrowserPool::refill_() {
+    REQUIRE_UI_THREAD();
+
+    refillPending_ = false;
+
+    if(
+        state_ != Running ||
+        creationFailed_ ||
+        (int)pooledWindows_.size() >= globals->config->browserPoolSize
+    ) {
+        return;
+    }
+
+    uint64_t poolHandle = nextPoolHandle_++;
+    REQUIRE(poolHandle);
+
+    shared_ptr<Window> window =
+        Window::tryCreate(shared_from_this(), poolHandle, true);
+    if(!window) {
+        WARNING_LOG(
+            "Creating a window for the browser pool failed, ",
+            "not retrying until the next window is opened"
+        );
+        creationFailed_ = true;
+        return;
+    }
+    REQUIRE(pooledWindows_.emplace(poolHandle, window).second);
+
+    scheduleRefill_();
+}
+
+void BrowserPool::checkShutdownComplete_() {
+    if(state_ == WaitWindows && cleanupWindows_.empty()) {
+        REQUIRE(pooledWindows_.empty());
+        state_ = ShutdownComplete;
+        postTask(
+            eventHandler_, &BrowserPoolEventHandler::onBrowserPoolShutdownComplete
+        );
+    }
+}
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "window.hpp"
+
+namespace browservice {
+
+class BrowserPoolEventHandler {
+public:
+    virtual void onBrowserPoolShutdownComplete() = 0;
+};
+
+// Pool of windows whose CEF browsers have been created in advance and have
+// loaded the start page, so that a new window can be shown without waiting for
+// the browser to start. The pool is kept at the size given in the
+// configuration (browserPoolSize) by creating a replacement in the background
+// whenever a window is taken from the pool.
+//
+// The pool acts as the event handler of the pooled windows until they are
+// claimed; a pooled window that closes by itself is simply dropped from the
+// pool. Before destruction, call shutdown and wait for the
+// onBrowserPoolShutdownComplete event.
+class BrowserPool :
+    public WindowEventHandler,
+    public enable_shared_from_this<BrowserPool>
+{
+SHARED_ONLY_CLASS(BrowserPool);
+public:
+    BrowserPool(CKey, weak_ptr<BrowserPoolEventHandler> eventHandler);
+
+    // Takes a window from the pool and makes it an open window with given
+    // event handler and handle (see Window::claim). Returns an empty pointer if
+    // the pool is empty.
+    shared_ptr<Window> tryClaim(
+        shared_ptr<WindowEventHandler> eventHandler,
+        uint64_t handle
+    );
+
+    // Number of windows in the pool.
+    int size();
+
+    // Closes all the pooled windows and stops refilling the pool; the
+    // onBrowserPoolShutdownComplete event is called when their cleanup is
+    // complete.
+    void shutdown();
+
+    // WindowEventHandler:
+    virtual void onWindowClose(uint64_t handle) override;
+    virtual void onWindowCleanupComplete(uint64_t handle) override;
+    virtual void onWindowViewImageChanged(uint64_t handle) override;
+    virtual void onWindowCursorChanged(uint64_t handle, int cursor) override;
+    virtual optional<pair<vector<string>, size_t>> onWindowQualitySelectorQuery(
+        uint64_t handle
+    ) override;
+    virtual void onWindowQualityChanged(uint64_t handle, size_t idx) override;
+    virtual bool onWindowNeedsClipboardButtonQuery(uint64_t handle) override;
+    virtual void onWindowClipboardButtonPressed(uint64_t handle) override;
+    virtual void onWindowDownloadCompleted(
+        uint64_t handle, shared_ptr<CompletedDownload> file
+    ) override;
+    virtual bool onWindowStartFileUpload(uint64_t handle) override;
+    virtual void onWindowCancelFileUpload(uint64_t handle) override;
+    virtual void onWindowCreatePopupRequest(
+        uint64_t handle,
+        function<shared_ptr<Window>(uint64_t)> accept
+    ) override;
+
+private:
+    void afterConstruct_(shared_ptr<BrowserPool> self);
+
+    // The pool is refilled by refill_ tasks that each create one window, so
+    // that a large pool does not block the UI thread for long.
+    void scheduleRefill_();
+    void refill_();
+
+    void checkShutdownComplete_();
+
+    weak_ptr<BrowserPoolEventHandler> eventHandler_;
+
+    enum {Running, WaitWindows, ShutdownComplete} state_;
+
+    // The pooled windows have handles of their own (unrelated to the handles
+    // of the Server) until they are claimed.
+    uint64_t nextPoolHandle_;
+
+    // Windows in the order of creation; the oldest window is claimed first.
+    map<uint64_t, shared_ptr<Window>> pooledWindows_;
+    map<uint64_t, shared_ptr<Window>> cleanupWindows_;
+
+    bool refillPending_;
+
+    // Set if creating a window fails, to avoid retrying in a loop; cleared by
+    // the next claim.
+    bool creationFailed_;
+};
+
+}
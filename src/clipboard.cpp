@@ -0,0 +1,21 @@
+#include "clipboard.hpp"
+
+#include "xwindow.hpp"
+
+namespace browservice {
+
+Clipboard::Clipboard(CKey) {
+    xWindow_ = XWindow::create();
+}
+
+void Clipboard::paste(function<void(string)> callback) {
+    REQUIRE_UI_THREAD();
+    xWindow_->pasteFromClipboard(callback);
+}
+
+void Clipboard::copy(string text) {
+    REQUIRE_UI_THREAD();
+    xWindow_->copyToClipboard(move(text));
+}
+
+}
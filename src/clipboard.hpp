@@ -0,0 +1,27 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace browservice {
+
+class XWindow;
+
+// The clipboard used by the user interface of the browser (the text fields and
+// the clipboard functionality of the vice plugin). The clipboard of the X
+// server is used through an XWindow, so that the text is shared with the web
+// pages.
+class Clipboard {
+SHARED_ONLY_CLASS(Clipboard);
+public:
+    Clipboard(CKey);
+
+    // Same semantics as the functions of XWindow; the callback is always
+    // called in a separate task (if it is called at all).
+    void paste(function<void(string)> callback);
+    void copy(string text);
+
+private:
+    shared_ptr<XWindow> xWindow_;
+};
+
+}
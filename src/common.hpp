@@ -6,6 +6,7 @@
 #include <cctype>
 #include <chrono>
 #include <climits>
+#include <condition_variable>
 #include <cstdlib>
 #include <exception>
 #include <fstream>
@@ -24,6 +25,8 @@
 #include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -35,6 +38,7 @@ namespace browservice {
 using std::array;
 using std::atomic;
 using std::binary_search;
+using std::condition_variable;
 using std::cerr;
 using std::cout;
 using std::declval;
@@ -46,6 +50,7 @@ using std::function;
 using std::future;
 using std::ifstream;
 using std::lock_guard;
+using std::make_pair;
 using std::make_shared;
 using std::make_unique;
 using std::map;
@@ -77,7 +82,10 @@ using std::thread;
 using std::tie;
 using std::tuple;
 using std::uniform_int_distribution;
+using std::unique_lock;
 using std::unique_ptr;
+using std::unordered_map;
+using std::unordered_set;
 using std::vector;
 using std::weak_ptr;
 
@@ -26,7 +26,19 @@ public:
     const bool useDedicatedXvfb;
     const string startPage;
     const string dataDir;
+    const string cacheDir;
+    const int cacheSize;
     const int windowLimit;
+    const int memoryLimit;
+    const int cpuLimit;
+    const int backlogLimit;
+    const string overloadPolicy;
+    const int hibernationTimeout;
+    const int browserPoolSize;
+    const bool rendererPriority;
+    const int resizeDelay;
+    const int resizeStep;
+    const vector<string> filterLists;
     const vector<pair<string, optional<string>>> chromiumArgs;
 };
 
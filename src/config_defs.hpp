@@ -4,7 +4,19 @@
     CONF_FOREACH_OPT_ITEM(useDedicatedXvfb) \
     CONF_FOREACH_OPT_ITEM(startPage) \
     CONF_FOREACH_OPT_ITEM(dataDir) \
+    CONF_FOREACH_OPT_ITEM(cacheDir) \
+    CONF_FOREACH_OPT_ITEM(cacheSize) \
     CONF_FOREACH_OPT_ITEM(windowLimit) \
+    CONF_FOREACH_OPT_ITEM(memoryLimit) \
+    CONF_FOREACH_OPT_ITEM(cpuLimit) \
+    CONF_FOREACH_OPT_ITEM(backlogLimit) \
+    CONF_FOREACH_OPT_ITEM(overloadPolicy) \
+    CONF_FOREACH_OPT_ITEM(hibernationTimeout) \
+    CONF_FOREACH_OPT_ITEM(browserPoolSize) \
+    CONF_FOREACH_OPT_ITEM(rendererPriority) \
+    CONF_FOREACH_OPT_ITEM(resizeDelay) \
+    CONF_FOREACH_OPT_ITEM(resizeStep) \
+    CONF_FOREACH_OPT_ITEM(filterLists) \
     CONF_FOREACH_OPT_ITEM(chromiumArgs)
 
 CONF_DEF_OPT_INFO(vicePlugin) {
@@ -79,6 +91,34 @@ CONF_DEF_OPT_INFO(dataDir) {
     }
 };
 
+CONF_DEF_OPT_INFO(cacheDir) {
+    const char* name = "cache-dir";
+    const char* valSpec = "PATH";
+    string desc() {
+        return "absolute path to a directory for the HTTP cache shared by all windows (such as a directory on a memory-backed file system like /dev/shm) instead of data-dir; requires data-dir to be set, as in incognito mode the cache is always kept in memory";
+    }
+    string defaultValStr() {
+        return "default empty";
+    }
+    string defaultVal() {
+        return "";
+    }
+};
+
+CONF_DEF_OPT_INFO(cacheSize) {
+    const char* name = "cache-size";
+    const char* valSpec = "MEGABYTES";
+    string desc() {
+        return "if nonzero, maximum size of the HTTP cache shared by all windows; the least recently used entries are evicted when the cache grows larger (if zero, the size is determined by Chromium based on the free disk space)";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0 && val <= 2047;
+    }
+};
+
 CONF_DEF_OPT_INFO(windowLimit) {
     const char* name = "window-limit";
     const char* valSpec = "COUNT";
@@ -93,6 +133,169 @@ CONF_DEF_OPT_INFO(windowLimit) {
     }
 };
 
+CONF_DEF_OPT_INFO(memoryLimit) {
+    const char* name = "memory-limit";
+    const char* valSpec = "MEGABYTES";
+    string desc() {
+        return "if nonzero, new windows are denied while the total resident memory of the browser processes exceeds MEGABYTES megabytes";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0;
+    }
+};
+
+CONF_DEF_OPT_INFO(cpuLimit) {
+    const char* name = "cpu-limit";
+    const char* valSpec = "PERCENT";
+    string desc() {
+        return "if nonzero, new windows are denied while the moving average of the CPU utilization of the host exceeds PERCENT percent";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0 && val <= 100;
+    }
+};
+
+CONF_DEF_OPT_INFO(backlogLimit) {
+    const char* name = "backlog-limit";
+    const char* valSpec = "COUNT";
+    string desc() {
+        return "if nonzero, new windows are denied while more than COUNT windows have view updates that the vice plugin has not fetched within a second (i.e. the image compression is falling behind)";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0;
+    }
+};
+
+CONF_DEF_OPT_INFO(overloadPolicy) {
+    const char* name = "overload-policy";
+    const char* valSpec = "deny/hibernate/shed";
+    string desc() {
+        return "action taken while a limit given by memory-limit, cpu-limit or backlog-limit is exceeded: deny only denies new windows; hibernate and shed additionally hibernate or close the least recently used window that has been idle for at least a minute, one window per second";
+    }
+    string defaultVal() {
+        return "deny";
+    }
+    bool validate(const string& val) {
+        return val == "deny" || val == "hibernate" || val == "shed";
+    }
+};
+
+CONF_DEF_OPT_INFO(hibernationTimeout) {
+    const char* name = "hibernation-timeout";
+    const char* valSpec = "SECONDS";
+    string desc() {
+        return "if nonzero, the browser of a window that has received no input for SECONDS seconds is closed to free memory while the window keeps showing its last view; the page is reloaded at the same URL and scroll position on the next input (the navigation history of the window is lost)";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0;
+    }
+};
+
+CONF_DEF_OPT_INFO(browserPoolSize) {
+    const char* name = "browser-pool-size";
+    const char* valSpec = "COUNT";
+    string desc() {
+        return "number of browsers created in advance with the start page loaded, to be used for new windows (each pooled browser uses the memory of an open window but does not count towards the window limit)";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0;
+    }
+};
+
+CONF_DEF_OPT_INFO(rendererPriority) {
+    const char* name = "renderer-priority";
+    const char* valSpec = "YES/NO";
+    string desc() {
+        return "if enabled, the CPU and I/O priorities of the renderer processes of windows without input in the last 10 seconds are lowered (less if a client is viewing the window) and raised again immediately on input; raising the CPU priority back requires the CAP_SYS_NICE capability or a sufficient RLIMIT_NICE, without which only the I/O priorities are adjusted";
+    }
+    bool defaultVal() {
+        return false;
+    }
+};
+
+CONF_DEF_OPT_INFO(resizeDelay) {
+    const char* name = "resize-delay";
+    const char* valSpec = "MILLISECONDS";
+    string desc() {
+        return "if nonzero, after a window is resized, further size changes are deferred until the size has stayed the same for MILLISECONDS milliseconds, so that dragging the edge of a window does not make the page relayout on every step (in the meantime, the view is shown at its previous size)";
+    }
+    int defaultVal() {
+        return 150;
+    }
+    bool validate(int val) {
+        return val >= 0;
+    }
+};
+
+CONF_DEF_OPT_INFO(resizeStep) {
+    const char* name = "resize-step";
+    const char* valSpec = "PIXELS";
+    string desc() {
+        return "the width and height of the view are rounded down to multiples of PIXELS pixels (the rest of the client window is left empty), which reduces the number of relayouts when windows are resized";
+    }
+    int defaultVal() {
+        return 1;
+    }
+    bool validate(int val) {
+        return val >= 1 && val <= 64;
+    }
+};
+
+CONF_DEF_OPT_INFO(filterLists) {
+    const char* name = "filter-lists";
+    const char* valSpec = "FILENAME,...";
+    string desc() {
+        return "comma-separated filter lists in the EasyList/Adblock Plus format, loaded at startup; requests matching the blocking rules (typically ads and trackers) are cancelled in all windows";
+    }
+    string defaultValStr() {
+        return "default empty";
+    }
+    vector<string> defaultVal() {
+        return vector<string>();
+    }
+    optional<vector<string>> parse(string str) {
+        vector<string> ret;
+        if(str.empty()) {
+            return ret;
+        }
+
+        size_t start = 0;
+        while(true) {
+            size_t end = str.find(',', start);
+            if(end == string::npos) {
+                end = str.size();
+            }
+            string filename = str.substr(start, end - start);
+            if(filename.empty()) {
+                optional<vector<string>> empty;
+                return empty;
+            }
+            ret.push_back(filename);
+
+            if(end == str.size()) {
+                break;
+            }
+            start = end + 1;
+        }
+        return ret;
+    }
+};
+
 CONF_DEF_OPT_INFO(chromiumArgs) {
     const char* name = "chromium-args";
     const char* valSpec = "NAME(=VAL),...";
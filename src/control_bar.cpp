@@ -708,6 +708,34 @@ void ControlBar::widgetViewportUpdated_() {
     }
 }
 
+void ControlBar::scheduleAnimationTick_() {
+    REQUIRE_UI_THREAD();
+
+    weak_ptr<ControlBar> selfWeak = shared_from_this();
+    animationTimeout_->set([selfWeak]() {
+        if(shared_ptr<ControlBar> self = selfWeak.lock()) {
+            self->animationTick_();
+        }
+    });
+}
+
+void ControlBar::animationTick_() {
+    REQUIRE_UI_THREAD();
+
+    if(!loading_) {
+        return;
+    }
+
+    // When paused, the animation is continued by
+    // widgetAnimationsResumedEvent_.
+    AnimationFrameStatus status = requestAnimationFrame_();
+    if(status == AnimationFrameStatus::Allow) {
+        signalViewDirty_();
+    } else if(status == AnimationFrameStatus::Skip) {
+        scheduleAnimationTick_();
+    }
+}
+
 void ControlBar::widgetRender_() {
     REQUIRE_UI_THREAD();
 
@@ -835,17 +863,20 @@ void ControlBar::widgetRender_() {
             }
         }
 
-        weak_ptr<ControlBar> selfWeak = shared_from_this();
-        animationTimeout_->set([selfWeak]() {
-            if(shared_ptr<ControlBar> self = selfWeak.lock()) {
-                self->signalViewDirty_();
-            }
-        });
+        scheduleAnimationTick_();
     } else {
         loadingAnimationStartTime_.reset();
     }
 }
 
+void ControlBar::widgetAnimationsResumedEvent_() {
+    REQUIRE_UI_THREAD();
+
+    if(loading_ && !animationTimeout_->isActive()) {
+        scheduleAnimationTick_();
+    }
+}
+
 vector<shared_ptr<Widget>> ControlBar::widgetListChildren_() {
     REQUIRE_UI_THREAD();
     vector<shared_ptr<Widget>> children = {
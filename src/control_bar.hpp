@@ -88,10 +88,16 @@ private:
     class Layout;
     Layout layout_();
 
+    // Loading animation ticks; the view is only redrawn if the frame is
+    // allowed by requestAnimationFrame_.
+    void scheduleAnimationTick_();
+    void animationTick_();
+
     // Widget:
     virtual void widgetViewportUpdated_() override;
     virtual void widgetRender_() override;
     virtual vector<shared_ptr<Widget>> widgetListChildren_() override;
+    virtual void widgetAnimationsResumedEvent_() override;
 
     weak_ptr<ControlBarEventHandler> eventHandler_;
 
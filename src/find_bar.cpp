@@ -170,6 +170,7 @@ void FindBar::open() {
     if(!isOpen_) {
         isOpen_ = true;
         findResult_ = true;
+        updateTextFieldBackground_();
         text_.reset();
         textField_->setText("");
         lastDirForward_ = true;
@@ -204,6 +205,7 @@ void FindBar::setFindResult(bool found) {
 
     if(isOpen_ && findResult_ != found) {
         findResult_ = found;
+        updateTextFieldBackground_();
         signalViewDirty_();
     }
 }
@@ -309,6 +311,14 @@ void FindBar::find_(string text, bool forward) {
     }
 }
 
+void FindBar::updateTextFieldBackground_() {
+    if(findResult_) {
+        textField_->setBackgroundColor(255, 255, 255);
+    } else {
+        textField_->setBackgroundColor(255, 176, 176);
+    }
+}
+
 void FindBar::widgetViewportUpdated_() {
     REQUIRE_UI_THREAD();
 
@@ -48,6 +48,7 @@ private:
 
     bool updateText_(string text);
     void find_(string text, bool forward);
+    void updateTextFieldBackground_();
 
     // Widget:
     virtual void widgetViewportUpdated_() override;
@@ -0,0 +1,117 @@
+#include "frame_store.hpp"
+
+namespace browservice {
+
+FrameStore::FrameStore(CKey, weak_ptr<FrameStoreEventHandler> eventHandler) {
+    eventHandler_ = eventHandler;
+    published_.store(-1);
+    nextSequenceNumber_ = 1;
+    pending_.store(false);
+}
+
+bool FrameStore::publish(ImageSlice backBuffer, const TileMap& changedTiles) {
+    REQUIRE_UI_THREAD();
+
+    int width = backBuffer.width();
+    int height = backBuffer.height();
+
+    for(Slot& slot : slots_) {
+        slot.staleTiles.merge(changedTiles);
+    }
+    if(
+        pendingChangedTiles_.width() == width &&
+        pendingChangedTiles_.height() == height
+    ) {
+        pendingChangedTiles_.merge(changedTiles);
+    } else {
+        pendingChangedTiles_ = TileMap(width, height);
+        pendingChangedTiles_.markAll();
+    }
+
+    // Find a slot that is neither published nor held by a reader. A reader
+    // may increment the reference count of a slot it has seen published
+    // earlier, but it will not use the slot unless the slot is still
+    // published after the increment. The atomic operations are sequentially
+    // consistent so that the reader and the writer cannot both miss each
+    // other's updates. For the same reason, pending_ is set before the search:
+    // a reader releasing a slot either makes it available to the search or
+    // sees pending_ and notifies the event handler.
+    pending_.store(true);
+    int published = published_.load();
+    Slot* target = nullptr;
+    for(int i = 0; i < SlotCount; ++i) {
+        if(i != published && slots_[i].refCount.load() == 0) {
+            target = &slots_[i];
+            break;
+        }
+    }
+    if(target == nullptr) {
+        return false;
+    }
+
+    Snapshot& snapshot = target->snapshot;
+    if(
+        snapshot.image.width() != width ||
+        snapshot.image.height() != height
+    ) {
+        snapshot.image = ImageSlice::reuseBuffer(target->buffer, width, height);
+        target->staleTiles = TileMap(width, height);
+        target->staleTiles.markAll();
+    }
+
+    for(Rect rect : target->staleTiles.toRects()) {
+        snapshot.image.putImage(
+            backBuffer.subRect(rect.startX, rect.endX, rect.startY, rect.endY),
+            rect.startX,
+            rect.startY
+        );
+    }
+    target->staleTiles.clear();
+
+    snapshot.sequenceNumber = nextSequenceNumber_++;
+    snapshot.changedTiles = pendingChangedTiles_;
+    pendingChangedTiles_.clear();
+    pending_.store(false);
+
+    published_.store((int)(target - slots_));
+    return true;
+}
+
+bool FrameStore::hasPendingChanges() {
+    REQUIRE_UI_THREAD();
+    return pending_.load();
+}
+
+shared_ptr<FrameStore::Snapshot> FrameStore::acquire() {
+    while(true) {
+        int idx = published_.load();
+        if(idx == -1) {
+            return {};
+        }
+
+        Slot& slot = slots_[idx];
+        slot.refCount.fetch_add(1);
+
+        // If the slot is still published, the writer will not touch it until
+        // the reference is released.
+        if(published_.load() == idx) {
+            shared_ptr<FrameStore> self = shared_from_this();
+            shared_ptr<void> reference(nullptr, [self, idx](void*) {
+                if(
+                    self->slots_[idx].refCount.fetch_sub(1) == 1 &&
+                    self->pending_.load()
+                ) {
+                    postTask(
+                        self->eventHandler_,
+                        &FrameStoreEventHandler::onFrameStoreSnapshotReleased
+                    );
+                }
+            });
+            return shared_ptr<Snapshot>(reference, &slot.snapshot);
+        }
+
+        slot.refCount.fetch_sub(1);
+    }
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "image_slice.hpp"
+#include "tile_map.hpp"
+
+namespace browservice {
+
+class FrameStoreEventHandler {
+public:
+    // Called in the UI thread when a reader releases a snapshot while a
+    // publish is pending, i.e. when publish should be retried.
+    virtual void onFrameStoreSnapshotReleased() = 0;
+};
+
+// Lock-free triple buffer of snapshots of a view image. The view image itself
+// (the image that CEF and the widgets draw into) acts as the back buffer; the
+// writer publishes its contents by copying the tiles that have changed into a
+// free snapshot slot and atomically swapping that slot in as the published
+// snapshot. Readers acquire the latest published snapshot; a snapshot is not
+// modified as long as it is held by a reader.
+//
+// The writer functions (publish, hasPendingChanges) may only be called from
+// the CEF UI thread; acquire may be called from any thread.
+class FrameStore : public enable_shared_from_this<FrameStore> {
+SHARED_ONLY_CLASS(FrameStore);
+public:
+    struct Snapshot {
+        ImageSlice image;
+
+        // Incremented by each publish.
+        uint64_t sequenceNumber;
+
+        // Tiles that differ from the previously published snapshot (all the
+        // tiles if the size has changed).
+        TileMap changedTiles;
+    };
+
+    FrameStore(CKey, weak_ptr<FrameStoreEventHandler> eventHandler);
+
+    // Publishes the contents of backBuffer; changedTiles must mark the tiles
+    // of backBuffer that have changed since the previous call. If all the
+    // slots are held by readers, the changes are retained as pending and the
+    // function returns false; in that case, publish should be called again
+    // later (changedTiles may then be empty), for example upon
+    // FrameStoreEventHandler::onFrameStoreSnapshotReleased.
+    bool publish(ImageSlice backBuffer, const TileMap& changedTiles);
+
+    // Returns true if the latest publish failed.
+    bool hasPendingChanges();
+
+    // Returns the latest published snapshot, or an empty pointer if nothing
+    // has been published yet. The snapshot (which may not be modified) is held
+    // until the returned pointer and its copies are destroyed.
+    shared_ptr<Snapshot> acquire();
+
+private:
+    static constexpr int SlotCount = 3;
+
+    struct Slot {
+        Slot() : refCount(0) {}
+
+        // Written by the writer only while the slot is not published and
+        // refCount is zero.
+        Snapshot snapshot;
+
+        // Accessed only by the writer: the tiles in which the slot differs
+        // from the back buffer.
+        TileMap staleTiles;
+
+        // Accessed only by the writer: the buffer of snapshot.image, reused
+        // across size changes (see ImageSlice::reuseBuffer).
+        ImageSlice buffer;
+
+        atomic<int> refCount;
+    };
+    Slot slots_[SlotCount];
+
+    // Index of the published slot, or -1 if nothing has been published yet.
+    atomic<int> published_;
+
+    weak_ptr<FrameStoreEventHandler> eventHandler_;
+
+    // Accessed only by the writer.
+    uint64_t nextSequenceNumber_;
+    TileMap pendingChangedTiles_;
+
+    // Written by the writer, read by the readers when they release a
+    // snapshot.
+    atomic<bool> pending_;
+};
+
+}
@@ -1,16 +1,23 @@
 #include "globals.hpp"
 
+#include "clipboard.hpp"
 #include "text.hpp"
-#include "xwindow.hpp"
 
 namespace browservice {
 
-Globals::Globals(CKey, shared_ptr<Config> config)
+Globals::Globals(CKey,
+    shared_ptr<Config> config,
+    shared_ptr<RequestFilter> requestFilter,
+    shared_ptr<StartupProfiler> startupProfiler
+)
     : config(config),
-      xWindow(XWindow::create()),
-      textRenderContext(TextRenderContext::create())
+      clipboard(Clipboard::create()),
+      textRenderContext(TextRenderContext::create()),
+      requestFilter(requestFilter),
+      startupProfiler(startupProfiler)
 {
     REQUIRE(config);
+    REQUIRE(startupProfiler);
 }
 
 shared_ptr<Globals> globals;
@@ -4,17 +4,28 @@
 
 namespace browservice {
 
+class Clipboard;
+class RequestFilter;
+class StartupProfiler;
 class TextRenderContext;
-class XWindow;
 
 class Globals {
 SHARED_ONLY_CLASS(Globals);
 public:
-    Globals(CKey, shared_ptr<Config> config);
+    Globals(CKey,
+        shared_ptr<Config> config,
+        shared_ptr<RequestFilter> requestFilter,
+        shared_ptr<StartupProfiler> startupProfiler
+    );
 
     const shared_ptr<Config> config;
-    const shared_ptr<XWindow> xWindow;
+    const shared_ptr<Clipboard> clipboard;
     const shared_ptr<TextRenderContext> textRenderContext;
+
+    // Empty if no filter lists are configured.
+    const shared_ptr<RequestFilter> requestFilter;
+
+    const shared_ptr<StartupProfiler> startupProfiler;
 };
 
 extern shared_ptr<Globals> globals;
@@ -0,0 +1,428 @@
+#include "image_kernels.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define IMAGE_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace browservice {
+namespace image_kernels {
+
+namespace {
+
+uint32_t packColor(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint32_t)b | ((uint32_t)g << 8) | ((uint32_t)r << 16);
+}
+
+void fillScalar(uint8_t* dest, size_t count, uint8_t r, uint8_t g, uint8_t b) {
+    for(size_t i = 0; i < count; ++i) {
+        dest[4 * i + 0] = b;
+        dest[4 * i + 1] = g;
+        dest[4 * i + 2] = r;
+    }
+}
+
+void blendMaskScalar(
+    uint8_t* dest, const uint8_t* mask, size_t count,
+    uint8_t r, uint8_t g, uint8_t b
+) {
+    for(size_t i = 0; i < count; ++i) {
+        if(mask[i] >= 128) {
+            dest[4 * i + 0] = b;
+            dest[4 * i + 1] = g;
+            dest[4 * i + 2] = r;
+        }
+    }
+}
+
+void recolorScalar(
+    uint8_t* dest, size_t count,
+    uint8_t blackR, uint8_t blackG, uint8_t blackB,
+    uint8_t otherR, uint8_t otherG, uint8_t otherB
+) {
+    for(size_t i = 0; i < count; ++i) {
+        uint8_t* pixel = &dest[4 * i];
+        if(pixel[0] == 0 && pixel[1] == 0 && pixel[2] == 0) {
+            pixel[0] = blackB;
+            pixel[1] = blackG;
+            pixel[2] = blackR;
+        } else {
+            pixel[0] = otherB;
+            pixel[1] = otherG;
+            pixel[2] = otherR;
+        }
+    }
+}
+
+#ifdef IMAGE_KERNELS_X86
+
+__attribute__((target("sse2")))
+void fillSSE2(uint8_t* dest, size_t count, uint8_t r, uint8_t g, uint8_t b) {
+    const __m128i color = _mm_set1_epi32((int)packColor(r, g, b));
+    const __m128i keepMask = _mm_set1_epi32((int)0xFF000000);
+
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i* ptr = (__m128i*)(dest + 4 * i);
+        __m128i val = _mm_loadu_si128(ptr);
+        val = _mm_or_si128(_mm_and_si128(val, keepMask), color);
+        _mm_storeu_si128(ptr, val);
+    }
+    fillScalar(dest + 4 * i, count - i, r, g, b);
+}
+
+__attribute__((target("sse2")))
+void blendMaskSSE2(
+    uint8_t* dest, const uint8_t* mask, size_t count,
+    uint8_t r, uint8_t g, uint8_t b
+) {
+    const __m128i color = _mm_set1_epi32((int)packColor(r, g, b));
+    const __m128i channelMask = _mm_set1_epi32(0x00FFFFFF);
+
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        // Signed comparison: the values >= 128 are negative
+        __m128i mask8 = _mm_cmplt_epi8(
+            _mm_loadu_si128((const __m128i*)(mask + i)),
+            _mm_setzero_si128()
+        );
+        __m128i mask16[2] = {
+            _mm_unpacklo_epi8(mask8, mask8), _mm_unpackhi_epi8(mask8, mask8)
+        };
+        for(int j = 0; j < 4; ++j) {
+            __m128i pixelMask = _mm_and_si128(
+                (j & 1)
+                    ? _mm_unpackhi_epi16(mask16[j >> 1], mask16[j >> 1])
+                    : _mm_unpacklo_epi16(mask16[j >> 1], mask16[j >> 1]),
+                channelMask
+            );
+            __m128i* ptr = (__m128i*)(dest + 4 * (i + 4 * j));
+            __m128i val = _mm_loadu_si128(ptr);
+            val = _mm_or_si128(
+                _mm_andnot_si128(pixelMask, val),
+                _mm_and_si128(pixelMask, color)
+            );
+            _mm_storeu_si128(ptr, val);
+        }
+    }
+    blendMaskScalar(dest + 4 * i, mask + i, count - i, r, g, b);
+}
+
+__attribute__((target("sse2")))
+void recolorSSE2(
+    uint8_t* dest, size_t count,
+    uint8_t blackR, uint8_t blackG, uint8_t blackB,
+    uint8_t otherR, uint8_t otherG, uint8_t otherB
+) {
+    const __m128i blackColor =
+        _mm_set1_epi32((int)packColor(blackR, blackG, blackB));
+    const __m128i otherColor =
+        _mm_set1_epi32((int)packColor(otherR, otherG, otherB));
+    const __m128i channelMask = _mm_set1_epi32(0x00FFFFFF);
+
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i* ptr = (__m128i*)(dest + 4 * i);
+        __m128i val = _mm_loadu_si128(ptr);
+        __m128i isBlack = _mm_cmpeq_epi32(
+            _mm_and_si128(val, channelMask), _mm_setzero_si128()
+        );
+        __m128i color = _mm_or_si128(
+            _mm_and_si128(isBlack, blackColor),
+            _mm_andnot_si128(isBlack, otherColor)
+        );
+        val = _mm_or_si128(_mm_andnot_si128(channelMask, val), color);
+        _mm_storeu_si128(ptr, val);
+    }
+    recolorScalar(
+        dest + 4 * i, count - i,
+        blackR, blackG, blackB,
+        otherR, otherG, otherB
+    );
+}
+
+__attribute__((target("avx2")))
+void fillAVX2(uint8_t* dest, size_t count, uint8_t r, uint8_t g, uint8_t b) {
+    const __m256i color = _mm256_set1_epi32((int)packColor(r, g, b));
+    const __m256i keepMask = _mm256_set1_epi32((int)0xFF000000);
+
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i* ptr = (__m256i*)(dest + 4 * i);
+        __m256i val = _mm256_loadu_si256(ptr);
+        val = _mm256_or_si256(_mm256_and_si256(val, keepMask), color);
+        _mm256_storeu_si256(ptr, val);
+    }
+    fillScalar(dest + 4 * i, count - i, r, g, b);
+}
+
+__attribute__((target("avx2")))
+void blendMaskAVX2(
+    uint8_t* dest, const uint8_t* mask, size_t count,
+    uint8_t r, uint8_t g, uint8_t b
+) {
+    const __m256i color = _mm256_set1_epi32((int)packColor(r, g, b));
+    const __m256i channelMask = _mm256_set1_epi32(0x00FFFFFF);
+
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        // Sign extension makes the 32-bit lanes of the values >= 128 negative
+        __m256i pixelMask = _mm256_and_si256(
+            _mm256_srai_epi32(
+                _mm256_cvtepi8_epi32(
+                    _mm_loadl_epi64((const __m128i*)(mask + i))
+                ),
+                31
+            ),
+            channelMask
+        );
+        __m256i* ptr = (__m256i*)(dest + 4 * i);
+        __m256i val = _mm256_loadu_si256(ptr);
+        val = _mm256_or_si256(
+            _mm256_andnot_si256(pixelMask, val),
+            _mm256_and_si256(pixelMask, color)
+        );
+        _mm256_storeu_si256(ptr, val);
+    }
+    blendMaskScalar(dest + 4 * i, mask + i, count - i, r, g, b);
+}
+
+__attribute__((target("avx2")))
+void recolorAVX2(
+    uint8_t* dest, size_t count,
+    uint8_t blackR, uint8_t blackG, uint8_t blackB,
+    uint8_t otherR, uint8_t otherG, uint8_t otherB
+) {
+    const __m256i blackColor =
+        _mm256_set1_epi32((int)packColor(blackR, blackG, blackB));
+    const __m256i otherColor =
+        _mm256_set1_epi32((int)packColor(otherR, otherG, otherB));
+    const __m256i channelMask = _mm256_set1_epi32(0x00FFFFFF);
+
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i* ptr = (__m256i*)(dest + 4 * i);
+        __m256i val = _mm256_loadu_si256(ptr);
+        __m256i isBlack = _mm256_cmpeq_epi32(
+            _mm256_and_si256(val, channelMask), _mm256_setzero_si256()
+        );
+        __m256i color = _mm256_blendv_epi8(otherColor, blackColor, isBlack);
+        val = _mm256_or_si256(_mm256_andnot_si256(channelMask, val), color);
+        _mm256_storeu_si256(ptr, val);
+    }
+    recolorScalar(
+        dest + 4 * i, count - i,
+        blackR, blackG, blackB,
+        otherR, otherG, otherB
+    );
+}
+
+#endif
+
+#ifdef IMAGE_KERNELS_NEON
+
+void fillNEON(uint8_t* dest, size_t count, uint8_t r, uint8_t g, uint8_t b) {
+    const uint8x16_t rVal = vdupq_n_u8(r);
+    const uint8x16_t gVal = vdupq_n_u8(g);
+    const uint8x16_t bVal = vdupq_n_u8(b);
+
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        uint8x16x4_t val = vld4q_u8(dest + 4 * i);
+        val.val[0] = bVal;
+        val.val[1] = gVal;
+        val.val[2] = rVal;
+        vst4q_u8(dest + 4 * i, val);
+    }
+    fillScalar(dest + 4 * i, count - i, r, g, b);
+}
+
+void blendMaskNEON(
+    uint8_t* dest, const uint8_t* mask, size_t count,
+    uint8_t r, uint8_t g, uint8_t b
+) {
+    const uint8x16_t threshold = vdupq_n_u8(128);
+    const uint8x16_t rVal = vdupq_n_u8(r);
+    const uint8x16_t gVal = vdupq_n_u8(g);
+    const uint8x16_t bVal = vdupq_n_u8(b);
+
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        uint8x16_t pixelMask = vcgeq_u8(vld1q_u8(mask + i), threshold);
+        uint8x16x4_t val = vld4q_u8(dest + 4 * i);
+        val.val[0] = vbslq_u8(pixelMask, bVal, val.val[0]);
+        val.val[1] = vbslq_u8(pixelMask, gVal, val.val[1]);
+        val.val[2] = vbslq_u8(pixelMask, rVal, val.val[2]);
+        vst4q_u8(dest + 4 * i, val);
+    }
+    blendMaskScalar(dest + 4 * i, mask + i, count - i, r, g, b);
+}
+
+void recolorNEON(
+    uint8_t* dest, size_t count,
+    uint8_t blackR, uint8_t blackG, uint8_t blackB,
+    uint8_t otherR, uint8_t otherG, uint8_t otherB
+) {
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        uint8x16x4_t val = vld4q_u8(dest + 4 * i);
+        uint8x16_t isBlack = vceqq_u8(
+            vorrq_u8(vorrq_u8(val.val[0], val.val[1]), val.val[2]),
+            vdupq_n_u8(0)
+        );
+        val.val[0] = vbslq_u8(isBlack, vdupq_n_u8(blackB), vdupq_n_u8(otherB));
+        val.val[1] = vbslq_u8(isBlack, vdupq_n_u8(blackG), vdupq_n_u8(otherG));
+        val.val[2] = vbslq_u8(isBlack, vdupq_n_u8(blackR), vdupq_n_u8(otherR));
+        vst4q_u8(dest + 4 * i, val);
+    }
+    recolorScalar(
+        dest + 4 * i, count - i,
+        blackR, blackG, blackB,
+        otherR, otherG, otherB
+    );
+}
+
+#endif
+
+struct Implementation {
+    const char* name;
+    void (*fill)(uint8_t*, size_t, uint8_t, uint8_t, uint8_t);
+    void (*blendMask)(
+        uint8_t*, const uint8_t*, size_t, uint8_t, uint8_t, uint8_t
+    );
+    void (*recolor)(
+        uint8_t*, size_t,
+        uint8_t, uint8_t, uint8_t,
+        uint8_t, uint8_t, uint8_t
+    );
+};
+
+const Implementation ScalarImplementation = {
+    "scalar", fillScalar, blendMaskScalar, recolorScalar
+};
+#ifdef IMAGE_KERNELS_X86
+const Implementation SSE2Implementation = {
+    "sse2", fillSSE2, blendMaskSSE2, recolorSSE2
+};
+const Implementation AVX2Implementation = {
+    "avx2", fillAVX2, blendMaskAVX2, recolorAVX2
+};
+#endif
+#ifdef IMAGE_KERNELS_NEON
+const Implementation NEONImplementation = {
+    "neon", fillNEON, blendMaskNEON, recolorNEON
+};
+#endif
+
+vector<const Implementation*> listImplementations() {
+    vector<const Implementation*> ret = {&ScalarImplementation};
+#ifdef IMAGE_KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) {
+        ret.push_back(&SSE2Implementation);
+    }
+    if(__builtin_cpu_supports("avx2")) {
+        ret.push_back(&AVX2Implementation);
+    }
+#endif
+#ifdef IMAGE_KERNELS_NEON
+    ret.push_back(&NEONImplementation);
+#endif
+    return ret;
+}
+
+// Constant-initialized so that the kernels may be safely used in static
+// initializers that run before the best implementation has been selected by
+// implementationSelector below.
+const Implementation* selected = &ScalarImplementation;
+
+struct ImplementationSelector {
+    ImplementationSelector() {
+        selected = listImplementations().back();
+    }
+} implementationSelector;
+
+}
+
+void fill(uint8_t* dest, size_t count, uint8_t r, uint8_t g, uint8_t b) {
+    selected->fill(dest, count, r, g, b);
+}
+
+void blit(
+    uint8_t* dest, int destPitch,
+    const uint8_t* src, int srcPitch,
+    int width, int height
+) {
+    // memcpy is already vectorized by the C library, so no separate SIMD
+    // implementations are needed.
+    size_t rowBytes = 4 * (size_t)width;
+    if(destPitch == width && srcPitch == width) {
+        memcpy(dest, src, rowBytes * (size_t)height);
+        return;
+    }
+    for(int y = 0; y < height; ++y) {
+        memcpy(dest, src, rowBytes);
+        dest += 4 * (ptrdiff_t)destPitch;
+        src += 4 * (ptrdiff_t)srcPitch;
+    }
+}
+
+void blendMask(
+    uint8_t* dest, const uint8_t* mask, size_t count,
+    uint8_t r, uint8_t g, uint8_t b
+) {
+    selected->blendMask(dest, mask, count, r, g, b);
+}
+
+bool compareAndCopy(uint8_t* dest, const uint8_t* src, size_t byteCount) {
+    // Compare-and-copy loops that store every block are slower than memcmp and
+    // memcpy of the C library, which are vectorized already and skip the copy
+    // if nothing has changed (the common case).
+    if(byteCount && memcmp(dest, src, byteCount)) {
+        memcpy(dest, src, byteCount);
+        return true;
+    }
+    return false;
+}
+
+void recolor(
+    uint8_t* dest, size_t count,
+    uint8_t blackR, uint8_t blackG, uint8_t blackB,
+    uint8_t otherR, uint8_t otherG, uint8_t otherB
+) {
+    selected->recolor(
+        dest, count,
+        blackR, blackG, blackB,
+        otherR, otherG, otherB
+    );
+}
+
+vector<string> availableImplementations() {
+    vector<string> ret;
+    for(const Implementation* impl : listImplementations()) {
+        ret.push_back(impl->name);
+    }
+    return ret;
+}
+
+string selectedImplementation() {
+    return selected->name;
+}
+
+bool selectImplementation(const string& name) {
+    for(const Implementation* impl : listImplementations()) {
+        if(name == impl->name) {
+            selected = impl;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace browservice {
+
+// Pixel processing kernels used by ImageSlice, the text renderer, the widgets
+// and the browser area. The pixels are 4 bytes each, in the same format as in
+// ImageSlice (blue, green, red and an unused byte that is never modified by the
+// kernels, except by blit and compareAndCopy).
+//
+// On x86, fill, blendMask and recolor have SSE2 and AVX2 implementations, and
+// the fastest one supported by the CPU is selected at startup; on ARM, NEON is
+// used when available. The scalar implementations are used as a fallback and
+// for the tails of the rows. Neither blit nor compareAndCopy is vectorized
+// here; they use memcpy and memcmp of the C library.
+namespace image_kernels {
+
+// Set the color of count pixels at dest to (r, g, b).
+void fill(uint8_t* dest, size_t count, uint8_t r, uint8_t g, uint8_t b);
+
+// Copy a width x height rectangle of pixels from src to dest. The pitches are
+// given in pixels.
+void blit(
+    uint8_t* dest, int destPitch,
+    const uint8_t* src, int srcPitch,
+    int width, int height
+);
+
+// Set the color of each of the count pixels at dest to (r, g, b) if the
+// corresponding value in the 8-bit gray mask is at least 128 (the text is
+// rendered without antialiasing, so a threshold is all the blending needed).
+void blendMask(
+    uint8_t* dest, const uint8_t* mask, size_t count,
+    uint8_t r, uint8_t g, uint8_t b
+);
+
+// Copy byteCount bytes from src to dest, returning true if the contents of dest
+// differed from src.
+bool compareAndCopy(uint8_t* dest, const uint8_t* src, size_t byteCount);
+
+// Replace the color of each of the count pixels at dest by (blackR, blackG,
+// blackB) if it is black and by (otherR, otherG, otherB) otherwise (used to
+// highlight selected text).
+void recolor(
+    uint8_t* dest, size_t count,
+    uint8_t blackR, uint8_t blackG, uint8_t blackB,
+    uint8_t otherR, uint8_t otherG, uint8_t otherB
+);
+
+// The names of the implementations available on this CPU, in increasing
+// order of preference ("scalar" is always first).
+vector<string> availableImplementations();
+
+// The name of the currently selected implementation.
+string selectedImplementation();
+
+// Select the implementation by name; returns false if it is not available.
+// Must not be called while kernels are running in other threads (intended for
+// benchmarks).
+bool selectImplementation(const string& name);
+
+}
+
+}
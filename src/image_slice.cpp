@@ -27,6 +27,28 @@ ImageSlice ImageSlice::createImage(int width, int height, uint8_t rgb) {
     return slice;
 }
 
+ImageSlice ImageSlice::reuseBuffer(ImageSlice& buffer, int width, int height) {
+    REQUIRE(width >= 0 && height >= 0);
+
+    auto roundUp = [](int val) {
+        return
+            (val + BufferGranularity - 1) / BufferGranularity *
+            BufferGranularity;
+    };
+    int allocWidth = roundUp(width);
+    int allocHeight = roundUp(height);
+
+    if(
+        buffer.width() < width ||
+        buffer.height() < height ||
+        (int64_t)buffer.width() * (int64_t)buffer.height() >
+            2 * (int64_t)allocWidth * (int64_t)allocHeight
+    ) {
+        buffer = createImage(allocWidth, allocHeight);
+    }
+    return buffer.subRect(0, width, 0, height);
+}
+
 ImageSlice ImageSlice::createImageFromStrings(
     const vector<string>& rows,
     const map<char, array<uint8_t, 3>>& colors
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "image_kernels.hpp"
 #include "rect.hpp"
 
 namespace browservice {
@@ -22,6 +23,14 @@ public:
     static ImageSlice createImage(int width, int height, uint8_t r, uint8_t g, uint8_t b);
     static ImageSlice createImage(int width, int height, uint8_t rgb = 255);
 
+    // Returns the width x height top left part of buffer, first replacing
+    // buffer with a new image if it is too small or much larger than needed.
+    // The new images are rounded up to multiples of BufferGranularity in both
+    // dimensions, so that small size changes reuse the same buffer. The
+    // contents of the returned slice are unspecified.
+    static constexpr int BufferGranularity = 256;
+    static ImageSlice reuseBuffer(ImageSlice& buffer, int width, int height);
+
     // Create new buffer with contents given by strings. In rows, each element
     // contains the pixels of each row as characters. The colors mapping
     // describes which color each character represents (given as RGB triplet).
@@ -86,11 +95,11 @@ public:
         );
 
         if(!rect.isEmpty()) {
-            for(int lineY = rect.startY; lineY < rect.endY; ++lineY) {
-                const uint8_t* srcLine = src.getPixelPtr(rect.startX, lineY);
-                uint8_t* destLine = getPixelPtr(rect.startX + x, lineY + y);
-                memcpy(destLine, srcLine, 4 * (rect.endX - rect.startX));
-            }
+            image_kernels::blit(
+                getPixelPtr(rect.startX + x, rect.startY + y), pitch_,
+                src.getPixelPtr(rect.startX, rect.startY), src.pitch_,
+                rect.endX - rect.startX, rect.endY - rect.startY
+            );
         }
     }
 
@@ -144,13 +153,7 @@ public:
         endY = max(endY, startY);
 
         for(int y = startY; y < endY; ++y) {
-            uint8_t* pos = getPixelPtr(startX, y);
-            for(int x = startX; x < endX; ++x) {
-                *(pos + 2) = r;
-                *(pos + 1) = g;
-                *(pos + 0) = b;
-                pos += 4;
-            }
+            image_kernels::fill(getPixelPtr(startX, y), endX - startX, r, g, b);
         }
     }
     void fill(int startX, int endX, int startY, int endY, uint8_t rgb) {
@@ -1,5 +1,8 @@
 #include "globals.hpp"
+#include "renderer_app.hpp"
+#include "request_filter.hpp"
 #include "server.hpp"
+#include "startup_profiler.hpp"
 #include "vice.hpp"
 #include "xvfb.hpp"
 
@@ -58,6 +61,20 @@ public:
         commandLine->AppendSwitch("disable-smooth-scrolling");
         commandLine->AppendSwitchWithValue("use-gl", "desktop");
 
+        // All the windows share the HTTP cache of the global request context;
+        // Chromium evicts the least recently used entries when the size limit
+        // is reached.
+        const Config& config = *globals->config;
+        if(!config.cacheDir.empty()) {
+            commandLine->AppendSwitchWithValue("disk-cache-dir", config.cacheDir);
+        }
+        if(config.cacheSize != 0) {
+            commandLine->AppendSwitchWithValue(
+                "disk-cache-size",
+                toString((int64_t)config.cacheSize * (int64_t)1024 * (int64_t)1024)
+            );
+        }
+
         for(const pair<string, optional<string>>& arg : globals->config->chromiumArgs) {
             if(arg.second) {
                 commandLine->AppendSwitchWithValue(arg.first, *arg.second);
@@ -72,8 +89,13 @@ public:
         REQUIRE_UI_THREAD();
         REQUIRE(!server_);
 
+        shared_ptr<StartupProfiler> startupProfiler = globals->startupProfiler;
+        startupProfiler->endPhase("initialize CEF");
+
+        startupProfiler->beginPhase("start server");
         server_ = Server::create(serverEventHandler_, viceCtx_);
         viceCtx_.reset();
+        startupProfiler->endPhase("start server");
         if(shutdown_) {
             server_->shutdown();
         }
@@ -110,42 +132,93 @@ int main(int argc, char* argv[]) {
 
     CefMainArgs mainArgs(argc, argv);
 
-    int exitCode = CefExecuteProcess(mainArgs, nullptr, nullptr);
+    int exitCode = CefExecuteProcess(mainArgs, createRendererApp(), nullptr);
     if(exitCode >= 0) {
         return exitCode;
     }
 
+    shared_ptr<StartupProfiler> startupProfiler = StartupProfiler::create();
+
     signal(SIGINT, handleTermSignalSetFlag);
     signal(SIGTERM, handleTermSignalSetFlag);
 
+    startupProfiler->beginPhase("read config");
     shared_ptr<Config> config = Config::read(argc, argv);
     if(!config) {
         return 1;
     }
+    startupProfiler->endPhase("read config");
+
+    if(!config->cacheDir.empty() && config->dataDir.empty()) {
+        cerr << "ERROR: Option --cache-dir requires --data-dir\n";
+        return 1;
+    }
+
+    // Starting Xvfb (mostly waiting for it to report its display number) and
+    // loading the filter lists are independent of the vice plugin, so they
+    // run in background threads while the plugin is loaded. If we return
+    // early, the destructors of the futures wait for the threads, after which
+    // the Xvfb is shut down.
+    future<shared_ptr<Xvfb>> xvfbFuture;
+    if(config->useDedicatedXvfb) {
+        xvfbFuture = std::async(std::launch::async, [startupProfiler]() {
+            startupProfiler->beginPhase("start Xvfb");
+            shared_ptr<Xvfb> xvfb = Xvfb::create();
+            startupProfiler->endPhase("start Xvfb");
+            return xvfb;
+        });
+    }
+
+    future<shared_ptr<RequestFilter>> requestFilterFuture;
+    if(!config->filterLists.empty()) {
+        requestFilterFuture = std::async(
+            std::launch::async,
+            [startupProfiler, config]() {
+                startupProfiler->beginPhase("load filter lists");
+                shared_ptr<RequestFilter> requestFilter =
+                    RequestFilter::load(config->filterLists);
+                startupProfiler->endPhase("load filter lists");
+                return requestFilter;
+            }
+        );
+    }
 
+    startupProfiler->beginPhase("load vice plugin");
     INFO_LOG("Loading vice plugin ", config->vicePlugin);
     shared_ptr<VicePlugin> vicePlugin = VicePlugin::load(config->vicePlugin);
     if(!vicePlugin) {
         cerr << "ERROR: Loading vice plugin " << config->vicePlugin << " failed\n";
         return 1;
     }
+    startupProfiler->endPhase("load vice plugin");
 
+    startupProfiler->beginPhase("initialize vice plugin");
     INFO_LOG("Initializing vice plugin ", config->vicePlugin);
     shared_ptr<ViceContext> viceCtx =
         ViceContext::init(vicePlugin, config->viceOpts);
     if(!viceCtx) {
         return 1;
     }
+    startupProfiler->endPhase("initialize vice plugin");
 
     vicePlugin.reset();
 
+    shared_ptr<RequestFilter> requestFilter;
+    if(requestFilterFuture.valid()) {
+        requestFilter = requestFilterFuture.get();
+        if(!requestFilter) {
+            cerr << "ERROR: Loading filter lists failed\n";
+            return 1;
+        }
+    }
+
     shared_ptr<Xvfb> xvfb;
-    if(config->useDedicatedXvfb) {
-        xvfb = Xvfb::create();
+    if(xvfbFuture.valid()) {
+        xvfb = xvfbFuture.get();
         xvfb->setupEnv();
     }
 
-    globals = Globals::create(config);
+    globals = Globals::create(config, requestFilter, startupProfiler);
 
     if(!termSignalReceived) {
         // Ignore non-fatal X errors
@@ -161,6 +234,7 @@ int main(int argc, char* argv[]) {
         CefString(&settings.cache_path).FromString(globals->config->dataDir);
         CefString(&settings.user_agent).FromString(globals->config->userAgent);
 
+        startupProfiler->beginPhase("initialize CEF");
         if(!CefInitialize(mainArgs, settings, app, nullptr)) {
             PANIC("Initializing CEF failed");
         }
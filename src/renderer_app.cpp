@@ -0,0 +1,48 @@
+#include "renderer_app.hpp"
+
+#include <unistd.h>
+
+namespace browservice {
+
+const char* RendererPIDMessage = "BrowserviceRendererPID";
+
+namespace {
+
+class RendererApp :
+    public CefApp,
+    public CefRenderProcessHandler
+{
+public:
+    // CefApp:
+    virtual CefRefPtr<CefRenderProcessHandler> GetRenderProcessHandler() override {
+        return this;
+    }
+
+    // CefRenderProcessHandler:
+    virtual void OnContextCreated(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefRefPtr<CefV8Context> context
+    ) override {
+        // With site isolation, the main frame may move to a different
+        // renderer process on navigation, so the PID is sent again for each
+        // new context.
+        if(frame->IsMain()) {
+            CefRefPtr<CefProcessMessage> msg =
+                CefProcessMessage::Create(RendererPIDMessage);
+            msg->GetArgumentList()->SetInt(0, (int)getpid());
+            frame->SendProcessMessage(PID_BROWSER, msg);
+        }
+    }
+
+private:
+    IMPLEMENT_REFCOUNTING(RendererApp);
+};
+
+}
+
+CefRefPtr<CefApp> createRendererApp() {
+    return new RendererApp();
+}
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "include/cef_app.h"
+
+namespace browservice {
+
+// Name of the process message that the renderer processes send to the browser
+// process whenever a JavaScript context is created for the main frame of a
+// browser. The only argument is the PID of the renderer process (integer),
+// used for attributing the resource usage of the renderer processes to the
+// windows.
+extern const char* RendererPIDMessage;
+
+// Returns the CefApp to be passed to CefExecuteProcess for the subprocesses.
+CefRefPtr<CefApp> createRendererApp();
+
+}
@@ -0,0 +1,246 @@
+#include "renderer_priority.hpp"
+
+#include <cerrno>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace browservice {
+
+namespace {
+
+// Constants of the ioprio_set/ioprio_get system calls (not exposed by glibc).
+const int IOPrioWhoProcess = 1;
+const int IOPrioClassShift = 13;
+const int IOPrioClassNone = 0;
+const int IOPrioClassRT = 1;
+const int IOPrioClassBE = 2;
+const int IOPrioClassIdle = 3;
+
+// Bit of CAP_SYS_NICE in the capability sets (see capabilities(7)).
+const int CapSysNice = 23;
+
+bool hasEffectiveCapability(int cap) {
+    ifstream fp("/proc/self/status");
+    string line;
+    const string prefix = "CapEff:";
+    while(getline(fp, line)) {
+        if(line.compare(0, prefix.size(), prefix) == 0) {
+            uint64_t caps = strtoull(line.c_str() + prefix.size(), nullptr, 16);
+            return (caps >> cap) & 1;
+        }
+    }
+    return false;
+}
+
+// Returns true if pid is a descendant of this process (checked when the
+// priorities are changed, as the PID may have been reused after the renderer
+// process exited).
+bool isOwnDescendant(int pid) {
+    int self = (int)getpid();
+    for(int depth = 0; depth < 16 && pid > 1; ++depth) {
+        ifstream fp(("/proc/" + toString(pid) + "/stat").c_str());
+        string line;
+        if(!getline(fp, line)) {
+            return false;
+        }
+
+        // The fields after the executable name are the state and the parent
+        // PID.
+        size_t pos = line.rfind(')');
+        if(pos == string::npos) {
+            return false;
+        }
+        stringstream ss(line.substr(pos + 1));
+        string state;
+        int ppid;
+        if(!(ss >> state >> ppid)) {
+            return false;
+        }
+        if(ppid == self) {
+            return true;
+        }
+        pid = ppid;
+    }
+    return false;
+}
+
+// Returns true if we may set the nice value of our processes to nice
+// (RLIMIT_NICE allows nice values down to 20 - rlim_cur).
+bool canSetNice(int nice) {
+    if(hasEffectiveCapability(CapSysNice)) {
+        return true;
+    }
+    rlimit limit;
+    if(getrlimit(RLIMIT_NICE, &limit) != 0) {
+        return false;
+    }
+    return
+        limit.rlim_cur == RLIM_INFINITY ||
+        20 - (long)limit.rlim_cur <= (long)nice;
+}
+
+}
+
+RendererPriorityManager::RendererPriorityManager(CKey) {
+    errno = 0;
+    baseNice_ = getpriority(PRIO_PROCESS, 0);
+    if(errno != 0) {
+        baseNice_ = 0;
+    }
+
+    adjustNice_ = canSetNice(baseNice_);
+    if(!adjustNice_) {
+        WARNING_LOG(
+            "Lowered renderer nice values could not be raised back without "
+            "the CAP_SYS_NICE capability or a sufficient RLIMIT_NICE (such as "
+            "'ulimit -e 20'); adjusting only the I/O priorities of the "
+            "renderer processes"
+        );
+    }
+    permissionWarningShown_ = false;
+}
+
+void RendererPriorityManager::update(const map<int, Level>& levels) {
+    REQUIRE_UI_THREAD();
+
+    map<int, Level> oldLevels;
+    swap(oldLevels, levels_);
+
+    bool permissionDenied = false;
+    for(pair<int, Level> p : levels) {
+        REQUIRE(p.first > 0);
+
+        auto it = oldLevels.find(p.first);
+        bool unchanged = it != oldLevels.end() && it->second == p.second;
+        if(unchanged || apply_(p.first, levelPriority_(p.second))) {
+            levels_.emplace(p.first, p.second);
+        } else {
+            permissionDenied = true;
+        }
+    }
+
+    if(permissionDenied) {
+        warnPermissionDenied_();
+    }
+}
+
+void RendererPriorityManager::raise(int pid, Level level) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(pid > 0);
+
+    auto it = levels_.find(pid);
+    if(it != levels_.end() && it->second >= level) {
+        return;
+    }
+
+    if(apply_(pid, levelPriority_(level))) {
+        levels_[pid] = level;
+    } else {
+        warnPermissionDenied_();
+    }
+}
+
+optional<RendererPriorityManager::Priority>
+RendererPriorityManager::currentPriority(int pid) {
+    if(pid <= 0) {
+        return {};
+    }
+
+    Priority priority;
+    errno = 0;
+    priority.nice = getpriority(PRIO_PROCESS, (id_t)pid);
+    if(errno != 0) {
+        return {};
+    }
+
+    long ioprio = syscall(SYS_ioprio_get, IOPrioWhoProcess, pid);
+    if(ioprio < 0) {
+        return {};
+    }
+    int ioClass = (int)(ioprio >> IOPrioClassShift);
+    if(ioClass == IOPrioClassBE) {
+        priority.ioLevel = (int)(ioprio & ((1 << IOPrioClassShift) - 1));
+    } else if(ioClass == IOPrioClassRT) {
+        priority.ioLevel = 0;
+    } else if(ioClass == IOPrioClassIdle) {
+        priority.ioLevel = 7;
+    } else {
+        // Without an explicit class, the level is derived from the nice value.
+        REQUIRE(ioClass == IOPrioClassNone);
+        priority.ioLevel = max(0, min(7, (priority.nice + 20) / 5));
+    }
+    return priority;
+}
+
+RendererPriorityManager::Priority RendererPriorityManager::levelPriority_(
+    Level level
+) {
+    Priority priority;
+    if(level == Interactive) {
+        priority.nice = baseNice_;
+        priority.ioLevel = 4;
+    } else if(level == Visible) {
+        priority.nice = baseNice_ + 5;
+        priority.ioLevel = 5;
+    } else {
+        REQUIRE(level == Background);
+        priority.nice = baseNice_ + 15;
+        priority.ioLevel = 7;
+    }
+    priority.nice = min(priority.nice, 19);
+    return priority;
+}
+
+void RendererPriorityManager::warnPermissionDenied_() {
+    if(!permissionWarningShown_) {
+        WARNING_LOG(
+            "Changing the priority of a renderer process was denied; raising "
+            "the priority requires the CAP_SYS_NICE capability or a "
+            "sufficient RLIMIT_NICE (such as 'ulimit -e 20')"
+        );
+        permissionWarningShown_ = true;
+    }
+}
+
+bool RendererPriorityManager::apply_(int pid, Priority priority) {
+    if(!isOwnDescendant(pid)) {
+        // The process has exited (and the PID may have been reused).
+        return true;
+    }
+
+    string taskPath = "/proc/" + toString(pid) + "/task";
+    DIR* dir = opendir(taskPath.c_str());
+    if(dir == nullptr) {
+        // The process has exited.
+        return true;
+    }
+
+    bool ok = true;
+    long ioprio = ((long)IOPrioClassBE << IOPrioClassShift) | priority.ioLevel;
+    while(dirent* entry = readdir(dir)) {
+        optional<int> tid = parseString<int>(entry->d_name);
+        if(!tid || *tid <= 0) {
+            continue;
+        }
+        if(
+            adjustNice_ &&
+            setpriority(PRIO_PROCESS, (id_t)*tid, priority.nice) != 0 &&
+            (errno == EACCES || errno == EPERM)
+        ) {
+            ok = false;
+        }
+        if(
+            syscall(SYS_ioprio_set, IOPrioWhoProcess, *tid, ioprio) != 0 &&
+            (errno == EACCES || errno == EPERM)
+        ) {
+            ok = false;
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace browservice {
+
+// Adjusts the CPU scheduling priority (nice value) and I/O priority
+// (best-effort class level) of the CEF renderer processes according to how
+// actively their windows are used, so that background pages cannot slow down
+// the windows the users are interacting with. The priorities are relative to
+// the nice value of the browservice process:
+//   - Interactive (recent input): same as browservice.
+//   - Visible (a client is fetching frames, or the plugin does not report
+//     frame demand): nice +5, I/O level 5.
+//   - Background (the plugin reports that no frames are needed): nice +15, I/O
+//     level 7.
+// On Linux, the priorities are per thread, so they are applied to all the
+// threads of a process. Raising the nice value back requires CAP_SYS_NICE or a
+// sufficient RLIMIT_NICE; if neither is available at startup, only the I/O
+// priorities are adjusted, as a lowered nice value could not be restored.
+class RendererPriorityManager {
+SHARED_ONLY_CLASS(RendererPriorityManager);
+public:
+    enum Level {Background, Visible, Interactive};
+
+    RendererPriorityManager(CKey);
+
+    // Sets the priority levels of the renderer processes given by PID (in our
+    // PID namespace; see ResourceMonitor::hostRendererPID). The priorities
+    // are never changed for processes that are not our descendants. The
+    // priorities are only changed for the processes whose level differs from
+    // the previous successfully applied level (failures are retried by the
+    // next call); processes not in the map are forgotten without changing
+    // their priorities (they are typically gone).
+    void update(const map<int, Level>& levels);
+
+    // Raises the priority level of a single renderer process to level if it
+    // is lower, without touching the other processes (lowering the levels is
+    // left to update).
+    void raise(int pid, Level level);
+
+    struct Priority {
+        int nice;
+
+        // Effective best-effort I/O priority level (0-7, lower is higher
+        // priority); processes in the realtime class are reported as 0 and
+        // processes in the idle class as 7.
+        int ioLevel;
+    };
+
+    // Reads the current priority of the main thread of a process; returns
+    // empty if the process does not exist.
+    static optional<Priority> currentPriority(int pid);
+
+private:
+    Priority levelPriority_(Level level);
+
+    void warnPermissionDenied_();
+
+    // Returns false if permission was denied for some thread.
+    bool apply_(int pid, Priority priority);
+
+    int baseNice_;
+
+    // False if the nice values are left unchanged because we could not raise
+    // them back to baseNice_.
+    bool adjustNice_;
+
+    map<int, Level> levels_;
+    bool permissionWarningShown_;
+};
+
+}
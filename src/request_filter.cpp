@@ -0,0 +1,674 @@
+#include "request_filter.hpp"
+
+namespace browservice {
+
+namespace {
+
+typedef RequestFilter::ResourceType ResourceType;
+
+uint32_t typeBit(ResourceType type) {
+    return (uint32_t)1 << (int)type;
+}
+
+// All types except Document, which is never blocked.
+const uint32_t AllTypes =
+    ((uint32_t)1 << ((int)ResourceType::Other + 1)) - 1 -
+    typeBit(ResourceType::Document);
+
+const map<string, ResourceType> typeOptions = {
+    {"subdocument", ResourceType::Subdocument},
+    {"frame", ResourceType::Subdocument},
+    {"stylesheet", ResourceType::Stylesheet},
+    {"css", ResourceType::Stylesheet},
+    {"script", ResourceType::Script},
+    {"image", ResourceType::Image},
+    {"font", ResourceType::Font},
+    {"object", ResourceType::Object},
+    {"object-subrequest", ResourceType::Object},
+    {"xmlhttprequest", ResourceType::XMLHttpRequest},
+    {"xhr", ResourceType::XMLHttpRequest},
+    {"ping", ResourceType::Ping},
+    {"beacon", ResourceType::Ping},
+    {"media", ResourceType::Media},
+    {"websocket", ResourceType::WebSocket},
+    {"other", ResourceType::Other}
+};
+
+bool isTokenChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '%';
+}
+
+// The ^ placeholder matches any character other than a letter, a digit or one
+// of _-.% (or the end of the URL).
+bool isSeparator(char c) {
+    return !(
+        (c >= 'a' && c <= 'z') ||
+        (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') ||
+        c == '_' || c == '-' || c == '.' || c == '%'
+    );
+}
+
+string toLower(string str) {
+    for(char& c : str) {
+        if(c >= 'A' && c <= 'Z') {
+            c = (char)(c - 'A' + 'a');
+        }
+    }
+    return str;
+}
+
+uint64_t hashToken(const char* begin, const char* end) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(const char* it = begin; it != end; ++it) {
+        hash ^= (uint64_t)(uint8_t)*it;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Returns the [begin, end) range of the host in the URL (empty if there is no
+// host).
+pair<size_t, size_t> hostRange(const string& url) {
+    size_t schemeEnd = url.find("://");
+    if(schemeEnd == string::npos) {
+        return {0, 0};
+    }
+    size_t begin = schemeEnd + 3;
+    size_t end = url.find_first_of("/?#", begin);
+    if(end == string::npos) {
+        end = url.size();
+    }
+
+    size_t at = url.rfind('@', end);
+    if(at != string::npos && at >= begin) {
+        begin = at + 1;
+    }
+    if(begin < end && url[begin] == '[') {
+        size_t bracket = url.find(']', begin);
+        if(bracket != string::npos && bracket < end) {
+            end = bracket + 1;
+        }
+    } else {
+        size_t colon = url.find(':', begin);
+        if(colon != string::npos && colon < end) {
+            end = colon;
+        }
+    }
+    return {begin, end};
+}
+
+bool isSubdomainOf(const string& host, const string& domain) {
+    if(host.size() < domain.size()) {
+        return false;
+    }
+    size_t offset = host.size() - domain.size();
+    return
+        host.compare(offset, string::npos, domain) == 0 &&
+        (offset == 0 || host[offset - 1] == '.');
+}
+
+bool hostInSet(const string& host, const unordered_set<string>& domains) {
+    if(domains.empty() || host.empty()) {
+        return false;
+    }
+    size_t pos = 0;
+    while(true) {
+        if(domains.count(host.substr(pos))) {
+            return true;
+        }
+        pos = host.find('.', pos);
+        if(pos == string::npos) {
+            return false;
+        }
+        ++pos;
+    }
+}
+
+// Common second-level labels under which country code TLDs register domains
+// (such as co.uk, com.au or ne.jp).
+const unordered_set<string> countrySecondLevelLabels = {
+    "ac", "ad", "co", "com", "ed", "edu", "gen", "go", "gob", "gov", "gr",
+    "info", "int", "lg", "ltd", "mil", "ne", "net", "nhs", "nic", "nom", "or",
+    "org", "plc", "sch"
+};
+
+// Approximation of the registrable domain of the host (the public suffix list
+// is not available): the last two labels, or three if the host is under a
+// common second-level domain of a country code TLD (such as co.uk).
+string baseDomain(const string& host) {
+    if(all_of(host.begin(), host.end(), [](char c) {
+        return (c >= '0' && c <= '9') || c == '.';
+    })) {
+        return host;
+    }
+
+    size_t last = host.rfind('.');
+    if(last == string::npos || last == 0) {
+        return host;
+    }
+    size_t second = host.rfind('.', last - 1);
+    if(second == string::npos) {
+        return host;
+    }
+    if(
+        host.size() - last - 1 == 2 &&
+        second > 0 &&
+        countrySecondLevelLabels.count(
+            host.substr(second + 1, last - second - 1)
+        )
+    ) {
+        size_t third = host.rfind('.', second - 1);
+        return third == string::npos ? host : host.substr(third + 1);
+    }
+    return host.substr(second + 1);
+}
+
+// If the segment matches text at position pos, returns true and sets end to
+// the end position of the match.
+bool matchSegmentAt(
+    const string& text,
+    size_t pos,
+    const string& segment,
+    size_t& end
+) {
+    for(char c : segment) {
+        if(c == '^') {
+            if(pos == text.size()) {
+                continue;
+            }
+            if(!isSeparator(text[pos])) {
+                return false;
+            }
+        } else if(pos == text.size() || text[pos] != c) {
+            return false;
+        }
+        ++pos;
+    }
+    end = pos;
+    return true;
+}
+
+}
+
+struct RequestFilter::Context {
+    string url;
+    string lowerURL;
+
+    // Position of the host in url
+    size_t hostBegin;
+    size_t hostEnd;
+
+    // Lowercase hosts of the request and the document
+    string host;
+    string documentHost;
+
+    uint32_t typeBit;
+    bool thirdParty;
+};
+
+shared_ptr<RequestFilter> RequestFilter::load(
+    const vector<string>& filenames
+) {
+    steady_clock::time_point startTime = steady_clock::now();
+
+    vector<string> lines;
+    for(const string& filename : filenames) {
+        ifstream fp(filename);
+        if(!fp.good()) {
+            ERROR_LOG("Could not open filter list '", filename, "'");
+            return {};
+        }
+        string line;
+        while(getline(fp, line)) {
+            lines.push_back(move(line));
+        }
+        if(fp.bad()) {
+            ERROR_LOG("Reading filter list '", filename, "' failed");
+            return {};
+        }
+    }
+
+    shared_ptr<RequestFilter> filter = RequestFilter::create(lines);
+
+    milliseconds loadTime =
+        duration_cast<milliseconds>(steady_clock::now() - startTime);
+    INFO_LOG(
+        "Loaded ", filter->ruleCount(), " request filter rules from ",
+        filenames.size(), " filter lists in ", loadTime.count(), "ms (",
+        filter->skippedRuleCount(), " unsupported rules skipped)"
+    );
+
+    return filter;
+}
+
+RequestFilter::RequestFilter(CKey, const vector<string>& lines) {
+    ruleCount_ = 0;
+    skippedRuleCount_ = 0;
+
+    for(const string& line : lines) {
+        if(parseLine_(line)) {
+            ++ruleCount_;
+        }
+    }
+}
+
+bool RequestFilter::shouldBlock(const Request& request) const {
+    if(request.type == ResourceType::Document) {
+        return false;
+    }
+
+    Context ctx;
+    ctx.url = request.url;
+    ctx.lowerURL = toLower(request.url);
+    tie(ctx.hostBegin, ctx.hostEnd) = hostRange(ctx.lowerURL);
+    ctx.host = ctx.lowerURL.substr(ctx.hostBegin, ctx.hostEnd - ctx.hostBegin);
+
+    string lowerDocumentURL = toLower(request.documentURL);
+    pair<size_t, size_t> documentHostRange = hostRange(lowerDocumentURL);
+    ctx.documentHost = lowerDocumentURL.substr(
+        documentHostRange.first,
+        documentHostRange.second - documentHostRange.first
+    );
+
+    ctx.typeBit = typeBit(request.type);
+    ctx.thirdParty =
+        !ctx.documentHost.empty() &&
+        baseDomain(ctx.host) != baseDomain(ctx.documentHost);
+
+    if(hostInSet(ctx.documentHost, documentExceptionDomains_)) {
+        return false;
+    }
+    if(matchesAny_(importantBlockRules_, ctx)) {
+        return true;
+    }
+    if(
+        !hostInSet(ctx.host, blockedDomains_) &&
+        !matchesAny_(blockRules_, ctx)
+    ) {
+        return false;
+    }
+    return
+        !hostInSet(ctx.host, exceptionDomains_) &&
+        !matchesAny_(exceptionRules_, ctx);
+}
+
+size_t RequestFilter::ruleCount() const {
+    return ruleCount_;
+}
+
+size_t RequestFilter::skippedRuleCount() const {
+    return skippedRuleCount_;
+}
+
+void RequestFilter::RuleSet::add(Rule rule, const string& pattern) {
+    size_t idx = rules.size();
+    rules.push_back(move(rule));
+    const Rule& added = rules.back();
+
+    // Index the rule by a run of token characters in the pattern that is
+    // guaranteed to appear as a whole token in every matching URL, i.e. it is
+    // not adjacent to a wildcard or an unanchored end of the pattern. Of the
+    // candidates, the one with the fewest rules indexed so far is chosen (the
+    // longest one in case of a tie) to keep the buckets small.
+    string lowerPattern = toLower(pattern);
+    optional<uint64_t> bestToken;
+    size_t bestBucketSize = 0;
+    size_t bestLength = 0;
+    size_t i = 0;
+    while(i < lowerPattern.size()) {
+        if(!isTokenChar(lowerPattern[i])) {
+            ++i;
+            continue;
+        }
+        size_t begin = i;
+        while(i < lowerPattern.size() && isTokenChar(lowerPattern[i])) {
+            ++i;
+        }
+        bool startBounded =
+            begin == 0
+                ? added.hostAnchor || added.startAnchor
+                : lowerPattern[begin - 1] != '*';
+        bool endBounded =
+            i == lowerPattern.size()
+                ? added.endAnchor
+                : lowerPattern[i] != '*';
+        size_t length = i - begin;
+        if(!startBounded || !endBounded || length < 2) {
+            continue;
+        }
+
+        const char* token = lowerPattern.data() + begin;
+        uint64_t hash = hashToken(token, token + length);
+        auto it = tokenIndex.find(hash);
+        size_t bucketSize = it == tokenIndex.end() ? 0 : it->second.size();
+        if(
+            !bestToken ||
+            bucketSize < bestBucketSize ||
+            (bucketSize == bestBucketSize && length > bestLength)
+        ) {
+            bestToken = hash;
+            bestBucketSize = bucketSize;
+            bestLength = length;
+        }
+    }
+
+    if(bestToken) {
+        tokenIndex[*bestToken].push_back(idx);
+    } else {
+        untokenized.push_back(idx);
+    }
+}
+
+bool RequestFilter::parseLine_(string line) {
+    while(!line.empty() && isspace((unsigned char)line.back())) {
+        line.pop_back();
+    }
+    size_t first = 0;
+    while(first < line.size() && isspace((unsigned char)line[first])) {
+        ++first;
+    }
+    line = line.substr(first);
+
+    // Empty lines, comments and headers
+    if(line.empty() || line[0] == '!' || line[0] == '[') {
+        return false;
+    }
+
+    // Element hiding rules and their variants
+    if(
+        line.find("##") != string::npos ||
+        line.find("#@#") != string::npos ||
+        line.find("#?#") != string::npos ||
+        line.find("#$#") != string::npos
+    ) {
+        return false;
+    }
+
+    bool exception = false;
+    if(line.compare(0, 2, "@@") == 0) {
+        exception = true;
+        line = line.substr(2);
+    }
+
+    string pattern = line;
+    string options;
+    size_t dollar = line.rfind('$');
+    if(dollar != string::npos) {
+        pattern = line.substr(0, dollar);
+        options = line.substr(dollar + 1);
+    }
+
+    // Regular expressions are not supported
+    if(pattern.size() > 2 && pattern.front() == '/' && pattern.back() == '/') {
+        ++skippedRuleCount_;
+        return false;
+    }
+
+    Rule rule;
+    rule.hostAnchor = false;
+    rule.startAnchor = false;
+    rule.endAnchor = false;
+    rule.matchCase = false;
+    rule.thirdParty = 0;
+
+    bool important = false;
+    bool document = false;
+    uint32_t includeTypes = 0;
+    uint32_t excludeTypes = 0;
+
+    size_t optPos = 0;
+    while(optPos < options.size()) {
+        size_t optEnd = options.find(',', optPos);
+        if(optEnd == string::npos) {
+            optEnd = options.size();
+        }
+        string option = toLower(options.substr(optPos, optEnd - optPos));
+        optPos = optEnd + 1;
+
+        bool negated = !option.empty() && option[0] == '~';
+        string name = negated ? option.substr(1) : option;
+
+        auto typeIt = typeOptions.find(name);
+        if(typeIt != typeOptions.end()) {
+            (negated ? excludeTypes : includeTypes) |= typeBit(typeIt->second);
+        } else if(name == "third-party" || name == "3p") {
+            rule.thirdParty = negated ? -1 : 1;
+        } else if(name == "first-party" || name == "1p") {
+            rule.thirdParty = negated ? 1 : -1;
+        } else if(option.compare(0, 7, "domain=") == 0) {
+            string domains = option.substr(7);
+            size_t pos = 0;
+            while(pos <= domains.size()) {
+                size_t end = domains.find('|', pos);
+                if(end == string::npos) {
+                    end = domains.size();
+                }
+                string domain = domains.substr(pos, end - pos);
+                pos = end + 1;
+                if(!domain.empty() && domain[0] == '~') {
+                    rule.excludeDomains.push_back(domain.substr(1));
+                } else if(!domain.empty()) {
+                    rule.includeDomains.push_back(domain);
+                }
+            }
+        } else if(option == "important") {
+            important = true;
+        } else if(option == "match-case") {
+            rule.matchCase = true;
+        } else if(option == "document" && exception) {
+            document = true;
+        } else {
+            ++skippedRuleCount_;
+            return false;
+        }
+    }
+
+    rule.typeMask = (includeTypes ? includeTypes : AllTypes) & ~excludeTypes;
+    if(rule.typeMask == 0 && !document) {
+        ++skippedRuleCount_;
+        return false;
+    }
+
+    if(pattern.compare(0, 2, "||") == 0) {
+        rule.hostAnchor = true;
+        pattern = pattern.substr(2);
+    } else if(pattern.compare(0, 1, "|") == 0) {
+        rule.startAnchor = true;
+        pattern = pattern.substr(1);
+    }
+    if(!pattern.empty() && pattern.back() == '|') {
+        rule.endAnchor = true;
+        pattern.pop_back();
+    }
+    if(!rule.matchCase) {
+        pattern = toLower(pattern);
+    }
+
+    // Plain domain rules go to the hash sets
+    bool plainDomain =
+        rule.hostAnchor && !rule.endAnchor &&
+        pattern.size() >= 2 && pattern.back() == '^' &&
+        all_of(pattern.begin(), pattern.end() - 1, [](char c) {
+            return isTokenChar(c) || c == '.' || c == '-';
+        }) &&
+        rule.typeMask == AllTypes && rule.thirdParty == 0 &&
+        rule.includeDomains.empty() && rule.excludeDomains.empty() &&
+        !important;
+    if(document) {
+        // Only @@||DOMAIN^$document is supported
+        if(!plainDomain) {
+            ++skippedRuleCount_;
+            return false;
+        }
+        documentExceptionDomains_.insert(pattern.substr(0, pattern.size() - 1));
+        return true;
+    }
+    if(plainDomain) {
+        string domain = pattern.substr(0, pattern.size() - 1);
+        (exception ? exceptionDomains_ : blockedDomains_).insert(domain);
+        return true;
+    }
+
+    // Anchors next to a wildcard have no effect
+    if(!pattern.empty() && pattern.front() == '*') {
+        rule.hostAnchor = false;
+        rule.startAnchor = false;
+    }
+    if(!pattern.empty() && pattern.back() == '*') {
+        rule.endAnchor = false;
+    }
+
+    size_t pos = 0;
+    while(pos <= pattern.size()) {
+        size_t end = pattern.find('*', pos);
+        if(end == string::npos) {
+            end = pattern.size();
+        }
+        if(end > pos) {
+            rule.segments.push_back(pattern.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+
+    RuleSet& ruleSet =
+        exception ? exceptionRules_ :
+        important ? importantBlockRules_ :
+        blockRules_;
+    ruleSet.add(move(rule), pattern);
+    return true;
+}
+
+bool RequestFilter::matchesAny_(const RuleSet& ruleSet, const Context& ctx) {
+    if(ruleSet.rules.empty()) {
+        return false;
+    }
+
+    for(size_t idx : ruleSet.untokenized) {
+        if(ruleMatches_(ruleSet.rules[idx], ctx)) {
+            return true;
+        }
+    }
+
+    // Check the rules indexed by each distinct token of the URL
+    vector<uint64_t> seen;
+    const string& url = ctx.lowerURL;
+    size_t i = 0;
+    while(i < url.size()) {
+        if(!isTokenChar(url[i])) {
+            ++i;
+            continue;
+        }
+        size_t begin = i;
+        while(i < url.size() && isTokenChar(url[i])) {
+            ++i;
+        }
+        uint64_t hash = hashToken(url.data() + begin, url.data() + i);
+        if(find(seen.begin(), seen.end(), hash) != seen.end()) {
+            continue;
+        }
+        seen.push_back(hash);
+
+        auto it = ruleSet.tokenIndex.find(hash);
+        if(it != ruleSet.tokenIndex.end()) {
+            for(size_t idx : it->second) {
+                if(ruleMatches_(ruleSet.rules[idx], ctx)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool RequestFilter::ruleMatches_(const Rule& rule, const Context& ctx) {
+    if(!(rule.typeMask & ctx.typeBit)) {
+        return false;
+    }
+    if(
+        (rule.thirdParty == 1 && !ctx.thirdParty) ||
+        (rule.thirdParty == -1 && ctx.thirdParty)
+    ) {
+        return false;
+    }
+    for(const string& domain : rule.excludeDomains) {
+        if(isSubdomainOf(ctx.documentHost, domain)) {
+            return false;
+        }
+    }
+    if(!rule.includeDomains.empty()) {
+        bool found = false;
+        for(const string& domain : rule.includeDomains) {
+            if(isSubdomainOf(ctx.documentHost, domain)) {
+                found = true;
+                break;
+            }
+        }
+        if(!found) {
+            return false;
+        }
+    }
+
+    if(rule.segments.empty()) {
+        return true;
+    }
+
+    const string& text = rule.matchCase ? ctx.url : ctx.lowerURL;
+    const vector<string>& segments = rule.segments;
+
+    // Matches the segments after the first one, starting at pos
+    auto matchRest = [&](size_t pos) {
+        for(size_t s = 1; s < segments.size(); ++s) {
+            bool last = s + 1 == segments.size();
+            bool found = false;
+            for(size_t start = pos; start <= text.size(); ++start) {
+                size_t end;
+                if(
+                    matchSegmentAt(text, start, segments[s], end) &&
+                    (!last || !rule.endAnchor || end == text.size())
+                ) {
+                    pos = end;
+                    found = true;
+                    break;
+                }
+            }
+            if(!found) {
+                return false;
+            }
+        }
+        return segments.size() > 1 || !rule.endAnchor || pos == text.size();
+    };
+
+    auto tryStart = [&](size_t start) {
+        size_t end;
+        return
+            matchSegmentAt(text, start, segments[0], end) && matchRest(end);
+    };
+
+    if(rule.startAnchor) {
+        return tryStart(0);
+    }
+    if(rule.hostAnchor) {
+        if(ctx.hostBegin == ctx.hostEnd) {
+            return false;
+        }
+        if(tryStart(ctx.hostBegin)) {
+            return true;
+        }
+        for(size_t pos = ctx.hostBegin; pos < ctx.hostEnd; ++pos) {
+            if(ctx.lowerURL[pos] == '.' && tryStart(pos + 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    for(size_t start = 0; start <= text.size(); ++start) {
+        if(tryStart(start)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
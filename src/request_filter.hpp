@@ -0,0 +1,120 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace browservice {
+
+// Matcher for blocking requests (typically ads and trackers) based on filter
+// lists in the EasyList/Adblock Plus format, loaded once at startup.
+//
+// Supported syntax: blocking rules and exception rules (@@) with the anchors
+// ||, | and trailing |, the wildcard * and the separator ^; the options
+// third-party/first-party, domain=, important, match-case and the resource
+// types (script, image, stylesheet, subdocument, xmlhttprequest, media, font,
+// object, ping, websocket, other, and their negations); and exception rules
+// of the form @@||DOMAIN^$document that disable blocking on the pages of
+// DOMAIN. Element hiding rules are ignored, as are rules with regular
+// expressions or other options.
+//
+// Plain domain rules (||DOMAIN^) are kept in a hash set and looked up for
+// each suffix of the host of the request. Other rules are indexed by a token
+// (a run of alphanumeric characters) that every matching URL must contain, so
+// that a request only needs to be checked against the rules indexed by the
+// tokens of its URL (and the few rules without a usable token).
+//
+// The object is immutable after loading, and thus shouldBlock may be called
+// concurrently from any thread (in practice the CEF IO thread).
+class RequestFilter {
+SHARED_ONLY_CLASS(RequestFilter);
+public:
+    enum class ResourceType {
+        Document,
+        Subdocument,
+        Stylesheet,
+        Script,
+        Image,
+        Font,
+        Object,
+        XMLHttpRequest,
+        Ping,
+        Media,
+        WebSocket,
+        Other
+    };
+
+    struct Request {
+        string url;
+
+        // URL of the document that initiated the request (used for the
+        // third-party and domain= options).
+        string documentURL;
+
+        ResourceType type;
+    };
+
+    // Loads the rules from given filter list files; returns an empty pointer
+    // (after logging the error) if reading a file fails.
+    static shared_ptr<RequestFilter> load(const vector<string>& filenames);
+
+    // Parses the rules from the lines of the filter lists. Unsupported lines
+    // are skipped.
+    RequestFilter(CKey, const vector<string>& lines);
+
+    // Returns true if the request should be blocked. Requests of type
+    // Document (navigations of the main frame) are never blocked.
+    bool shouldBlock(const Request& request) const;
+
+    size_t ruleCount() const;
+    size_t skippedRuleCount() const;
+
+private:
+    struct Rule {
+        // The pattern without anchors split at the wildcards (empty parts
+        // omitted); lowercase unless matchCase is set.
+        vector<string> segments;
+        bool hostAnchor;
+        bool startAnchor;
+        bool endAnchor;
+        bool matchCase;
+
+        // Bit mask of the ResourceTypes the rule applies to.
+        uint32_t typeMask;
+
+        // 1 = only third-party requests, -1 = only first-party requests,
+        // 0 = both.
+        int thirdParty;
+
+        vector<string> includeDomains;
+        vector<string> excludeDomains;
+    };
+
+    // Rules indexed by the hash of one of their tokens.
+    struct RuleSet {
+        vector<Rule> rules;
+        unordered_map<uint64_t, vector<size_t>> tokenIndex;
+        vector<size_t> untokenized;
+
+        void add(Rule rule, const string& pattern);
+    };
+
+    // Query data derived from a Request.
+    struct Context;
+
+    // Returns false if the line is not a supported rule.
+    bool parseLine_(string line);
+
+    static bool matchesAny_(const RuleSet& ruleSet, const Context& ctx);
+    static bool ruleMatches_(const Rule& rule, const Context& ctx);
+
+    unordered_set<string> blockedDomains_;
+    unordered_set<string> exceptionDomains_;
+    unordered_set<string> documentExceptionDomains_;
+    RuleSet blockRules_;
+    RuleSet importantBlockRules_;
+    RuleSet exceptionRules_;
+
+    size_t ruleCount_;
+    size_t skippedRuleCount_;
+};
+
+}
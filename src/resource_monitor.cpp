@@ -0,0 +1,346 @@
+#include "resource_monitor.hpp"
+
+#include <dirent.h>
+#include <unistd.h>
+
+namespace browservice {
+
+namespace {
+
+// Weight of the latest sample in the CPU utilization moving average; with one
+// sample per second, the average reflects roughly the last five seconds.
+const double CPUAverageWeight = 0.2;
+
+struct ProcessStat {
+    int ppid;
+
+    // Total CPU time (user and system) in clock ticks.
+    uint64_t cpuTicks;
+
+    // Resident set size in pages.
+    uint64_t rssPages;
+};
+
+// Reads the statistics of process pid from /proc/PID/stat. Returns empty if
+// the process no longer exists.
+optional<ProcessStat> readProcessStat(const string& pid) {
+    ifstream fp(("/proc/" + pid + "/stat").c_str());
+    string line;
+    if(!getline(fp, line)) {
+        return {};
+    }
+
+    // The executable name in parentheses may contain spaces, so the fields
+    // are parsed starting from the last closing parenthesis. The first field
+    // after it is the state (field 3 in proc(5)).
+    size_t pos = line.rfind(')');
+    if(pos == string::npos) {
+        return {};
+    }
+    stringstream ss(line.substr(pos + 1));
+    vector<string> fields;
+    string field;
+    while(ss >> field) {
+        fields.push_back(field);
+    }
+    if(fields.size() < 22) {
+        return {};
+    }
+
+    optional<int> parsedPPid = parseString<int>(fields[1]);
+    optional<uint64_t> parsedUTime = parseString<uint64_t>(fields[11]);
+    optional<uint64_t> parsedSTime = parseString<uint64_t>(fields[12]);
+    optional<uint64_t> parsedRSS = parseString<uint64_t>(fields[21]);
+    if(!parsedPPid || !parsedUTime || !parsedSTime || !parsedRSS) {
+        return {};
+    }
+    ProcessStat stat;
+    stat.ppid = *parsedPPid;
+    stat.cpuTicks = *parsedUTime + *parsedSTime;
+    stat.rssPages = *parsedRSS;
+    return stat;
+}
+
+// Finds this process and its descendants (with their statistics) and returns
+// their total resident memory in bytes.
+optional<uint64_t> readProcessTree(map<int, ProcessStat>& processes) {
+    DIR* dir = opendir("/proc");
+    if(dir == nullptr) {
+        WARNING_LOG("Could not open /proc for measuring memory usage");
+        return {};
+    }
+
+    map<int, vector<int>> children;
+    map<int, ProcessStat> stats;
+    while(dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if(name.empty() || !all_of(name.begin(), name.end(), ::isdigit)) {
+            continue;
+        }
+        optional<int> pid = parseString<int>(name);
+        if(!pid) {
+            continue;
+        }
+        optional<ProcessStat> stat = readProcessStat(name);
+        if(stat) {
+            children[stat->ppid].push_back(*pid);
+            stats[*pid] = *stat;
+        }
+    }
+    closedir(dir);
+
+    uint64_t totalPages = 0;
+    vector<int> stack = {(int)getpid()};
+    while(!stack.empty()) {
+        int pid = stack.back();
+        stack.pop_back();
+
+        auto statIt = stats.find(pid);
+        if(statIt != stats.end()) {
+            processes[pid] = statIt->second;
+            totalPages += statIt->second.rssPages;
+        }
+        auto childIt = children.find(pid);
+        if(childIt != children.end()) {
+            stack.insert(
+                stack.end(), childIt->second.begin(), childIt->second.end()
+            );
+        }
+    }
+
+    return totalPages * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+bool isRendererProcess(int pid) {
+    ifstream fp(("/proc/" + toString(pid) + "/cmdline").c_str());
+    string arg;
+    while(getline(fp, arg, '\0')) {
+        if(arg == "--type=renderer") {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the PID of the process in the innermost PID namespace it belongs
+// to (the last field of the NSpid line of /proc/PID/status).
+optional<int> readInnermostPID(int pid) {
+    ifstream fp(("/proc/" + toString(pid) + "/status").c_str());
+    string line;
+    const string prefix = "NSpid:";
+    while(getline(fp, line)) {
+        if(line.compare(0, prefix.size(), prefix) == 0) {
+            stringstream ss(line.substr(prefix.size()));
+            string field;
+            optional<int> innermost;
+            while(ss >> field) {
+                innermost = parseString<int>(field);
+            }
+            return innermost;
+        }
+    }
+    return {};
+}
+
+// Maps the PIDs of the renderer processes among given processes in their own
+// PID namespace to our PID namespace (0 if ambiguous).
+map<int, int> findRendererPIDs(const map<int, ProcessStat>& processes) {
+    map<int, int> ret;
+    for(const pair<const int, ProcessStat>& p : processes) {
+        int pid = p.first;
+        if(!isRendererProcess(pid)) {
+            continue;
+        }
+        optional<int> innermost = readInnermostPID(pid);
+        if(!innermost || *innermost <= 0) {
+            continue;
+        }
+        if(!ret.emplace(*innermost, pid).second) {
+            ret[*innermost] = 0;
+        }
+    }
+    return ret;
+}
+
+// Returns the total and idle CPU time of the host in clock ticks.
+optional<pair<uint64_t, uint64_t>> readCPUTimes() {
+    ifstream fp("/proc/stat");
+    string label;
+    if(!(fp >> label) || label != "cpu") {
+        WARNING_LOG("Could not read /proc/stat for measuring CPU usage");
+        return {};
+    }
+
+    // user, nice, system, idle, iowait, irq, softirq, steal (the guest times
+    // that follow are included in user and nice)
+    uint64_t total = 0;
+    uint64_t idle = 0;
+    for(int i = 0; i < 8; ++i) {
+        uint64_t val;
+        if(!(fp >> val)) {
+            break;
+        }
+        total += val;
+        if(i == 3 || i == 4) {
+            idle += val;
+        }
+    }
+    return make_pair(total, idle);
+}
+
+// Reads the usage of the renderer processes (identified by their PIDs in our
+// PID namespace) from the statistics of the process tree.
+map<int, ResourceMonitor::RendererUsage> readRendererUsage(
+    const map<int, int>& rendererPIDs,
+    const map<int, ProcessStat>& processes
+) {
+    map<int, ResourceMonitor::RendererUsage> ret;
+    for(pair<int, int> p : rendererPIDs) {
+        int pid = p.second;
+        auto it = processes.find(pid);
+        if(pid == 0 || it == processes.end()) {
+            continue;
+        }
+
+        ResourceMonitor::RendererUsage usage;
+        usage.cpuTime = milliseconds((int64_t)(
+            1000 * it->second.cpuTicks / (uint64_t)sysconf(_SC_CLK_TCK)
+        ));
+        usage.memory =
+            it->second.rssPages * (uint64_t)sysconf(_SC_PAGESIZE);
+        usage.priority = RendererPriorityManager::currentPriority(pid);
+        ret.emplace(pid, usage);
+    }
+    return ret;
+}
+
+}
+
+ResourceMonitor::ResourceMonitor(CKey) {
+    memoryUsage_ = 0;
+    prevCPUTotal_ = 0;
+    prevCPUIdle_ = 0;
+    sampleInProgress_ = false;
+    sampleRequested_ = false;
+    samplerShutdown_ = false;
+}
+
+ResourceMonitor::~ResourceMonitor() {
+    {
+        lock_guard<mutex> lock(samplerMutex_);
+        samplerShutdown_ = true;
+    }
+    samplerCv_.notify_one();
+    samplerThread_.join();
+}
+
+void ResourceMonitor::sample() {
+    REQUIRE_UI_THREAD();
+
+    if(sampleInProgress_) {
+        return;
+    }
+    sampleInProgress_ = true;
+
+    {
+        lock_guard<mutex> lock(samplerMutex_);
+        sampleRequested_ = true;
+    }
+    samplerCv_.notify_one();
+}
+
+uint64_t ResourceMonitor::memoryUsage() {
+    REQUIRE_UI_THREAD();
+    return memoryUsage_;
+}
+
+double ResourceMonitor::cpuUsage() {
+    REQUIRE_UI_THREAD();
+    return cpuUsage_.value_or(0.0);
+}
+
+int ResourceMonitor::hostRendererPID(int reportedPID) {
+    REQUIRE_UI_THREAD();
+
+    auto it = rendererPIDs_.find(reportedPID);
+    return it == rendererPIDs_.end() ? 0 : it->second;
+}
+
+optional<ResourceMonitor::RendererUsage> ResourceMonitor::rendererUsage(
+    int pid
+) {
+    REQUIRE_UI_THREAD();
+
+    auto it = rendererUsage_.find(pid);
+    if(it == rendererUsage_.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+void ResourceMonitor::afterConstruct_(shared_ptr<ResourceMonitor> self) {
+    // The thread may not retain the monitor, as the destructor joins it.
+    weak_ptr<ResourceMonitor> selfWeak = self;
+    samplerThread_ = thread([this, selfWeak]() {
+        runSamplerThread_(selfWeak);
+    });
+}
+
+void ResourceMonitor::runSamplerThread_(weak_ptr<ResourceMonitor> selfWeak) {
+    unique_lock<mutex> lock(samplerMutex_);
+    while(true) {
+        if(samplerShutdown_) {
+            return;
+        } else if(sampleRequested_) {
+            sampleRequested_ = false;
+
+            lock.unlock();
+            Sample sample;
+            map<int, ProcessStat> processes;
+            sample.memoryUsage = readProcessTree(processes);
+            sample.cpuTimes = readCPUTimes();
+            sample.rendererPIDs = findRendererPIDs(processes);
+            sample.rendererUsage =
+                readRendererUsage(sample.rendererPIDs, processes);
+            postTask(selfWeak, &ResourceMonitor::sampleDone_, sample);
+            lock = unique_lock<mutex>(samplerMutex_);
+        } else {
+            samplerCv_.wait(lock);
+        }
+    }
+}
+
+void ResourceMonitor::sampleDone_(Sample sample) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(sampleInProgress_);
+
+    sampleInProgress_ = false;
+
+    if(sample.memoryUsage) {
+        memoryUsage_ = *sample.memoryUsage;
+    }
+    swap(rendererPIDs_, sample.rendererPIDs);
+    swap(rendererUsage_, sample.rendererUsage);
+
+    if(!sample.cpuTimes) {
+        return;
+    }
+    uint64_t total = sample.cpuTimes->first;
+    uint64_t idle = sample.cpuTimes->second;
+    if(prevCPUTotal_ != 0 && total > prevCPUTotal_ && idle >= prevCPUIdle_) {
+        double busy =
+            1.0 - (double)(idle - prevCPUIdle_) / (double)(total - prevCPUTotal_);
+        double usage = 100.0 * max(busy, 0.0);
+        if(cpuUsage_) {
+            cpuUsage_ =
+                CPUAverageWeight * usage +
+                (1.0 - CPUAverageWeight) * *cpuUsage_;
+        } else {
+            cpuUsage_ = usage;
+        }
+    }
+    prevCPUTotal_ = total;
+    prevCPUIdle_ = idle;
+}
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "renderer_priority.hpp"
+
+namespace browservice {
+
+// Measures the resource usage of the browser for admission control: the total
+// resident memory of the browservice process and all its descendants (the
+// CEF renderer, GPU and utility processes and the dedicated Xvfb), read from
+// /proc/PID/stat, and an exponential moving average of the CPU utilization of
+// the whole host, read from /proc/stat. Pages shared between the processes
+// are counted once for each process, so the memory usage is an overestimate.
+// The samples also locate the renderer processes (see hostRendererPID) and
+// record their usage (see rendererUsage). As scanning /proc may be slow on
+// hosts with many processes, the samples are read in a background thread.
+class ResourceMonitor : public enable_shared_from_this<ResourceMonitor> {
+SHARED_ONLY_CLASS(ResourceMonitor);
+public:
+    ResourceMonitor(CKey);
+    ~ResourceMonitor();
+
+    // Starts taking a new sample in the background thread; the measurements
+    // are updated once it is complete (the call is ignored if the previous
+    // sample is still in progress). Should be called approximately once per
+    // second, as the moving average weights the samples equally.
+    void sample();
+
+    // Total resident memory in bytes as of the latest sample (0 before the
+    // first sample).
+    uint64_t memoryUsage();
+
+    // Moving average of the CPU utilization of the host in percent (0 until
+    // the second sample).
+    double cpuUsage();
+
+    // Translates the PID reported by a renderer process for itself (see
+    // RendererPIDMessage) to the PID of the process in our PID namespace, as
+    // the sandbox may run the renderer processes in a PID namespace of their
+    // own. The translation is based on the renderer processes among the
+    // descendants of this process in the latest sample. Returns 0 if no such
+    // renderer process is known (or the PID is ambiguous), in which case the
+    // PID should be treated as unknown.
+    int hostRendererPID(int reportedPID);
+
+    // Total CPU time, resident memory (in bytes) and priority (empty if it
+    // could not be read) of the renderer process with given PID in our PID
+    // namespace (as returned by hostRendererPID) as of the latest sample;
+    // empty if the process was not found in the sample.
+    struct RendererUsage {
+        milliseconds cpuTime;
+        uint64_t memory;
+        optional<RendererPriorityManager::Priority> priority;
+    };
+    optional<RendererUsage> rendererUsage(int pid);
+
+private:
+    void afterConstruct_(shared_ptr<ResourceMonitor> self);
+
+    // Results of a sample, read in the sampler thread. The values are empty
+    // if they could not be read.
+    struct Sample {
+        optional<uint64_t> memoryUsage;
+
+        // Total and idle CPU time of the host in clock ticks.
+        optional<pair<uint64_t, uint64_t>> cpuTimes;
+
+        // Maps the PIDs of the renderer processes in their own PID namespace
+        // to our PID namespace (0 if ambiguous).
+        map<int, int> rendererPIDs;
+
+        // Indexed by the PIDs in our PID namespace.
+        map<int, RendererUsage> rendererUsage;
+    };
+
+    void runSamplerThread_(weak_ptr<ResourceMonitor> selfWeak);
+    void sampleDone_(Sample sample);
+
+    uint64_t memoryUsage_;
+    map<int, int> rendererPIDs_;
+    map<int, RendererUsage> rendererUsage_;
+
+    // Total and idle CPU time in clock ticks as of the previous sample (total
+    // is 0 before the first sample).
+    uint64_t prevCPUTotal_;
+    uint64_t prevCPUIdle_;
+
+    // Empty until the second sample.
+    optional<double> cpuUsage_;
+
+    // Accessed only in the UI thread.
+    bool sampleInProgress_;
+
+    thread samplerThread_;
+    mutex samplerMutex_;
+    condition_variable samplerCv_;
+    bool sampleRequested_;
+    bool samplerShutdown_;
+};
+
+}
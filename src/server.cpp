@@ -1,7 +1,9 @@
 #include "server.hpp"
 
+#include "clipboard.hpp"
 #include "globals.hpp"
-#include "xwindow.hpp"
+#include "startup_profiler.hpp"
+#include "timeout.hpp"
 
 namespace browservice {
 
@@ -15,6 +17,17 @@ Server::Server(CKey,
     nextWindowHandle_ = 1;
     viceCtx_ = viceCtx;
     clipboardContentRequested_ = false;
+    resourceMonitor_ = ResourceMonitor::create();
+    resourceTimeout_ = Timeout::create(1000);
+    if(globals->config->rendererPriority) {
+        rendererPriorityManager_ = RendererPriorityManager::create();
+    }
+    rendererPriorityTimeout_ = Timeout::create(1000);
+    browserPoolShutdownComplete_ = false;
+    browserPoolHits_ = 0;
+    browserPoolMisses_ = 0;
+    pooledFirstFrames_ = {0, milliseconds(0)};
+    unpooledFirstFrames_ = {0, milliseconds(0)};
 
     // Setup is finished in afterConstruct_
 }
@@ -26,6 +39,12 @@ void Server::shutdown() {
         state_ = WaitWindows;
         INFO_LOG("Shutting down server");
 
+        resourceTimeout_->clear(false);
+        rendererPriorityTimeout_->clear(false);
+
+        logBrowserPoolStats_();
+        firstFrameWaits_.clear();
+
         map<uint64_t, shared_ptr<Window>> windows;
         swap(windows, openWindows_);
         for(pair<uint64_t, shared_ptr<Window>> p : windows) {
@@ -34,6 +53,8 @@ void Server::shutdown() {
             REQUIRE(cleanupWindows_.insert(p).second);
         }
 
+        browserPool_->shutdown();
+
         checkCleanupComplete_();
     }
 }
@@ -58,12 +79,38 @@ uint64_t Server::onViceContextCreateWindowRequest(string& reason) {
         return 0;
     }
 
+    if(optional<string> overload = overloadReason_()) {
+        INFO_LOG("Denying window creation due to overload: ", *overload);
+        reason = *overload;
+        return 0;
+    }
+
     uint64_t handle = nextWindowHandle_++;
     REQUIRE(handle);
 
-    shared_ptr<Window> window = Window::tryCreate(shared_from_this(), handle);
+    steady_clock::time_point requestTime = steady_clock::now();
+
+    bool fromPool = false;
+    shared_ptr<Window> window;
+    if(globals->config->browserPoolSize > 0) {
+        window = browserPool_->tryClaim(shared_from_this(), handle);
+        if(window) {
+            fromPool = true;
+            ++browserPoolHits_;
+        } else {
+            INFO_LOG("Browser pool is empty, creating window from scratch");
+            ++browserPoolMisses_;
+        }
+    }
+    if(!window) {
+        window = Window::tryCreate(shared_from_this(), handle);
+    }
+
     if(window) {
         REQUIRE(openWindows_.emplace(handle, window).second);
+        REQUIRE(firstFrameWaits_.emplace(
+            handle, FirstFrameWait{requestTime, fromPool}
+        ).second);
         return handle;
     } else {
         reason = "Creating CEF browser for window failed";
@@ -81,6 +128,7 @@ void Server::onViceContextCloseWindow(uint64_t window) {
     uint64_t handle = it->first;
     shared_ptr<Window> windowPtr = it->second;
     openWindows_.erase(it);
+    firstFrameWaits_.erase(handle);
 
     windowPtr->close();
     REQUIRE(cleanupWindows_.emplace(handle, windowPtr).second);
@@ -98,9 +146,92 @@ void Server::onViceContextResizeWindow(
     it->second->resize(width, height);
 }
 
+void Server::onViceContextWindowFrameDemand(
+    uint64_t window, int framesPerSecond
+) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ != ShutdownComplete);
+
+    auto it = openWindows_.find(window);
+    REQUIRE(it != openWindows_.end());
+
+    it->second->setFrameDemand(framesPerSecond);
+    raiseRendererPriority_(it->second);
+}
+
+ViceWindowStats Server::onViceContextQueryWindowStats(uint64_t window) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ != ShutdownComplete);
+
+    auto it = openWindows_.find(window);
+    REQUIRE(it != openWindows_.end());
+
+    ViceWindowStats stats;
+    stats.contentCPUTime = milliseconds(0);
+    stats.contentMemory = 0;
+    stats.viewRenderTime =
+        duration_cast<milliseconds>(it->second->viewRenderTime());
+    stats.blockedRequests = it->second->blockedRequestCount();
+
+    Window::CacheStats cacheStats = it->second->cacheStats();
+    stats.cacheHits = cacheStats.hits;
+    stats.cacheMisses = cacheStats.misses;
+    stats.cacheBytesSaved = cacheStats.bytesSaved;
+
+    stats.rendererNice = 0;
+    stats.rendererIOPriority = -1;
+
+    // The usage is only reported if the renderer PID has been translated to
+    // our PID namespace; otherwise, it might refer to an unrelated process.
+    int pid = rendererHostPID_(it->second);
+    if(pid == 0) {
+        return stats;
+    }
+
+    optional<ResourceMonitor::RendererUsage> usage =
+        resourceMonitor_->rendererUsage(pid);
+    if(!usage) {
+        return stats;
+    }
+
+    if(usage->priority) {
+        stats.rendererNice = usage->priority->nice;
+        stats.rendererIOPriority = usage->priority->ioLevel;
+    }
+
+    // A renderer process may host the pages of multiple windows (for example
+    // popups opened by a page), in which case its usage is divided evenly
+    // between them. The numbers of windows sharing each process are counted
+    // once per resource check, as the usage is only sampled then.
+    if(!rendererSharers_) {
+        rendererSharers_.emplace();
+        for(pair<uint64_t, shared_ptr<Window>> p : openWindows_) {
+            int sharerPID = rendererHostPID_(p.second);
+            if(sharerPID != 0) {
+                ++(*rendererSharers_)[sharerPID];
+            }
+        }
+    }
+    // The window may have been opened after the count.
+    uint64_t sharers = max((*rendererSharers_)[pid], (uint64_t)1);
+    stats.contentCPUTime = usage->cpuTime / (int64_t)sharers;
+    stats.contentMemory = usage->memory / sharers;
+
+    return stats;
+}
+
 void Server::onViceContextFetchWindowImage(
     uint64_t window,
-    function<void(const uint8_t*, size_t, size_t, size_t)> putImage
+    bool snapshot,
+    function<void(
+        const uint8_t* image,
+        size_t width,
+        size_t height,
+        size_t pitch,
+        uint64_t sequenceNumber,
+        const vector<Rect>& dirtyRects,
+        shared_ptr<void> frameOwner
+    )> putImage
 ) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ != ShutdownComplete);
@@ -108,11 +239,45 @@ void Server::onViceContextFetchWindowImage(
     auto it = openWindows_.find(window);
     REQUIRE(it != openWindows_.end());
 
-    ImageSlice image = it->second->fetchViewImage();
+    recordFirstFrame_(window, it->second);
+
+    shared_ptr<void> frameOwner;
+    uint64_t sequenceNumber;
+    TileMap changedTiles;
+    ImageSlice image;
+    if(snapshot) {
+        image = it->second->fetchViewFrame(
+            frameOwner, sequenceNumber, changedTiles
+        );
+    } else {
+        changedTiles = it->second->changedTiles();
+        image = it->second->fetchViewImage();
+        sequenceNumber = it->second->viewSequenceNumber();
+    }
+
+    vector<Rect> dirtyRects;
     if(image.width() < 1 || image.height() < 1) {
         image = ImageSlice::createImage(1, 1);
+        frameOwner = make_shared<ImageSlice>(image);
+        dirtyRects.push_back(Rect(0, 1, 0, 1));
+    } else if(
+        changedTiles.width() != image.width() ||
+        changedTiles.height() != image.height()
+    ) {
+        dirtyRects.push_back(Rect(0, image.width(), 0, image.height()));
+    } else {
+        dirtyRects = changedTiles.toRects();
     }
-    putImage(image.buf(), image.width(), image.height(), image.pitch());
+
+    putImage(
+        image.buf(),
+        image.width(),
+        image.height(),
+        image.pitch(),
+        sequenceNumber,
+        dirtyRects,
+        frameOwner
+    );
 }
 
 #define FORWARD_INPUT_EVENT(Name, args, call) \
@@ -124,6 +289,7 @@ void Server::onViceContextFetchWindowImage(
         REQUIRE(it != openWindows_.end()); \
         \
         it->second->send ## Name ## Event call; \
+        raiseRendererPriority_(it->second); \
     }
 
 FORWARD_INPUT_EVENT(
@@ -186,7 +352,7 @@ void Server::onViceContextCopyToClipboard(string text) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ != ShutdownComplete);
 
-    globals->xWindow->copyToClipboard(move(text));
+    globals->clipboard->copy(move(text));
 }
 
 void Server::onViceContextRequestClipboardContent() {
@@ -224,7 +390,7 @@ void Server::onViceContextRequestClipboardContent() {
     shared_ptr<Responder> responder = make_shared<Responder>();
     responder->server = shared_from_this();
 
-    globals->xWindow->pasteFromClipboard([responder](string text) {
+    globals->clipboard->paste([responder](string text) {
         responder->respond(text);
     });
 }
@@ -267,6 +433,7 @@ void Server::onWindowClose(uint64_t handle) {
 
     shared_ptr<Window> window = it->second;
     openWindows_.erase(it);
+    firstFrameWaits_.erase(handle);
 
     REQUIRE(cleanupWindows_.emplace(handle, window).second);
 
@@ -380,6 +547,11 @@ void Server::onWindowCreatePopupRequest(
         return;
     }
 
+    if(optional<string> overload = overloadReason_()) {
+        INFO_LOG("Denying popup window request due to overload: ", *overload);
+        return;
+    }
+
     uint64_t newHandle = nextWindowHandle_++;
     REQUIRE(newHandle);
 
@@ -405,16 +577,280 @@ void Server::onWindowCreatePopupRequest(
     }
 }
 
+void Server::onBrowserPoolShutdownComplete() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == WaitWindows);
+
+    browserPoolShutdownComplete_ = true;
+    checkCleanupComplete_();
+}
+
 void Server::afterConstruct_(shared_ptr<Server> self) {
+    browserPool_ = BrowserPool::create(self);
     viceCtx_->start(self);
+
+    // The resources are also sampled without limits, as the samples are used
+    // to translate the renderer PIDs.
+    checkResources_();
+    if(rendererPriorityManager_) {
+        rendererPriorityTick_();
+    }
 }
 
 void Server::checkCleanupComplete_() {
-    if(state_ == WaitWindows && cleanupWindows_.empty()) {
+    if(
+        state_ == WaitWindows &&
+        cleanupWindows_.empty() &&
+        browserPoolShutdownComplete_
+    ) {
         REQUIRE(openWindows_.empty());
         state_ = WaitViceContext;
         viceCtx_->shutdown();
     }
 }
 
+optional<string> Server::overloadReason_() {
+    const Config& config = *globals->config;
+
+    if(config.memoryLimit > 0) {
+        uint64_t usageMB = resourceMonitor_->memoryUsage() / (1024 * 1024);
+        if(usageMB > (uint64_t)config.memoryLimit) {
+            return
+                "Memory usage of the browser (" + toString(usageMB) + " MB) "
+                "exceeds the limit of " + toString(config.memoryLimit) + " MB";
+        }
+    }
+
+    if(config.cpuLimit > 0) {
+        int usage = (int)resourceMonitor_->cpuUsage();
+        if(usage > config.cpuLimit) {
+            return
+                "CPU utilization (" + toString(usage) + "%) exceeds the "
+                "limit of " + toString(config.cpuLimit) + "%";
+        }
+    }
+
+    if(config.backlogLimit > 0) {
+        int backlog = 0;
+        for(pair<uint64_t, shared_ptr<Window>> p : openWindows_) {
+            if(p.second->isViewBacklogged()) {
+                ++backlog;
+            }
+        }
+        if(backlog > config.backlogLimit) {
+            return
+                toString(backlog) + " windows have view updates waiting to "
+                "be sent, exceeding the limit of " +
+                toString(config.backlogLimit);
+        }
+    }
+
+    return {};
+}
+
+void Server::checkResources_() {
+    REQUIRE_UI_THREAD();
+
+    if(state_ != Running) {
+        return;
+    }
+
+    // The sample is taken in the background; the check below uses the results
+    // of the previous one.
+    resourceMonitor_->sample();
+    rendererSharers_.reset();
+
+    const Config& config = *globals->config;
+    bool hasLimits =
+        config.memoryLimit > 0 ||
+        config.cpuLimit > 0 ||
+        config.backlogLimit > 0;
+    if(hasLimits && config.overloadPolicy != "deny") {
+        if(optional<string> overload = overloadReason_()) {
+            INFO_LOG("Server overloaded: ", *overload);
+            relieveOverload_();
+        }
+    }
+
+    weak_ptr<Server> selfWeak = shared_from_this();
+    resourceTimeout_->set([selfWeak]() {
+        if(shared_ptr<Server> self = selfWeak.lock()) {
+            self->checkResources_();
+        }
+    });
+}
+
+void Server::relieveOverload_() {
+    REQUIRE(state_ == Running);
+
+    vector<pair<steady_clock::time_point, uint64_t>> candidates;
+    steady_clock::time_point now = steady_clock::now();
+    for(pair<uint64_t, shared_ptr<Window>> p : openWindows_) {
+        Window& window = *p.second;
+        if(
+            window.isAwake() &&
+            now - window.lastActivityTime() >= OverloadIdleTime
+        ) {
+            candidates.emplace_back(window.lastActivityTime(), p.first);
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+
+    for(pair<steady_clock::time_point, uint64_t> candidate : candidates) {
+        uint64_t handle = candidate.second;
+        auto it = openWindows_.find(handle);
+        REQUIRE(it != openWindows_.end());
+
+        if(globals->config->overloadPolicy == "hibernate") {
+            // Windows with uploads or downloads in progress cannot hibernate
+            if(it->second->hibernate()) {
+                INFO_LOG("Hibernated window ", handle, " to relieve overload");
+                return;
+            }
+        } else {
+            REQUIRE(globals->config->overloadPolicy == "shed");
+            INFO_LOG("Closing window ", handle, " to relieve overload");
+
+            shared_ptr<Window> window = it->second;
+            openWindows_.erase(it);
+            firstFrameWaits_.erase(handle);
+
+            window->close();
+            REQUIRE(cleanupWindows_.emplace(handle, window).second);
+            viceCtx_->closeWindow(handle);
+            return;
+        }
+    }
+
+    INFO_LOG("No idle windows available for relieving overload");
+}
+
+int Server::rendererHostPID_(shared_ptr<Window> window) {
+    int pid = window->rendererPID();
+    return pid > 0 ? resourceMonitor_->hostRendererPID(pid) : 0;
+}
+
+RendererPriorityManager::Level Server::rendererPriorityLevel_(
+    shared_ptr<Window> window,
+    steady_clock::time_point now
+) {
+    if(now - window->lastActivityTime() < InteractivePriorityTime) {
+        return RendererPriorityManager::Interactive;
+    } else if(window->frameDemand() == 0) {
+        return RendererPriorityManager::Background;
+    } else {
+        // A negative demand means that the plugin has not reported it.
+        return RendererPriorityManager::Visible;
+    }
+}
+
+void Server::updateRendererPriorities_() {
+    REQUIRE_UI_THREAD();
+
+    if(!rendererPriorityManager_ || state_ != Running) {
+        return;
+    }
+
+    steady_clock::time_point now = steady_clock::now();
+    map<int, RendererPriorityManager::Level> levels;
+    for(pair<uint64_t, shared_ptr<Window>> p : openWindows_) {
+        // Never act on a PID that has not been translated to our namespace.
+        int pid = rendererHostPID_(p.second);
+        if(pid == 0) {
+            continue;
+        }
+
+        RendererPriorityManager::Level level =
+            rendererPriorityLevel_(p.second, now);
+        auto it = levels.find(pid);
+        if(it == levels.end()) {
+            levels.emplace(pid, level);
+        } else {
+            it->second = max(it->second, level);
+        }
+    }
+
+    rendererPriorityManager_->update(levels);
+}
+
+void Server::raiseRendererPriority_(shared_ptr<Window> window) {
+    REQUIRE_UI_THREAD();
+
+    if(!rendererPriorityManager_ || state_ != Running) {
+        return;
+    }
+
+    int pid = rendererHostPID_(window);
+    if(pid != 0) {
+        rendererPriorityManager_->raise(
+            pid, rendererPriorityLevel_(window, steady_clock::now())
+        );
+    }
+}
+
+void Server::rendererPriorityTick_() {
+    REQUIRE_UI_THREAD();
+
+    if(state_ != Running) {
+        return;
+    }
+
+    updateRendererPriorities_();
+
+    weak_ptr<Server> selfWeak = shared_from_this();
+    rendererPriorityTimeout_->set([selfWeak]() {
+        if(shared_ptr<Server> self = selfWeak.lock()) {
+            self->rendererPriorityTick_();
+        }
+    });
+}
+
+void Server::recordFirstFrame_(uint64_t handle, shared_ptr<Window> window) {
+    // The fetches before the first paint of the browser only return the
+    // initial blank image.
+    auto it = firstFrameWaits_.find(handle);
+    if(it == firstFrameWaits_.end() || !window->browserPainted()) {
+        return;
+    }
+
+    milliseconds elapsed = duration_cast<milliseconds>(
+        steady_clock::now() - it->second.requestTime
+    );
+    bool fromPool = it->second.fromPool;
+    firstFrameWaits_.erase(it);
+
+    INFO_LOG(
+        "First painted frame of window ", handle, " fetched ", elapsed.count(),
+        " ms after the creation request",
+        fromPool ? " (browser taken from the pool)" : ""
+    );
+
+    globals->startupProfiler->firstFrameServed();
+
+    FirstFrameStats& stats =
+        fromPool ? pooledFirstFrames_ : unpooledFirstFrames_;
+    ++stats.count;
+    stats.total += elapsed;
+}
+
+void Server::logBrowserPoolStats_() {
+    if(globals->config->browserPoolSize <= 0) {
+        return;
+    }
+
+    auto average = [](const FirstFrameStats& stats) -> string {
+        if(stats.count == 0) {
+            return "n/a";
+        }
+        return toString(stats.total.count() / stats.count) + " ms";
+    };
+
+    INFO_LOG(
+        "Browser pool statistics: ", browserPoolHits_, " hits, ",
+        browserPoolMisses_, " misses; average time to first frame ",
+        average(pooledFirstFrames_), " for pooled browsers and ",
+        average(unpooledFirstFrames_), " for new browsers"
+    );
+}
+
 }
@@ -1,6 +1,8 @@
 #pragma once
 
-#include "window.hpp"
+#include "browser_pool.hpp"
+#include "renderer_priority.hpp"
+#include "resource_monitor.hpp"
 #include "vice.hpp"
 
 namespace browservice {
@@ -10,12 +12,21 @@ public:
     virtual void onServerShutdownComplete() = 0;
 };
 
+class Timeout;
+
 // The root object for the whole browser proxy server, handling multiple
 // browser windows. Before quitting CEF message loop, call shutdown and wait
 // for onServerShutdownComplete event.
+//
+// New windows are admitted only if the number of windows is below the window
+// limit and the resource usage measured by ResourceMonitor (and the number of
+// windows with backlogged views) is within the limits given in the
+// configuration. While a resource limit is exceeded, the least recently used
+// windows may be hibernated or closed depending on the overload policy.
 class Server :
     public ViceContextEventHandler,
     public WindowEventHandler,
+    public BrowserPoolEventHandler,
     public enable_shared_from_this<Server>
 {
 SHARED_ONLY_CLASS(Server);
@@ -34,9 +45,24 @@ public:
     virtual void onViceContextResizeWindow(
         uint64_t window, int width, int height
     ) override;
+    virtual void onViceContextWindowFrameDemand(
+        uint64_t window, int framesPerSecond
+    ) override;
+    virtual ViceWindowStats onViceContextQueryWindowStats(
+        uint64_t window
+    ) override;
     virtual void onViceContextFetchWindowImage(
         uint64_t window,
-        function<void(const uint8_t*, size_t, size_t, size_t)> putImage
+        bool snapshot,
+        function<void(
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const vector<Rect>& dirtyRects,
+            shared_ptr<void> frameOwner
+        )> putImage
     ) override;
     virtual void onViceContextMouseDown(
         uint64_t window, int x, int y, int button
@@ -85,11 +111,55 @@ public:
         function<shared_ptr<Window>(uint64_t)> accept
     ) override;
 
+    // BrowserPoolEventHandler:
+    virtual void onBrowserPoolShutdownComplete() override;
+
 private:
     void afterConstruct_(shared_ptr<Server> self);
 
     void checkCleanupComplete_();
 
+    // Returns the reason for denying new windows if a resource limit is
+    // exceeded.
+    optional<string> overloadReason_();
+
+    // Called every second while the server is running to sample the resource
+    // usage and, if some resource limit is enabled, to relieve overload.
+    void checkResources_();
+
+    // Hibernates or closes (depending on the overload policy) the least
+    // recently used awake window that has been idle for at least
+    // OverloadIdleTime.
+    static constexpr milliseconds OverloadIdleTime = milliseconds(60000);
+    void relieveOverload_();
+
+    // Returns the PID of the renderer process of the window in our PID
+    // namespace, or 0 if it is not known (see
+    // ResourceMonitor::hostRendererPID).
+    int rendererHostPID_(shared_ptr<Window> window);
+
+    // Recomputes the priority levels of the renderer processes from the state
+    // of their windows (the highest level if a process is shared by multiple
+    // windows) and applies the changes, if renderer priority management is
+    // enabled. Called every second (rendererPriorityTick_) to lower the
+    // priorities as the input ages; on input and frame demand changes, only
+    // the renderer of the affected window is raised (raiseRendererPriority_).
+    static constexpr milliseconds InteractivePriorityTime =
+        milliseconds(10000);
+    RendererPriorityManager::Level rendererPriorityLevel_(
+        shared_ptr<Window> window,
+        steady_clock::time_point now
+    );
+    void updateRendererPriorities_();
+    void raiseRendererPriority_(shared_ptr<Window> window);
+    void rendererPriorityTick_();
+
+    // Called upon each fetch of the view of a window; records the time to the
+    // first frame of a window created on request of the vice plugin if the
+    // browser has painted the view and the time has not been recorded yet.
+    void recordFirstFrame_(uint64_t handle, shared_ptr<Window> window);
+    void logBrowserPoolStats_();
+
     weak_ptr<ServerEventHandler> eventHandler_;
 
     uint64_t nextWindowHandle_;
@@ -99,6 +169,39 @@ private:
     map<uint64_t, shared_ptr<Window>> openWindows_;
     map<uint64_t, shared_ptr<Window>> cleanupWindows_;
 
+    shared_ptr<ResourceMonitor> resourceMonitor_;
+    shared_ptr<Timeout> resourceTimeout_;
+
+    // Number of open windows per renderer process (by PID in our PID
+    // namespace) for dividing the usage of the processes in the window
+    // statistics; computed on demand and reset on each resource check.
+    optional<map<int, uint64_t>> rendererSharers_;
+
+    // Empty if renderer priority management is disabled.
+    shared_ptr<RendererPriorityManager> rendererPriorityManager_;
+    shared_ptr<Timeout> rendererPriorityTimeout_;
+
+    shared_ptr<BrowserPool> browserPool_;
+    bool browserPoolShutdownComplete_;
+
+    // Statistics of the windows created on request of the vice plugin: the
+    // number of windows taken from the browser pool (hits) and created from
+    // scratch (misses), and the time from the creation request to the first
+    // fetch of the view painted by the browser for both cases.
+    int browserPoolHits_;
+    int browserPoolMisses_;
+    struct FirstFrameWait {
+        steady_clock::time_point requestTime;
+        bool fromPool;
+    };
+    map<uint64_t, FirstFrameWait> firstFrameWaits_;
+    struct FirstFrameStats {
+        int count;
+        milliseconds total;
+    };
+    FirstFrameStats pooledFirstFrames_;
+    FirstFrameStats unpooledFirstFrames_;
+
     bool clipboardContentRequested_;
 };
 
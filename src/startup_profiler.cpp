@@ -0,0 +1,56 @@
+#include "startup_profiler.hpp"
+
+namespace browservice {
+
+StartupProfiler::StartupProfiler(CKey) {
+    startTime_ = steady_clock::now();
+    firstFrameServed_ = false;
+}
+
+void StartupProfiler::beginPhase(string name) {
+    steady_clock::time_point now = steady_clock::now();
+
+    lock_guard<mutex> lock(mutex_);
+    REQUIRE(phaseStartTimes_.emplace(move(name), now).second);
+}
+
+void StartupProfiler::endPhase(string name) {
+    steady_clock::time_point now = steady_clock::now();
+
+    steady_clock::time_point phaseStartTime;
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto it = phaseStartTimes_.find(name);
+        REQUIRE(it != phaseStartTimes_.end());
+        phaseStartTime = it->second;
+    }
+
+    INFO_LOG(
+        "Startup phase '", name, "' took ",
+        duration_cast<milliseconds>(now - phaseStartTime).count(),
+        " ms (finished ", elapsed_(now).count(), " ms after program start)"
+    );
+}
+
+void StartupProfiler::firstFrameServed() {
+    steady_clock::time_point now = steady_clock::now();
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        if(firstFrameServed_) {
+            return;
+        }
+        firstFrameServed_ = true;
+    }
+
+    INFO_LOG(
+        "First frame served ", elapsed_(now).count(),
+        " ms after program start"
+    );
+}
+
+milliseconds StartupProfiler::elapsed_(steady_clock::time_point time) {
+    return duration_cast<milliseconds>(time - startTime_);
+}
+
+}
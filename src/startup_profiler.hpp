@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace browservice {
+
+// Measures the phases of the startup of the program, which may run
+// concurrently in different threads, and logs the duration of each phase and
+// the time from the creation of the profiler (the start of the program) to the
+// end of the phase. The time to the first view image painted by the browser
+// and fetched by the vice plugin is logged similarly, as it is what the first
+// user is waiting for.
+class StartupProfiler {
+SHARED_ONLY_CLASS(StartupProfiler);
+public:
+    StartupProfiler(CKey);
+
+    // Thread-safe. Each phase name may be used only once.
+    void beginPhase(string name);
+    void endPhase(string name);
+
+    // Logs the time to the first served frame on the first call; subsequent
+    // calls are ignored. Thread-safe.
+    void firstFrameServed();
+
+private:
+    // Time since the profiler was created.
+    milliseconds elapsed_(steady_clock::time_point time);
+
+    steady_clock::time_point startTime_;
+
+    mutex mutex_;
+    map<string, steady_clock::time_point> phaseStartTimes_;
+    bool firstFrameServed_;
+};
+
+}
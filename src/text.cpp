@@ -1,6 +1,7 @@
 #include "text.hpp"
 
 #include "globals.hpp"
+#include "image_kernels.hpp"
 #include "rect.hpp"
 
 #include <freetype/fttypes.h>
@@ -71,6 +72,37 @@ private:
     string oldValue_;
 };
 
+struct Graymap {
+    int width;
+    int height;
+    vector<uint8_t> buffer;
+    FT_Bitmap ftBitmap;
+
+    Graymap(int pWidth, int pHeight) {
+        width = pWidth;
+        height = pHeight;
+
+        REQUIRE(width >= 1);
+        REQUIRE(height >= 1);
+
+        const int Limit = INT_MAX / 9;
+        REQUIRE(width < Limit / height);
+
+        buffer.resize(width * height);
+        ftBitmap.rows = height;
+        ftBitmap.width = width;
+        ftBitmap.pitch = width;
+        ftBitmap.buffer = buffer.data();
+        ftBitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+    }
+
+    Graymap(const Graymap&) = delete;
+    Graymap& operator=(const Graymap&) = delete;
+
+    Graymap(Graymap&&) = default;
+    Graymap& operator=(Graymap&&) = default;
+};
+
 }
 
 struct TextRenderContext::Impl {
@@ -78,6 +110,21 @@ struct TextRenderContext::Impl {
     PangoContext* pangoCtx;
     PangoFontDescription* fontDesc;
 
+    // LRU cache of rendered graymaps shared by all the layouts using this
+    // context, keyed by the font description and the text. The cache is
+    // bounded both in the number of entries and in the total graymap size.
+    static constexpr size_t GraymapCacheMaxEntries = 256;
+    static constexpr size_t GraymapCacheMaxBytes = 4 << 20;
+
+    struct GraymapCacheEntry {
+        shared_ptr<const Graymap> graymap;
+        uint64_t lastUse;
+    };
+    map<string, GraymapCacheEntry> graymapCache;
+    size_t graymapCacheBytes;
+    uint64_t graymapCacheUseCounter;
+    string fontKey;
+
     Impl() {
         // Set interpreter version environment variable
         FreeType2SetEnv setEnv;
@@ -111,6 +158,14 @@ struct TextRenderContext::Impl {
 
         fontDesc = pango_font_description_from_string("Verdana 11");
         REQUIRE(fontDesc != nullptr);
+
+        char* fontDescStr = pango_font_description_to_string(fontDesc);
+        REQUIRE(fontDescStr != nullptr);
+        fontKey = fontDescStr;
+        g_free(fontDescStr);
+
+        graymapCacheBytes = 0;
+        graymapCacheUseCounter = 0;
     }
 
     ~Impl() {
@@ -120,50 +175,72 @@ struct TextRenderContext::Impl {
     }
 
     DISABLE_COPY_MOVE(Impl);
-};
 
-namespace {
+    string graymapCacheKey(const string& text) {
+        string key = fontKey;
+        key.push_back('\0');
+        key.append(text);
+        return key;
+    }
 
-struct Graymap {
-    int width;
-    int height;
-    vector<uint8_t> buffer;
-    FT_Bitmap ftBitmap;
+    shared_ptr<const Graymap> findCachedGraymap(const string& key) {
+        auto it = graymapCache.find(key);
+        if(it == graymapCache.end()) {
+            return {};
+        }
+        it->second.lastUse = ++graymapCacheUseCounter;
+        return it->second.graymap;
+    }
 
-    Graymap(int pWidth, int pHeight) {
-        width = pWidth;
-        height = pHeight;
+    void cacheGraymap(string key, shared_ptr<const Graymap> graymap) {
+        size_t bytes = graymap->buffer.size();
+        if(bytes > GraymapCacheMaxBytes / 4) {
+            return;
+        }
 
-        REQUIRE(width >= 1);
-        REQUIRE(height >= 1);
+        auto it = graymapCache.find(key);
+        if(it != graymapCache.end()) {
+            graymapCacheBytes -= it->second.graymap->buffer.size();
+            graymapCache.erase(it);
+        }
 
-        const int Limit = INT_MAX / 9;
-        REQUIRE(width < Limit / height);
+        while(
+            !graymapCache.empty() && (
+                graymapCache.size() >= GraymapCacheMaxEntries ||
+                graymapCacheBytes + bytes > GraymapCacheMaxBytes
+            )
+        ) {
+            auto oldest = graymapCache.begin();
+            for(
+                auto candidate = graymapCache.begin();
+                candidate != graymapCache.end();
+                ++candidate
+            ) {
+                if(candidate->second.lastUse < oldest->second.lastUse) {
+                    oldest = candidate;
+                }
+            }
+            graymapCacheBytes -= oldest->second.graymap->buffer.size();
+            graymapCache.erase(oldest);
+        }
 
-        buffer.resize(width * height);
-        ftBitmap.rows = height;
-        ftBitmap.width = width;
-        ftBitmap.pitch = width;
-        ftBitmap.buffer = buffer.data();
-        ftBitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+        graymapCacheBytes += bytes;
+        graymapCache.emplace(
+            move(key),
+            GraymapCacheEntry{move(graymap), ++graymapCacheUseCounter}
+        );
     }
-
-    Graymap(const Graymap&) = delete;
-    Graymap& operator=(const Graymap&) = delete;
-
-    Graymap(Graymap&&) = default;
-    Graymap& operator=(Graymap&&) = default;
 };
 
-}
-
 struct TextLayout::Impl {
     shared_ptr<TextRenderContext> ctx;
     PangoLayout* layout;
 
     string text;
 
-    optional<Graymap> graymap;
+    // Rendered graymap of the current text; may be shared with other layouts
+    // through the cache in the context.
+    shared_ptr<const Graymap> graymap;
 
     Impl(shared_ptr<TextRenderContext> ctx) : ctx(ctx) {
         layout = pango_layout_new(ctx->impl_->pangoCtx);
@@ -181,6 +258,10 @@ struct TextLayout::Impl {
     DISABLE_COPY_MOVE(Impl);
 
     void setText(string newText) {
+        if(newText == text) {
+            return;
+        }
+
         graymap.reset();
 
         pango_layout_set_text(layout, newText.data(), newText.size());
@@ -256,20 +337,12 @@ struct TextLayout::Impl {
 
         if(!rect.isEmpty()) {
             for(int y = rect.startY; y < rect.endY; ++y) {
-                uint8_t* graymapPos =
-                    &graymap->buffer[y * graymap->width + rect.startX];
-                uint8_t* destPos =
-                    dest.getPixelPtr(rect.startX + offsetX, y + offsetY);
-
-                for(int x = rect.startX; x < rect.endX; ++x) {
-                    if(*graymapPos >= 128) {
-                        *(destPos + 0) = b;
-                        *(destPos + 1) = g;
-                        *(destPos + 2) = r;
-                    }
-                    ++graymapPos;
-                    destPos += 4;
-                }
+                image_kernels::blendMask(
+                    dest.getPixelPtr(rect.startX + offsetX, y + offsetY),
+                    &graymap->buffer[y * graymap->width + rect.startX],
+                    rect.endX - rect.startX,
+                    r, g, b
+                );
             }
         }
     }
@@ -285,9 +358,19 @@ struct TextLayout::Impl {
     void ensureGraymapRendered() {
         if(graymap) return;
 
+        TextRenderContext::Impl& ctxImpl = *ctx->impl_;
+        string key = ctxImpl.graymapCacheKey(text);
+        graymap = ctxImpl.findCachedGraymap(key);
+        if(graymap) return;
+
         PangoRectangle extents = getExtents();
-        graymap = Graymap(extents.width, extents.height);
-        pango_ft2_render_layout(&graymap->ftBitmap, layout, -extents.x, -extents.y);
+        shared_ptr<Graymap> newGraymap =
+            make_shared<Graymap>(extents.width, extents.height);
+        pango_ft2_render_layout(
+            &newGraymap->ftBitmap, layout, -extents.x, -extents.y
+        );
+        graymap = newGraymap;
+        ctxImpl.cacheGraymap(move(key), newGraymap);
     }
 };
 
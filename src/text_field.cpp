@@ -1,10 +1,11 @@
 #include "text_field.hpp"
 
+#include "clipboard.hpp"
 #include "globals.hpp"
+#include "image_kernels.hpp"
 #include "key.hpp"
 #include "text.hpp"
 #include "timeout.hpp"
-#include "xwindow.hpp"
 
 namespace browservice {
 
@@ -23,6 +24,8 @@ TextField::TextField(CKey,
     removeCaretOnSubmit_ = true;
     allowEmptySubmit_ = true;
 
+    backgroundColor_ = {255, 255, 255};
+
     hasFocus_ = false;
     leftMouseButtonDown_ = false;
     shiftKeyDown_ = false;
@@ -71,6 +74,16 @@ void TextField::setAllowEmptySubmit(bool value) {
     allowEmptySubmit_ = value;
 }
 
+void TextField::setBackgroundColor(uint8_t r, uint8_t g, uint8_t b) {
+    REQUIRE_UI_THREAD();
+
+    array<uint8_t, 3> color = {r, g, b};
+    if(backgroundColor_ != color) {
+        backgroundColor_ = color;
+        signalViewDirty_();
+    }
+}
+
 void TextField::unsetCaret_() {
     if(caretActive_) {
         caretActive_ = false;
@@ -112,14 +125,28 @@ void TextField::scheduleBlinkCaret_() {
 
         if(shared_ptr<TextField> self = selfWeak.lock()) {
             if(self->caretActive_) {
-                self->caretBlinkState_ = !self->caretBlinkState_;
-                self->signalViewDirty_();
-                self->scheduleBlinkCaret_();
+                self->blinkCaret_();
             }
         }
     });
 }
 
+void TextField::blinkCaret_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(caretActive_);
+
+    // If the blinking is paused, it is continued by
+    // widgetAnimationsResumedEvent_.
+    AnimationFrameStatus status = requestAnimationFrame_();
+    if(status == AnimationFrameStatus::Allow) {
+        caretBlinkState_ = !caretBlinkState_;
+        signalViewDirty_();
+        scheduleBlinkCaret_();
+    } else if(status == AnimationFrameStatus::Skip) {
+        scheduleBlinkCaret_();
+    }
+}
+
 void TextField::typeText_(const char* textPtr, int textLength) {
     if(caretActive_) {
         int idx1 = min(caretStart_, caretEnd_);
@@ -173,7 +200,7 @@ void TextField::eraseRange_() {
 void TextField::pasteFromClipboard_() {
     if(caretActive_) {
         weak_ptr<TextField> selfWeak = shared_from_this();
-        globals->xWindow->pasteFromClipboard([selfWeak](string text) {
+        globals->clipboard->paste([selfWeak](string text) {
             REQUIRE_UI_THREAD();
             if(shared_ptr<TextField> self = selfWeak.lock()) {
                 self->typeText_(text.data(), text.size());
@@ -189,7 +216,7 @@ void TextField::copyToClipboard_() {
         if(idx1 < idx2) {
             string text = textLayout_->text();
             REQUIRE(idx1 >= 0 && idx2 <= (int)text.size());
-            globals->xWindow->copyToClipboard(text.substr(idx1, idx2 - idx1));
+            globals->clipboard->copy(text.substr(idx1, idx2 - idx1));
         }
     }
 }
@@ -203,6 +230,10 @@ void TextField::widgetRender_() {
     REQUIRE_UI_THREAD();
 
     ImageSlice viewport = getViewport();
+    viewport.fill(
+        0, viewport.width(), 0, viewport.height(),
+        backgroundColor_[0], backgroundColor_[1], backgroundColor_[2]
+    );
 
     textLayout_->render(viewport);
 
@@ -220,23 +251,14 @@ void TextField::widgetRender_() {
             fillSlice = viewport.subRect(endX + 1, startX, caretStartY, caretEndY);
         }
 
+        // Highlight the selection: black text becomes white and the
+        // background becomes dark blue
         for(int y = 0; y < fillSlice.height(); ++y) {
-            uint8_t* ptr = fillSlice.getPixelPtr(0, y);
-            for(int x = 0; x < fillSlice.width(); ++x) {
-                uint8_t& r = *(ptr + 0);
-                uint8_t& g = *(ptr + 1);
-                uint8_t& b = *(ptr + 2);
-                if(r == 0 && g == 0 && b == 0) {
-                    r = 255;
-                    g = 255;
-                    b = 255;
-                } else {
-                    r = 128;
-                    g = 0;
-                    b = 0;
-                }
-                ptr += 4;
-            }
+            image_kernels::recolor(
+                fillSlice.getPixelPtr(0, y), fillSlice.width(),
+                255, 255, 255,
+                0, 0, 128
+            );
         }
 
         if(caretBlinkState_) {
@@ -407,4 +429,12 @@ void TextField::widgetLoseFocusEvent_() {
     }
 }
 
+void TextField::widgetAnimationsResumedEvent_() {
+    REQUIRE_UI_THREAD();
+
+    if(caretActive_ && !caretBlinkTimeout_->isActive()) {
+        scheduleBlinkCaret_();
+    }
+}
+
 }
@@ -42,10 +42,15 @@ public:
     void setRemoveCaretOnSubmit(bool value);
     void setAllowEmptySubmit(bool value);
 
+    // The text field fills its viewport with the background color (white by
+    // default) before drawing the text.
+    void setBackgroundColor(uint8_t r, uint8_t g, uint8_t b);
+
 private:
     void unsetCaret_();
     void setCaret_(int start, int end);
     void scheduleBlinkCaret_();
+    void blinkCaret_();
 
     void typeText_(const char* textPtr, int textLength);
     void typeCharacter_(int key);
@@ -66,6 +71,7 @@ private:
     virtual void widgetKeyUpEvent_(int key) override;
     virtual void widgetGainFocusEvent_(int x, int y) override;
     virtual void widgetLoseFocusEvent_() override;
+    virtual void widgetAnimationsResumedEvent_() override;
 
     weak_ptr<TextFieldEventHandler> eventHandler_;
 
@@ -74,6 +80,8 @@ private:
     bool removeCaretOnSubmit_;
     bool allowEmptySubmit_;
 
+    array<uint8_t, 3> backgroundColor_;
+
     bool hasFocus_;
     bool leftMouseButtonDown_;
     bool shiftKeyDown_;
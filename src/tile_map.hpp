@@ -0,0 +1,173 @@
+#pragma once
+
+#include "rect.hpp"
+
+namespace browservice {
+
+// Bitmap of TileSize x TileSize tiles covering a width x height image, used to
+// track which parts of the image have changed. Tile (tx, ty) covers the pixels
+// [TileSize * tx, TileSize * (tx + 1)) x [TileSize * ty, TileSize * (ty + 1))
+// (clipped to the image).
+class TileMap {
+public:
+    static constexpr int TileSize = 64;
+
+    // Create an empty map for a 0x0 image
+    TileMap()
+        : width_(0),
+          height_(0),
+          tileCountX_(0),
+          tileCountY_(0)
+    {}
+
+    // Create a map with no tiles marked for a width x height image
+    TileMap(int width, int height) {
+        REQUIRE(width >= 0 && height >= 0);
+
+        width_ = width;
+        height_ = height;
+        tileCountX_ = (width + TileSize - 1) / TileSize;
+        tileCountY_ = (height + TileSize - 1) / TileSize;
+        words_.resize((tileCountX_ * tileCountY_ + 63) / 64, 0);
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    int tileCountX() const { return tileCountX_; }
+    int tileCountY() const { return tileCountY_; }
+
+    bool isMarked(int tx, int ty) const {
+        REQUIRE(tx >= 0 && tx < tileCountX_ && ty >= 0 && ty < tileCountY_);
+        size_t idx = (size_t)(ty * tileCountX_ + tx);
+        return (words_[idx / 64] >> (idx % 64)) & 1;
+    }
+
+    // Returns true if no tiles are marked
+    bool isEmpty() const {
+        for(uint64_t word : words_) {
+            if(word) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void mark(int tx, int ty) {
+        REQUIRE(tx >= 0 && tx < tileCountX_ && ty >= 0 && ty < tileCountY_);
+        size_t idx = (size_t)(ty * tileCountX_ + tx);
+        words_[idx / 64] |= (uint64_t)1 << (idx % 64);
+    }
+
+    // Mark the tile containing pixel (x, y); does nothing if the pixel is
+    // outside the image
+    void markPixel(int x, int y) {
+        if(x >= 0 && x < width_ && y >= 0 && y < height_) {
+            mark(x / TileSize, y / TileSize);
+        }
+    }
+
+    // Mark all the tiles intersecting given rectangle (the part of the
+    // rectangle outside the image is ignored)
+    void markRect(Rect rect) {
+        rect = Rect::intersection(rect, Rect(0, width_, 0, height_));
+        if(rect.isEmpty()) {
+            return;
+        }
+
+        int endTX = (rect.endX + TileSize - 1) / TileSize;
+        int endTY = (rect.endY + TileSize - 1) / TileSize;
+        for(int ty = rect.startY / TileSize; ty < endTY; ++ty) {
+            for(int tx = rect.startX / TileSize; tx < endTX; ++tx) {
+                mark(tx, ty);
+            }
+        }
+    }
+
+    void markAll() {
+        markRect(Rect(0, width_, 0, height_));
+    }
+
+    void clear() {
+        fill(words_.begin(), words_.end(), 0);
+    }
+
+    // Mark all the tiles marked in other. If the image sizes differ, all the
+    // tiles are marked.
+    void merge(const TileMap& other) {
+        if(other.width_ != width_ || other.height_ != height_) {
+            markAll();
+            return;
+        }
+        for(size_t i = 0; i < words_.size(); ++i) {
+            words_[i] |= other.words_[i];
+        }
+    }
+
+    // Returns disjoint rectangles (clipped to the image) that together cover
+    // exactly the marked tiles. Horizontal runs of marked tiles form the
+    // rectangles, and runs spanning the same columns in consecutive tile rows
+    // are merged.
+    vector<Rect> toRects() const {
+        vector<Rect> rects;
+
+        // Indices of the rectangles extending to the previous tile row in the
+        // order of increasing startX
+        vector<size_t> open;
+        vector<size_t> nextOpen;
+
+        for(int ty = 0; ty < tileCountY_; ++ty) {
+            nextOpen.clear();
+            size_t openPos = 0;
+
+            int tx = 0;
+            while(tx < tileCountX_) {
+                if(!isMarked(tx, ty)) {
+                    ++tx;
+                    continue;
+                }
+                int startTX = tx;
+                while(tx < tileCountX_ && isMarked(tx, ty)) {
+                    ++tx;
+                }
+
+                int startX = startTX * TileSize;
+                int endX = min(tx * TileSize, width_);
+                int endY = min((ty + 1) * TileSize, height_);
+
+                while(
+                    openPos < open.size() &&
+                    rects[open[openPos]].startX < startX
+                ) {
+                    ++openPos;
+                }
+                if(
+                    openPos < open.size() &&
+                    rects[open[openPos]].startX == startX &&
+                    rects[open[openPos]].endX == endX
+                ) {
+                    rects[open[openPos]].endY = endY;
+                    nextOpen.push_back(open[openPos]);
+                    ++openPos;
+                } else {
+                    rects.emplace_back(startX, endX, ty * TileSize, endY);
+                    nextOpen.push_back(rects.size() - 1);
+                }
+            }
+
+            open.swap(nextOpen);
+        }
+
+        return rects;
+    }
+
+private:
+    int width_;
+    int height_;
+    int tileCountX_;
+    int tileCountY_;
+
+    vector<uint64_t> words_;
+};
+
+}
@@ -44,6 +44,13 @@ struct VicePlugin::APIFuncs {
 
     FOREACH_VICE_API_FUNC
 #undef FOREACH_VICE_API_FUNC_ITEM
+
+    // Only loaded for API versions 1000001, 1000002, 1000003 and 1000004,
+    // respectively.
+    decltype(&vicePluginAPI_startWithDamageCallbacks) startWithDamageCallbacks;
+    decltype(&vicePluginAPI_startWithFrameCallbacks) startWithFrameCallbacks;
+    decltype(&vicePluginAPI_startWithDemandCallbacks) startWithDemandCallbacks;
+    decltype(&vicePluginAPI_startWithStatsCallbacks) startWithStatsCallbacks;
 };
 
 namespace {
@@ -56,6 +63,29 @@ char* createMallocString(string val) {
     return ret;
 }
 
+// Converts the dirty rectangles of a width x height window image to the API
+// format, clipping them to the image.
+vector<VicePluginAPI_Rect> toAPIRects(
+    const vector<Rect>& rects,
+    size_t width,
+    size_t height
+) {
+    vector<VicePluginAPI_Rect> ret;
+    ret.reserve(rects.size());
+    for(Rect rect : rects) {
+        rect = Rect::intersection(rect, Rect(0, (int)width, 0, (int)height));
+        if(!rect.isEmpty()) {
+            VicePluginAPI_Rect apiRect;
+            apiRect.x = (size_t)rect.startX;
+            apiRect.y = (size_t)rect.startY;
+            apiRect.width = (size_t)(rect.endX - rect.startX);
+            apiRect.height = (size_t)(rect.endY - rect.startY);
+            ret.push_back(apiRect);
+        }
+    }
+    return ret;
+}
+
 #define API_CALLBACK_HANDLE_EXCEPTIONS_START try {
 #define API_CALLBACK_HANDLE_EXCEPTIONS_END \
     } catch(const exception& e) { \
@@ -108,6 +138,26 @@ API_CALLBACK_HANDLE_EXCEPTIONS_START
 API_CALLBACK_HANDLE_EXCEPTIONS_END
 }
 
+// Loads the start function required by an extended API version; returns
+// nullptr (with a warning) if the plugin does not provide it.
+void* loadStartSymbol(
+    void* lib,
+    const string& filename,
+    uint64_t apiVersion,
+    const char* name
+) {
+    void* sym = dlsym(lib, name);
+    if(sym == nullptr) {
+        const char* err = dlerror();
+        WARNING_LOG(
+            "Vice plugin ", filename, " claims to support API version ",
+            apiVersion, " but loading symbol '", name, "' failed (",
+            err != nullptr ? err : "Unknown error", "), ignoring the version"
+        );
+    }
+    return sym;
+}
+
 void destructorCallback(void* filenamePtr) {
 API_CALLBACK_HANDLE_EXCEPTIONS_START
 
@@ -152,7 +202,58 @@ shared_ptr<VicePlugin> VicePlugin::load(string filename) {
     FOREACH_VICE_API_FUNC
 #undef FOREACH_VICE_API_FUNC_ITEM
 
+    // Prefer the newest API version supported by the plugin. Versions 1000001
+    // (damage information for the window image fetches), 1000002 (window
+    // images retained by the plugin without copying), 1000003 (frame demand
+    // reported by the plugin) and 1000004 (window resource usage queried by the
+    // plugin) are extensions of version 1000000 with their own start
+    // functions.
     uint64_t apiVersion = 1000000;
+    apiFuncs->startWithDamageCallbacks = nullptr;
+    apiFuncs->startWithFrameCallbacks = nullptr;
+    apiFuncs->startWithDemandCallbacks = nullptr;
+    apiFuncs->startWithStatsCallbacks = nullptr;
+
+    if(apiFuncs->isAPIVersionSupported(1000004)) {
+        sym = loadStartSymbol(
+            lib, filename, 1000004, "vicePluginAPI_startWithStatsCallbacks"
+        );
+        if(sym != nullptr) {
+            apiFuncs->startWithStatsCallbacks =
+                (decltype(apiFuncs->startWithStatsCallbacks))sym;
+            apiVersion = 1000004;
+        }
+    }
+    if(apiVersion == 1000000 && apiFuncs->isAPIVersionSupported(1000003)) {
+        sym = loadStartSymbol(
+            lib, filename, 1000003, "vicePluginAPI_startWithDemandCallbacks"
+        );
+        if(sym != nullptr) {
+            apiFuncs->startWithDemandCallbacks =
+                (decltype(apiFuncs->startWithDemandCallbacks))sym;
+            apiVersion = 1000003;
+        }
+    }
+    if(apiVersion == 1000000 && apiFuncs->isAPIVersionSupported(1000002)) {
+        sym = loadStartSymbol(
+            lib, filename, 1000002, "vicePluginAPI_startWithFrameCallbacks"
+        );
+        if(sym != nullptr) {
+            apiFuncs->startWithFrameCallbacks =
+                (decltype(apiFuncs->startWithFrameCallbacks))sym;
+            apiVersion = 1000002;
+        }
+    }
+    if(apiVersion == 1000000 && apiFuncs->isAPIVersionSupported(1000001)) {
+        sym = loadStartSymbol(
+            lib, filename, 1000001, "vicePluginAPI_startWithDamageCallbacks"
+        );
+        if(sym != nullptr) {
+            apiFuncs->startWithDamageCallbacks =
+                (decltype(apiFuncs->startWithDamageCallbacks))sym;
+            apiVersion = 1000001;
+        }
+    }
 
     if(!apiFuncs->isAPIVersionSupported(apiVersion)) {
         ERROR_LOG(
@@ -376,6 +477,7 @@ ViceContext::ViceContext(CKey, CKey,
     shutdownCompleteFlag_.store(false);
 
     nextWindowHandle_ = 1;
+    nextFrameHandle_ = 1;
 
     uploadTempDir_ = TempDir::create();
     nextUploadIdx_ = (uint64_t)1;
@@ -471,11 +573,15 @@ void ViceContext::start(shared_ptr<ViceContextEventHandler> eventHandler) {
         bool putImageCalled = false;
         self->eventHandler_->onViceContextFetchWindowImage(
             window,
+            false,
             [&](
                 const uint8_t* image,
                 size_t width,
                 size_t height,
-                size_t pitch
+                size_t pitch,
+                uint64_t sequenceNumber,
+                const vector<Rect>& dirtyRects,
+                shared_ptr<void> frameOwner
             ) {
                 REQUIRE(!putImageCalled);
                 putImageCalled = true;
@@ -488,6 +594,179 @@ void ViceContext::start(shared_ptr<ViceContextEventHandler> eventHandler) {
         REQUIRE(putImageCalled);
     });
 
+    VicePluginAPI_DamageCallbacks damageCallbacks;
+    memset(&damageCallbacks, 0, sizeof(VicePluginAPI_DamageCallbacks));
+
+    damageCallbacks.fetchWindowImageWithDamage = CTX_CALLBACK(void, (
+        uint64_t window,
+        void (*putImageFunc)(
+            void* putImageFuncData,
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const VicePluginAPI_Rect* dirtyRects,
+            size_t dirtyRectCount
+        ),
+        void* putImageFuncData
+    ), {
+        REQUIRE(self->openWindows_.count(window));
+
+        bool putImageCalled = false;
+        self->eventHandler_->onViceContextFetchWindowImage(
+            window,
+            false,
+            [&](
+                const uint8_t* image,
+                size_t width,
+                size_t height,
+                size_t pitch,
+                uint64_t sequenceNumber,
+                const vector<Rect>& dirtyRects,
+                shared_ptr<void> frameOwner
+            ) {
+                REQUIRE(!putImageCalled);
+                putImageCalled = true;
+
+                REQUIRE(width);
+                REQUIRE(height);
+
+                vector<VicePluginAPI_Rect> apiDirtyRects =
+                    toAPIRects(dirtyRects, width, height);
+
+                putImageFunc(
+                    putImageFuncData,
+                    image,
+                    width,
+                    height,
+                    pitch,
+                    sequenceNumber,
+                    apiDirtyRects.data(),
+                    apiDirtyRects.size()
+                );
+            }
+        );
+        REQUIRE(putImageCalled);
+    });
+
+    VicePluginAPI_FrameCallbacks frameCallbacks;
+    memset(&frameCallbacks, 0, sizeof(VicePluginAPI_FrameCallbacks));
+
+    frameCallbacks.fetchWindowFrame = CTX_CALLBACK(void, (
+        uint64_t window,
+        void (*putFrameFunc)(
+            void* putFrameFuncData,
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const VicePluginAPI_Rect* dirtyRects,
+            size_t dirtyRectCount,
+            uint64_t frame
+        ),
+        void* putFrameFuncData
+    ), {
+        REQUIRE(self->openWindows_.count(window));
+
+        bool putImageCalled = false;
+        self->eventHandler_->onViceContextFetchWindowImage(
+            window,
+            true,
+            [&](
+                const uint8_t* image,
+                size_t width,
+                size_t height,
+                size_t pitch,
+                uint64_t sequenceNumber,
+                const vector<Rect>& dirtyRects,
+                shared_ptr<void> frameOwner
+            ) {
+                REQUIRE(!putImageCalled);
+                putImageCalled = true;
+
+                REQUIRE(width);
+                REQUIRE(height);
+                REQUIRE(frameOwner);
+
+                uint64_t frame = self->nextFrameHandle_++;
+                REQUIRE(self->sharedFrames_.emplace(frame, frameOwner).second);
+
+                vector<VicePluginAPI_Rect> apiDirtyRects =
+                    toAPIRects(dirtyRects, width, height);
+
+                putFrameFunc(
+                    putFrameFuncData,
+                    image,
+                    width,
+                    height,
+                    pitch,
+                    sequenceNumber,
+                    apiDirtyRects.data(),
+                    apiDirtyRects.size(),
+                    frame
+                );
+            }
+        );
+        REQUIRE(putImageCalled);
+    });
+
+    // The frames may be released from any thread; the frame owners are
+    // released in the UI thread.
+    frameCallbacks.releaseFrame = CTX_CALLBACK_WITHOUT_PUMPEVENTS_CHECK(void, (
+        uint64_t frame
+    ), {
+        postTask(self, &ViceContext::releaseFrame_, frame);
+    });
+
+    VicePluginAPI_DemandCallbacks demandCallbacks;
+    memset(&demandCallbacks, 0, sizeof(VicePluginAPI_DemandCallbacks));
+
+    demandCallbacks.setWindowFrameDemand = CTX_CALLBACK(void, (
+        uint64_t window,
+        uint32_t framesPerSecond
+    ), {
+        REQUIRE(self->openWindows_.count(window));
+
+        self->eventHandler_->onViceContextWindowFrameDemand(
+            window,
+            (int)min(framesPerSecond, (uint32_t)1000)
+        );
+    });
+
+    VicePluginAPI_StatsCallbacks statsCallbacks;
+    memset(&statsCallbacks, 0, sizeof(VicePluginAPI_StatsCallbacks));
+
+    statsCallbacks.queryWindowStats = CTX_CALLBACK(void, (
+        uint64_t window,
+        VicePluginAPI_WindowStats* stats
+    ), {
+        REQUIRE(self->openWindows_.count(window));
+        REQUIRE(stats != nullptr);
+        REQUIRE(stats->structSize >= sizeof(size_t));
+
+        ViceWindowStats windowStats =
+            self->eventHandler_->onViceContextQueryWindowStats(window);
+
+        // The plugin may have been built against a revision of the API header
+        // with a smaller struct, so only the part it knows is written.
+        VicePluginAPI_WindowStats ret;
+        memset(&ret, 0, sizeof(VicePluginAPI_WindowStats));
+        ret.structSize =
+            min(stats->structSize, sizeof(VicePluginAPI_WindowStats));
+        ret.contentCPUTimeMs = (uint64_t)windowStats.contentCPUTime.count();
+        ret.contentMemoryBytes = windowStats.contentMemory;
+        ret.viewRenderTimeMs = (uint64_t)windowStats.viewRenderTime.count();
+        ret.blockedRequestCount = windowStats.blockedRequests;
+        ret.cacheHitCount = windowStats.cacheHits;
+        ret.cacheMissCount = windowStats.cacheMisses;
+        ret.cacheBytesSaved = windowStats.cacheBytesSaved;
+        ret.rendererNice = (int32_t)windowStats.rendererNice;
+        ret.rendererIOPriority = (int32_t)windowStats.rendererIOPriority;
+        memcpy(stats, &ret, ret.structSize);
+    });
+
 #define FORWARD_INPUT_EVENT(name, Name, args, call) \
     callbacks.name = CTX_CALLBACK(void, args, { \
         REQUIRE(self->openWindows_.count(window)); \
@@ -592,11 +871,51 @@ void ViceContext::start(shared_ptr<ViceContextEventHandler> eventHandler) {
         self->eventHandler_->onViceContextCancelFileUpload(window);
     });
 
-    plugin_->apiFuncs_->start(
-        ctx_,
-        callbacks,
-        callbackData
-    );
+    if(plugin_->apiVersion_ == 1000004) {
+        REQUIRE(plugin_->apiFuncs_->startWithStatsCallbacks != nullptr);
+        plugin_->apiFuncs_->startWithStatsCallbacks(
+            ctx_,
+            callbacks,
+            damageCallbacks,
+            frameCallbacks,
+            demandCallbacks,
+            statsCallbacks,
+            callbackData
+        );
+    } else if(plugin_->apiVersion_ == 1000003) {
+        REQUIRE(plugin_->apiFuncs_->startWithDemandCallbacks != nullptr);
+        plugin_->apiFuncs_->startWithDemandCallbacks(
+            ctx_,
+            callbacks,
+            damageCallbacks,
+            frameCallbacks,
+            demandCallbacks,
+            callbackData
+        );
+    } else if(plugin_->apiVersion_ == 1000002) {
+        REQUIRE(plugin_->apiFuncs_->startWithFrameCallbacks != nullptr);
+        plugin_->apiFuncs_->startWithFrameCallbacks(
+            ctx_,
+            callbacks,
+            damageCallbacks,
+            frameCallbacks,
+            callbackData
+        );
+    } else if(plugin_->apiVersion_ == 1000001) {
+        REQUIRE(plugin_->apiFuncs_->startWithDamageCallbacks != nullptr);
+        plugin_->apiFuncs_->startWithDamageCallbacks(
+            ctx_,
+            callbacks,
+            damageCallbacks,
+            callbackData
+        );
+    } else {
+        plugin_->apiFuncs_->start(
+            ctx_,
+            callbacks,
+            callbackData
+        );
+    }
 }
 
 void ViceContext::shutdown() {
@@ -838,6 +1157,14 @@ void ViceContext::pumpEvents_() {
     threadActivePumpEventsContext = nullptr;
 }
 
+void ViceContext::releaseFrame_(uint64_t frame) {
+    REQUIRE_UI_THREAD();
+
+    if(!sharedFrames_.erase(frame)) {
+        PANIC("Vice plugin released unknown frame ", frame);
+    }
+}
+
 void ViceContext::shutdownComplete_() {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Running);
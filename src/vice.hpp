@@ -1,5 +1,6 @@
 #pragma once
 
+#include "rect.hpp"
 #include "timeout.hpp"
 
 typedef struct VicePluginAPI_Context VicePluginAPI_Context;
@@ -71,6 +72,21 @@ private:
     function<void()> srcCleanup_;
 };
 
+// Resource usage of a window (see VicePluginAPI_WindowStats).
+struct ViceWindowStats {
+    milliseconds contentCPUTime;
+    uint64_t contentMemory;
+    milliseconds viewRenderTime;
+    uint64_t blockedRequests;
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+    uint64_t cacheBytesSaved;
+
+    // rendererIOPriority is -1 if the priorities are not known.
+    int rendererNice;
+    int rendererIOPriority;
+};
+
 // Implementations of these event handlers may NOT call functions of ViceContext
 // directly.
 class ViceContextEventHandler {
@@ -83,9 +99,34 @@ public:
     virtual void onViceContextResizeWindow(
         uint64_t window, int width, int height
     ) = 0;
+    // Estimate of the maximum rate at which the plugin consumes the images of
+    // the window; 0 means that the window currently has no consumer. Only
+    // called by plugins supporting API version 1000003.
+    virtual void onViceContextWindowFrameDemand(
+        uint64_t window, int framesPerSecond
+    ) = 0;
+    // Only called by plugins supporting API version 1000004.
+    virtual ViceWindowStats onViceContextQueryWindowStats(uint64_t window) = 0;
+    // The sequence number must be incremented whenever the image changes, and
+    // dirtyRects must cover all the pixels that may have changed since the
+    // previous fetch of the window (the whole image if the size has changed).
+    // Depending on the API version of the plugin, the sequence number and the
+    // dirty rectangles may be ignored. If snapshot is true, frameOwner must be
+    // nonempty and the image may not be modified as long as frameOwner is
+    // alive; otherwise, frameOwner is ignored and the image needs to stay
+    // valid only until putImage returns.
     virtual void onViceContextFetchWindowImage(
         uint64_t window,
-        function<void(const uint8_t*, size_t, size_t, size_t)> putImage
+        bool snapshot,
+        function<void(
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const vector<Rect>& dirtyRects,
+            shared_ptr<void> frameOwner
+        )> putImage
     ) = 0;
 
     virtual void onViceContextMouseDown(
@@ -178,6 +219,7 @@ private:
     static shared_ptr<ViceContext> getContext_(void* callbackData);
 
     void pumpEvents_();
+    void releaseFrame_(uint64_t frame);
     void shutdownComplete_();
 
     shared_ptr<VicePlugin> plugin_;
@@ -204,6 +246,10 @@ private:
     set<uint64_t> openWindows_;
     set<uint64_t> uploadModeWindows_;
 
+    // Frames retained by the plugin (API version 1000002).
+    uint64_t nextFrameHandle_;
+    map<uint64_t, shared_ptr<void>> sharedFrames_;
+
     shared_ptr<TempDir> uploadTempDir_;
     uint64_t nextUploadIdx_;
 };
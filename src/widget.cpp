@@ -9,6 +9,7 @@ Widget::Widget(weak_ptr<WidgetParent> parent) {
 
     parent_ = parent;
     viewDirty_ = false;
+    childViewDirty_ = false;
 
     mouseOver_ = false;
     focused_ = false;
@@ -33,16 +34,12 @@ ImageSlice Widget::getViewport() {
     return viewport_;
 }
 
-void Widget::render() {
+vector<Rect> Widget::render() {
     REQUIRE_UI_THREAD();
 
-    viewDirty_ = false;
-    widgetRender_();
-
-    for(shared_ptr<Widget> child : widgetListChildren_()) {
-        REQUIRE(child);
-        child->render();
-    }
+    vector<Rect> damage;
+    render_(false, damage);
+    return damage;
 }
 
 int Widget::cursor() {
@@ -216,9 +213,27 @@ void Widget::sendLoseFocusEvent() {
     }
 }
 
+void Widget::sendAnimationsResumedEvent() {
+    REQUIRE_UI_THREAD();
+
+    widgetAnimationsResumedEvent_();
+    for(shared_ptr<Widget> child : widgetListChildren_()) {
+        REQUIRE(child);
+        child->sendAnimationsResumedEvent();
+    }
+}
+
 void Widget::onWidgetViewDirty() {
     REQUIRE_UI_THREAD();
-    signalViewDirty_();
+
+    if(!viewDirty_ && !childViewDirty_) {
+        childViewDirty_ = true;
+        if(shared_ptr<WidgetParent> parent = parent_.lock()) {
+            parent->onWidgetViewDirty();
+        }
+    } else {
+        childViewDirty_ = true;
+    }
 }
 
 void Widget::onWidgetCursorChanged() {
@@ -263,9 +278,12 @@ void Widget::signalViewDirty_() {
     REQUIRE_UI_THREAD();
 
     if(!viewDirty_) {
+        bool parentSignaled = childViewDirty_;
         viewDirty_ = true;
-        if(shared_ptr<WidgetParent> parent = parent_.lock()) {
-            parent->onWidgetViewDirty();
+        if(!parentSignaled) {
+            if(shared_ptr<WidgetParent> parent = parent_.lock()) {
+                parent->onWidgetViewDirty();
+            }
         }
     }
 }
@@ -278,6 +296,21 @@ void Widget::setCursor_(int newCursor) {
     updateCursor_();
 }
 
+AnimationFrameStatus Widget::onWidgetRequestAnimationFrame() {
+    REQUIRE_UI_THREAD();
+    return requestAnimationFrame_();
+}
+
+AnimationFrameStatus Widget::requestAnimationFrame_() {
+    REQUIRE_UI_THREAD();
+
+    if(shared_ptr<WidgetParent> parent = parent_.lock()) {
+        return parent->onWidgetRequestAnimationFrame();
+    } else {
+        return AnimationFrameStatus::Allow;
+    }
+}
+
 bool Widget::isMouseOver_() {
     REQUIRE_UI_THREAD();
     return mouseOver_;
@@ -293,6 +326,40 @@ pair<int, int> Widget::getLastMousePos_() {
     return {lastMouseX_, lastMouseY_};
 }
 
+void Widget::render_(bool force, vector<Rect>& damage) {
+    if(force || viewDirty_) {
+        // The widget may draw over its children, so the whole subtree is
+        // rendered; the viewports of the children are contained in the
+        // viewport of this widget, so it alone is reported as damage.
+        viewDirty_ = false;
+        childViewDirty_ = false;
+        widgetRender_();
+
+        if(!force) {
+            Rect rect(
+                viewport_.globalX(),
+                viewport_.globalX() + viewport_.width(),
+                viewport_.globalY(),
+                viewport_.globalY() + viewport_.height()
+            );
+            if(!rect.isEmpty()) {
+                damage.push_back(rect);
+            }
+        }
+
+        for(shared_ptr<Widget> child : widgetListChildren_()) {
+            REQUIRE(child);
+            child->render_(true, damage);
+        }
+    } else if(childViewDirty_) {
+        childViewDirty_ = false;
+        for(shared_ptr<Widget> child : widgetListChildren_()) {
+            REQUIRE(child);
+            child->render_(false, damage);
+        }
+    }
+}
+
 void Widget::updateFocus_(int x, int y) {
     shared_ptr<Widget> newFocusChild = childByPoint_(x, y);
     if(newFocusChild != focusChild_ || !focused_) {
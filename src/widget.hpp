@@ -16,6 +16,19 @@ enum class GlobalHotkey {
     Refresh
 };
 
+// Answer to an animation frame request of a widget (see
+// WidgetParent::onWidgetRequestAnimationFrame).
+enum class AnimationFrameStatus {
+    // The widget may advance its animation and signal its view dirty now.
+    Allow,
+    // The frame budget is exhausted; the widget should skip this tick and ask
+    // again on its next tick.
+    Skip,
+    // Nobody is viewing the widgets; the widget should stop its animation
+    // timer until widgetAnimationsResumedEvent_ is called.
+    Pause
+};
+
 class Widget;
 
 class WidgetParent {
@@ -27,6 +40,13 @@ public:
     virtual void onWidgetCursorChanged() = 0;
     virtual void onWidgetTakeFocus(Widget* child) {}
     virtual void onGlobalHotkeyPressed(GlobalHotkey key) = 0;
+
+    // Called by animating widgets (such as the loading bar and the blinking
+    // caret) before advancing their animations, so that the animations do not
+    // produce more frames than are consumed.
+    virtual AnimationFrameStatus onWidgetRequestAnimationFrame() {
+        return AnimationFrameStatus::Allow;
+    }
 };
 
 class Widget : public WidgetParent {
@@ -36,7 +56,10 @@ public:
     void setViewport(ImageSlice viewport);
     ImageSlice getViewport();
 
-    void render();
+    // Renders the widgets in the subtree whose views are dirty, along with
+    // their descendants, and returns the viewports of the rendered subtrees as
+    // rectangles in global coordinates
+    vector<Rect> render();
 
     int cursor();
 
@@ -59,11 +82,16 @@ public:
     void sendGainFocusEvent(int x, int y);
     void sendLoseFocusEvent();
 
+    // Notify the widget and its descendants that the animations paused due to
+    // AnimationFrameStatus::Pause may be continued.
+    void sendAnimationsResumedEvent();
+
     // WidgetParent: (forward events from possible children)
     virtual void onWidgetViewDirty() override;
     virtual void onWidgetCursorChanged() override;
     virtual void onWidgetTakeFocus(Widget* child) override;
     virtual void onGlobalHotkeyPressed(GlobalHotkey key) override;
+    virtual AnimationFrameStatus onWidgetRequestAnimationFrame() override;
 
 protected:
     // The widget should call this when its view has updated and the changes
@@ -74,6 +102,10 @@ protected:
     // not be immediately visible if mouse is not over this widget
     void setCursor_(int newCursor);
 
+    // The widget should call this on each tick of its animation timer and
+    // follow the returned status.
+    AnimationFrameStatus requestAnimationFrame_();
+
     // Functions to query widget status so that it does not always need its own
     // bookkeeping
     bool isMouseOver_();
@@ -94,7 +126,9 @@ protected:
     // allowed to render to the viewport outside this function; however, it
     // is possible that some other widget (such as the parent) is drawing to
     // the same viewport. The children of this widget (in the list returned by
-    // widgetListChildren_) are rendered after this call.
+    // widgetListChildren_) are rendered after this call. As the widget is only
+    // rendered when its own view or the view of its parent is dirty, this
+    // function should redraw everything the widget shows in its viewport.
     virtual void widgetRender_() {}
 
     // This function should list the child widgets of this widget; it is used
@@ -118,7 +152,13 @@ protected:
     virtual void widgetGainFocusEvent_(int x, int y) {}
     virtual void widgetLoseFocusEvent_() {}
 
+    // Called when the animations paused by AnimationFrameStatus::Pause may be
+    // continued.
+    virtual void widgetAnimationsResumedEvent_() {}
+
 private:
+    void render_(bool force, vector<Rect>& damage);
+
     void updateFocus_(int x, int y);
     void updateMouseOver_(int x, int y);
 
@@ -144,6 +184,9 @@ private:
     ImageSlice viewport_;
     bool viewDirty_;
 
+    // Set if the view of some descendant is dirty
+    bool childViewDirty_;
+
     shared_ptr<Widget> focusChild_;
     shared_ptr<Widget> mouseOverChild_;
 
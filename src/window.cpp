@@ -3,20 +3,93 @@
 #include "data_url.hpp"
 #include "globals.hpp"
 #include "key.hpp"
+#include "renderer_app.hpp"
+#include "request_filter.hpp"
 #include "root_widget.hpp"
 #include "timeout.hpp"
 #include "vice.hpp"
 
 #include "include/cef_client.h"
 
+#include <ctime>
+
 namespace browservice {
 
+namespace {
+
+// Maximum absolute delta of a single wheel event passed to the widgets; merged
+// wheel events with larger total deltas are split into multiple events.
+const int MaxWheelDelta = 180;
+
+RequestFilter::ResourceType requestFilterResourceType(
+    cef_resource_type_t type
+) {
+    typedef RequestFilter::ResourceType ResourceType;
+    switch(type) {
+        case RT_MAIN_FRAME: return ResourceType::Document;
+        case RT_SUB_FRAME: return ResourceType::Subdocument;
+        case RT_STYLESHEET: return ResourceType::Stylesheet;
+        case RT_SCRIPT:
+        case RT_WORKER:
+        case RT_SHARED_WORKER:
+        case RT_SERVICE_WORKER:
+            return ResourceType::Script;
+        case RT_IMAGE:
+        case RT_FAVICON:
+            return ResourceType::Image;
+        case RT_FONT_RESOURCE: return ResourceType::Font;
+        case RT_OBJECT:
+        case RT_PLUGIN_RESOURCE:
+            return ResourceType::Object;
+        case RT_MEDIA: return ResourceType::Media;
+        case RT_XHR: return ResourceType::XMLHttpRequest;
+        case RT_PING:
+        case RT_CSP_REPORT:
+            return ResourceType::Ping;
+        default: return ResourceType::Other;
+    }
+}
+
+// CEF does not tell whether a response was served from the HTTP cache, so we
+// compare the time the response was generated to the time the request was
+// started. The generation time is the Date header plus the Age header, as
+// shared caches such as CDNs add the time they have kept the response to the
+// Age header; thus only responses stored in the cache of the browser itself
+// are counted as hits. Revalidated cache entries get a new Date and are thus
+// counted as misses.
+bool isCacheHit(CefRefPtr<CefResponse> response, time_t requestTime) {
+    REQUIRE(response);
+
+    string dateStr = response->GetHeaderByName("Date").ToString();
+    tm dateTm;
+    memset(&dateTm, 0, sizeof(tm));
+    const char* end =
+        strptime(dateStr.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &dateTm);
+    if(end == nullptr || *end != '\0') {
+        return false;
+    }
+    time_t date = timegm(&dateTm);
+
+    optional<int64_t> age =
+        parseString<int64_t>(response->GetHeaderByName("Age").ToString());
+    if(age && *age > 0) {
+        date += (time_t)*age;
+    }
+
+    // Allow some clock skew between the server and the local host.
+    const time_t Slack = 60;
+    return date + Slack < requestTime;
+}
+
+}
+
 class Window::Client :
     public CefClient,
     public CefLifeSpanHandler,
     public CefLoadHandler,
     public CefDisplayHandler,
     public CefRequestHandler,
+    public CefResourceRequestHandler,
     public CefFindHandler,
     public CefKeyboardHandler,
     public CefDialogHandler
@@ -35,6 +108,8 @@ public:
 
         lastFindID_ = -1;
         certificateErrorPageSignKey_ = generateDataURLSignKey();
+
+        requestFilter_ = globals->requestFilter;
     }
 
     // CefClient:
@@ -65,6 +140,29 @@ public:
     virtual CefRefPtr<CefDialogHandler> GetDialogHandler() override {
         return this;
     }
+    virtual bool OnProcessMessageReceived(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefProcessId sourceProcess,
+        CefRefPtr<CefProcessMessage> message
+    ) override {
+        REQUIRE_UI_THREAD();
+        REQUIRE(browser);
+
+        if(message->GetName() != RendererPIDMessage) {
+            return false;
+        }
+
+        // The message may arrive after the browser has been closed.
+        if(
+            window_->state_ == Open &&
+            window_->browser_ &&
+            window_->browser_->IsSame(browser)
+        ) {
+            window_->rendererPID_ = message->GetArgumentList()->GetInt(0);
+        }
+        return true;
+    }
 
     // CefLifeSpanHandler:
     virtual bool OnBeforePopup(
@@ -113,7 +211,7 @@ public:
                 );
 
                 shared_ptr<Window> newWindow = Window::create(Window::CKey());
-                newWindow->init_(window_->eventHandler_, newHandle);
+                newWindow->init_(window_->eventHandler_, newHandle, false);
 
                 windowInfo.SetAsWindowless(kNullWindowHandle);
                 browserSettings.background_color = (cef_color_t)-1;
@@ -149,7 +247,14 @@ public:
         window_->browser_ = browser;
         window_->rootWidget_->browserArea()->setBrowser(browser);
 
+        if(window_->hibernationState_ == Waking) {
+            INFO_LOG("Window ", window_->handle_, " woke up from hibernation");
+            window_->hibernationState_ = Awake;
+        }
+        REQUIRE(window_->hibernationState_ == Awake);
+
         window_->updateSecurityStatus_();
+        window_->applyFrameDemand_();
 
         if(window_->state_ == Closed) {
             // Browser close deferred from close().
@@ -171,6 +276,24 @@ public:
     virtual void OnBeforeClose(CefRefPtr<CefBrowser> browser) override {
         BROWSER_EVENT_HANDLER_CHECKS();
 
+        if(
+            window_->state_ == Open &&
+            window_->hibernationState_ == ClosingBrowser
+        ) {
+            INFO_LOG(
+                "CEF browser of window ", window_->handle_,
+                " closed for hibernation"
+            );
+            window_->browser_ = nullptr;
+            window_->rendererPID_ = 0;
+            window_->rootWidget_->browserArea()->setBrowser(nullptr);
+            window_->hibernationState_ = Hibernated;
+            if(window_->wakeRequested_) {
+                window_->wake_();
+            }
+            return;
+        }
+
         if(window_->state_ == Open) {
             // The window closed on its own (not triggered by close()).
             INFO_LOG(
@@ -183,19 +306,7 @@ public:
             window_->eventHandler_->onWindowClose(window_->handle_);
         }
 
-        REQUIRE(window_->state_ == Closed);
-        REQUIRE(window_->eventHandler_);
-
-        INFO_LOG(
-            "Cleanup of CEF browser for window ", window_->handle_, " complete"
-        );
-
-        window_->state_ = CleanupComplete;
-        window_->browser_ = nullptr;
-        window_->retainedUploads_.clear();
-        window_->rootWidget_->browserArea()->setBrowser(nullptr);
-        window_->eventHandler_->onWindowCleanupComplete(window_->handle_);
-        window_->eventHandler_.reset();
+        window_->cleanupComplete_();
     }
 
     // CefLoadHandler:
@@ -232,6 +343,22 @@ public:
         if(window_->state_ == Open) {
             window_->rootWidget_->controlBar()->setLoading(isLoading);
             window_->updateSecurityStatus_();
+
+            if(
+                !isLoading &&
+                window_->hibernationState_ == Awake &&
+                window_->wakeScroll_
+            ) {
+                // Restore the scroll position saved before hibernation.
+                pair<int, int> scroll = *window_->wakeScroll_;
+                window_->wakeScroll_.reset();
+                browser->GetMainFrame()->ExecuteJavaScript(
+                    "window.scrollTo(" + toString(scroll.first) + "," +
+                    toString(scroll.second) + ");",
+                    "",
+                    0
+                );
+            }
         }
     }
 
@@ -305,6 +432,39 @@ public:
         return true;
     }
 
+    virtual bool OnConsoleMessage(
+        CefRefPtr<CefBrowser> browser,
+        cef_log_severity_t level,
+        const CefString& message,
+        const CefString& source,
+        int line
+    ) override {
+        BROWSER_EVENT_HANDLER_CHECKS();
+
+        // Catch the scroll position reported by the script started in
+        // Window::hibernate.
+        const string& tag = window_->scrollMessageTag_;
+        string msg = message;
+        if(
+            window_->state_ != Open ||
+            window_->hibernationState_ != SavingScroll ||
+            msg.compare(0, tag.size(), tag) != 0
+        ) {
+            return false;
+        }
+
+        size_t sep = msg.find(',', tag.size());
+        if(sep != string::npos) {
+            optional<int> x =
+                parseString<int>(msg.substr(tag.size(), sep - tag.size()));
+            optional<int> y = parseString<int>(msg.substr(sep + 1));
+            if(x && y) {
+                window_->wakeScroll_ = make_pair(*x, *y);
+            }
+        }
+        return true;
+    }
+
     // CefRequestHandler:
     virtual CefRefPtr<CefResourceRequestHandler> GetResourceRequestHandler(
         CefRefPtr<CefBrowser> browser,
@@ -318,7 +478,8 @@ public:
         CEF_REQUIRE_IO_THREAD();
 
         postTask(window_, &Window::updateSecurityStatus_);
-        return nullptr;
+
+        return this;
     }
 
     virtual bool OnCertificateError(
@@ -334,6 +495,61 @@ public:
         return false;
     }
 
+    // CefResourceRequestHandler:
+    virtual cef_return_value_t OnBeforeResourceLoad(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefRefPtr<CefRequest> request,
+        CefRefPtr<CefRequestCallback> callback
+    ) override {
+        CEF_REQUIRE_IO_THREAD();
+        REQUIRE(request);
+
+        if(requestFilter_ && shouldBlock_(browser, frame, request)) {
+            postTask(window_, &Window::onRequestBlocked_);
+            return RV_CANCEL;
+        }
+
+        string url = request->GetURL().ToString();
+        if(
+            request->GetMethod().ToString() == "GET" &&
+            (url.compare(0, 7, "http://") == 0 ||
+            url.compare(0, 8, "https://") == 0)
+        ) {
+            requestStartTimes_[request->GetIdentifier()] = time(nullptr);
+        }
+        return RV_CONTINUE;
+    }
+
+    virtual void OnResourceLoadComplete(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefRefPtr<CefRequest> request,
+        CefRefPtr<CefResponse> response,
+        URLRequestStatus status,
+        int64 receivedContentLength
+    ) override {
+        CEF_REQUIRE_IO_THREAD();
+        REQUIRE(request);
+
+        auto it = requestStartTimes_.find(request->GetIdentifier());
+        if(it == requestStartTimes_.end()) {
+            return;
+        }
+        time_t startTime = it->second;
+        requestStartTimes_.erase(it);
+
+        if(status != UR_SUCCESS || !response) {
+            return;
+        }
+        postTask(
+            window_,
+            &Window::onResourceLoaded_,
+            isCacheHit(response, startTime),
+            (uint64_t)max((int64)0, receivedContentLength)
+        );
+    }
+
     // CefFindHandler:
     virtual void OnFindResult(
         CefRefPtr<CefBrowser> browser,
@@ -426,6 +642,36 @@ public:
     }
 
 private:
+    bool shouldBlock_(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefRefPtr<CefRequest> request
+    ) {
+        RequestFilter::Request filterRequest;
+        filterRequest.url = request->GetURL().ToString();
+        filterRequest.type =
+            requestFilterResourceType(request->GetResourceType());
+
+        // The domain options of the filters refer to the document making the
+        // request; for frame navigations, that is the parent document.
+        CefRefPtr<CefFrame> documentFrame = frame;
+        if(
+            filterRequest.type == RequestFilter::ResourceType::Subdocument &&
+            documentFrame &&
+            documentFrame->GetParent()
+        ) {
+            documentFrame = documentFrame->GetParent();
+        }
+        if(!documentFrame && browser) {
+            documentFrame = browser->GetMainFrame();
+        }
+        if(documentFrame) {
+            filterRequest.documentURL = documentFrame->GetURL().ToString();
+        }
+
+        return requestFilter_->shouldBlock(filterRequest);
+    }
+
     shared_ptr<Window> window_;
     CefRefPtr<CefRenderHandler> renderHandler_;
     CefRefPtr<CefDownloadHandler> downloadHandler_;
@@ -434,21 +680,30 @@ private:
     optional<string> lastCertificateErrorURL_;
     string certificateErrorPageSignKey_;
 
+    // Immutable and thus safe to use in the IO thread.
+    shared_ptr<RequestFilter> requestFilter_;
+
+    // Wall clock start times of the HTTP GET requests in progress by
+    // identifier, used for the cache statistics (accessed only in the IO
+    // thread).
+    map<uint64_t, time_t> requestStartTimes_;
+
     IMPLEMENT_REFCOUNTING(Client);
 };
 
 shared_ptr<Window> Window::tryCreate(
     shared_ptr<WindowEventHandler> eventHandler,
-    uint64_t handle
+    uint64_t handle,
+    bool pooled
 ) {
     REQUIRE_UI_THREAD();
     REQUIRE(eventHandler);
     REQUIRE(handle);
 
-    INFO_LOG("Creating window ", handle);
+    INFO_LOG("Creating ", pooled ? "pooled " : "", "window ", handle);
 
     shared_ptr<Window> window = Window::create(CKey());
-    window->init_(eventHandler, handle);
+    window->init_(eventHandler, handle, pooled);
 
     CefRefPtr<CefClient> client = new Client(window);
 
@@ -494,8 +749,14 @@ void Window::close() {
     afterClose_();
 
     // If the browser has been created, we start closing it; otherwise, we defer
-    // closing it to Client::OnAfterCreated.
-    if(browser_) {
+    // closing it to Client::OnAfterCreated. If the browser is already closing
+    // for hibernation, Client::OnBeforeClose completes the cleanup; if the
+    // window has no browser due to hibernation, the cleanup is completed
+    // immediately (or by createBrowserForWake_ if it has already been
+    // scheduled).
+    if(hibernationState_ == Hibernated) {
+        postTask(shared_from_this(), &Window::cleanupComplete_);
+    } else if(browser_ && hibernationState_ != ClosingBrowser) {
         CefRefPtr<CefBrowser> browser = browser_;
         postTask([browser] {
             browser->GetHost()->CloseBrowser(true);
@@ -503,6 +764,37 @@ void Window::close() {
     }
 }
 
+void Window::claim(
+    shared_ptr<WindowEventHandler> eventHandler,
+    uint64_t handle
+) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+    REQUIRE(pooled_);
+    REQUIRE(eventHandler);
+    REQUIRE(handle);
+
+    pooled_ = false;
+    eventHandler_ = eventHandler;
+    handle_ = handle;
+    lastActivityTime_ = steady_clock::now();
+
+    // Back to the CEF defaults until the new consumer reports its demand.
+    bool resumed = frameDemand_ == 0;
+    frameDemand_ = -1;
+    applyFrameDemand_();
+    if(resumed) {
+        rootWidget_->sendAnimationsResumedEvent();
+    }
+
+    queryUIFeatures_();
+
+    // The view has not been fetched while pooled; signal the change to the new
+    // event handler once it has registered the window.
+    imageChanged_ = false;
+    postTask(shared_from_this(), &Window::signalImageChanged_);
+}
+
 void Window::resize(int width, int height) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
@@ -510,9 +802,29 @@ void Window::resize(int width, int height) {
     width = max(min(width, 4096), 64);
     height = max(min(height, 4096), 64);
 
+    // Rounding down keeps the edges of the page (such as the scroll bars)
+    // visible; the client shows the rest of its window empty.
+    int step = globals->config->resizeStep;
+    width = max(width - width % step, 64);
+    height = max(height - height % step, 64);
+
+    if(resizeTimeout_->isActive()) {
+        if(width != pendingWidth_ || height != pendingHeight_) {
+            pendingWidth_ = width;
+            pendingHeight_ = height;
+            resizeTimeout_->clear(false);
+            startResizeTimeout_();
+        }
+        return;
+    }
+
     if(rootViewport_.width() != width || rootViewport_.height() != height) {
-        rootViewport_ = ImageSlice::createImage(width, height);
-        rootWidget_->setViewport(rootViewport_);
+        applyResize_(width, height);
+        if(globals->config->resizeDelay > 0) {
+            pendingWidth_ = width;
+            pendingHeight_ = height;
+            startResizeTimeout_();
+        }
     }
 }
 
@@ -521,14 +833,73 @@ ImageSlice Window::fetchViewImage() {
     REQUIRE(state_ == Open);
 
     imageChanged_ = false;
+    if(!changedTiles_.isEmpty()) {
+        ++viewSequenceNumber_;
+        changedTiles_.clear();
+    }
     return rootViewport_;
 }
 
+TileMap Window::changedTiles() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return changedTiles_;
+}
+
+ImageSlice Window::fetchViewFrame(
+    shared_ptr<void>& frameOwner,
+    uint64_t& sequenceNumber,
+    TileMap& changedTiles
+) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    if(!frameStore_) {
+        frameStore_ = FrameStore::create(shared_from_this());
+        unpublishedTiles_ =
+            TileMap(rootViewport_.width(), rootViewport_.height());
+        unpublishedTiles_.markAll();
+    }
+
+    imageChanged_ = false;
+    if(!unpublishedTiles_.isEmpty() || frameStore_->hasPendingChanges()) {
+        // If this fails, the changes stay pending in frameStore_ and
+        // onFrameStoreSnapshotReleased signals the image change again.
+        frameStore_->publish(rootViewport_, unpublishedTiles_);
+        unpublishedTiles_.clear();
+    }
+
+    // The first publish always succeeds, as no snapshot can be held before it.
+    shared_ptr<FrameStore::Snapshot> snapshot = frameStore_->acquire();
+    REQUIRE(snapshot);
+
+    sequenceNumber = snapshot->sequenceNumber;
+    changedTiles = snapshot->changedTiles;
+    frameOwner = snapshot;
+    return snapshot->image;
+}
+
+uint64_t Window::viewSequenceNumber() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return viewSequenceNumber_;
+}
+
 void Window::navigate(int direction) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
     REQUIRE(direction >= -1 && direction <= 1);
 
+    // The history is lost in hibernation, so all the navigation operations
+    // just wake up the window.
+    noteActivity_();
+    flushPointerEvent_();
+    if(hibernationState_ != Awake) {
+        return;
+    }
+
     if(browser_) {
         if(direction == -1) {
             browser_->GoBack();
@@ -542,6 +913,117 @@ void Window::navigate(int direction) {
     }
 }
 
+bool Window::hibernate() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    if(hibernationState_ != Awake) {
+        return
+            hibernationState_ == SavingScroll ||
+            hibernationState_ == Hibernated ||
+            (hibernationState_ == ClosingBrowser && !wakeRequested_);
+    }
+
+    // Uploads and downloads would be interrupted by closing the browser.
+    if(
+        !browser_ ||
+        fileUploadCallback_ ||
+        pendingDownloadCount_ > 0 ||
+        downloadsInProgress_
+    ) {
+        return false;
+    }
+
+    CefRefPtr<CefFrame> frame = browser_->GetMainFrame();
+    if(!frame) {
+        return false;
+    }
+
+    // Data URLs (such as the certificate error pages) cannot be restored.
+    string url = frame->GetURL();
+    if(url.empty() || url.compare(0, 5, "data:") == 0) {
+        return false;
+    }
+
+    INFO_LOG("Hibernating window ", handle_);
+
+    // The browser is closed on the next watchdog tick, giving the script that
+    // reports the scroll position to Client::OnConsoleMessage time to run.
+    wakeURL_ = url;
+    wakeScroll_.reset();
+    scrollMessageTag_ =
+        "browserviceScroll_" + toString(rng()) + "_" + toString(rng()) + ":";
+    frame->ExecuteJavaScript(
+        "console.log('" + scrollMessageTag_ + "'+Math.round(window.scrollX)+"
+        "','+Math.round(window.scrollY));",
+        "",
+        0
+    );
+
+    hibernationState_ = SavingScroll;
+    wakeRequested_ = false;
+    return true;
+}
+
+int Window::rendererPID() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return rendererPID_;
+}
+
+steady_clock::duration Window::viewRenderTime() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return widgetRenderTime_ + rootWidget_->browserArea()->paintTime();
+}
+
+bool Window::browserPainted() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return rootWidget_->browserArea()->hasPainted();
+}
+
+uint64_t Window::blockedRequestCount() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return blockedRequestCount_;
+}
+
+Window::CacheStats Window::cacheStats() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return cacheStats_;
+}
+
+bool Window::isAwake() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return hibernationState_ == Awake;
+}
+
+steady_clock::time_point Window::lastActivityTime() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return lastActivityTime_;
+}
+
+bool Window::isViewBacklogged() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return
+        imageChanged_ &&
+        frameDemand_ != 0 &&
+        steady_clock::now() - imageChangedTime_ >= ViewBacklogTime;
+}
+
 void Window::uploadFile(shared_ptr<ViceFileUpload> file) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
@@ -573,6 +1055,9 @@ void Window::sendMouseDownEvent(int x, int y, int button) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    noteActivity_();
+    flushPointerEvent_();
+
     if(button >= 0 && button <= 2) {
         clampMouseCoords_(x, y);
         rootWidget_->sendMouseDownEvent(x, y, button);
@@ -583,6 +1068,9 @@ void Window::sendMouseUpEvent(int x, int y, int button) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    noteActivity_();
+    flushPointerEvent_();
+
     if(button >= 0 && button <= 2) {
         clampMouseCoords_(x, y);
         rootWidget_->sendMouseUpEvent(x, y, button);
@@ -593,14 +1081,19 @@ void Window::sendMouseMoveEvent(int x, int y) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    noteActivity_();
+
     clampMouseCoords_(x, y);
-    rootWidget_->sendMouseMoveEvent(x, y);
+    queuePointerEvent_(false, x, y, 0);
 }
 
 void Window::sendMouseDoubleClickEvent(int x, int y, int button) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    noteActivity_();
+    flushPointerEvent_();
+
     if(button == 0) {
         clampMouseCoords_(x, y);
         rootWidget_->sendMouseDoubleClickEvent(x, y);
@@ -611,15 +1104,19 @@ void Window::sendMouseWheelEvent(int x, int y, int dx, int dy) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    noteActivity_();
+
     clampMouseCoords_(x, y);
-    int delta = max(-180, min(180, -dy));
-    rootWidget_->sendMouseWheelEvent(x, y, delta);
+    int delta = max(-MaxWheelDelta, min(MaxWheelDelta, -dy));
+    queuePointerEvent_(true, x, y, delta);
 }
 
 void Window::sendMouseLeaveEvent(int x, int y) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    flushPointerEvent_();
+
     clampMouseCoords_(x, y);
     rootWidget_->sendMouseLeaveEvent(x, y);
 }
@@ -628,6 +1125,9 @@ void Window::sendKeyDownEvent(int key) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    noteActivity_();
+    flushPointerEvent_();
+
     if(isValidKey(key)) {
         rootWidget_->sendKeyDownEvent(key);
     }
@@ -637,6 +1137,9 @@ void Window::sendKeyUpEvent(int key) {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    noteActivity_();
+    flushPointerEvent_();
+
     if(isValidKey(key)) {
         rootWidget_->sendKeyUpEvent(key);
     }
@@ -646,6 +1149,8 @@ void Window::sendLoseFocusEvent() {
     REQUIRE_UI_THREAD();
     REQUIRE(state_ == Open);
 
+    flushPointerEvent_();
+
     rootWidget_->sendLoseFocusEvent();
 }
 
@@ -659,12 +1164,53 @@ void Window::onWidgetViewDirty() {
     shared_ptr<Window> self = shared_from_this();
     postTask([self]() {
         if(self->state_ == Open) {
-            self->rootWidget_->render();
+            // The browser area is rendered separately (its changes are
+            // reported through onBrowserAreaViewDirty), so the damage
+            // typically only covers parts of the control bar.
+            steady_clock::time_point startTime = steady_clock::now();
+            vector<Rect> damage = self->rootWidget_->render();
+            self->widgetRenderTime_ += steady_clock::now() - startTime;
+            if(damage.empty()) {
+                return;
+            }
+
+            TileMap tiles(
+                self->rootViewport_.width(), self->rootViewport_.height()
+            );
+            for(Rect rect : damage) {
+                tiles.markRect(rect);
+            }
+            self->markViewChanged_(tiles);
+
             self->signalImageChanged_();
         }
     });
 }
 
+AnimationFrameStatus Window::onWidgetRequestAnimationFrame() {
+    REQUIRE_UI_THREAD();
+
+    if(state_ != Open || frameDemand_ == 0) {
+        return AnimationFrameStatus::Pause;
+    }
+
+    // Skip the frame if the previous change has not been fetched yet or the
+    // frame budget given by the demand has been used.
+    if(imageChanged_) {
+        return AnimationFrameStatus::Skip;
+    }
+    steady_clock::time_point now = steady_clock::now();
+    if(frameDemand_ > 0) {
+        milliseconds interval(1000 / frameDemand_);
+        if(now - lastAnimationFrameTime_ < interval) {
+            return AnimationFrameStatus::Skip;
+        }
+    }
+
+    lastAnimationFrameTime_ = now;
+    return AnimationFrameStatus::Allow;
+}
+
 void Window::onWidgetCursorChanged() {
     REQUIRE_UI_THREAD();
 
@@ -713,7 +1259,19 @@ void Window::onGlobalHotkeyPressed(GlobalHotkey key) {
 void Window::onAddressSubmitted(string url) {
     REQUIRE_UI_THREAD();
 
-    if(state_ != Open || !browser_ || url.empty()) {
+    if(state_ != Open || url.empty()) {
+        return;
+    }
+
+    noteActivity_();
+    if(hibernationState_ != Awake) {
+        // Load the URL instead of the saved one when waking up.
+        wakeURL_ = url;
+        wakeScroll_.reset();
+        rootWidget_->browserArea()->takeFocus();
+        return;
+    }
+    if(!browser_) {
         return;
     }
 
@@ -741,6 +1299,28 @@ void Window::onPendingDownloadAccepted() {
     }
 }
 
+void Window::setFrameDemand(int framesPerSecond) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+    REQUIRE(framesPerSecond >= 0);
+
+    bool resumed = frameDemand_ == 0 && framesPerSecond > 0;
+
+    frameDemand_ = framesPerSecond;
+    applyFrameDemand_();
+
+    if(resumed) {
+        rootWidget_->sendAnimationsResumedEvent();
+    }
+}
+
+int Window::frameDemand() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    return frameDemand_;
+}
+
 void Window::onFind(string text, bool forward, bool findNext) {
     REQUIRE_UI_THREAD();
 
@@ -766,21 +1346,26 @@ void Window::onClipboardButtonPressed() {
     }
 }
 
-void Window::onBrowserAreaViewDirty() {
+void Window::onBrowserAreaViewDirty(TileMap changedTiles) {
     REQUIRE_UI_THREAD();
 
     if(state_ == Open) {
-        signalImageChanged_();
+        // We are inside OnPaint; the tiles are recorded immediately so that
+        // the next fetch sees them, but the event handler is notified later.
+        markViewChanged_(changedTiles);
+        postTask(shared_from_this(), &Window::signalImageChanged_);
     }
 }
 
 void Window::onPendingDownloadCountChanged(int count) {
     REQUIRE_UI_THREAD();
+    pendingDownloadCount_ = count;
     rootWidget_->controlBar()->setPendingDownloadCount(count);
 }
 
 void Window::onDownloadProgressChanged(vector<int> progress) {
     REQUIRE_UI_THREAD();
+    downloadsInProgress_ = !progress.empty();
     rootWidget_->controlBar()->setDownloadProgress(move(progress));
 }
 
@@ -793,28 +1378,104 @@ void Window::onDownloadCompleted(shared_ptr<CompletedDownload> file) {
     }
 }
 
-void Window::init_(shared_ptr<WindowEventHandler> eventHandler, uint64_t handle) {
+void Window::onFrameStoreSnapshotReleased() {
+    REQUIRE_UI_THREAD();
+
+    if(state_ == Open && frameStore_ && frameStore_->hasPendingChanges()) {
+        signalImageChanged_();
+    }
+}
+
+void Window::init_(
+    shared_ptr<WindowEventHandler> eventHandler,
+    uint64_t handle,
+    bool pooled
+) {
     REQUIRE_UI_THREAD();
     REQUIRE(eventHandler);
     REQUIRE(handle);
 
     handle_ = handle;
     state_ = Open;
+    pooled_ = pooled;
     eventHandler_ = eventHandler;
 
     imageChanged_ = false;
+    imageChangedTime_ = steady_clock::now();
 
     shared_ptr<Window> self = shared_from_this();
 
-    rootViewport_ = ImageSlice::createImage(800, 600);
+    rootViewport_ = ImageSlice::reuseBuffer(viewportBuffer_, 800, 600);
+    rootViewport_.fill(0, 800, 0, 600, 255);
     rootWidget_ = RootWidget::create(self, self, self, true);
     rootWidget_->setViewport(rootViewport_);
 
+    changedTiles_ = TileMap(800, 600);
+    changedTiles_.markAll();
+    viewSequenceNumber_ = 0;
+
     downloadManager_ = DownloadManager::create(self);
 
     watchdogTimeout_ = Timeout::create(1000);
 
+    resizeTimeout_ = Timeout::create(max(globals->config->resizeDelay, 1));
+    pendingWidth_ = 800;
+    pendingHeight_ = 600;
+
     fileUploadAcceptFilter_ = 0;
+
+    // A hidden browser would not paint the start page at all, so a pooled
+    // window keeps rendering at a minimal rate to have its view ready when
+    // claimed.
+    frameDemand_ = pooled ? 1 : -1;
+    browserHidden_ = false;
+    browserFrameRate_ = MaxFrameRate;
+    lastAnimationFrameTime_ = steady_clock::now();
+
+    hibernationState_ = Awake;
+    wakeRequested_ = false;
+    lastActivityTime_ = steady_clock::now();
+
+    pendingDownloadCount_ = 0;
+    downloadsInProgress_ = false;
+
+    rendererPID_ = 0;
+    widgetRenderTime_ = steady_clock::duration::zero();
+    blockedRequestCount_ = 0;
+    cacheStats_.hits = 0;
+    cacheStats_.misses = 0;
+    cacheStats_.bytesSaved = 0;
+
+    pointerFlushScheduled_ = false;
+}
+
+void Window::applyFrameDemand_() {
+    REQUIRE_UI_THREAD();
+
+    if(state_ != Open || !browser_) {
+        return;
+    }
+    CefRefPtr<CefBrowserHost> host = browser_->GetHost();
+
+    // A hidden browser does not render at all; when the consumer returns, the
+    // whole view is repainted so that the next fetch is up to date.
+    bool hidden = frameDemand_ == 0;
+    if(hidden != browserHidden_) {
+        browserHidden_ = hidden;
+        host->WasHidden(hidden);
+        if(!hidden) {
+            host->Invalidate(PET_VIEW);
+        }
+    }
+
+    if(!hidden) {
+        int frameRate =
+            frameDemand_ < 0 ? MaxFrameRate : min(frameDemand_, MaxFrameRate);
+        if(frameRate != browserFrameRate_) {
+            browserFrameRate_ = frameRate;
+            host->SetWindowlessFrameRate(frameRate);
+        }
+    }
 }
 
 void Window::createSuccessful_() {
@@ -824,6 +1485,16 @@ void Window::createSuccessful_() {
 
     postTask(self, &Window::watchdog_);
 
+    // The UI features of a pooled window are queried when it is claimed
+    if(!pooled_) {
+        queryUIFeatures_();
+    }
+}
+
+void Window::queryUIFeatures_() {
+    REQUIRE_UI_THREAD();
+
+    shared_ptr<Window> self = shared_from_this();
     postTask([self]() {
         if(self->state_ != Open) {
             return;
@@ -859,6 +1530,7 @@ void Window::afterClose_() {
     REQUIRE(state_ == Closed);
 
     watchdogTimeout_->clear(false);
+    resizeTimeout_->clear(false);
 
     if(fileUploadCallback_) {
         fileUploadCallback_->Cancel();
@@ -878,6 +1550,18 @@ void Window::watchdog_() {
     // time just in case our event handlers do not catch all the changes.
     updateSecurityStatus_();
 
+    if(hibernationState_ == SavingScroll) {
+        closeBrowserForHibernation_();
+    } else if(
+        hibernationState_ == Awake &&
+        !pooled_ &&
+        globals->config->hibernationTimeout > 0 &&
+        steady_clock::now() - lastActivityTime_ >=
+            milliseconds(1000 * (int64_t)globals->config->hibernationTimeout)
+    ) {
+        hibernate();
+    }
+
     if(!watchdogTimeout_->isActive()) {
         weak_ptr<Window> selfWeak = shared_from_this();
         watchdogTimeout_->set([selfWeak]() {
@@ -888,10 +1572,120 @@ void Window::watchdog_() {
     }
 }
 
-void Window::updateSecurityStatus_() {
+void Window::noteActivity_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    lastActivityTime_ = steady_clock::now();
+    if(hibernationState_ != Awake) {
+        wake_();
+    }
+}
+
+void Window::closeBrowserForHibernation_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+    REQUIRE(hibernationState_ == SavingScroll);
+    REQUIRE(browser_);
+
+    hibernationState_ = ClosingBrowser;
+
+    CefRefPtr<CefBrowser> browser = browser_;
+    postTask([browser] {
+        browser->GetHost()->CloseBrowser(true);
+    });
+}
+
+void Window::wake_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    lastActivityTime_ = steady_clock::now();
+
+    if(hibernationState_ == SavingScroll) {
+        // The browser is still running; just cancel the hibernation.
+        hibernationState_ = Awake;
+        wakeScroll_.reset();
+    } else if(hibernationState_ == ClosingBrowser) {
+        // Continued in Client::OnBeforeClose.
+        wakeRequested_ = true;
+    } else if(hibernationState_ == Hibernated) {
+        // The browser is created in a separate task to avoid calling the event
+        // handler directly if the creation fails.
+        INFO_LOG("Waking up window ", handle_, " from hibernation");
+        hibernationState_ = WakePending;
+        wakeRequested_ = false;
+        postTask(shared_from_this(), &Window::createBrowserForWake_);
+    }
+}
+
+void Window::createBrowserForWake_() {
     REQUIRE_UI_THREAD();
+    REQUIRE(hibernationState_ == WakePending);
 
     if(state_ != Open) {
+        // The window was closed before the browser was created.
+        if(state_ == Closed) {
+            cleanupComplete_();
+        }
+        return;
+    }
+
+    // The new browser starts with the CEF defaults; applyFrameDemand_ is
+    // called by Client::OnAfterCreated.
+    browserHidden_ = false;
+    browserFrameRate_ = MaxFrameRate;
+
+    CefRefPtr<CefClient> client = new Client(shared_from_this());
+
+    CefWindowInfo windowInfo;
+    windowInfo.SetAsWindowless(kNullWindowHandle);
+
+    CefBrowserSettings browserSettings;
+    browserSettings.background_color = (cef_color_t)-1;
+
+    hibernationState_ = Waking;
+    if(!CefBrowserHost::CreateBrowser(
+        windowInfo,
+        client,
+        wakeURL_,
+        browserSettings,
+        nullptr,
+        nullptr
+    )) {
+        WARNING_LOG(
+            "Opening CEF browser for window ", handle_, " failed while ",
+            "waking up from hibernation, closing the window"
+        );
+        hibernationState_ = Hibernated;
+        state_ = Closed;
+        afterClose_();
+        REQUIRE(eventHandler_);
+        eventHandler_->onWindowClose(handle_);
+        cleanupComplete_();
+    }
+}
+
+void Window::cleanupComplete_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Closed);
+    REQUIRE(eventHandler_);
+
+    INFO_LOG("Cleanup of CEF browser for window ", handle_, " complete");
+
+    state_ = CleanupComplete;
+    browser_ = nullptr;
+    retainedUploads_.clear();
+    rootWidget_->browserArea()->setBrowser(nullptr);
+    eventHandler_->onWindowCleanupComplete(handle_);
+    eventHandler_.reset();
+}
+
+void Window::updateSecurityStatus_() {
+    REQUIRE_UI_THREAD();
+
+    // Keep showing the status of the page during hibernation.
+    if(state_ != Open || hibernationState_ != Awake) {
         return;
     }
 
@@ -923,6 +1717,129 @@ void Window::updateSecurityStatus_() {
     rootWidget_->controlBar()->setSecurityStatus(securityStatus);
 }
 
+void Window::onRequestBlocked_() {
+    REQUIRE_UI_THREAD();
+    ++blockedRequestCount_;
+}
+
+void Window::onResourceLoaded_(bool fromCache, uint64_t bytes) {
+    REQUIRE_UI_THREAD();
+
+    if(fromCache) {
+        ++cacheStats_.hits;
+        cacheStats_.bytesSaved += bytes;
+    } else {
+        ++cacheStats_.misses;
+    }
+}
+
+void Window::queuePointerEvent_(bool wheel, int x, int y, int delta) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    if(pendingPointerEvent_) {
+        PendingPointerEvent& pending = *pendingPointerEvent_;
+        if(!wheel && !pending.wheel) {
+            pending.x = x;
+            pending.y = y;
+            return;
+        }
+        if(
+            wheel && pending.wheel &&
+            x == pending.x && y == pending.y &&
+            (delta < 0) == (pending.delta < 0)
+        ) {
+            pending.delta += delta;
+            return;
+        }
+        flushPointerEvent_();
+    }
+
+    PendingPointerEvent event;
+    event.wheel = wheel;
+    event.x = x;
+    event.y = y;
+    event.delta = delta;
+    pendingPointerEvent_ = event;
+
+    if(!pointerFlushScheduled_) {
+        pointerFlushScheduled_ = true;
+        shared_ptr<Window> self = shared_from_this();
+        postTask([self]() {
+            self->pointerFlushScheduled_ = false;
+            if(self->state_ == Open) {
+                self->flushPointerEvent_();
+            }
+        });
+    }
+}
+
+void Window::flushPointerEvent_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    if(!pendingPointerEvent_) {
+        return;
+    }
+    PendingPointerEvent event = *pendingPointerEvent_;
+    pendingPointerEvent_.reset();
+
+    if(event.wheel) {
+        int delta = event.delta;
+        do {
+            int part = max(-MaxWheelDelta, min(MaxWheelDelta, delta));
+            rootWidget_->sendMouseWheelEvent(event.x, event.y, part);
+            delta -= part;
+        } while(delta != 0);
+    } else {
+        rootWidget_->sendMouseMoveEvent(event.x, event.y);
+    }
+}
+
+void Window::applyResize_(int width, int height) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    int oldWidth = rootViewport_.width();
+    int oldHeight = rootViewport_.height();
+    if(width == oldWidth && height == oldHeight) {
+        return;
+    }
+
+    // The view of a hibernating browser cannot be resized.
+    if(hibernationState_ != Awake) {
+        wake_();
+    }
+
+    // If the buffer is reused, the old view stays in place until it is
+    // repainted; the newly uncovered area is cleared to white as in a new
+    // image.
+    rootViewport_ = ImageSlice::reuseBuffer(viewportBuffer_, width, height);
+    rootViewport_.fill(oldWidth, width, 0, height, 255);
+    rootViewport_.fill(0, width, oldHeight, height, 255);
+    rootWidget_->setViewport(rootViewport_);
+
+    changedTiles_ = TileMap(width, height);
+    changedTiles_.markAll();
+    if(frameStore_) {
+        unpublishedTiles_ = changedTiles_;
+    }
+}
+
+void Window::startResizeTimeout_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open);
+
+    weak_ptr<Window> selfWeak = shared_from_this();
+    resizeTimeout_->set([selfWeak]() {
+        if(shared_ptr<Window> self = selfWeak.lock()) {
+            if(self->state_ == Open) {
+                self->applyResize_(self->pendingWidth_, self->pendingHeight_);
+            }
+        }
+    });
+}
+
 void Window::clampMouseCoords_(int& x, int& y) {
     x = max(x, -1000);
     y = max(y, -1000);
@@ -930,11 +1847,21 @@ void Window::clampMouseCoords_(int& x, int& y) {
     y = min(y, rootViewport_.height() + 1000);
 }
 
+void Window::markViewChanged_(const TileMap& tiles) {
+    REQUIRE_UI_THREAD();
+
+    changedTiles_.merge(tiles);
+    if(frameStore_) {
+        unpublishedTiles_.merge(tiles);
+    }
+}
+
 void Window::signalImageChanged_() {
     REQUIRE_UI_THREAD();
 
     if(state_ == Open && !imageChanged_) {
         imageChanged_ = true;
+        imageChangedTime_ = steady_clock::now();
 
         REQUIRE(eventHandler_);
         eventHandler_->onWindowViewImageChanged(handle_);
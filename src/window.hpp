@@ -3,8 +3,10 @@
 #include "browser_area.hpp"
 #include "control_bar.hpp"
 #include "download_manager.hpp"
+#include "frame_store.hpp"
 #include "image_slice.hpp"
 #include "root_widget.hpp"
+#include "tile_map.hpp"
 
 class CefBrowser;
 class CefFileDialogCallback;
@@ -62,19 +64,31 @@ class ViceFileUpload;
 //    closed), the onWindowCleanupComplete event handler is called. After this, 
 //    the Window drops the pointer to the event handler and the window object
 //    may be destructed
+//
+// While the window is open, it may hibernate: the CEF browser is closed to
+// free its resources, but the window stays open and keeps showing the last
+// view of the browser. On the next input event, a new CEF browser is created
+// for the same URL and the scroll position is restored (the navigation
+// history is lost). Hibernation is initiated by the hibernate() member
+// function or automatically after the hibernation timeout given in the
+// configuration.
 class Window :
     public WidgetParent,
     public ControlBarEventHandler,
     public BrowserAreaEventHandler,
     public DownloadManagerEventHandler,
+    public FrameStoreEventHandler,
     public enable_shared_from_this<Window>
 {
 SHARED_ONLY_CLASS(Window);
 public:
-    // Returns empty pointer if CEF browser creation fails.
+    // Returns empty pointer if CEF browser creation fails. A pooled window
+    // (see BrowserPool) renders at a minimal frame rate and does not
+    // hibernate until it is claimed.
     static shared_ptr<Window> tryCreate(
         shared_ptr<WindowEventHandler> eventHandler,
-        uint64_t handle
+        uint64_t handle,
+        bool pooled = false
     );
 
     // Private constructor.
@@ -84,17 +98,110 @@ public:
     ~Window();
 
     void close();
+
+    // Hands a pooled window over to a new event handler with a new handle. The
+    // window is treated as newly opened: the event handler is queried for the
+    // UI features, and the frame demand is unset (restoring the default frame
+    // rate) until the next setFrameDemand call.
+    void claim(shared_ptr<WindowEventHandler> eventHandler, uint64_t handle);
+
+    // The size is clamped to the supported range and rounded down to a
+    // multiple of the resize-step option. If the window has been resized
+    // within the last resize-delay milliseconds, the resize is deferred until
+    // the requested size has stayed the same for resize-delay milliseconds.
     void resize(int width, int height);
     ImageSlice fetchViewImage();
 
+    // Returns the tiles of the view image that have changed since the previous
+    // fetchViewImage call.
+    TileMap changedTiles();
+
+    // Same as fetchViewImage, except that the returned image is a snapshot that
+    // is not modified as long as frameOwner (set by this function) is alive.
+    // The snapshots are taken from a triple-buffered frame store (see
+    // FrameStore) to which the changes are published by these calls. The
+    // sequence number of the snapshot and the tiles changed since the previous
+    // snapshot are returned through sequenceNumber and changedTiles; they are
+    // independent of the fetchViewImage counters. If the free snapshot slots
+    // are all held, the previous snapshot is returned again, and the image
+    // change is signaled again as soon as a snapshot is released.
+    ImageSlice fetchViewFrame(
+        shared_ptr<void>& frameOwner,
+        uint64_t& sequenceNumber,
+        TileMap& changedTiles
+    );
+
+    // Returns the sequence number of the image returned by the latest
+    // fetchViewImage call. The sequence number is incremented by the
+    // fetchViewImage calls that return a changed image.
+    uint64_t viewSequenceNumber();
+
     // -1 = back, 0 = refresh, 1 = forward.
     void navigate(int direction);
 
+    // Starts hibernating the window if possible (the browser has been created
+    // and it has no file uploads or downloads in progress). Returns true if
+    // the window is hibernating after the call.
+    bool hibernate();
+
+    // Returns true if the browser of the window is running normally (the
+    // window is not hibernating, about to hibernate or waking up).
+    bool isAwake();
+
+    // Time of the latest input event of the window (or its creation).
+    steady_clock::time_point lastActivityTime();
+
+    // Returns true if the view has changed and the change has not been fetched
+    // within ViewBacklogTime even though there is demand for frames, i.e. the
+    // consumer is falling behind.
+    static constexpr milliseconds ViewBacklogTime = milliseconds(1000);
+    bool isViewBacklogged();
+
+    // PID of the renderer process of the main frame of the browser as
+    // reported by the process itself (see RendererPIDMessage), or 0 if not
+    // known. As the renderer may be sandboxed in a PID namespace of its own,
+    // the PID must be translated using ResourceMonitor::hostRendererPID before
+    // use.
+    int rendererPID();
+
+    // Total time spent in the UI thread producing the view image of the window
+    // (copying the frames painted by the browser and rendering the widgets).
+    steady_clock::duration viewRenderTime();
+
+    // Returns true if the browser has painted the view at least once.
+    bool browserPainted();
+
+    // Number of requests of the window blocked by globals->requestFilter.
+    uint64_t blockedRequestCount();
+
+    // Statistics of the successful HTTP GET requests of the window: the
+    // number of responses served from the HTTP cache of the browser (hits)
+    // and from the network (misses), and the total size of the hits in bytes.
+    // Hits are detected heuristically, as CEF does not report them.
+    struct CacheStats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t bytesSaved;
+    };
+    CacheStats cacheStats();
+
+    // Adapts the rendering of the CEF browser and the widget animations to the
+    // rate at which the view images are consumed: the frame rate is limited to
+    // framesPerSecond (at most MaxFrameRate), and if framesPerSecond is 0, the
+    // browser is hidden and the animations are paused until a nonzero demand
+    // is set.
+    static constexpr int MaxFrameRate = 30;
+    void setFrameDemand(int framesPerSecond);
+    int frameDemand();
+
     void uploadFile(shared_ptr<ViceFileUpload> file);
     void cancelFileUpload();
 
     // Functions for passing input events to the Window. The functions accept
-    // all combinations of argument values (the values are sanitized).
+    // all combinations of argument values (the values are sanitized). Mouse
+    // move and wheel events may be merged with adjacent events of the same
+    // kind before they are passed on (see queuePointerEvent_); the order of
+    // the events is always preserved.
     void sendMouseDownEvent(int x, int y, int button);
     void sendMouseUpEvent(int x, int y, int button);
     void sendMouseMoveEvent(int x, int y);
@@ -109,6 +216,7 @@ public:
     virtual void onWidgetViewDirty() override;
     virtual void onWidgetCursorChanged() override;
     virtual void onGlobalHotkeyPressed(GlobalHotkey key) override;
+    virtual AnimationFrameStatus onWidgetRequestAnimationFrame() override;
 
     // ControlBarEventHandler:
     virtual void onAddressSubmitted(string url) override;
@@ -119,7 +227,7 @@ public:
     virtual void onClipboardButtonPressed() override;
 
     // BrowserAreaEventHandler:
-    virtual void onBrowserAreaViewDirty() override;
+    virtual void onBrowserAreaViewDirty(TileMap changedTiles) override;
 
     // DownloadManagerEventHandler:
     virtual void onPendingDownloadCountChanged(int count) override;
@@ -128,6 +236,9 @@ public:
         shared_ptr<CompletedDownload> file
     ) override;
 
+    // FrameStoreEventHandler:
+    virtual void onFrameStoreSnapshotReleased() override;
+
 private:
     // Class that implements CefClient interfaces for the window.
     class Client;
@@ -141,35 +252,160 @@ private:
     //         after this, the window is open.
     //       - If creating the browser failed, call createFailed_() and let the
     //         object destruct.
-    void init_(shared_ptr<WindowEventHandler> eventHandler, uint64_t handle);
+    void init_(
+        shared_ptr<WindowEventHandler> eventHandler,
+        uint64_t handle,
+        bool pooled
+    );
     void createSuccessful_();
     void createFailed_();
 
+    // Queries the event handler for the quality selector and clipboard button
+    // in a posted task.
+    void queryUIFeatures_();
+
     void afterClose_();
 
+    // Called when all the resources of a closed window (including the
+    // browser) have been released.
+    void cleanupComplete_();
+
     void watchdog_();
     void updateSecurityStatus_();
+    void onRequestBlocked_();
+    void onResourceLoaded_(bool fromCache, uint64_t bytes);
+
+    // Clients typically send their input events in batches (such as all the
+    // events since the previous image request), which may contain dozens of
+    // mouse moves that would each cause the page to update its hover state.
+    // Thus mouse move and wheel events are held back until the end of the
+    // current task or until the next other input event, and a move replaces a
+    // pending move and a wheel event in the same direction at the same
+    // position adds its delta to a pending wheel event (the merged delta is
+    // passed on as multiple events if it exceeds the range of a single event).
+    // As the flush is run as a separate task, events handled before it (such
+    // as the next batch, if the UI thread is busy) are also merged.
+    void queuePointerEvent_(bool wheel, int x, int y, int delta);
+    void flushPointerEvent_();
+
+    // Records an input event for the hibernation timeout; if the window is
+    // hibernating, the browser is restored.
+    void noteActivity_();
+    void closeBrowserForHibernation_();
+    void wake_();
+    void createBrowserForWake_();
+
+    // Applies frameDemand_ to browser_ if it exists (the CEF defaults if
+    // frameDemand_ is -1).
+    void applyFrameDemand_();
 
     void clampMouseCoords_(int& x, int& y);
 
+    void applyResize_(int width, int height);
+    void startResizeTimeout_();
+
     // May call onWindowViewImageChanged immediately.
     void signalImageChanged_();
 
+    // Marks the tiles as changed in rootViewport_ (also for the next publish
+    // to frameStore_ if it exists).
+    void markViewChanged_(const TileMap& tiles);
+
     uint64_t handle_;
     enum {Open, Closed, CleanupComplete} state_;
 
+    // True if the window is in a BrowserPool waiting to be claimed.
+    bool pooled_;
+
     // Empty only in CleanupComplete state.
     shared_ptr<WindowEventHandler> eventHandler_;
 
     bool imageChanged_;
+    steady_clock::time_point imageChangedTime_;
 
     // Always empty in CleanupComplete state. May be empty in Open and Closed
-    // states if the browser has not yet started.
+    // states if the browser has not yet started or the window is hibernating.
     CefRefPtr<CefBrowser> browser_;
 
+    // Hibernation proceeds through these states in order (see hibernate()):
+    //   - Awake: the browser is running normally (or being created
+    //     initially).
+    //   - SavingScroll: a script reporting the scroll position in a console
+    //     message has been started; the browser is closed on the next watchdog
+    //     tick.
+    //   - ClosingBrowser: waiting for the browser to close; wakeRequested_ is
+    //     set if the window should be restored right after that.
+    //   - Hibernated: there is no browser.
+    //   - WakePending: a task creating the new browser has been posted.
+    //   - Waking: waiting for the new browser to be created.
+    enum {
+        Awake,
+        SavingScroll,
+        ClosingBrowser,
+        Hibernated,
+        WakePending,
+        Waking
+    } hibernationState_;
+    bool wakeRequested_;
+    steady_clock::time_point lastActivityTime_;
+
+    // The URL to load and the scroll position to restore (if reported) when
+    // waking up. The console message reporting the scroll position starts with
+    // scrollMessageTag_, which is randomized for each hibernation.
+    string wakeURL_;
+    optional<pair<int, int>> wakeScroll_;
+    string scrollMessageTag_;
+
+    int pendingDownloadCount_;
+    bool downloadsInProgress_;
+
+    int rendererPID_;
+    steady_clock::duration widgetRenderTime_;
+    uint64_t blockedRequestCount_;
+    CacheStats cacheStats_;
+
+    struct PendingPointerEvent {
+        bool wheel;
+        int x;
+        int y;
+        int delta;
+    };
+    optional<PendingPointerEvent> pendingPointerEvent_;
+    bool pointerFlushScheduled_;
+
+    // Latest demand given to setFrameDemand (-1 if not set), and the state it
+    // has been applied to in browser_ (initially the CEF defaults).
+    int frameDemand_;
+    bool browserHidden_;
+    int browserFrameRate_;
+
+    // Time of the latest animation frame allowed by
+    // onWidgetRequestAnimationFrame; the animations of the widgets are limited
+    // to frameDemand_ frames per second.
+    steady_clock::time_point lastAnimationFrameTime_;
+
+    // rootViewport_ is the top left part of viewportBuffer_, which is only
+    // reallocated if the size changes a lot (see ImageSlice::reuseBuffer).
     ImageSlice rootViewport_;
+    ImageSlice viewportBuffer_;
     shared_ptr<RootWidget> rootWidget_;
 
+    // While resizeTimeout_ is active, resizes are deferred; the latest
+    // requested size is applied when the timeout expires.
+    shared_ptr<Timeout> resizeTimeout_;
+    int pendingWidth_;
+    int pendingHeight_;
+
+    // Tiles of rootViewport_ changed since the previous fetchViewImage call.
+    TileMap changedTiles_;
+    uint64_t viewSequenceNumber_;
+
+    // Snapshots of rootViewport_ for fetchViewFrame; created by the first
+    // fetchViewFrame call, after which the changes are tracked in
+    // unpublishedTiles_ and published by each fetchViewFrame call.
+    shared_ptr<FrameStore> frameStore_;
+    TileMap unpublishedTiles_;
+
     shared_ptr<DownloadManager> downloadManager_;
 
     shared_ptr<Timeout> watchdogTimeout_;
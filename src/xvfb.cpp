@@ -41,6 +41,30 @@ string generateCookie() {
     return cookie;
 }
 
+// Returns the path of the first executable named name in the directories
+// listed in the PATH environment variable, similarly to execlp; empty if not
+// found.
+optional<string> findExecutable(string name) {
+    const char* pathEnv = getenv("PATH");
+    string path = pathEnv != nullptr ? pathEnv : "/bin:/usr/bin";
+
+    size_t start = 0;
+    while(true) {
+        size_t end = path.find(':', start);
+        string dir = path.substr(
+            start, end == string::npos ? string::npos : end - start
+        );
+        string candidate = (dir.empty() ? "." : dir) + "/" + name;
+        if(access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+        if(end == string::npos) {
+            return {};
+        }
+        start = end + 1;
+    }
+}
+
 void addCookieToXAuthFile(string path, int display, string cookie) {
     string xauthCmd = "xauth -f " + path + " source -";
     FILE* proc = popen(xauthCmd.c_str(), "w");
@@ -79,29 +103,45 @@ Xvfb::Xvfb(CKey) {
     int readDisplayFd = displayFds[0];
     int writeDisplayFd = displayFds[1];
 
+    // As this process may have other threads, the child may only use
+    // async-signal-safe functions between fork and exec; thus the executable
+    // path and the arguments are prepared beforehand.
+    optional<string> xvfbPath = findExecutable("Xvfb");
+    if(!xvfbPath) {
+        PANIC("Starting Xvfb failed (Xvfb executable not found in PATH)");
+    }
+    vector<string> args = {
+        "Xvfb",
+        "-displayfd", toString(writeDisplayFd),
+        "-auth", xAuthPath_,
+        "-screen", "0", "640x480x24"
+    };
+    vector<char*> argv;
+    for(string& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
     pid_ = fork();
     REQUIRE(pid_ != -1);
     if(!pid_) {
         // Xvfb subprocess:
-        REQUIRE(!close(readDisplayFd));
+        if(close(readDisplayFd)) {
+            _exit(1);
+        }
 
         // Move the X server process to its own process group, as otherwise
         // Ctrl+C sent to the parent would stop the X server before we have
         // time to shut the parent down
-        REQUIRE(!setpgid(0, 0));
-
-        string writeDisplayFdStr = toString(writeDisplayFd);
-        execlp(
-            "Xvfb",
-            "Xvfb",
-            "-displayfd", writeDisplayFdStr.c_str(),
-            "-auth", xAuthPath_.c_str(),
-            "-screen", "0", "640x480x24",
-            (char*)nullptr
-        );
+        if(setpgid(0, 0)) {
+            _exit(1);
+        }
+
+        execv(xvfbPath->c_str(), argv.data());
 
-        // If exec succeeded, this should not be reachable
-        REQUIRE(false);
+        // If exec succeeded, this should not be reachable; the parent detects
+        // the failure as the pipe is closed without a display number
+        _exit(1);
     }
 
     // Parent process:
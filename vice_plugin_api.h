@@ -88,6 +88,15 @@ extern "C" {
  *
  *  6. The program destroys the plugin context using vicePluginAPI_destroyContext.
  *
+ * API version 1000001 extends version 1000000 with damage information for the window view images,
+ * API version 1000002 further extends version 1000001 by allowing the plugin to retain the window
+ * view images without copying them, API version 1000003 further extends version 1000002 by letting
+ * the plugin report how often the images of each window are actually consumed, and API version
+ * 1000004 further extends version 1000003 by letting the plugin query the resource usage of each
+ * window; see the sections "API version 1000001", "API version 1000002", "API version 1000003" and
+ * "API version 1000004" below for the differences. A program supporting multiple versions should
+ * use the newest version supported by the plugin.
+ *
  * General API conventions and rules:
  *
  *   - The program and plugin communicate bidirectionally using function calls. The program directly
@@ -687,6 +696,308 @@ void vicePluginAPI_setGlobalPanicCallback(
     void (*destructorCallback)(void* data)
 );
 
+/***************************************************************************************************
+ *** API version 1000001 ***
+ ***************************/
+
+/* API version 1000001 is an extension of API version 1000000 that allows the program to tell the
+ * plugin which parts of the window view image have changed, so that the plugin can avoid
+ * processing the unchanged parts. All the types and functions of API version 1000000 are also
+ * used in API version 1000001 in exactly the same way (with apiVersion set to 1000001 when
+ * required), with the following exception: a context initialized with apiVersion 1000001 must be
+ * started using vicePluginAPI_startWithDamageCallbacks instead of vicePluginAPI_start.
+ */
+
+/* Rectangle [x, x + width) x [y, y + height) in a window view image. */
+struct VicePluginAPI_Rect {
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+};
+typedef struct VicePluginAPI_Rect VicePluginAPI_Rect;
+
+/* Struct of pointers to callback functions provided by the program in addition to the callbacks in
+ * VicePluginAPI_Callbacks. The same rules apply to these callbacks as to the callbacks in
+ * VicePluginAPI_Callbacks.
+ */
+struct VicePluginAPI_DamageCallbacks {
+
+    /* Works exactly like the fetchWindowImage callback of VicePluginAPI_Callbacks, except that the
+     * callback must pass the following additional arguments to putImageFunc:
+     *
+     *   - sequenceNumber: The sequence number of the view image. For each window, the sequence
+     *     numbers of the images fetched by successive calls are nondecreasing, and if the image
+     *     differs from the image fetched by the previous call for the same window, the sequence
+     *     number is strictly larger.
+     *
+     *   - dirtyRects, dirtyRectCount: A list of dirtyRectCount rectangles (if dirtyRectCount is 0,
+     *     dirtyRects may be NULL) inside the image that cover all the pixels that may differ from
+     *     the image fetched by the previous call (of either fetchWindowImage or
+     *     fetchWindowImageWithDamage) for the same window. The rectangles may overlap and they may
+     *     also cover unchanged pixels. For the first fetch of a window and whenever the size of the
+     *     image has changed, the rectangles must cover the whole image.
+     *
+     * The plugin may not use the dirtyRects pointer after putImageFunc has returned.
+     */
+    void (*fetchWindowImageWithDamage)(
+        void*,
+        uint64_t window,
+        void (*putImageFunc)(
+            void* data,
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const VicePluginAPI_Rect* dirtyRects,
+            size_t dirtyRectCount
+        ),
+        void* data
+    );
+
+};
+typedef struct VicePluginAPI_DamageCallbacks VicePluginAPI_DamageCallbacks;
+
+/* Same as vicePluginAPI_start, except that the program additionally provides the damage callbacks
+ * (which also receive callbackData as the first argument). Must be used instead of
+ * vicePluginAPI_start to start contexts initialized with apiVersion 1000001.
+ */
+void vicePluginAPI_startWithDamageCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    void* callbackData
+);
+
+/***************************************************************************************************
+ *** API version 1000002 ***
+ ***************************/
+
+/* API version 1000002 is an extension of API version 1000001 that allows the plugin to keep using
+ * a window view image after the fetch callback has returned, so that the plugin does not need to
+ * copy the image before processing it. All the types and functions of API version 1000001 are also
+ * used in API version 1000002 in exactly the same way (with apiVersion set to 1000002 when
+ * required), with the following exception: a context initialized with apiVersion 1000002 must be
+ * started using vicePluginAPI_startWithFrameCallbacks instead of vicePluginAPI_start or
+ * vicePluginAPI_startWithDamageCallbacks.
+ */
+
+/* Struct of pointers to callback functions provided by the program in addition to the callbacks in
+ * VicePluginAPI_Callbacks and VicePluginAPI_DamageCallbacks. Unless otherwise noted, the same rules
+ * apply to these callbacks as to the callbacks in VicePluginAPI_Callbacks.
+ */
+struct VicePluginAPI_FrameCallbacks {
+
+    /* Works exactly like the fetchWindowImageWithDamage callback of VicePluginAPI_DamageCallbacks
+     * (and counts as a fetch in the same way), except that the image is given as a frame: the
+     * callback passes a frame handle as the last argument to putFrameFunc, and the image pointed
+     * to by the image argument stays valid and unmodified until the plugin releases the frame by
+     * calling releaseFrame. The plugin may read the image from any thread. The dirtyRects pointer
+     * may not be used after putFrameFunc has returned.
+     */
+    void (*fetchWindowFrame)(
+        void*,
+        uint64_t window,
+        void (*putFrameFunc)(
+            void* data,
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const VicePluginAPI_Rect* dirtyRects,
+            size_t dirtyRectCount,
+            uint64_t frame
+        ),
+        void* data
+    );
+
+    /* Releases a frame obtained using fetchWindowFrame. The plugin must release each frame exactly
+     * once, and it must release all the frames before calling the shutdownComplete callback. The
+     * frames may be released in any order, even after the corresponding window has been closed.
+     * Unlike the other callbacks, this callback may be called from any thread at any time (before
+     * shutdownComplete).
+     */
+    void (*releaseFrame)(void*, uint64_t frame);
+
+};
+typedef struct VicePluginAPI_FrameCallbacks VicePluginAPI_FrameCallbacks;
+
+/* Same as vicePluginAPI_startWithDamageCallbacks, except that the program additionally provides the
+ * frame callbacks (which also receive callbackData as the first argument). Must be used instead of
+ * vicePluginAPI_start and vicePluginAPI_startWithDamageCallbacks to start contexts initialized
+ * with apiVersion 1000002.
+ */
+void vicePluginAPI_startWithFrameCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    VicePluginAPI_FrameCallbacks frameCallbacks,
+    void* callbackData
+);
+
+/***************************************************************************************************
+ *** API version 1000003 ***
+ ***************************/
+
+/* API version 1000003 is an extension of API version 1000002 that allows the plugin to tell the
+ * program how often the view images of each window are consumed by its clients, so that the
+ * program can avoid rendering frames that nobody will see. All the types and functions of API
+ * version 1000002 are also used in API version 1000003 in exactly the same way (with apiVersion set
+ * to 1000003 when required), with the following exception: a context initialized with apiVersion
+ * 1000003 must be started using vicePluginAPI_startWithDemandCallbacks instead of
+ * vicePluginAPI_start, vicePluginAPI_startWithDamageCallbacks or
+ * vicePluginAPI_startWithFrameCallbacks.
+ */
+
+/* Struct of pointers to callback functions provided by the program in addition to the callbacks in
+ * VicePluginAPI_Callbacks, VicePluginAPI_DamageCallbacks and VicePluginAPI_FrameCallbacks. Unless
+ * otherwise noted, the same rules apply to these callbacks as to the callbacks in
+ * VicePluginAPI_Callbacks.
+ */
+struct VicePluginAPI_DemandCallbacks {
+
+    /* Informs the program that the view images of given open window are currently consumed by the
+     * clients at most approximately framesPerSecond times per second. The value 0 means that the
+     * window currently has no consumer at all (for example, the client has gone to the background
+     * or lost its connection); in that case, the program may stop rendering the window altogether,
+     * but it must still respond to fetches normally. Before the first call for a window, the
+     * program should assume that the demand is unknown and render normally. The plugin should only
+     * call this callback when the demand changes significantly. The demand is only a hint; the
+     * program must still signal view changes using the notifyWindowViewChanged API function as
+     * usual, and the plugin may fetch the image at any time.
+     */
+    void (*setWindowFrameDemand)(void*, uint64_t window, uint32_t framesPerSecond);
+
+};
+typedef struct VicePluginAPI_DemandCallbacks VicePluginAPI_DemandCallbacks;
+
+/* Same as vicePluginAPI_startWithFrameCallbacks, except that the program additionally provides the
+ * demand callbacks (which also receive callbackData as the first argument). Must be used instead of
+ * vicePluginAPI_start, vicePluginAPI_startWithDamageCallbacks and
+ * vicePluginAPI_startWithFrameCallbacks to start contexts initialized with apiVersion 1000003.
+ */
+void vicePluginAPI_startWithDemandCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    VicePluginAPI_FrameCallbacks frameCallbacks,
+    VicePluginAPI_DemandCallbacks demandCallbacks,
+    void* callbackData
+);
+
+/***************************************************************************************************
+ *** API version 1000004 ***
+ ***************************/
+
+/* API version 1000004 is an extension of API version 1000003 that allows the plugin to query the
+ * resource usage of each window from the program, for example to show it to the administrator. All
+ * the types and functions of API version 1000003 are also used in API version 1000004 in exactly
+ * the same way (with apiVersion set to 1000004 when required), with the following exception: a
+ * context initialized with apiVersion 1000004 must be started using
+ * vicePluginAPI_startWithStatsCallbacks instead of vicePluginAPI_start,
+ * vicePluginAPI_startWithDamageCallbacks, vicePluginAPI_startWithFrameCallbacks or
+ * vicePluginAPI_startWithDemandCallbacks.
+ *
+ * Fields may be added to the end of VicePluginAPI_WindowStats in later revisions of this header
+ * without a new API version number; the structSize field lets a program and a plugin built against
+ * different revisions agree on the fields that are present.
+ */
+
+/* Resource usage of a single window as measured by the program. */
+struct VicePluginAPI_WindowStats {
+
+    /* Before calling queryWindowStats, the plugin must set structSize to
+     * sizeof(VicePluginAPI_WindowStats) (as defined in the revision of this header it was built
+     * against). The program fills in only the fields that fit within structSize bytes and, before
+     * returning, sets structSize to the number of bytes it filled in (the smaller of the value given
+     * by the plugin and the size of the struct known to the program). The plugin must treat the
+     * fields beyond the returned structSize as unavailable.
+     */
+    size_t structSize;
+
+    /* Total CPU time in milliseconds used by the browser processes rendering the content of the
+     * window since they were started. If a process is shared by multiple windows, its usage is
+     * divided evenly between them.
+     */
+    uint64_t contentCPUTimeMs;
+
+    /* Current resident memory in bytes of the browser processes rendering the content of the
+     * window, divided between windows similarly to contentCPUTimeMs.
+     */
+    uint64_t contentMemoryBytes;
+
+    /* Total time in milliseconds spent by the main thread of the program on producing the view
+     * images of the window (such as copying the rendered content and drawing the user interface)
+     * since the window was created.
+     */
+    uint64_t viewRenderTimeMs;
+
+    /* Number of requests made by the pages in the window that the program has blocked (for example
+     * using ad blocking filter lists) since the window was created.
+     */
+    uint64_t blockedRequestCount;
+
+    /* Estimated number of successful HTTP GET requests made by the pages in the window that were
+     * served from the HTTP cache of the browser (cacheHitCount) or from the network
+     * (cacheMissCount), and the estimated total number of response bytes served from the cache,
+     * since the window was created. The browser does not report where a response came from, so the
+     * estimate is a heuristic: a response is counted as a cache hit if it was generated (according
+     * to its Date and Age headers) more than a minute before the request was made. Thus responses
+     * without a valid Date header and cache entries revalidated with the server are counted as
+     * misses, responses cached for less than a minute may be counted as misses, and a server clock
+     * that lags behind by more than a minute makes network responses count as hits.
+     */
+    uint64_t cacheHitCount;
+    uint64_t cacheMissCount;
+    uint64_t cacheBytesSaved;
+
+    /* Current CPU scheduling priority (nice value, -20 to 19) and I/O priority (best-effort level,
+     * 0 to 7; lower values mean higher priority) of the main browser process rendering the content
+     * of the window. If the priorities are not known, rendererIOPriority is -1 and rendererNice
+     * should be ignored.
+     */
+    int32_t rendererNice;
+    int32_t rendererIOPriority;
+
+};
+typedef struct VicePluginAPI_WindowStats VicePluginAPI_WindowStats;
+
+/* Struct of pointers to callback functions provided by the program in addition to the callbacks in
+ * VicePluginAPI_Callbacks, VicePluginAPI_DamageCallbacks, VicePluginAPI_FrameCallbacks and
+ * VicePluginAPI_DemandCallbacks. Unless otherwise noted, the same rules apply to these callbacks as
+ * to the callbacks in VicePluginAPI_Callbacks.
+ */
+struct VicePluginAPI_StatsCallbacks {
+
+    /* Fills *stats with the current resource usage of given open window (see the structSize field
+     * of VicePluginAPI_WindowStats). The program may return zeros for statistics it cannot
+     * measure. The plugin may call this callback at any time for any
+     * open window, but as computing the statistics may be relatively costly, it should only do so
+     * on request (such as when serving a status page).
+     */
+    void (*queryWindowStats)(void*, uint64_t window, VicePluginAPI_WindowStats* stats);
+
+};
+typedef struct VicePluginAPI_StatsCallbacks VicePluginAPI_StatsCallbacks;
+
+/* Same as vicePluginAPI_startWithDemandCallbacks, except that the program additionally provides the
+ * stats callbacks (which also receive callbackData as the first argument). Must be used instead of
+ * vicePluginAPI_start, vicePluginAPI_startWithDamageCallbacks,
+ * vicePluginAPI_startWithFrameCallbacks and vicePluginAPI_startWithDemandCallbacks to start
+ * contexts initialized with apiVersion 1000004.
+ */
+void vicePluginAPI_startWithStatsCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    VicePluginAPI_FrameCallbacks frameCallbacks,
+    VicePluginAPI_DemandCallbacks demandCallbacks,
+    VicePluginAPI_StatsCallbacks statsCallbacks,
+    void* callbackData
+);
+
 #ifdef __cplusplus
 }
 #endif
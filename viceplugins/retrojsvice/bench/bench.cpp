@@ -0,0 +1,594 @@
+// Standalone benchmark for the image encoders (PNGCompressor and compressJPEG).
+//
+// Usage: retrojsvice_bench [-i ITERATIONS] [-t THREADCOUNTS] PATH...
+//
+// Each PATH is either an image file (PNG or JPEG), a frame capture file
+// recorded using the frame-capture-dir plugin option (up to 50 evenly spaced
+// frames are used) or a directory from which all such files are loaded
+// (non-recursively); the images form the benchmark corpus. Every encoder mode
+// is run over the corpus ITERATIONS times (default 5) after one warmup pass,
+// PNG modes once for each thread count in the comma-separated list
+// THREADCOUNTS (default 1,2,4). The results are written to stdout as JSON;
+// progress information is written to stderr.
+//
+// For each mode, the throughput (mbPerSec, in terms of the uncompressed BGRA
+// input) and the per-frame latencies are measured using the production code
+// path. For PNG, the average per-frame time of each stage (stageMs, summed over
+// all threads) is measured in a separate pass using
+// PNGCompressor::compressProfiled.
+
+#include "../src/frame_capture.hpp"
+#include "../src/jpeg.hpp"
+#include "../src/png.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+static void check(
+    bool condVal,
+    const char* condStr,
+    const char* condFile,
+    int condLine
+) {
+    if(!condVal) {
+        std::cerr << "FATAL ERROR " << condFile << ":" << condLine << ": ";
+        std::cerr << "Condition '" << condStr << "' does not hold\n";
+        abort();
+    }
+}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Image in the format expected by the encoders, with pitch equal to width.
+struct Frame {
+    std::string name;
+    size_t width;
+    size_t height;
+    std::vector<uint8_t> bgra;
+};
+
+uint32_t readU32(const uint8_t* pos) {
+    return
+        ((uint32_t)pos[0] << 24) | ((uint32_t)pos[1] << 16) |
+        ((uint32_t)pos[2] << 8) | (uint32_t)pos[3];
+}
+
+// Minimal PNG decoder supporting non-interlaced images with bit depth 8.
+std::optional<Frame> decodePNG(const std::vector<uint8_t>& data) {
+    std::optional<Frame> fail;
+
+    size_t width = 0;
+    size_t height = 0;
+    int colorType = -1;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> idat;
+
+    size_t pos = 8;
+    while(pos + 12 <= data.size()) {
+        size_t length = readU32(&data[pos]);
+        std::string type((const char*)&data[pos + 4], 4);
+        if(length > data.size() - pos - 12) {
+            return fail;
+        }
+        const uint8_t* body = &data[pos + 8];
+
+        if(type == "IHDR") {
+            if(length != 13) {
+                return fail;
+            }
+            width = readU32(body);
+            height = readU32(body + 4);
+            int bitDepth = body[8];
+            colorType = body[9];
+            int interlace = body[12];
+            if(bitDepth != 8 || interlace != 0) {
+                return fail;
+            }
+        } else if(type == "PLTE") {
+            palette.assign(body, body + length);
+        } else if(type == "IDAT") {
+            idat.insert(idat.end(), body, body + length);
+        } else if(type == "IEND") {
+            break;
+        }
+        pos += length + 12;
+    }
+
+    size_t channels;
+    if(colorType == 0) {
+        channels = 1;
+    } else if(colorType == 2) {
+        channels = 3;
+    } else if(colorType == 3) {
+        channels = 1;
+    } else if(colorType == 4) {
+        channels = 2;
+    } else if(colorType == 6) {
+        channels = 4;
+    } else {
+        return fail;
+    }
+    if(width == 0 || height == 0) {
+        return fail;
+    }
+
+    size_t stride = channels * width;
+    std::vector<uint8_t> raw(height * (stride + 1));
+    uLongf rawLength = raw.size();
+    if(
+        uncompress(raw.data(), &rawLength, idat.data(), idat.size()) != Z_OK ||
+        rawLength != raw.size()
+    ) {
+        return fail;
+    }
+
+    std::vector<uint8_t> pixels(height * stride);
+    for(size_t y = 0; y < height; ++y) {
+        int filter = raw[y * (stride + 1)];
+        const uint8_t* src = &raw[y * (stride + 1) + 1];
+        uint8_t* line = &pixels[y * stride];
+        const uint8_t* up = y ? line - stride : nullptr;
+        for(size_t i = 0; i < stride; ++i) {
+            int a = i >= channels ? line[i - channels] : 0;
+            int b = up != nullptr ? up[i] : 0;
+            int c = (up != nullptr && i >= channels) ? up[i - channels] : 0;
+            int pred;
+            if(filter == 0) {
+                pred = 0;
+            } else if(filter == 1) {
+                pred = a;
+            } else if(filter == 2) {
+                pred = b;
+            } else if(filter == 3) {
+                pred = (a + b) / 2;
+            } else if(filter == 4) {
+                int p = a + b - c;
+                int pa = std::abs(p - a);
+                int pb = std::abs(p - b);
+                int pc = std::abs(p - c);
+                if(pa <= pb && pa <= pc) {
+                    pred = a;
+                } else if(pb <= pc) {
+                    pred = b;
+                } else {
+                    pred = c;
+                }
+            } else {
+                return fail;
+            }
+            line[i] = (uint8_t)(src[i] + pred);
+        }
+    }
+
+    Frame frame;
+    frame.width = width;
+    frame.height = height;
+    frame.bgra.resize(4 * width * height);
+    for(size_t i = 0; i < width * height; ++i) {
+        const uint8_t* src = &pixels[channels * i];
+        uint8_t r;
+        uint8_t g;
+        uint8_t b;
+        if(colorType == 0 || colorType == 4) {
+            r = g = b = src[0];
+        } else if(colorType == 3) {
+            if(3 * (size_t)src[0] + 3 > palette.size()) {
+                return fail;
+            }
+            r = palette[3 * src[0]];
+            g = palette[3 * src[0] + 1];
+            b = palette[3 * src[0] + 2];
+        } else {
+            r = src[0];
+            g = src[1];
+            b = src[2];
+        }
+        uint8_t* dest = &frame.bgra[4 * i];
+        dest[0] = b;
+        dest[1] = g;
+        dest[2] = r;
+        dest[3] = 255;
+    }
+    return frame;
+}
+
+std::optional<Frame> decodeJPEG(const std::vector<uint8_t>& data) {
+    Frame frame;
+    std::vector<uint8_t> rgb =
+        decompressJPEG(data.data(), data.size(), frame.width, frame.height);
+
+    frame.bgra.resize(4 * frame.width * frame.height);
+    for(size_t i = 0; i < frame.width * frame.height; ++i) {
+        frame.bgra[4 * i] = rgb[3 * i + 2];
+        frame.bgra[4 * i + 1] = rgb[3 * i + 1];
+        frame.bgra[4 * i + 2] = rgb[3 * i];
+        frame.bgra[4 * i + 3] = 255;
+    }
+    return frame;
+}
+
+const size_t MaxCaptureFrames = 50;
+
+// Returns false if the file is not supported.
+bool loadFile(const std::string& path, std::vector<Frame>& corpus) {
+    std::ifstream fp(path, std::ios::binary);
+    std::vector<uint8_t> data(
+        (std::istreambuf_iterator<char>(fp)),
+        std::istreambuf_iterator<char>()
+    );
+
+    const uint8_t pngSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    const char captureMagic[7] = {'R', 'J', 'V', 'C', 'A', 'P', 'T'};
+    std::optional<Frame> frame;
+    if(data.size() >= 8 && !memcmp(data.data(), pngSignature, 8)) {
+        frame = decodePNG(data);
+    } else if(data.size() >= 2 && data[0] == 0xFF && data[1] == 0xD8) {
+        frame = decodeJPEG(data);
+    } else if(data.size() >= 7 && !memcmp(data.data(), captureMagic, 7)) {
+        data.clear();
+        std::shared_ptr<retrojsvice::FrameCaptureReader> reader =
+            retrojsvice::FrameCaptureReader::tryOpen(path);
+        if(!reader) {
+            return false;
+        }
+        size_t frameCount = reader->frameCount();
+        size_t count = std::min(frameCount, MaxCaptureFrames);
+        for(size_t i = 0; i < count; ++i) {
+            size_t idx = frameCount * i / count;
+            retrojsvice::CapturedFrame captured = reader->readFrame(idx);
+
+            Frame frame;
+            frame.name = path + "#" + std::to_string(idx);
+            frame.width = captured.width;
+            frame.height = captured.height;
+            frame.bgra = std::move(captured.image);
+            corpus.push_back(std::move(frame));
+        }
+        return true;
+    }
+
+    if(frame) {
+        frame->name = path;
+        corpus.push_back(std::move(*frame));
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void loadCorpus(const std::string& path, std::vector<Frame>& corpus) {
+    struct stat st;
+    if(stat(path.c_str(), &st)) {
+        std::cerr << "WARNING: Could not access '" << path << "', skipping\n";
+        return;
+    }
+
+    if(S_ISDIR(st.st_mode)) {
+        std::vector<std::string> names;
+        DIR* dir = opendir(path.c_str());
+        CHECK(dir != nullptr);
+        while(dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if(name != "." && name != "..") {
+                names.push_back(name);
+            }
+        }
+        closedir(dir);
+
+        std::sort(names.begin(), names.end());
+        for(const std::string& name : names) {
+            std::string filePath = path + "/" + name;
+            if(!stat(filePath.c_str(), &st) && S_ISREG(st.st_mode)) {
+                loadFile(filePath, corpus);
+            }
+        }
+    } else {
+        if(!loadFile(path, corpus)) {
+            std::cerr <<
+                "WARNING: Unsupported file '" << path << "', skipping\n";
+        }
+    }
+}
+
+struct Mode {
+    std::string name;
+    bool png;
+    PNGCompressor::Settings pngSettings;
+    JPEGSettings jpegSettings;
+};
+
+std::vector<Mode> encoderModes() {
+    std::vector<Mode> modes;
+
+    auto pngMode = [&](
+        std::string name,
+        int level,
+        PNGCompressor::Strategy strategy
+    ) {
+        Mode mode;
+        mode.name = std::move(name);
+        mode.png = true;
+        mode.pngSettings.level = level;
+        mode.pngSettings.strategy = strategy;
+        modes.push_back(mode);
+    };
+    pngMode("png-l1-rle", 1, PNGCompressor::Strategy::RLE);
+    pngMode("png-l1-huffman", 1, PNGCompressor::Strategy::HuffmanOnly);
+    pngMode("png-l3-filtered", 3, PNGCompressor::Strategy::Filtered);
+    pngMode("png-l6-default", 6, PNGCompressor::Strategy::Default);
+
+    auto jpegMode = [&](
+        std::string name,
+        int quality,
+        JPEGDCTMethod dctMethod,
+        bool optimizeCoding
+    ) {
+        Mode mode;
+        mode.name = std::move(name);
+        mode.png = false;
+        mode.jpegSettings.quality = quality;
+        mode.jpegSettings.dctMethod = dctMethod;
+        mode.jpegSettings.optimizeCoding = optimizeCoding;
+        modes.push_back(mode);
+    };
+    for(int quality : {30, 60, 80, 90, 100}) {
+        jpegMode(
+            "jpeg-q" + std::to_string(quality),
+            quality,
+            JPEGDCTMethod::Auto,
+            false
+        );
+    }
+    jpegMode("jpeg-q80-accurate", 80, JPEGDCTMethod::Accurate, false);
+    jpegMode("jpeg-q80-float", 80, JPEGDCTMethod::Float, false);
+    jpegMode("jpeg-q80-optimized", 80, JPEGDCTMethod::Auto, true);
+
+    return modes;
+}
+
+double toMs(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Nearest-rank percentile of sorted values.
+double percentile(const std::vector<double>& sorted, double p) {
+    CHECK(!sorted.empty());
+    size_t rank = (size_t)(p * (double)sorted.size() + 0.999999);
+    rank = std::max(rank, (size_t)1);
+    rank = std::min(rank, sorted.size());
+    return sorted[rank - 1];
+}
+
+size_t encode(
+    const Mode& mode,
+    PNGCompressor* pngCompressor,
+    const Frame& frame,
+    PNGCompressor::StageTimes* stageTimes
+) {
+    if(mode.png) {
+        std::vector<std::vector<uint8_t>> chunks;
+        if(stageTimes != nullptr) {
+            chunks = pngCompressor->compressProfiled(
+                frame.bgra.data(),
+                frame.width,
+                frame.height,
+                frame.width,
+                mode.pngSettings,
+                *stageTimes
+            );
+        } else {
+            chunks = pngCompressor->compress(
+                frame.bgra.data(),
+                frame.width,
+                frame.height,
+                frame.width,
+                mode.pngSettings
+            );
+        }
+        size_t size = 0;
+        for(const std::vector<uint8_t>& chunk : chunks) {
+            size += chunk.size();
+        }
+        return size;
+    } else {
+        return compressJPEG(
+            frame.bgra.data(),
+            frame.width,
+            frame.height,
+            frame.width,
+            mode.jpegSettings
+        ).length;
+    }
+}
+
+void runMode(
+    const Mode& mode,
+    size_t threadCount,
+    const std::vector<Frame>& corpus,
+    int iterations,
+    std::ostream& out
+) {
+    std::cerr << "Running " << mode.name << " with " << threadCount;
+    std::cerr << " thread(s)\n";
+
+    std::unique_ptr<PNGCompressor> pngCompressor;
+    if(mode.png) {
+        pngCompressor.reset(new PNGCompressor(threadCount));
+    }
+
+    for(const Frame& frame : corpus) {
+        encode(mode, pngCompressor.get(), frame, nullptr);
+    }
+
+    std::vector<double> latencies;
+    Clock::duration totalTime = Clock::duration::zero();
+    uint64_t totalInputBytes = 0;
+    uint64_t totalSize = 0;
+    for(int iter = 0; iter < iterations; ++iter) {
+        for(const Frame& frame : corpus) {
+            Clock::time_point start = Clock::now();
+            size_t size = encode(mode, pngCompressor.get(), frame, nullptr);
+            Clock::duration time = Clock::now() - start;
+
+            latencies.push_back(toMs(time));
+            totalTime += time;
+            totalInputBytes += frame.bgra.size();
+            totalSize += size;
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    // Stage times are measured in a separate pass, as the profiled compression
+    // path is slower than the production one
+    PNGCompressor::StageTimes stageTimes;
+    if(mode.png) {
+        for(const Frame& frame : corpus) {
+            encode(mode, pngCompressor.get(), frame, &stageTimes);
+        }
+    }
+
+    double sampleCount = (double)latencies.size();
+    double seconds = std::chrono::duration<double>(totalTime).count();
+
+    out << "    {\"mode\": \"" << mode.name << "\", ";
+    out << "\"encoder\": \"" << (mode.png ? "png" : "jpeg") << "\", ";
+    out << "\"threads\": " << threadCount << ", ";
+    out << "\"samples\": " << latencies.size() << ", ";
+    out << "\"mbPerSec\": " << (double)totalInputBytes / 1e6 / seconds << ", ";
+    out << "\"avgSize\": " << (double)totalSize / sampleCount << ", ";
+    out << "\"compressionRatio\": ";
+    out << (double)totalInputBytes / (double)totalSize << ", ";
+    out << "\"avgMs\": " << toMs(totalTime) / sampleCount << ", ";
+    out << "\"p50Ms\": " << percentile(latencies, 0.5) << ", ";
+    out << "\"p99Ms\": " << percentile(latencies, 0.99);
+    if(mode.png) {
+        double frameCount = (double)corpus.size();
+        out << ", \"stageMs\": {";
+        out << "\"swizzle\": " << toMs(stageTimes.swizzle) / frameCount << ", ";
+        out << "\"filter\": " << toMs(stageTimes.filter) / frameCount << ", ";
+        out << "\"deflate\": " << toMs(stageTimes.deflate) / frameCount << ", ";
+        out << "\"crc\": " << toMs(stageTimes.crc) / frameCount << "}";
+    }
+    out << "}";
+}
+
+std::string jsonEscape(const std::string& src) {
+    std::string ret;
+    for(char c : src) {
+        if(c == '"' || c == '\\') {
+            ret.push_back('\\');
+            ret.push_back(c);
+        } else if((unsigned char)c < 32) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", (int)(unsigned char)c);
+            ret += buf;
+        } else {
+            ret.push_back(c);
+        }
+    }
+    return ret;
+}
+
+void usage(const char* programName) {
+    std::cerr << "Usage: " << programName;
+    std::cerr << " [-i ITERATIONS] [-t THREADCOUNTS] PATH...\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = 5;
+    std::vector<size_t> threadCounts = {1, 2, 4};
+    std::vector<std::string> paths;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if((arg == "-i" || arg == "-t") && i + 1 < argc) {
+            std::string value = argv[++i];
+            if(arg == "-i") {
+                iterations = atoi(value.c_str());
+                if(iterations <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else {
+                threadCounts.clear();
+                std::stringstream ss(value);
+                std::string item;
+                while(std::getline(ss, item, ',')) {
+                    int threadCount = atoi(item.c_str());
+                    if(threadCount <= 0) {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    threadCounts.push_back((size_t)threadCount);
+                }
+            }
+        } else if(!arg.empty() && arg[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    std::vector<Frame> corpus;
+    for(const std::string& path : paths) {
+        loadCorpus(path, corpus);
+    }
+    if(corpus.empty() || threadCounts.empty()) {
+        std::cerr << "ERROR: Empty corpus\n";
+        usage(argv[0]);
+        return 1;
+    }
+    std::cerr << "Loaded " << corpus.size() << " frame(s)\n";
+
+    std::ostream& out = std::cout;
+    out << "{\n";
+    out << "  \"iterations\": " << iterations << ",\n";
+    out << "  \"corpus\": [\n";
+    for(size_t i = 0; i < corpus.size(); ++i) {
+        const Frame& frame = corpus[i];
+        out << "    {\"name\": \"" << jsonEscape(frame.name) << "\", ";
+        out << "\"width\": " << frame.width << ", ";
+        out << "\"height\": " << frame.height << "}";
+        out << (i + 1 < corpus.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n";
+    out << "  \"results\": [\n";
+    bool first = true;
+    for(const Mode& mode : encoderModes()) {
+        // The JPEG encoder is single-threaded
+        std::vector<size_t> modeThreadCounts =
+            mode.png ? threadCounts : std::vector<size_t>{1};
+        for(size_t threadCount : modeThreadCounts) {
+            if(!first) {
+                out << ",\n";
+            }
+            first = false;
+            runMode(mode, threadCount, corpus, iterations, out);
+        }
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+
+    return 0;
+}
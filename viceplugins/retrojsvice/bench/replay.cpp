@@ -0,0 +1,401 @@
+// Replays a frame capture recorded using the frame-capture-dir plugin option
+// through the image pipeline (ImageCompressor and the HTTP server) without a
+// browser, making it possible to profile the compress-send path
+// deterministically.
+//
+// Usage: retrojsvice_replay [-m] [-q QUALITY] [-p PORT] CAPTUREFILE
+//
+// The frames are fed to the ImageCompressor at their original timing or, if -m
+// is given, each frame as soon as the previous one has been fetched for
+// compression. A client thread polls the compressed images over HTTP from a
+// server listening on 127.0.0.1:PORT (default 8090), similarly to the browser
+// client. QUALITY is the image quality (10..100 for JPEG, 101 for PNG; default
+// 101). When all the frames have been fed and the last one has been received by
+// the client, a summary is written to stdout as JSON.
+
+#include "../src/frame_capture.hpp"
+#include "../src/http.hpp"
+#include "../src/image_compressor.hpp"
+#include "../src/task_queue.hpp"
+
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+
+namespace retrojsvice {
+
+namespace {
+
+double toMs(steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Nearest-rank percentile of sorted values.
+double percentile(const vector<double>& sorted, double p) {
+    if(sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(p * (double)sorted.size() + 0.999999);
+    rank = max(rank, (size_t)1);
+    rank = min(rank, sorted.size());
+    return sorted[rank - 1];
+}
+
+}
+
+class ReplayDriver :
+    public TaskQueueEventHandler,
+    public HTTPServerEventHandler,
+    public ImageCompressorEventHandler,
+    public enable_shared_from_this<ReplayDriver>
+{
+SHARED_ONLY_CLASS(ReplayDriver);
+public:
+    ReplayDriver(CKey,
+        shared_ptr<FrameCaptureReader> reader,
+        bool maxSpeed,
+        int quality,
+        int port
+    ) {
+        reader_ = reader;
+        maxSpeed_ = maxSpeed;
+        quality_ = quality;
+        port_ = port;
+
+        runTasksPending_ = false;
+        shutdownComplete_ = false;
+
+        fetchedCount_ = 0;
+        feedingDone_ = false;
+        lastFrameFetched_ = false;
+        shuttingDown_ = false;
+
+        responseBytes_ = 0;
+    }
+
+    // Runs the replay in the calling thread (which acts as the API thread) and
+    // writes the summary to out.
+    void run(ostream& out) {
+        REQUIRE_API_THREAD();
+
+        shared_ptr<ReplayDriver> self = shared_from_this();
+        taskQueue_ = TaskQueue::create(self);
+
+        {
+            ActiveTaskQueueLock activeTaskQueueLock(taskQueue_);
+
+            optional<SocketAddress> listenAddr =
+                SocketAddress::parse("127.0.0.1:" + toString(port_));
+            REQUIRE(listenAddr.has_value());
+            httpServer_ = HTTPServer::create(self, *listenAddr, 4);
+
+            imageCompressor_ = ImageCompressor::create(
+                self, milliseconds(2000), quality_, "", 0, nullptr, nullptr, nullptr
+            );
+
+            startTime_ = steady_clock::now();
+
+            thread feederThread([self, taskQueue{taskQueue_}]() {
+                ActiveTaskQueueLock activeTaskQueueLock(taskQueue);
+                self->runFeeder_();
+            });
+            thread clientThread([self, taskQueue{taskQueue_}]() {
+                ActiveTaskQueueLock activeTaskQueueLock(taskQueue);
+                self->runClient_();
+            });
+
+            while(true) {
+                {
+                    unique_lock<mutex> lock(mutex_);
+                    while(!runTasksPending_ && !shutdownComplete_) {
+                        cv_.wait(lock);
+                    }
+                    if(shutdownComplete_) {
+                        break;
+                    }
+                    runTasksPending_ = false;
+                }
+                taskQueue_->runTasks(mce);
+            }
+
+            feederThread.join();
+            clientThread.join();
+
+            endTime_ = steady_clock::now();
+
+            imageCompressor_.reset();
+            httpServer_.reset();
+        }
+        taskQueue_.reset();
+
+        writeSummary_(out);
+    }
+
+    // TaskQueueEventHandler:
+    virtual void onTaskQueueNeedsRunTasks() override {
+        {
+            lock_guard<mutex> lock(mutex_);
+            runTasksPending_ = true;
+        }
+        cv_.notify_all();
+    }
+    virtual void onTaskQueueShutdownComplete() override {
+        REQUIRE_API_THREAD();
+        {
+            lock_guard<mutex> lock(mutex_);
+            shutdownComplete_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    // HTTPServerEventHandler:
+    virtual void onHTTPServerRequest(shared_ptr<HTTPRequest> request) override {
+        REQUIRE_API_THREAD();
+
+        if(shuttingDown_) {
+            request->sendTextResponse(503, "ERROR: Replay finished\n");
+        } else {
+            imageCompressor_->sendCompressedImageWait(mce, request);
+        }
+    }
+    virtual void onHTTPServerShutdownComplete() override {
+        REQUIRE_API_THREAD();
+        taskQueue_->shutdown();
+    }
+
+    // ImageCompressorEventHandler:
+    virtual void onImageCompressorFetchImage(
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
+    ) override {
+        REQUIRE_API_THREAD();
+        REQUIRE(currentFrame_);
+
+        func(
+            currentFrame_->image.data(),
+            currentFrame_->width,
+            currentFrame_->height,
+            currentFrame_->width,
+            {},
+            currentFrame_
+        );
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            ++fetchedCount_;
+            fetchedIdx_ = currentIdx_;
+            if(feedingDone_ && currentIdx_ + 1 == reader_->frameCount()) {
+                lastFrameFetched_ = true;
+            }
+        }
+        cv_.notify_all();
+    }
+    virtual bool onImageCompressorHasGUI() override {
+        return false;
+    }
+    virtual void onImageCompressorRenderGUI(
+        vector<uint8_t>& data, size_t width, size_t height
+    ) override {}
+
+private:
+    void runFeeder_() {
+        size_t frameCount = reader_->frameCount();
+        optional<steady_clock::duration> firstTimestamp;
+
+        for(size_t idx = 0; idx < frameCount; ++idx) {
+            shared_ptr<CapturedFrame> frame =
+                make_shared<CapturedFrame>(reader_->readFrame(idx));
+
+            if(maxSpeed_) {
+                if(idx) {
+                    unique_lock<mutex> lock(mutex_);
+                    while(!fetchedIdx_ || *fetchedIdx_ + 1 != idx) {
+                        cv_.wait(lock);
+                    }
+                }
+            } else {
+                if(!firstTimestamp) {
+                    firstTimestamp = frame->timestamp;
+                }
+                std::this_thread::sleep_until(
+                    startTime_ + (frame->timestamp - *firstTimestamp)
+                );
+            }
+
+            {
+                lock_guard<mutex> lock(mutex_);
+                feedingDone_ = idx + 1 == frameCount;
+            }
+
+            shared_ptr<ReplayDriver> self = shared_from_this();
+            postTask([self, frame, idx]() {
+                self->currentFrame_ = frame;
+                self->currentIdx_ = idx;
+                self->imageCompressor_->setIframeSignal(mce, frame->iframeSignal);
+                self->imageCompressor_->setCursorSignal(mce, frame->cursorSignal);
+                self->imageCompressor_->updateNotify(mce);
+            });
+        }
+    }
+
+    void runClient_() {
+        Poco::Net::HTTPClientSession session("127.0.0.1", (Poco::UInt16)port_);
+        session.setKeepAlive(true);
+
+        for(uint64_t i = 1; ; ++i) {
+            bool last;
+            {
+                lock_guard<mutex> lock(mutex_);
+                last = lastFrameFetched_;
+            }
+
+            steady_clock::time_point start = steady_clock::now();
+
+            Poco::Net::HTTPRequest request(
+                Poco::Net::HTTPRequest::HTTP_GET,
+                "/image/" + toString(i) + "/",
+                Poco::Net::HTTPMessage::HTTP_1_1
+            );
+            session.sendRequest(request);
+
+            Poco::Net::HTTPResponse response;
+            istream& body = session.receiveResponse(response);
+            uint64_t size = 0;
+            char buf[65536];
+            while(body.read(buf, sizeof(buf)) || body.gcount()) {
+                size += (uint64_t)body.gcount();
+            }
+            REQUIRE(response.getStatus() == Poco::Net::HTTPResponse::HTTP_OK);
+
+            latencies_.push_back(toMs(steady_clock::now() - start));
+            responseBytes_ += size;
+
+            // The response to a request made after the last frame was fetched
+            // contains the last frame.
+            if(last) {
+                break;
+            }
+        }
+
+        shared_ptr<ReplayDriver> self = shared_from_this();
+        postTask([self]() {
+            self->shuttingDown_ = true;
+            self->imageCompressor_->stopFetching();
+            self->httpServer_->shutdown();
+        });
+    }
+
+    void writeSummary_(ostream& out) {
+        sort(latencies_.begin(), latencies_.end());
+
+        double seconds = toMs(endTime_ - startTime_) / 1000.0;
+        out << "{\n";
+        out << "  \"frames\": " << reader_->frameCount() << ",\n";
+        out << "  \"framesCompressed\": " << fetchedCount_ << ",\n";
+        out << "  \"responses\": " << latencies_.size() << ",\n";
+        out << "  \"responseBytes\": " << responseBytes_ << ",\n";
+        out << "  \"seconds\": " << seconds << ",\n";
+        out << "  \"framesPerSec\": " << (double)fetchedCount_ / seconds << ",\n";
+        out << "  \"mbPerSec\": " << (double)responseBytes_ / 1e6 / seconds << ",\n";
+        out << "  \"p50Ms\": " << percentile(latencies_, 0.5) << ",\n";
+        out << "  \"p99Ms\": " << percentile(latencies_, 0.99) << "\n";
+        out << "}\n";
+    }
+
+    shared_ptr<FrameCaptureReader> reader_;
+    bool maxSpeed_;
+    int quality_;
+    int port_;
+
+    shared_ptr<TaskQueue> taskQueue_;
+    shared_ptr<HTTPServer> httpServer_;
+    shared_ptr<ImageCompressor> imageCompressor_;
+
+    steady_clock::time_point startTime_;
+    steady_clock::time_point endTime_;
+
+    mutex mutex_;
+    condition_variable cv_;
+    bool runTasksPending_;
+    bool shutdownComplete_;
+    size_t fetchedCount_;
+    optional<size_t> fetchedIdx_;
+    bool feedingDone_;
+    bool lastFrameFetched_;
+
+    // Accessed only by the API thread.
+    shared_ptr<CapturedFrame> currentFrame_;
+    size_t currentIdx_;
+    bool shuttingDown_;
+
+    // Accessed only by the client thread.
+    vector<double> latencies_;
+    uint64_t responseBytes_;
+};
+
+}
+
+using namespace retrojsvice;
+
+namespace {
+
+void usage(const char* programName) {
+    cerr << "Usage: " << programName;
+    cerr << " [-m] [-q QUALITY] [-p PORT] CAPTUREFILE\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    bool maxSpeed = false;
+    int quality = 101;
+    int port = 8090;
+    string path;
+
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if(arg == "-m") {
+            maxSpeed = true;
+        } else if((arg == "-q" || arg == "-p") && i + 1 < argc) {
+            optional<int> value = parseString<int>(argv[++i]);
+            if(arg == "-q" && value && *value >= 10 && *value <= 101) {
+                quality = *value;
+            } else if(arg == "-p" && value && *value > 0 && *value < 65536) {
+                port = *value;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if(path.empty() && !arg.empty() && arg[0] != '-') {
+            path = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(path.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    shared_ptr<FrameCaptureReader> reader = FrameCaptureReader::tryOpen(path);
+    if(!reader) {
+        return 1;
+    }
+    if(!reader->frameCount()) {
+        cerr << "ERROR: Capture file contains no frames\n";
+        return 1;
+    }
+
+    inAPIThread_ = true;
+    ReplayDriver::create(reader, maxSpeed, quality, port)->run(std::cout);
+    inAPIThread_ = false;
+
+    return 0;
+}
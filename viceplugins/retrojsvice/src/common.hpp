@@ -75,6 +75,7 @@ using std::thread;
 using std::tie;
 using std::tuple;
 using std::uniform_int_distribution;
+using std::uniform_real_distribution;
 using std::unique_lock;
 using std::unique_ptr;
 using std::variant;
@@ -0,0 +1,247 @@
+#include "compression_effort.hpp"
+
+namespace retrojsvice {
+
+namespace {
+
+// The CPU utilization is sampled from /proc/stat at most this often.
+const steady_clock::duration CPUSampleInterval = milliseconds(500);
+
+// The fastest tier is used if the CPU utilization is at least this high; the
+// highest tier is used only if the utilization is below LowCPUUtilization and
+// no other frames are being compressed.
+const double HighCPUUtilization = 0.6;
+const double LowCPUUtilization = 0.25;
+
+// One in this many frames compressed using a higher tier is also compressed
+// using the fastest tier to measure the savings.
+const size_t MeasureInterval = 8;
+
+const steady_clock::duration ReportInterval = std::chrono::seconds(60);
+
+// Reads the busy and total CPU time summed over all cores from /proc/stat in
+// clock ticks.
+optional<pair<uint64_t, uint64_t>> readCPUTimes() {
+    ifstream fp("/proc/stat");
+    string label;
+    fp >> label;
+    if(!fp.good() || label != "cpu") {
+        return {};
+    }
+
+    // user nice system idle iowait irq softirq steal
+    uint64_t times[8];
+    for(uint64_t& time : times) {
+        if(!(fp >> time)) {
+            return {};
+        }
+    }
+
+    uint64_t total = 0;
+    for(uint64_t time : times) {
+        total += time;
+    }
+    uint64_t idle = times[3] + times[4];
+    return make_pair(total - idle, total);
+}
+
+}
+
+PNGCompressor::Settings CompressionEffortGovernor::pngSettings(int tier) {
+    REQUIRE(tier >= 0 && tier < TierCount);
+
+    PNGCompressor::Settings settings;
+    if(tier == 1) {
+        settings.level = 3;
+        settings.strategy = PNGCompressor::Strategy::Filtered;
+    } else if(tier == 2) {
+        settings.level = 6;
+        settings.strategy = PNGCompressor::Strategy::Default;
+    }
+    return settings;
+}
+
+JPEGSettings CompressionEffortGovernor::jpegSettings(int tier, int quality) {
+    REQUIRE(tier >= 0 && tier < TierCount);
+
+    JPEGSettings settings;
+    settings.quality = quality;
+    if(tier >= 1) {
+        settings.optimizeCoding = true;
+    }
+    if(tier >= 2) {
+        settings.dctMethod = JPEGDCTMethod::Accurate;
+    }
+    return settings;
+}
+
+CompressionEffortGovernor::CompressionEffortGovernor(CKey) {
+    coreCount_ = max((size_t)thread::hardware_concurrency(), (size_t)1);
+
+    activeCount_ = 0;
+
+    cpuSampleTime_ = steady_clock::now();
+    cpuUtilization_ = 1.0;
+    if(optional<pair<uint64_t, uint64_t>> times = readCPUTimes()) {
+        cpuStatAvailable_ = true;
+        tie(cpuBusyTime_, cpuTotalTime_) = *times;
+    } else {
+        WARNING_LOG(
+            "Could not read CPU utilization from /proc/stat, ",
+            "compression effort governor will always use the fastest tier"
+        );
+        cpuStatAvailable_ = false;
+        cpuBusyTime_ = 0;
+        cpuTotalTime_ = 0;
+    }
+
+    framesSinceMeasure_ = 0;
+    lastReportTime_ = steady_clock::now();
+}
+
+CompressionEffortGovernor::~CompressionEffortGovernor() {
+    lock_guard<mutex> lock(mutex_);
+    REQUIRE(!activeCount_);
+    logReport_();
+}
+
+CompressionEffortGovernor::FrameEffort CompressionEffortGovernor::beginFrame(
+    bool backlogged
+) {
+    lock_guard<mutex> lock(mutex_);
+
+    updateCPUUtilization_();
+
+    // Each PNG compression may keep up to 4 cores busy; make sure that there
+    // are enough cores for the concurrent compressions.
+    size_t maxConcurrent = max(coreCount_ / 4, (size_t)1);
+
+    int tier;
+    if(
+        backlogged ||
+        cpuUtilization_ >= HighCPUUtilization ||
+        activeCount_ >= maxConcurrent
+    ) {
+        tier = 0;
+    } else if(cpuUtilization_ < LowCPUUtilization && !activeCount_) {
+        tier = 2;
+    } else {
+        tier = 1;
+    }
+
+    ++activeCount_;
+
+    bool measureSavings = false;
+    if(tier) {
+        ++framesSinceMeasure_;
+        if(framesSinceMeasure_ >= MeasureInterval) {
+            framesSinceMeasure_ = 0;
+            measureSavings = true;
+        }
+    }
+
+    return {tier, measureSavings};
+}
+
+void CompressionEffortGovernor::endFrame(
+    int tier,
+    uint64_t size,
+    optional<uint64_t> fastestSize
+) {
+    REQUIRE(tier >= 0 && tier < TierCount);
+
+    lock_guard<mutex> lock(mutex_);
+    REQUIRE(activeCount_);
+    --activeCount_;
+
+    TierStats& stats = stats_[tier];
+    ++stats.frameCount;
+    stats.totalSize += size;
+    if(fastestSize) {
+        stats.measuredSize += size;
+        stats.measuredFastestSize += *fastestSize;
+    }
+
+    if(steady_clock::now() - lastReportTime_ >= ReportInterval) {
+        logReport_();
+    }
+}
+
+void CompressionEffortGovernor::updateCPUUtilization_() {
+    if(!cpuStatAvailable_) {
+        return;
+    }
+
+    steady_clock::time_point now = steady_clock::now();
+    if(now - cpuSampleTime_ < CPUSampleInterval) {
+        return;
+    }
+
+    optional<pair<uint64_t, uint64_t>> times = readCPUTimes();
+    if(!times) {
+        return;
+    }
+    uint64_t busyTime;
+    uint64_t totalTime;
+    tie(busyTime, totalTime) = *times;
+
+    if(totalTime > cpuTotalTime_ && busyTime >= cpuBusyTime_) {
+        cpuUtilization_ =
+            (double)(busyTime - cpuBusyTime_) /
+            (double)(totalTime - cpuTotalTime_);
+        cpuUtilization_ = min(cpuUtilization_, 1.0);
+
+        cpuSampleTime_ = now;
+        cpuBusyTime_ = busyTime;
+        cpuTotalTime_ = totalTime;
+    }
+}
+
+void CompressionEffortGovernor::logReport_() {
+    lastReportTime_ = steady_clock::now();
+
+    uint64_t frameCount = 0;
+    for(const TierStats& stats : stats_) {
+        frameCount += stats.frameCount;
+    }
+    if(!frameCount) {
+        return;
+    }
+
+    // Estimate the total size had all frames been compressed using tier 0 by
+    // scaling the sizes of the higher tiers by their measured ratios.
+    double totalSize = 0.0;
+    double estimatedFastestSize = 0.0;
+
+    stringstream msg;
+    msg << std::fixed;
+    msg.precision(1);
+    msg << "Compression effort tiers:";
+    for(int tier = 0; tier < TierCount; ++tier) {
+        const TierStats& stats = stats_[tier];
+
+        double size = (double)stats.totalSize;
+        double fastestSize = size;
+        if(tier && stats.measuredSize) {
+            fastestSize *=
+                (double)stats.measuredFastestSize / (double)stats.measuredSize;
+        }
+        totalSize += size;
+        estimatedFastestSize += fastestSize;
+
+        msg << " tier " << tier << " " << stats.frameCount << " frames (";
+        msg << 100.0 * (double)stats.frameCount / (double)frameCount << "%)";
+        msg << (tier + 1 < TierCount ? "," : ";");
+    }
+    msg << " estimated savings " << (int64_t)(estimatedFastestSize - totalSize);
+    msg << " B (";
+    if(estimatedFastestSize > 0.0) {
+        msg << 100.0 * (1.0 - totalSize / estimatedFastestSize);
+    } else {
+        msg << 0.0;
+    }
+    msg << "%) compared to always using tier 0";
+    INFO_LOG(msg.str());
+}
+
+}
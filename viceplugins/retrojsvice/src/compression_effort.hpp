@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "jpeg.hpp"
+#include "png.hpp"
+
+namespace retrojsvice {
+
+// Compression effort governor shared by all windows. For each frame about to be
+// compressed, the governor chooses an effort tier based on the compression
+// backlog and the CPU utilization of the host: when the CPU is mostly idle and
+// the windows keep up with their frames, the higher tiers spend more CPU time
+// to produce smaller images (higher deflate levels, optimized Huffman tables
+// and accurate DCT); under pressure, the fastest tier (the default encoder
+// settings) is used.
+//
+// To report the byte savings, every few frames compressed using a higher tier
+// are also compressed using the fastest tier for comparison. The chosen tiers
+// and the estimated savings are logged periodically.
+class CompressionEffortGovernor {
+SHARED_ONLY_CLASS(CompressionEffortGovernor);
+public:
+    // Tier 0 is the fastest.
+    static constexpr int TierCount = 3;
+
+    static PNGCompressor::Settings pngSettings(int tier);
+    static JPEGSettings jpegSettings(int tier, int quality);
+
+    CompressionEffortGovernor(CKey);
+    ~CompressionEffortGovernor();
+
+    struct FrameEffort {
+        int tier;
+
+        // If true, the frame should also be compressed using tier 0 and its
+        // size passed to endFrame as fastestSize.
+        bool measureSavings;
+    };
+
+    // Called before compressing a frame; backlogged should be true if the
+    // window already has a newer frame waiting to be compressed. Each call must
+    // be followed by a call to endFrame once the compression is done. May be
+    // called from any thread.
+    FrameEffort beginFrame(bool backlogged);
+
+    // Records the size of the compressed frame. May be called from any thread.
+    void endFrame(
+        int tier,
+        uint64_t size,
+        optional<uint64_t> fastestSize
+    );
+
+private:
+    void updateCPUUtilization_();
+    void logReport_();
+
+    size_t coreCount_;
+
+    mutex mutex_;
+    size_t activeCount_;
+
+    bool cpuStatAvailable_;
+    steady_clock::time_point cpuSampleTime_;
+    uint64_t cpuBusyTime_;
+    uint64_t cpuTotalTime_;
+    double cpuUtilization_;
+
+    size_t framesSinceMeasure_;
+    steady_clock::time_point lastReportTime_;
+
+    struct TierStats {
+        uint64_t frameCount = 0;
+        uint64_t totalSize = 0;
+
+        // Total sizes of the frames for which the tier 0 size was measured.
+        uint64_t measuredSize = 0;
+        uint64_t measuredFastestSize = 0;
+    };
+    TierStats stats_[TierCount];
+};
+
+}
@@ -1,14 +1,20 @@
 #include "context.hpp"
 
+#include "compression_effort.hpp"
 #include "download.hpp"
 #include "html.hpp"
 #include "secrets.hpp"
+#include "shadow_compressor.hpp"
 #include "upload.hpp"
 
 namespace retrojsvice {
 
 namespace {
 
+// Status page: "/status/" for HTML or "/status/json/" for JSON, optionally
+// followed by "?sort=KEY".
+regex statusPathRegex("/status/(json/)?(?:\\?sort=([a-z-]+))?");
+
 const string defaultHTTPListenAddr = "127.0.0.1:8080";
 const int defaultHTTPMaxThreads = 100;
 
@@ -85,6 +91,22 @@ string htmlEscapeString(string src) {
     return ret;
 }
 
+ImageDamage createImageDamage(
+    uint64_t sequenceNumber,
+    const VicePluginAPI_Rect* dirtyRects,
+    size_t dirtyRectCount
+) {
+    REQUIRE(dirtyRects != nullptr || !dirtyRectCount);
+
+    ImageDamage damage;
+    damage.sequenceNumber = sequenceNumber;
+    for(size_t i = 0; i < dirtyRectCount; ++i) {
+        const VicePluginAPI_Rect& rect = dirtyRects[i];
+        damage.dirtyRects.emplace_back(rect.x, rect.y, rect.width, rect.height);
+    }
+    return damage;
+}
+
 thread_local bool threadRunningPumpEvents = false;
 
 }
@@ -172,6 +194,10 @@ variant<shared_ptr<Context>, string> Context::init(
     int httpMaxThreads = defaultHTTPMaxThreads;
     string httpAuthCredentials;
     bool allowQualitySelector = true;
+    int frameCacheSize = 0;
+    double shadowCompressionRate = 0.0;
+    bool adaptiveCompressionEffort = false;
+    string frameCaptureDir;
 
     for(const pair<string, string>& option : options) {
         const string& name = option.first;
@@ -222,6 +248,32 @@ variant<shared_ptr<Context>, string> Context::init(
             } else {
                 return "Invalid value '" + value + "' for option quality-selector";
             }
+        } else if(name == "frame-cache-size") {
+            optional<int> parsed = parseString<int>(value);
+            if(!parsed.has_value() || *parsed < 0 || *parsed > 1000) {
+                return "Invalid value '" + value + "' for option frame-cache-size";
+            }
+            frameCacheSize = *parsed;
+        } else if(name == "shadow-compression-rate") {
+            optional<double> parsed = parseString<double>(value);
+            if(!parsed.has_value() || !(*parsed >= 0.0 && *parsed <= 1.0)) {
+                return "Invalid value '" + value + "' for option shadow-compression-rate";
+            }
+            shadowCompressionRate = *parsed;
+        } else if(name == "adaptive-compression-effort") {
+            string lowValue = value;
+            for(char& c : lowValue) {
+                c = tolower(c);
+            }
+            if(trueValues.count(lowValue)) {
+                adaptiveCompressionEffort = true;
+            } else if(falseValues.count(lowValue)) {
+                adaptiveCompressionEffort = false;
+            } else {
+                return "Invalid value '" + value + "' for option adaptive-compression-effort";
+            }
+        } else if(name == "frame-capture-dir") {
+            frameCaptureDir = value;
         } else {
             return "Unrecognized option '" + name + "'";
         }
@@ -234,6 +286,10 @@ variant<shared_ptr<Context>, string> Context::init(
         httpMaxThreads,
         httpAuthCredentials,
         allowQualitySelector,
+        frameCacheSize,
+        shadowCompressionRate,
+        adaptiveCompressionEffort,
+        frameCaptureDir,
         programName
     );
 }
@@ -244,6 +300,10 @@ Context::Context(CKey, CKey,
     int httpMaxThreads,
     string httpAuthCredentials,
     bool allowQualitySelector,
+    int frameCacheSize,
+    double shadowCompressionRate,
+    bool adaptiveCompressionEffort,
+    string frameCaptureDir,
     string programName
 )
     : httpListenAddr_(httpListenAddr)
@@ -254,6 +314,10 @@ Context::Context(CKey, CKey,
     httpMaxThreads_ = httpMaxThreads;
     httpAuthCredentials_ = httpAuthCredentials;
     allowQualitySelector_ = allowQualitySelector;
+    frameCacheSize_ = frameCacheSize;
+    shadowCompressionRate_ = shadowCompressionRate;
+    adaptiveCompressionEffort_ = adaptiveCompressionEffort;
+    frameCaptureDir_ = frameCaptureDir;
     programName_ = sanitizeProgramName(programName);
 
     state_ = Pending;
@@ -277,6 +341,10 @@ Context::~Context() {
 
 void Context::start(
     VicePluginAPI_Callbacks callbacks,
+    optional<VicePluginAPI_DamageCallbacks> damageCallbacks,
+    optional<VicePluginAPI_FrameCallbacks> frameCallbacks,
+    optional<VicePluginAPI_DemandCallbacks> demandCallbacks,
+    optional<VicePluginAPI_StatsCallbacks> statsCallbacks,
     void* callbackData
 ) {
     APILock apiLock(this);
@@ -292,6 +360,10 @@ void Context::start(
     INFO_LOG("Starting plugin");
 
     callbacks_ = callbacks;
+    damageCallbacks_ = damageCallbacks;
+    frameCallbacks_ = frameCallbacks;
+    demandCallbacks_ = demandCallbacks;
+    statsCallbacks_ = statsCallbacks;
     callbackData_ = callbackData;
 
     state_ = Running;
@@ -305,8 +377,21 @@ void Context::start(
         httpMaxThreads_
     );
     secretGen_ = SecretGenerator::create();
+    if(shadowCompressionRate_ > 0.0) {
+        shadowCompressor_ = ShadowCompressor::create(shadowCompressionRate_);
+    }
+    if(adaptiveCompressionEffort_) {
+        compressionEffortGovernor_ = CompressionEffortGovernor::create();
+    }
     windowManager_ = WindowManager::create(
-        shared_from_this(), secretGen_, programName_, defaultQuality_
+        shared_from_this(),
+        secretGen_,
+        programName_,
+        defaultQuality_,
+        (size_t)frameCacheSize_,
+        shadowCompressor_,
+        compressionEffortGovernor_,
+        frameCaptureDir_
     );
 
     clipboardCSRFToken_ = secretGen_->generateCSRFToken();
@@ -560,6 +645,43 @@ vector<tuple<string, string, string, string>> Context::getOptionDocs() {
         "make image quality adjustable using a quality selector widget",
         "default: yes"
     );
+    ret.emplace_back(
+        "frame-cache-size",
+        "COUNT",
+        "if nonzero, image requests are redirected to content-addressed "
+        "frame URLs that the client may cache, allowing previously seen "
+        "frames to be shown without retransmission; COUNT is the number of "
+        "recently sent frames retained per window for serving these URLs",
+        "default: 0"
+    );
+    ret.emplace_back(
+        "shadow-compression-rate",
+        "FRACTION",
+        "fraction (0..1) of frames re-encoded in the background at idle "
+        "priority using alternative encoder settings; the results are "
+        "discarded and only their size, encoding time and quality compared "
+        "to the sent frames are logged periodically",
+        "default: 0"
+    );
+    ret.emplace_back(
+        "adaptive-compression-effort",
+        "YES/NO",
+        "choose the encoder effort for each frame based on the CPU "
+        "utilization and compression backlog, producing smaller images "
+        "using more CPU time when the host has spare capacity; the chosen "
+        "effort tiers and the resulting savings are logged periodically",
+        "default: no"
+    );
+    ret.emplace_back(
+        "frame-capture-dir",
+        "PATH",
+        "if nonempty, all the frames of each window are recorded to a "
+        "capture file in directory PATH for offline replay using the "
+        "retrojsvice_replay tool (warning: the captures contain sensitive "
+        "data, as everything shown in the browser is recorded, including "
+        "typed text; the files are created readable only by the owner)",
+        "default empty"
+    );
 
     return ret;
 }
@@ -589,8 +711,18 @@ void Context::onHTTPServerRequest(shared_ptr<HTTPRequest> request) {
         return;
     }
 
-    if(request->path() == "/clipboard/") {
+    smatch match;
+    string path = request->path();
+    if(path == "/clipboard/") {
         handleClipboardHTTPRequest_(mce, request);
+    } else if(regex_match(path, match, statusPathRegex)) {
+        REQUIRE(match.size() == 3);
+        handleStatusHTTPRequest_(
+            mce,
+            request,
+            match[1].matched,
+            match[2].matched ? string(match[2]) : "cpu"
+        );
     } else {
         windowManager_->handleHTTPRequest(mce, request);
     }
@@ -626,6 +758,10 @@ void Context::onTaskQueueShutdownComplete() {
     callbacks_.shutdownComplete(callbackData_);
 
     memset(&callbacks_, 0, sizeof(VicePluginAPI_Callbacks));
+    damageCallbacks_.reset();
+    frameCallbacks_.reset();
+    demandCallbacks_.reset();
+    statsCallbacks_.reset();
 }
 
 variant<uint64_t, string> Context::onWindowManagerCreateWindowRequest() {
@@ -658,27 +794,126 @@ void Context::onWindowManagerCloseWindow(uint64_t window) {
 
 void Context::onWindowManagerFetchImage(
     uint64_t window,
-    function<void(const uint8_t*, size_t, size_t, size_t)> func
+    function<void(
+        const uint8_t*,
+        size_t,
+        size_t,
+        size_t,
+        const optional<ImageDamage>&,
+        shared_ptr<void>
+    )> func
 ) {
     REQUIRE(threadRunningPumpEvents);
     REQUIRE(state_ == Running);
     REQUIRE(window);
 
-    auto callFunc = [](
-        void* funcPtr,
-        const uint8_t* image,
-        size_t width,
-        size_t height,
-        size_t pitch
-    ) {
-        REQUIRE(funcPtr != nullptr);
-        function<void(const uint8_t*, size_t, size_t, size_t)>& func =
-            *(function<void(const uint8_t*, size_t, size_t, size_t)>*)funcPtr;
-        func(image, width, height, pitch);
-    };
+    typedef function<void(
+        const uint8_t*,
+        size_t,
+        size_t,
+        size_t,
+        const optional<ImageDamage>&,
+        shared_ptr<void>
+    )> Func;
+
+    if(frameCallbacks_) {
+        // Passed as the putFrameFunc data to give the callback access to the
+        // release callback.
+        struct FrameFuncData {
+            Func* func;
+            void (*releaseFrame)(void*, uint64_t);
+            void* callbackData;
+        };
+        FrameFuncData frameFuncData;
+        frameFuncData.func = &func;
+        frameFuncData.releaseFrame = frameCallbacks_->releaseFrame;
+        frameFuncData.callbackData = callbackData_;
+
+        auto callFunc = [](
+            void* dataPtr,
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const VicePluginAPI_Rect* dirtyRects,
+            size_t dirtyRectCount,
+            uint64_t frame
+        ) {
+            REQUIRE(dataPtr != nullptr);
+            const FrameFuncData& data = *(const FrameFuncData*)dataPtr;
+
+            // The frame is released when the last copy of frameOwner is
+            // destroyed, possibly in a compressor thread.
+            REQUIRE(data.releaseFrame != nullptr);
+            auto releaseFrame = data.releaseFrame;
+            void* callbackData = data.callbackData;
+            shared_ptr<void> frameOwner(
+                (void*)image,
+                [releaseFrame, callbackData, frame](void*) {
+                    releaseFrame(callbackData, frame);
+                }
+            );
+
+            (*data.func)(
+                image,
+                width,
+                height,
+                pitch,
+                createImageDamage(sequenceNumber, dirtyRects, dirtyRectCount),
+                frameOwner
+            );
+        };
+
+        REQUIRE(frameCallbacks_->fetchWindowFrame != nullptr);
+        frameCallbacks_->fetchWindowFrame(
+            callbackData_, window, callFunc, (void*)&frameFuncData
+        );
+    } else if(damageCallbacks_) {
+        auto callFunc = [](
+            void* funcPtr,
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch,
+            uint64_t sequenceNumber,
+            const VicePluginAPI_Rect* dirtyRects,
+            size_t dirtyRectCount
+        ) {
+            REQUIRE(funcPtr != nullptr);
+            Func& func = *(Func*)funcPtr;
+            func(
+                image,
+                width,
+                height,
+                pitch,
+                createImageDamage(sequenceNumber, dirtyRects, dirtyRectCount),
+                {}
+            );
+        };
 
-    REQUIRE(callbacks_.fetchWindowImage != nullptr);
-    callbacks_.fetchWindowImage(callbackData_, window, callFunc, (void*)&func);
+        REQUIRE(damageCallbacks_->fetchWindowImageWithDamage != nullptr);
+        damageCallbacks_->fetchWindowImageWithDamage(
+            callbackData_, window, callFunc, (void*)&func
+        );
+    } else {
+        auto callFunc = [](
+            void* funcPtr,
+            const uint8_t* image,
+            size_t width,
+            size_t height,
+            size_t pitch
+        ) {
+            REQUIRE(funcPtr != nullptr);
+            Func& func = *(Func*)funcPtr;
+            func(image, width, height, pitch, {}, {});
+        };
+
+        REQUIRE(callbacks_.fetchWindowImage != nullptr);
+        callbacks_.fetchWindowImage(
+            callbackData_, window, callFunc, (void*)&func
+        );
+    }
 }
 
 void Context::onWindowManagerResizeWindow(
@@ -697,6 +932,24 @@ void Context::onWindowManagerResizeWindow(
     callbacks_.resizeWindow(callbackData_, window, width, height);
 }
 
+void Context::onWindowManagerFrameDemand(
+    uint64_t window,
+    int framesPerSecond
+) {
+    REQUIRE(threadRunningPumpEvents);
+    REQUIRE(state_ == Running);
+    REQUIRE(window);
+    REQUIRE(framesPerSecond >= 0);
+
+    // Without API version 1000003, the program has no use for the demand.
+    if(demandCallbacks_) {
+        REQUIRE(demandCallbacks_->setWindowFrameDemand != nullptr);
+        demandCallbacks_->setWindowFrameDemand(
+            callbackData_, window, (uint32_t)framesPerSecond
+        );
+    }
+}
+
 #define FORWARD_WINDOW_EVENT(src, callback, callbackArgs) \
     void Context::src { \
         REQUIRE(threadRunningPumpEvents); \
@@ -827,6 +1080,235 @@ void Context::handleClipboardHTTPRequest_(MCE,
     }
 }
 
+void Context::handleStatusHTTPRequest_(MCE,
+    shared_ptr<HTTPRequest> request,
+    bool json,
+    string sortKey
+) {
+    REQUIRE(state_ == Running);
+
+    // Without authentication, the page would reveal the activity of other
+    // users to anyone who can connect.
+    if(httpAuthCredentials_.empty()) {
+        request->sendTextResponse(
+            404, "ERROR: Status page requires HTTP authentication\n"
+        );
+        return;
+    }
+    if(request->method() != "GET") {
+        request->sendTextResponse(400, "ERROR: Invalid request method");
+        return;
+    }
+
+    struct Row {
+        uint64_t handle;
+        WindowStats stats;
+
+        // Empty if the program does not support API version 1000004.
+        optional<VicePluginAPI_WindowStats> programStats;
+
+        uint64_t totalCPUTimeMs() const {
+            uint64_t ret = (uint64_t)duration_cast<milliseconds>(
+                stats.compressionTime
+            ).count();
+            if(programStats) {
+                ret += programStats->contentCPUTimeMs;
+                ret += programStats->viewRenderTimeMs;
+            }
+            return ret;
+        }
+    };
+
+    vector<Row> rows;
+    for(pair<uint64_t, WindowStats> p : windowManager_->windowStats()) {
+        Row row;
+        row.handle = p.first;
+        row.stats = p.second;
+        if(statsCallbacks_) {
+            REQUIRE(statsCallbacks_->queryWindowStats != nullptr);
+            // The fields the program does not fill in (if it has been built
+            // against an older revision of the API header) are left as zeros,
+            // except for the priority, which is marked unknown.
+            VicePluginAPI_WindowStats programStats;
+            memset(&programStats, 0, sizeof(VicePluginAPI_WindowStats));
+            programStats.structSize = sizeof(VicePluginAPI_WindowStats);
+            statsCallbacks_->queryWindowStats(
+                callbackData_, row.handle, &programStats
+            );
+            REQUIRE(
+                programStats.structSize <= sizeof(VicePluginAPI_WindowStats)
+            );
+            if(
+                programStats.structSize <
+                offsetof(VicePluginAPI_WindowStats, rendererIOPriority) +
+                    sizeof(programStats.rendererIOPriority)
+            ) {
+                programStats.rendererIOPriority = -1;
+            }
+            row.programStats = programStats;
+        }
+        rows.push_back(row);
+    }
+
+    map<string, function<uint64_t(const Row&)>> sortKeys = {
+        {"cpu", [](const Row& row) { return row.totalCPUTimeMs(); }},
+        {"content-cpu", [](const Row& row) {
+            return row.programStats ? row.programStats->contentCPUTimeMs : 0;
+        }},
+        {"memory", [](const Row& row) {
+            return row.programStats ? row.programStats->contentMemoryBytes : 0;
+        }},
+        {"render", [](const Row& row) {
+            return row.programStats ? row.programStats->viewRenderTimeMs : 0;
+        }},
+        {"compression", [](const Row& row) {
+            return (uint64_t)duration_cast<milliseconds>(
+                row.stats.compressionTime
+            ).count();
+        }},
+        {"bytes", [](const Row& row) { return row.stats.bytesSent; }},
+        {"blocked", [](const Row& row) {
+            return row.programStats ? row.programStats->blockedRequestCount : 0;
+        }},
+        {"cache", [](const Row& row) {
+            return row.programStats ? row.programStats->cacheBytesSaved : 0;
+        }}
+    };
+    auto sortKeyIt = sortKeys.find(sortKey);
+    if(sortKeyIt == sortKeys.end()) {
+        request->sendTextResponse(400, "ERROR: Invalid sort key\n");
+        return;
+    }
+    function<uint64_t(const Row&)> cost = sortKeyIt->second;
+    stable_sort(
+        rows.begin(),
+        rows.end(),
+        [&](const Row& a, const Row& b) { return cost(a) > cost(b); }
+    );
+
+    auto seconds = [](uint64_t ms) {
+        string frac = toString(ms % 1000);
+        return toString(ms / 1000) + "." + string(3 - frac.size(), '0') + frac;
+    };
+    auto mebibytes = [](uint64_t bytes) {
+        uint64_t tenths = bytes * 10 / (1024 * 1024);
+        return toString(tenths / 10) + "." + toString(tenths % 10);
+    };
+
+    if(json) {
+        stringstream out;
+        out << "{\"sort\":\"" << sortKey << "\",\"windows\":[";
+        for(size_t i = 0; i < rows.size(); ++i) {
+            const Row& row = rows[i];
+            if(i) {
+                out << ",";
+            }
+            out << "{\"window\":" << row.handle;
+            out << ",\"totalCPUTimeMs\":" << row.totalCPUTimeMs();
+            if(row.programStats) {
+                out << ",\"contentCPUTimeMs\":";
+                out << row.programStats->contentCPUTimeMs;
+                out << ",\"contentMemoryBytes\":";
+                out << row.programStats->contentMemoryBytes;
+                out << ",\"viewRenderTimeMs\":";
+                out << row.programStats->viewRenderTimeMs;
+                out << ",\"blockedRequests\":";
+                out << row.programStats->blockedRequestCount;
+                out << ",\"cacheHits\":";
+                out << row.programStats->cacheHitCount;
+                out << ",\"cacheMisses\":";
+                out << row.programStats->cacheMissCount;
+                out << ",\"cacheBytesSaved\":";
+                out << row.programStats->cacheBytesSaved;
+                if(row.programStats->rendererIOPriority >= 0) {
+                    out << ",\"rendererNice\":";
+                    out << row.programStats->rendererNice;
+                    out << ",\"rendererIOPriority\":";
+                    out << row.programStats->rendererIOPriority;
+                } else {
+                    out << ",\"rendererNice\":null";
+                    out << ",\"rendererIOPriority\":null";
+                }
+            } else {
+                out << ",\"contentCPUTimeMs\":null";
+                out << ",\"contentMemoryBytes\":null";
+                out << ",\"viewRenderTimeMs\":null";
+                out << ",\"blockedRequests\":null";
+                out << ",\"cacheHits\":null";
+                out << ",\"cacheMisses\":null";
+                out << ",\"cacheBytesSaved\":null";
+                out << ",\"rendererNice\":null";
+                out << ",\"rendererIOPriority\":null";
+            }
+            out << ",\"compressionTimeMs\":";
+            out << duration_cast<milliseconds>(row.stats.compressionTime).count();
+            out << ",\"bytesSent\":" << row.stats.bytesSent;
+            out << ",\"frameDemand\":" << row.stats.frameDemand << "}";
+        }
+        out << "]}\n";
+
+        string body = out.str();
+        request->sendResponse(
+            200,
+            "application/json",
+            body.size(),
+            [body](ostream& out) { out << body; },
+            true
+        );
+    } else {
+        stringstream out;
+        for(const Row& row : rows) {
+            out << "<tr><td>" << row.handle << "</td>";
+            out << "<td>" << seconds(row.totalCPUTimeMs()) << "</td>";
+            if(row.programStats) {
+                out << "<td>" << seconds(row.programStats->contentCPUTimeMs);
+                out << "</td><td>";
+                out << mebibytes(row.programStats->contentMemoryBytes);
+                out << "</td><td>";
+                out << seconds(row.programStats->viewRenderTimeMs) << "</td>";
+            } else {
+                out << "<td>-</td><td>-</td><td>-</td>";
+            }
+            out << "<td>" << seconds((uint64_t)duration_cast<milliseconds>(
+                row.stats.compressionTime
+            ).count()) << "</td>";
+            out << "<td>" << mebibytes(row.stats.bytesSent) << "</td>";
+            if(row.programStats) {
+                const VicePluginAPI_WindowStats& programStats =
+                    *row.programStats;
+                uint64_t requests =
+                    programStats.cacheHitCount + programStats.cacheMissCount;
+                out << "<td>" << programStats.blockedRequestCount << "</td>";
+                if(requests) {
+                    out << "<td>";
+                    out << programStats.cacheHitCount * 100 / requests;
+                    out << "</td>";
+                } else {
+                    out << "<td>-</td>";
+                }
+                out << "<td>" << mebibytes(programStats.cacheBytesSaved);
+                out << "</td>";
+                if(programStats.rendererIOPriority >= 0) {
+                    out << "<td>" << programStats.rendererNice << "/";
+                    out << programStats.rendererIOPriority << "</td>";
+                } else {
+                    out << "<td>-</td>";
+                }
+            } else {
+                out << "<td>-</td><td>-</td><td>-</td><td>-</td>";
+            }
+            out << "<td>" << row.stats.frameDemand << "</td></tr>\n";
+        }
+        string rowsHTML = out.str();
+
+        request->sendHTMLResponse(
+            200,
+            writeStatusHTML,
+            {programName_, rows.size(), sortKey, rowsHTML}
+        );
+    }
+}
+
 void Context::startClipboardTimeout_() {
     REQUIRE(state_ == Running);
 
@@ -7,7 +7,9 @@
 
 namespace retrojsvice {
 
+class CompressionEffortGovernor;
 class SecretGenerator;
+class ShadowCompressor;
 
 // The implementation of the vice plugin context, exposed through the C API in
 // vice_plugin_api.cpp.
@@ -32,13 +34,25 @@ public:
         int httpMaxThreads,
         string httpAuthCredentials,
         bool allowQualitySelector,
+        int frameCacheSize,
+        double shadowCompressionRate,
+        bool adaptiveCompressionEffort,
+        string frameCaptureDir,
         string programName
     );
     ~Context();
 
     // Public API functions:
+    // damageCallbacks is given only for API versions 1000001 and newer,
+    // frameCallbacks only for API versions 1000002 and newer,
+    // demandCallbacks only for API versions 1000003 and newer and
+    // statsCallbacks only for API version 1000004.
     void start(
         VicePluginAPI_Callbacks callbacks,
+        optional<VicePluginAPI_DamageCallbacks> damageCallbacks,
+        optional<VicePluginAPI_FrameCallbacks> frameCallbacks,
+        optional<VicePluginAPI_DemandCallbacks> demandCallbacks,
+        optional<VicePluginAPI_StatsCallbacks> statsCallbacks,
         void* callbackData
     );
     void shutdown();
@@ -93,13 +107,24 @@ public:
     virtual void onWindowManagerCloseWindow(uint64_t window) override;
     virtual void onWindowManagerFetchImage(
         uint64_t window,
-        function<void(const uint8_t*, size_t, size_t, size_t)> func
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
     ) override;
     virtual void onWindowManagerResizeWindow(
         uint64_t window,
         size_t width,
         size_t height
     ) override;
+    virtual void onWindowManagerFrameDemand(
+        uint64_t window,
+        int framesPerSecond
+    ) override;
     virtual void onWindowManagerMouseDown(
         uint64_t window, int x, int y, int button
     ) override;
@@ -131,6 +156,15 @@ public:
 
 private:
     void handleClipboardHTTPRequest_(MCE, shared_ptr<HTTPRequest> request);
+
+    // Serves the resource usage of the open windows as an HTML table or as
+    // JSON (if json is true), sorted by sortKey in descending order. Only
+    // available if HTTP authentication is enabled.
+    void handleStatusHTTPRequest_(MCE,
+        shared_ptr<HTTPRequest> request,
+        bool json,
+        string sortKey
+    );
     void startClipboardTimeout_();
 
     int defaultQuality_;
@@ -138,6 +172,10 @@ private:
     int httpMaxThreads_;
     string httpAuthCredentials_;
     bool allowQualitySelector_;
+    int frameCacheSize_;
+    double shadowCompressionRate_;
+    bool adaptiveCompressionEffort_;
+    string frameCaptureDir_;
     string programName_;
 
     enum {Pending, Running, ShutdownComplete} state_;
@@ -150,11 +188,17 @@ private:
     atomic<bool> inAPICall_;
 
     VicePluginAPI_Callbacks callbacks_;
+    optional<VicePluginAPI_DamageCallbacks> damageCallbacks_;
+    optional<VicePluginAPI_FrameCallbacks> frameCallbacks_;
+    optional<VicePluginAPI_DemandCallbacks> demandCallbacks_;
+    optional<VicePluginAPI_StatsCallbacks> statsCallbacks_;
     void* callbackData_;
 
     shared_ptr<TaskQueue> taskQueue_;
     shared_ptr<HTTPServer> httpServer_;
     shared_ptr<SecretGenerator> secretGen_;
+    shared_ptr<ShadowCompressor> shadowCompressor_;
+    shared_ptr<CompressionEffortGovernor> compressionEffortGovernor_;
     shared_ptr<WindowManager> windowManager_;
 
     string clipboardCSRFToken_;
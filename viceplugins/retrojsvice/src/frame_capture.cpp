@@ -0,0 +1,357 @@
+#include "frame_capture.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+namespace retrojsvice {
+
+namespace {
+
+const char FileMagic[8] = {'R', 'J', 'V', 'C', 'A', 'P', 'T', '\0'};
+const uint32_t FileVersion = 1;
+
+// Maximum number of frames waiting to be written before new frames are
+// dropped.
+const size_t MaxPendingFrames = 8;
+
+// Maximum number of delta records between two key records.
+const size_t KeyInterval = 64;
+
+size_t paddedSize(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+}
+
+shared_ptr<FrameCaptureWriter> FrameCaptureWriter::tryCreate(string path) {
+    // The captures contain everything the user sees, so only the owner may
+    // read them.
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    FILE* file = fd >= 0 ? fdopen(fd, "wb") : nullptr;
+    if(file == nullptr) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        WARNING_LOG("Could not create frame capture file ", path);
+        return {};
+    }
+
+    FrameCaptureFileHeader header;
+    memcpy(header.magic, FileMagic, 8);
+    header.version = FileVersion;
+    header.reserved = 0;
+    if(
+        fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fflush(file)
+    ) {
+        WARNING_LOG("Writing frame capture file ", path, " failed");
+        fclose(file);
+        return {};
+    }
+
+    INFO_LOG("Capturing frames to ", path);
+    return create(CKey(), file, move(path));
+}
+
+FrameCaptureWriter::FrameCaptureWriter(CKey, CKey, FILE* file, string path) {
+    REQUIRE(file != nullptr);
+
+    file_ = file;
+    path_ = move(path);
+    startTime_ = steady_clock::now();
+
+    shutdown_ = false;
+    droppedCount_ = 0;
+
+    failed_ = false;
+    prevWidth_ = 0;
+    prevHeight_ = 0;
+    framesSinceKey_ = 0;
+}
+
+FrameCaptureWriter::~FrameCaptureWriter() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    cv_.notify_one();
+    writerThread_.join();
+
+    fclose(file_);
+}
+
+void FrameCaptureWriter::write(
+    const uint8_t* image,
+    size_t width,
+    size_t height,
+    size_t pitch,
+    int iframeSignal,
+    int cursorSignal
+) {
+    REQUIRE(width && height);
+
+    steady_clock::time_point now = steady_clock::now();
+
+    unique_lock<mutex> lock(mutex_);
+    if(pendingFrames_.size() >= MaxPendingFrames) {
+        ++droppedCount_;
+        return;
+    }
+    size_t droppedCount = droppedCount_;
+    droppedCount_ = 0;
+    lock.unlock();
+
+    CapturedFrame frame;
+    frame.timestamp = now - startTime_;
+    frame.width = width;
+    frame.height = height;
+    frame.iframeSignal = iframeSignal;
+    frame.cursorSignal = cursorSignal;
+    frame.droppedCount = droppedCount;
+    frame.image.resize(4 * width * height);
+    for(size_t y = 0; y < height; ++y) {
+        memcpy(
+            &frame.image[4 * y * width], &image[4 * y * pitch], 4 * width
+        );
+    }
+
+    lock.lock();
+    pendingFrames_.push(move(frame));
+    lock.unlock();
+    cv_.notify_one();
+}
+
+void FrameCaptureWriter::afterConstruct_(shared_ptr<FrameCaptureWriter> self) {
+    writerThread_ = thread([this]() { runWriter_(); });
+}
+
+void FrameCaptureWriter::runWriter_() {
+    unique_lock<mutex> lock(mutex_);
+    while(true) {
+        if(!pendingFrames_.empty()) {
+            CapturedFrame frame = move(pendingFrames_.front());
+            pendingFrames_.pop();
+
+            lock.unlock();
+            if(!failed_ && !writeRecord_(frame)) {
+                WARNING_LOG(
+                    "Writing frame capture file ", path_, " failed, ",
+                    "stopping capture"
+                );
+                failed_ = true;
+            }
+            lock.lock();
+        } else if(shutdown_) {
+            return;
+        } else {
+            cv_.wait(lock);
+        }
+    }
+}
+
+bool FrameCaptureWriter::writeRecord_(const CapturedFrame& frame) {
+    bool isKey =
+        frame.width != prevWidth_ ||
+        frame.height != prevHeight_ ||
+        framesSinceKey_ >= KeyInterval;
+
+    const vector<uint8_t>* payload = &frame.image;
+    vector<uint8_t> delta;
+    if(!isKey) {
+        delta.resize(frame.image.size());
+        for(size_t i = 0; i < delta.size(); ++i) {
+            delta[i] = frame.image[i] ^ prevImage_[i];
+        }
+        payload = &delta;
+    }
+
+    uLongf compressedSize = compressBound(payload->size());
+    vector<uint8_t> compressed(compressedSize);
+    REQUIRE(compress2(
+        compressed.data(),
+        &compressedSize,
+        payload->data(),
+        payload->size(),
+        1
+    ) == Z_OK);
+    compressed.resize(paddedSize(compressedSize), 0);
+
+    FrameCaptureRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timestampUs = (uint64_t)duration_cast<std::chrono::microseconds>(
+        frame.timestamp
+    ).count();
+    header.payloadSize = compressedSize;
+    header.width = (uint32_t)frame.width;
+    header.height = (uint32_t)frame.height;
+    header.iframeSignal = (uint8_t)frame.iframeSignal;
+    header.cursorSignal = (uint8_t)frame.cursorSignal;
+    header.isKey = isKey ? 1 : 0;
+    header.droppedCount = (uint32_t)frame.droppedCount;
+
+    if(
+        fwrite(&header, sizeof(header), 1, file_) != 1 ||
+        fwrite(compressed.data(), 1, compressed.size(), file_) !=
+            compressed.size() ||
+        fflush(file_)
+    ) {
+        return false;
+    }
+
+    prevImage_ = frame.image;
+    prevWidth_ = frame.width;
+    prevHeight_ = frame.height;
+    framesSinceKey_ = isKey ? 0 : framesSinceKey_ + 1;
+    return true;
+}
+
+shared_ptr<FrameCaptureReader> FrameCaptureReader::tryOpen(string path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        WARNING_LOG("Could not open frame capture file ", path);
+        return {};
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(FrameCaptureFileHeader)) {
+        WARNING_LOG("Invalid frame capture file ", path);
+        close(fd);
+        return {};
+    }
+    size_t size = (size_t)st.st_size;
+
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        WARNING_LOG("Could not map frame capture file ", path);
+        return {};
+    }
+    const uint8_t* data = (const uint8_t*)map;
+
+    const FrameCaptureFileHeader& fileHeader =
+        *(const FrameCaptureFileHeader*)data;
+    if(
+        memcmp(fileHeader.magic, FileMagic, 8) ||
+        fileHeader.version != FileVersion
+    ) {
+        WARNING_LOG("Invalid frame capture file ", path);
+        munmap(map, size);
+        return {};
+    }
+
+    // Index the complete records; a truncated or invalid record ends the
+    // capture.
+    vector<size_t> recordOffsets;
+    size_t pos = sizeof(FrameCaptureFileHeader);
+    bool first = true;
+    while(size - pos >= sizeof(FrameCaptureRecordHeader)) {
+        const FrameCaptureRecordHeader& header =
+            *(const FrameCaptureRecordHeader*)(data + pos);
+        size_t payloadSpace = size - pos - sizeof(FrameCaptureRecordHeader);
+        if(
+            header.payloadSize > payloadSpace ||
+            paddedSize(header.payloadSize) > payloadSpace ||
+            !header.width ||
+            !header.height ||
+            (first && !header.isKey)
+        ) {
+            break;
+        }
+        recordOffsets.push_back(pos);
+        pos += sizeof(FrameCaptureRecordHeader) + paddedSize(header.payloadSize);
+        first = false;
+    }
+    if(pos != size) {
+        WARNING_LOG(
+            "Frame capture file ", path, " has ", size - pos,
+            " trailing bytes, ignoring them"
+        );
+    }
+
+    return create(CKey(), data, size, move(recordOffsets));
+}
+
+FrameCaptureReader::FrameCaptureReader(CKey, CKey,
+    const uint8_t* data,
+    size_t size,
+    vector<size_t> recordOffsets
+) {
+    data_ = data;
+    size_ = size;
+    recordOffsets_ = move(recordOffsets);
+}
+
+FrameCaptureReader::~FrameCaptureReader() {
+    munmap((void*)data_, size_);
+}
+
+size_t FrameCaptureReader::frameCount() {
+    return recordOffsets_.size();
+}
+
+CapturedFrame FrameCaptureReader::readFrame(size_t idx) {
+    REQUIRE(idx < recordOffsets_.size());
+
+    if(cachedIdx_ && *cachedIdx_ == idx) {
+        return cachedFrame_;
+    }
+
+    // Find the frame to start decoding from: either the frame following the
+    // cached frame or the closest preceding key record.
+    size_t startIdx = idx;
+    while(
+        !recordHeader_(startIdx).isKey &&
+        !(cachedIdx_ && *cachedIdx_ + 1 == startIdx)
+    ) {
+        REQUIRE(startIdx);
+        --startIdx;
+    }
+
+    for(size_t i = startIdx; i <= idx; ++i) {
+        const FrameCaptureRecordHeader& header = recordHeader_(i);
+        const uint8_t* payload =
+            data_ + recordOffsets_[i] + sizeof(FrameCaptureRecordHeader);
+
+        vector<uint8_t> decompressed(4 * (size_t)header.width * header.height);
+        uLongf decompressedSize = decompressed.size();
+        REQUIRE(uncompress(
+            decompressed.data(),
+            &decompressedSize,
+            payload,
+            header.payloadSize
+        ) == Z_OK);
+        REQUIRE(decompressedSize == decompressed.size());
+
+        if(!header.isKey) {
+            REQUIRE(cachedIdx_ && *cachedIdx_ + 1 == i);
+            REQUIRE(cachedFrame_.image.size() == decompressed.size());
+            for(size_t j = 0; j < decompressed.size(); ++j) {
+                decompressed[j] ^= cachedFrame_.image[j];
+            }
+        }
+
+        cachedFrame_.timestamp = duration_cast<steady_clock::duration>(
+            std::chrono::microseconds(header.timestampUs)
+        );
+        cachedFrame_.width = header.width;
+        cachedFrame_.height = header.height;
+        cachedFrame_.iframeSignal = header.iframeSignal;
+        cachedFrame_.cursorSignal = header.cursorSignal;
+        cachedFrame_.droppedCount = header.droppedCount;
+        cachedFrame_.image = move(decompressed);
+        cachedIdx_ = i;
+    }
+
+    return cachedFrame_;
+}
+
+const FrameCaptureRecordHeader& FrameCaptureReader::recordHeader_(size_t idx) {
+    REQUIRE(idx < recordOffsets_.size());
+    return *(const FrameCaptureRecordHeader*)(data_ + recordOffsets_[idx]);
+}
+
+}
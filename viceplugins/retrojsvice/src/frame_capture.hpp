@@ -0,0 +1,152 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <cstdio>
+
+namespace retrojsvice {
+
+// Frame capture files record the sequence of frames fetched by an
+// ImageCompressor, along with their timing and the signals encoded into the
+// image size, so that the compression pipeline can be replayed offline.
+//
+// File format (all integers in native byte order; the records start at 8-byte
+// aligned offsets so that the file can be memory-mapped and the record headers
+// accessed in place):
+//
+//   FrameCaptureFileHeader
+//   For each frame:
+//     FrameCaptureRecordHeader
+//     payloadSize bytes of zlib-compressed payload, padded with zeros to a
+//     multiple of 8 bytes
+//
+// The uncompressed payload is the frame as tightly packed BGRA data
+// (4 * width * height bytes). In delta records, the payload is XORed with the
+// previous frame (which has the same dimensions); in key records, it is stored
+// as is. The file is written in append-only fashion; a truncated last record is
+// ignored by the reader.
+
+struct FrameCaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+static_assert(sizeof(FrameCaptureFileHeader) == 16);
+
+struct FrameCaptureRecordHeader {
+    // Time since the start of the capture in microseconds.
+    uint64_t timestampUs;
+    uint64_t payloadSize;
+    uint32_t width;
+    uint32_t height;
+    uint8_t iframeSignal;
+    uint8_t cursorSignal;
+    uint8_t isKey;
+    uint8_t reserved;
+
+    // Number of frames dropped before this frame because the writer could not
+    // keep up.
+    uint32_t droppedCount;
+};
+static_assert(sizeof(FrameCaptureRecordHeader) == 32);
+
+struct CapturedFrame {
+    steady_clock::duration timestamp;
+    size_t width;
+    size_t height;
+    int iframeSignal;
+    int cursorSignal;
+    size_t droppedCount;
+
+    // Tightly packed BGRA image data (4 * width * height bytes).
+    vector<uint8_t> image;
+};
+
+// Writes frames to a capture file. The compression and writing of the frames is
+// done in a background thread; if the thread falls behind, new frames are
+// dropped (the number of dropped frames is recorded in the next written
+// record).
+class FrameCaptureWriter {
+SHARED_ONLY_CLASS(FrameCaptureWriter);
+public:
+    // Returns empty pointer and logs a warning if creating the file fails.
+    static shared_ptr<FrameCaptureWriter> tryCreate(string path);
+
+    // Private constructor.
+    FrameCaptureWriter(CKey, CKey, FILE* file, string path);
+    ~FrameCaptureWriter();
+
+    // Records a frame given in the format used by
+    // ImageCompressorEventHandler::onImageCompressorFetchImage. The image data
+    // is copied before returning. May be called from any thread.
+    void write(
+        const uint8_t* image,
+        size_t width,
+        size_t height,
+        size_t pitch,
+        int iframeSignal,
+        int cursorSignal
+    );
+
+private:
+    void afterConstruct_(shared_ptr<FrameCaptureWriter> self);
+
+    void runWriter_();
+    bool writeRecord_(const CapturedFrame& frame);
+
+    FILE* file_;
+    string path_;
+    steady_clock::time_point startTime_;
+
+    thread writerThread_;
+    mutex mutex_;
+    condition_variable cv_;
+    bool shutdown_;
+    queue<CapturedFrame> pendingFrames_;
+    size_t droppedCount_;
+
+    // Accessed only by the writer thread.
+    bool failed_;
+    vector<uint8_t> prevImage_;
+    size_t prevWidth_;
+    size_t prevHeight_;
+    size_t framesSinceKey_;
+};
+
+// Reads frames from a memory-mapped capture file.
+class FrameCaptureReader {
+SHARED_ONLY_CLASS(FrameCaptureReader);
+public:
+    // Returns empty pointer and logs a warning if opening the file fails or it
+    // is not a valid capture file.
+    static shared_ptr<FrameCaptureReader> tryOpen(string path);
+
+    // Private constructor.
+    FrameCaptureReader(CKey, CKey,
+        const uint8_t* data,
+        size_t size,
+        vector<size_t> recordOffsets
+    );
+    ~FrameCaptureReader();
+
+    size_t frameCount();
+
+    // Decodes the frame with given index. Reading the frames in order is
+    // efficient; random access requires decoding the frames starting from the
+    // previous key record.
+    CapturedFrame readFrame(size_t idx);
+
+private:
+    const FrameCaptureRecordHeader& recordHeader_(size_t idx);
+
+    const uint8_t* data_;
+    size_t size_;
+    vector<size_t> recordOffsets_;
+
+    // The most recently decoded frame (if any) is cached to make sequential
+    // reading efficient.
+    optional<size_t> cachedIdx_;
+    CapturedFrame cachedFrame_;
+};
+
+}
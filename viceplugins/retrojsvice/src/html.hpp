@@ -61,6 +61,14 @@ struct ClipboardHTMLData {
 };
 void writeClipboardHTML(ostream& out, const ClipboardHTMLData& data);
 
+struct StatusHTMLData {
+    const string& programName;
+    size_t windowCount;
+    const string& sortKey;
+    const string& rows;
+};
+void writeStatusHTML(ostream& out, const StatusHTMLData& data);
+
 struct DownloadIframeHTMLData {
     const string& programName;
     const string& pathPrefix;
@@ -98,6 +98,11 @@ public:
         return userAgent_;
     }
 
+    string getHeader(const string& name) {
+        REQUIRE(request_ != nullptr);
+        return request_->get(name, "");
+    }
+
     string getFormParam(string name) {
         REQUIRE(request_ != nullptr);
 
@@ -278,6 +283,11 @@ string HTTPRequest::userAgent() {
     return impl_->userAgent();
 }
 
+string HTTPRequest::getHeader(string name) {
+    REQUIRE_API_THREAD();
+    return impl_->getHeader(name);
+}
+
 string HTTPRequest::getFormParam(string name) {
     REQUIRE_API_THREAD();
     return impl_->getFormParam(move(name));
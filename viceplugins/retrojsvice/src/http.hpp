@@ -27,6 +27,10 @@ public:
     string path();
     string userAgent();
 
+    // Returns the value of given request header or empty string if the header
+    // is not present.
+    string getHeader(string name);
+
     // Form accessors return empty string/pointer if there is no entry with
     // specified name.
     string getFormParam(string name);
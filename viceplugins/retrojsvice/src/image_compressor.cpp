@@ -1,115 +1,236 @@
 #include "image_compressor.hpp"
 
+#include "compression_effort.hpp"
+#include "frame_capture.hpp"
 #include "http.hpp"
 #include "jpeg.hpp"
 #include "png.hpp"
+#include "shadow_compressor.hpp"
 #include "task_queue.hpp"
 
+#include <Poco/Crypto/DigestEngine.h>
+
 namespace retrojsvice {
 
+// Compressed image data split into chunks that point to memory retained by
+// owner.
+struct CompressedImage {
+    string contentType;
+    uint64_t length;
+    shared_ptr<void> owner;
+    vector<pair<const uint8_t*, size_t>> chunks;
+
+    // Hex SHA-256 digest of the data; empty if frame caching is disabled.
+    string hash;
+};
+
+// Image fetched for compression; width and height include the signal padding.
+// If frameOwner is nonempty, the image is a frame shared by the program that
+// has not been copied: it has frameWidth x frameHeight pixels at frame with
+// pitch framePitch, and data is empty. Otherwise, the image is stored in data
+// with pitch width.
+struct FetchedImage {
+    size_t width;
+    size_t height;
+    vector<uint8_t> data;
+
+    shared_ptr<void> frameOwner;
+    const uint8_t* frame;
+    size_t frameWidth;
+    size_t frameHeight;
+    size_t framePitch;
+};
+
 namespace {
 
-void serveWhiteJPEGPixel(shared_ptr<HTTPRequest> request) {
+shared_ptr<CompressedImage> createCompressedImage(
+    string contentType,
+    shared_ptr<void> owner,
+    vector<pair<const uint8_t*, size_t>> chunks,
+    bool computeHash
+) {
+    shared_ptr<CompressedImage> image = make_shared<CompressedImage>();
+    image->contentType = move(contentType);
+    image->length = 0;
+    image->owner = move(owner);
+    image->chunks = move(chunks);
+
+    for(pair<const uint8_t*, size_t> chunk : image->chunks) {
+        image->length += chunk.second;
+    }
+
+    if(computeHash) {
+        Poco::Crypto::DigestEngine hasher("SHA256");
+        for(pair<const uint8_t*, size_t> chunk : image->chunks) {
+            hasher.update(chunk.first, chunk.second);
+        }
+        image->hash = hasher.digestToHex(hasher.digest());
+    }
+
+    return image;
+}
+
+void sendCompressedImage(
+    shared_ptr<HTTPRequest> request,
+    shared_ptr<CompressedImage> image,
+    bool noCache,
+    vector<pair<string, string>> extraHeaders
+) {
     REQUIRE_API_THREAD();
 
-    // 1x1 white JPEG
-    vector<uint8_t> data = {
-        255, 216, 255, 224, 0, 16, 74, 70, 73, 70, 0, 1, 1, 1, 0, 72, 0, 72,
-        0, 0, 255, 219, 0, 67, 0, 3, 2, 2, 3, 2, 2, 3, 3, 3, 3, 4, 3, 3, 4,
-        5, 8, 5, 5, 4, 4, 5, 10, 7, 7, 6, 8, 12, 10, 12, 12, 11, 10, 11, 11,
-        13, 14, 18, 16, 13, 14, 17, 14, 11, 11, 16, 22, 16, 17, 19, 20, 21,
-        21, 21, 12, 15, 23, 24, 22, 20, 24, 18, 20, 21, 20, 255, 219, 0, 67,
-        1, 3, 4, 4, 5, 4, 5, 9, 5, 5, 9, 20, 13, 11, 13, 20, 20, 20, 20, 20,
-        20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
-        20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
-        20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 255, 192, 0, 17, 8, 0,
-        1, 0, 1, 3, 1, 17, 0, 2, 17, 1, 3, 17, 1, 255, 196, 0, 20, 0, 1, 0,
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9, 255, 196, 0, 20, 16, 1,
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 196, 0, 20, 1,
-        1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 196, 0, 20,
-        17, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 218, 0,
-        12, 3, 1, 0, 2, 17, 3, 17, 0, 63, 0, 84, 193, 255, 217
-    };
-    uint64_t contentLength = data.size();
     request->sendResponse(
         200,
-        "image/jpeg",
-        contentLength,
-        [data{move(data)}](ostream& out) {
-            out.write((const char*)data.data(), data.size());
+        image->contentType,
+        image->length,
+        [image](ostream& out) {
+            for(pair<const uint8_t*, size_t> chunk : image->chunks) {
+                out.write((const char*)chunk.first, chunk.second);
+            }
+        },
+        noCache,
+        move(extraHeaders)
+    );
+}
+
+shared_ptr<CompressedImage> whiteJPEGPixel(bool computeHash) {
+    // 1x1 white JPEG
+    shared_ptr<vector<uint8_t>> data = make_shared<vector<uint8_t>>(
+        vector<uint8_t>{
+            255, 216, 255, 224, 0, 16, 74, 70, 73, 70, 0, 1, 1, 1, 0, 72, 0, 72,
+            0, 0, 255, 219, 0, 67, 0, 3, 2, 2, 3, 2, 2, 3, 3, 3, 3, 4, 3, 3, 4,
+            5, 8, 5, 5, 4, 4, 5, 10, 7, 7, 6, 8, 12, 10, 12, 12, 11, 10, 11, 11,
+            13, 14, 18, 16, 13, 14, 17, 14, 11, 11, 16, 22, 16, 17, 19, 20, 21,
+            21, 21, 12, 15, 23, 24, 22, 20, 24, 18, 20, 21, 20, 255, 219, 0, 67,
+            1, 3, 4, 4, 5, 4, 5, 9, 5, 5, 9, 20, 13, 11, 13, 20, 20, 20, 20, 20,
+            20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+            20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+            20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 255, 192, 0, 17, 8, 0,
+            1, 0, 1, 3, 1, 17, 0, 2, 17, 1, 3, 17, 1, 255, 196, 0, 20, 0, 1, 0,
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9, 255, 196, 0, 20, 16, 1,
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 196, 0, 20, 1,
+            1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 196, 0, 20,
+            17, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 218, 0,
+            12, 3, 1, 0, 2, 17, 3, 17, 0, 63, 0, 84, 193, 255, 217
         }
     );
+    return createCompressedImage(
+        "image/jpeg", data, {{data->data(), data->size()}}, computeHash
+    );
 }
 
-function<void(shared_ptr<HTTPRequest>)> compressPNG_(
-    vector<uint8_t> imageData,
+// Copies the srcWidth x srcHeight image to a new width x height buffer with
+// pitch width, filling the extra area with white.
+vector<uint8_t> padImage(
+    const uint8_t* src,
+    size_t srcWidth,
+    size_t srcHeight,
+    size_t srcPitch,
+    size_t width,
+    size_t height
+) {
+    REQUIRE(srcWidth && srcHeight);
+    REQUIRE(srcWidth <= width && srcHeight <= height);
+
+    vector<uint8_t> data(4 * width * height, (uint8_t)255);
+
+    const uint8_t* srcLine = src;
+    uint8_t* line = data.data();
+    for(size_t y = 0; y < srcHeight; ++y) {
+        memcpy(line, srcLine, 4 * srcWidth - 1);
+        srcLine += 4 * srcPitch;
+        line += 4 * width;
+    }
+
+    return data;
+}
+
+shared_ptr<CompressedImage> compressPNG_(
+    const uint8_t* image,
     size_t imageWidth,
     size_t imageHeight,
-    shared_ptr<PNGCompressor> pngCompressor
+    size_t imagePitch,
+    shared_ptr<PNGCompressor> pngCompressor,
+    const PNGCompressor::Settings& settings,
+    bool computeHash
 ) {
     REQUIRE(imageWidth && imageHeight);
-    REQUIRE(imageData.size() == 4 * imageWidth * imageHeight);
+    REQUIRE(imagePitch >= imageWidth);
 
     shared_ptr<vector<vector<uint8_t>>> png =
         make_shared<vector<vector<uint8_t>>>(
             pngCompressor->compress(
-                imageData.data(),
+                image,
                 imageWidth,
                 imageHeight,
-                imageWidth
+                imagePitch,
+                settings
             )
         );
 
-    uint64_t length = 0;
+    vector<pair<const uint8_t*, size_t>> chunks;
     for(const vector<uint8_t>& chunk : *png) {
-        length += chunk.size();
+        chunks.emplace_back(chunk.data(), chunk.size());
     }
 
-    return [png, length](shared_ptr<HTTPRequest> request) {
-        REQUIRE_API_THREAD();
-
-        request->sendResponse(
-            200,
-            "image/png",
-            length,
-            [png](ostream& out) {
-                for(const vector<uint8_t>& chunk : *png) {
-                    out.write((const char*)chunk.data(), chunk.size());
-                }
-            }
-        );
-    };
+    return createCompressedImage("image/png", png, move(chunks), computeHash);
 }
 
-function<void(shared_ptr<HTTPRequest>)> compressJPEG_(
-    vector<uint8_t> imageData,
+shared_ptr<CompressedImage> compressJPEG_(
+    const uint8_t* image,
     size_t imageWidth,
     size_t imageHeight,
-    int quality
+    size_t imagePitch,
+    const JPEGSettings& settings,
+    bool computeHash
 ) {
     REQUIRE(imageWidth && imageHeight);
-    REQUIRE(imageData.size() == 4 * imageWidth * imageHeight);
-    REQUIRE(quality > 0 && quality <= 100);
+    REQUIRE(imagePitch >= imageWidth);
+    REQUIRE(settings.quality > 0 && settings.quality <= 100);
 
     shared_ptr<JPEGData> jpeg = make_shared<JPEGData>(compressJPEG(
-        imageData.data(),
+        image,
         imageWidth,
         imageHeight,
-        imageWidth,
-        quality
+        imagePitch,
+        settings
     ));
-    return [jpeg](shared_ptr<HTTPRequest> request) {
-        REQUIRE_API_THREAD();
-
-        request->sendResponse(
-            200,
-            "image/jpeg",
-            jpeg->length,
-            [jpeg](ostream& out) {
-                out.write((const char*)jpeg->data.get(), jpeg->length);
-            }
+
+    return createCompressedImage(
+        "image/jpeg", jpeg, {{jpeg->data.get(), jpeg->length}}, computeHash
+    );
+}
+
+// Size of given image compressed using the fastest settings.
+uint64_t fastestCompressedSize(
+    const uint8_t* image,
+    size_t imageWidth,
+    size_t imageHeight,
+    size_t imagePitch,
+    int quality,
+    shared_ptr<PNGCompressor> pngCompressor
+) {
+    uint64_t size = 0;
+    if(quality == 101) {
+        vector<vector<uint8_t>> png = pngCompressor->compress(
+            image,
+            imageWidth,
+            imageHeight,
+            imagePitch,
+            CompressionEffortGovernor::pngSettings(0)
         );
-    };
+        for(const vector<uint8_t>& chunk : png) {
+            size += chunk.size();
+        }
+    } else {
+        size = compressJPEG(
+            image,
+            imageWidth,
+            imageHeight,
+            imagePitch,
+            CompressionEffortGovernor::jpegSettings(0, quality)
+        ).length;
+    }
+    return size;
 }
 
 }
@@ -117,7 +238,12 @@ function<void(shared_ptr<HTTPRequest>)> compressJPEG_(
 ImageCompressor::ImageCompressor(CKey,
     weak_ptr<ImageCompressorEventHandler> eventHandler,
     steady_clock::duration sendTimeout,
-    int quality
+    int quality,
+    string framePathPrefix,
+    size_t frameCacheSize,
+    shared_ptr<ShadowCompressor> shadowCompressor,
+    shared_ptr<CompressionEffortGovernor> compressionEffortGovernor,
+    shared_ptr<FrameCaptureWriter> frameCapture
 ) {
     REQUIRE_API_THREAD();
     REQUIRE(quality >= 10 && quality <= 101);
@@ -134,16 +260,34 @@ ImageCompressor::ImageCompressor(CKey,
     pngThreadCount = min(pngThreadCount, 4);
     pngThreadCount = max(pngThreadCount, 1);
     pngCompressor_ = make_shared<PNGCompressor>(pngThreadCount);
+    shadowCompressor_ = shadowCompressor;
+    compressionEffortGovernor_ = compressionEffortGovernor;
+    frameCapture_ = frameCapture;
 
     compressorShutdownScheduled_ = false;
     compressorTaskScheduled_ = false;
 
-    compressedImage_ = serveWhiteJPEGPixel;
+    framePathPrefix_ = move(framePathPrefix);
+    frameCacheSize_ = frameCacheSize;
+
+    compressedImage_ = whiteJPEGPixel(frameCacheSize_ > 0);
 
     fetchingStopped_ = false;
     imageUpdated_ = false;
     compressedImageUpdated_ = false;
     compressionInProgress_ = false;
+    backlogged_ = false;
+
+    lastWidth_ = 0;
+    lastHeight_ = 0;
+    lastQuality_ = quality;
+
+    requestWaiting_ = false;
+    responseSent_ = false;
+    lastResponseTime_ = steady_clock::now();
+
+    compressionTime_ = steady_clock::duration(0);
+    bytesSent_ = 0;
 }
 
 ImageCompressor::~ImageCompressor() {
@@ -183,11 +327,8 @@ void ImageCompressor::sendCompressedImageNow(MCE,
     REQUIRE_API_THREAD();
 
     flush(mce);
-
-    compressedImage_(httpRequest);
-
-    compressedImageUpdated_ = false;
-    pump_(mce);
+    recordRequest_();
+    sendCompressedImage_(mce, httpRequest);
 }
 
 void ImageCompressor::sendCompressedImageWait(MCE,
@@ -196,18 +337,87 @@ void ImageCompressor::sendCompressedImageWait(MCE,
     REQUIRE_API_THREAD();
 
     flush(mce);
+    recordRequest_();
 
     if(compressedImageUpdated_) {
-        sendCompressedImageNow(mce, httpRequest);
+        sendCompressedImage_(mce, httpRequest);
     } else {
+        requestWaiting_ = true;
         shared_ptr<ImageCompressor> self = shared_from_this();
         waitTag_ = postDelayedTask(sendTimeout_, [self, httpRequest]() {
             REQUIRE_API_THREAD();
-            self->sendCompressedImageNow(mce, httpRequest);
+            self->sendCompressedImage_(mce, httpRequest);
         });
     }
 }
 
+int ImageCompressor::frameDemand() {
+    REQUIRE_API_THREAD();
+
+    if(
+        !requestWaiting_ &&
+        steady_clock::now() - lastResponseTime_ > idleLimit_()
+    ) {
+        return 0;
+    }
+
+    // The client cannot consume frames faster than it requests them; if the
+    // turnaround is not known yet, assume the maximum.
+    if(!turnaroundEstimate_ || *turnaroundEstimate_ <= 0.0) {
+        return MaxFrameDemand;
+    }
+    double fps = 1.0 / *turnaroundEstimate_;
+    return max(1, min(MaxFrameDemand, (int)(fps + 0.5)));
+}
+
+void ImageCompressor::serveFrame(
+    shared_ptr<HTTPRequest> httpRequest,
+    string hash
+) {
+    REQUIRE_API_THREAD();
+
+    string etag = "\"" + hash + "\"";
+    vector<pair<string, string>> cacheHeaders = {
+        {"ETag", etag},
+        {"Cache-Control", "private, max-age=31536000, immutable"}
+    };
+
+    // As the frame URL is determined by the content, any cached copy the
+    // client has is valid, even if the frame has already been dropped from
+    // frameCache_.
+    string ifNoneMatch = httpRequest->getHeader("If-None-Match");
+    if(ifNoneMatch == "*" || ifNoneMatch.find(etag) != string::npos) {
+        httpRequest->sendTextResponse(304, "", false, move(cacheHeaders));
+        return;
+    }
+
+    shared_ptr<CompressedImage> frame;
+    for(const shared_ptr<CompressedImage>& candidate : frameCache_) {
+        if(candidate->hash == hash) {
+            frame = candidate;
+            break;
+        }
+    }
+
+    if(frame) {
+        cacheFrame_(frame);
+        bytesSent_ += frame->length;
+        sendCompressedImage(httpRequest, frame, false, move(cacheHeaders));
+    } else {
+        httpRequest->sendTextResponse(404, "ERROR: Frame not available\n");
+    }
+}
+
+steady_clock::duration ImageCompressor::compressionTime() {
+    REQUIRE_API_THREAD();
+    return compressionTime_;
+}
+
+uint64_t ImageCompressor::bytesSent() {
+    REQUIRE_API_THREAD();
+    return bytesSent_;
+}
+
 void ImageCompressor::stopFetching() {
     REQUIRE_API_THREAD();
     fetchingStopped_ = true;
@@ -265,61 +475,169 @@ void ImageCompressor::afterConstruct_(shared_ptr<ImageCompressor> self) {
     });
 }
 
-tuple<vector<uint8_t>, size_t, size_t> ImageCompressor::fetchImage_(MCE) {
+FetchedImage ImageCompressor::fetchImage_(MCE, bool& unchanged) {
     REQUIRE_API_THREAD();
     REQUIRE(!fetchingStopped_);
 
-    vector<uint8_t> data;
-    size_t width;
-    size_t height;
+    FetchedImage image;
+
+    unchanged = false;
+    optional<uint64_t> sequenceNumber;
 
     if(shared_ptr<ImageCompressorEventHandler> eventHandler = eventHandler_.lock()) {
+        // The GUI is drawn on a copy of the image.
+        bool hasGUI = eventHandler->onImageCompressorHasGUI();
+
         bool funcCalled = false;
         auto func = [&](
             const uint8_t* srcImage,
             size_t srcWidth,
             size_t srcHeight,
-            size_t srcPitch
+            size_t srcPitch,
+            const optional<ImageDamage>& damage,
+            shared_ptr<void> frameOwner
         ) {
             REQUIRE(!funcCalled);
             funcCalled = true;
             REQUIRE(srcWidth);
             REQUIRE(srcHeight);
 
+            if(damage) {
+                sequenceNumber = damage->sequenceNumber;
+                unchanged =
+                    lastSequenceNumber_ && (
+                        damage->sequenceNumber == *lastSequenceNumber_ ||
+                        damage->dirtyRects.empty()
+                    );
+            }
+
             srcWidth = min(srcWidth, (size_t)16384);
             srcHeight = min(srcHeight, (size_t)16384);
 
-            width = srcWidth;
-            height = srcHeight;
+            if(frameCapture_) {
+                frameCapture_->write(
+                    srcImage,
+                    srcWidth,
+                    srcHeight,
+                    srcPitch,
+                    iframeSignal_,
+                    cursorSignal_
+                );
+            }
 
-            while((int)(width % (size_t)IframeSignalCount) != iframeSignal_) {
-                ++width;
+            image.width = srcWidth;
+            image.height = srcHeight;
+
+            while(
+                (int)(image.width % (size_t)IframeSignalCount) != iframeSignal_
+            ) {
+                ++image.width;
             }
-            while((int)(height % (size_t)CursorSignalCount) != cursorSignal_) {
-                ++height;
+            while(
+                (int)(image.height % (size_t)CursorSignalCount) != cursorSignal_
+            ) {
+                ++image.height;
             }
 
-            data.resize(4 * width * height, (uint8_t)255);
-
-            const uint8_t* srcLine = srcImage;
-            uint8_t* line = data.data();
-            for(size_t y = 0; y < srcHeight; ++y) {
-                memcpy(line, srcLine, 4 * srcWidth - 1);
-                srcLine += 4 * srcPitch;
-                line += 4 * width;
+            if(frameOwner && !hasGUI) {
+                // Leave copying (if needed) to the compressor thread.
+                image.frameOwner = move(frameOwner);
+                image.frame = srcImage;
+                image.frameWidth = srcWidth;
+                image.frameHeight = srcHeight;
+                image.framePitch = srcPitch;
+            } else {
+                image.data = padImage(
+                    srcImage,
+                    srcWidth,
+                    srcHeight,
+                    srcPitch,
+                    image.width,
+                    image.height
+                );
             }
         };
         eventHandler->onImageCompressorFetchImage(func);
         REQUIRE(funcCalled);
 
-        eventHandler->onImageCompressorRenderGUI(data, width, height);
+        if(hasGUI) {
+            eventHandler->onImageCompressorRenderGUI(
+                image.data, image.width, image.height
+            );
+            unchanged = false;
+            sequenceNumber.reset();
+        }
+    } else {
+        image.data.resize(4, (uint8_t)255);
+        image.width = 1;
+        image.height = 1;
+    }
+
+    // The size also changes if the signals change.
+    if(image.width != lastWidth_ || image.height != lastHeight_) {
+        unchanged = false;
+    }
+    lastSequenceNumber_ = sequenceNumber;
+    lastWidth_ = image.width;
+    lastHeight_ = image.height;
+
+    return image;
+}
+
+void ImageCompressor::recordRequest_() {
+    REQUIRE_API_THREAD();
+
+    // A request that arrives while the previous one is still waiting does
+    // not tell anything about the turnaround time of the client.
+    if(!responseSent_ || requestWaiting_) {
+        return;
+    }
+
+    // After an idle period (for example, the client was in the background),
+    // the gap is not a turnaround; the estimate is restarted instead.
+    steady_clock::duration gap = steady_clock::now() - lastResponseTime_;
+    if(gap > idleLimit_()) {
+        turnaroundEstimate_.reset();
+        return;
+    }
+
+    double turnaround =
+        (double)duration_cast<milliseconds>(gap).count() / 1000.0;
+    if(turnaroundEstimate_) {
+        *turnaroundEstimate_ = 0.75 * *turnaroundEstimate_ + 0.25 * turnaround;
+    } else {
+        turnaroundEstimate_ = turnaround;
+    }
+}
+
+steady_clock::duration ImageCompressor::idleLimit_() {
+    return max((steady_clock::duration)milliseconds(5000), 2 * sendTimeout_);
+}
+
+void ImageCompressor::sendCompressedImage_(MCE,
+    shared_ptr<HTTPRequest> httpRequest
+) {
+    REQUIRE_API_THREAD();
+
+    if(frameCacheSize_) {
+        cacheFrame_(compressedImage_);
+        httpRequest->sendTextResponse(
+            302,
+            "Found",
+            true,
+            {{"Location", framePathPrefix_ + compressedImage_->hash + "/"}}
+        );
     } else {
-        data.resize(4, (uint8_t)255);
-        width = 1;
-        height = 1;
+        bytesSent_ += compressedImage_->length;
+        sendCompressedImage(httpRequest, compressedImage_, true, {});
     }
 
-    return {move(data), width, height};
+    requestWaiting_ = false;
+    responseSent_ = true;
+    lastResponseTime_ = steady_clock::now();
+
+    compressedImageUpdated_ = false;
+    pump_(mce);
 }
 
 void ImageCompressor::pump_(MCE) {
@@ -334,36 +652,178 @@ void ImageCompressor::pump_(MCE) {
         return;
     }
 
-    compressionInProgress_ = true;
     imageUpdated_ = false;
 
     int quality = quality_;
+    bool computeHash = frameCacheSize_ > 0;
+    bool backlogged = backlogged_;
 
-    vector<uint8_t> imageData;
-    size_t imageWidth;
-    size_t imageHeight;
-    tie(imageData, imageWidth, imageHeight) = fetchImage_(mce);
+    bool unchanged;
+    shared_ptr<FetchedImage> image =
+        make_shared<FetchedImage>(fetchImage_(mce, unchanged));
+
+    // If the image has not changed since it was last compressed, the latest
+    // compressed image is still up to date.
+    if(unchanged && quality == lastQuality_) {
+        return;
+    }
+    lastQuality_ = quality;
+
+    compressionInProgress_ = true;
 
     shared_ptr<ImageCompressor> self = shared_from_this();
     shared_ptr<PNGCompressor> pngCompressor = pngCompressor_;
+    shared_ptr<ShadowCompressor> shadowCompressor = shadowCompressor_;
+    shared_ptr<CompressionEffortGovernor> effortGovernor =
+        compressionEffortGovernor_;
     function<void()> task = [
         self,
         pngCompressor,
+        shadowCompressor,
+        effortGovernor,
         quality,
-        imageData{move(imageData)},
-        imageWidth,
-        imageHeight
-    ]() {
-        CompressedImage compressedImage;
+        computeHash,
+        backlogged,
+        image
+    ]() mutable {
+        // A shared frame can be compressed directly unless it needs padding.
+        if(
+            image->frameOwner && (
+                image->frameWidth != image->width ||
+                image->frameHeight != image->height
+            )
+        ) {
+            image->data = padImage(
+                image->frame,
+                image->frameWidth,
+                image->frameHeight,
+                image->framePitch,
+                image->width,
+                image->height
+            );
+            image->frameOwner.reset();
+        }
+
+        const uint8_t* imagePixels;
+        size_t imagePitch;
+        if(image->frameOwner) {
+            imagePixels = image->frame;
+            imagePitch = image->framePitch;
+        } else {
+            imagePixels = image->data.data();
+            imagePitch = image->width;
+        }
+        size_t imageWidth = image->width;
+        size_t imageHeight = image->height;
+
+        optional<CompressionEffortGovernor::FrameEffort> effort;
+        if(effortGovernor) {
+            effort = effortGovernor->beginFrame(backlogged);
+        }
+        int tier = effort ? effort->tier : 0;
+
+        bool shadowSample = shadowCompressor && shadowCompressor->sample();
+        steady_clock::time_point startTime = steady_clock::now();
+
+        shared_ptr<CompressedImage> compressedImage;
         if(quality == 101) {
-            compressedImage =
-                compressPNG_(imageData, imageWidth, imageHeight, pngCompressor);
+            compressedImage = compressPNG_(
+                imagePixels,
+                imageWidth,
+                imageHeight,
+                imagePitch,
+                pngCompressor,
+                CompressionEffortGovernor::pngSettings(tier),
+                computeHash
+            );
         } else {
-            compressedImage =
-                compressJPEG_(imageData, imageWidth, imageHeight, quality);
+            compressedImage = compressJPEG_(
+                imagePixels,
+                imageWidth,
+                imageHeight,
+                imagePitch,
+                CompressionEffortGovernor::jpegSettings(tier, quality),
+                computeHash
+            );
         }
 
-        postTask(self, &ImageCompressor::compressTaskDone_, mce, compressedImage);
+        steady_clock::duration compressionTime = steady_clock::now() - startTime;
+        uint64_t compressedSize = compressedImage->length;
+
+        // The shadow sample and the savings measurement are done after the
+        // result has been handed over, so that they neither delay the response
+        // nor count towards the compression time.
+        // The pixels are copied for them so that the shared frame can be
+        // released as soon as the encode ends.
+        bool measureSavings = effort && effort->measureSavings;
+        if(image->frameOwner && (shadowSample || measureSavings)) {
+            image->data = padImage(
+                imagePixels,
+                imageWidth,
+                imageHeight,
+                imagePitch,
+                imageWidth,
+                imageHeight
+            );
+            imagePixels = image->data.data();
+            imagePitch = imageWidth;
+        }
+
+        image->frameOwner.reset();
+
+        postTask(
+            self,
+            &ImageCompressor::compressTaskDone_,
+            mce,
+            compressedImage,
+            compressionTime
+        );
+
+        // The remaining work does not need the compressor; if this were the
+        // last reference, the compressor would be destroyed in its own thread
+        // and fail to join it.
+        self.reset();
+
+        if(shadowSample) {
+            vector<uint8_t> compressedData;
+            compressedData.reserve(compressedImage->length);
+            for(pair<const uint8_t*, size_t> chunk : compressedImage->chunks) {
+                compressedData.insert(
+                    compressedData.end(), chunk.first, chunk.first + chunk.second
+                );
+            }
+
+            shadowCompressor->submit(
+                padImage(
+                    imagePixels,
+                    imageWidth,
+                    imageHeight,
+                    imagePitch,
+                    imageWidth,
+                    imageHeight
+                ),
+                imageWidth,
+                imageHeight,
+                quality,
+                move(compressedData),
+                compressionTime
+            );
+        }
+
+        if(effort) {
+            optional<uint64_t> fastestSize;
+            if(measureSavings) {
+                fastestSize = fastestCompressedSize(
+                    imagePixels,
+                    imageWidth,
+                    imageHeight,
+                    imagePitch,
+                    quality,
+                    pngCompressor
+                );
+            }
+            effortGovernor->endFrame(tier, compressedSize, fastestSize);
+        }
     };
 
     {
@@ -375,15 +835,42 @@ void ImageCompressor::pump_(MCE) {
     compressorCv_.notify_one();
 }
 
-void ImageCompressor::compressTaskDone_(MCE, CompressedImage compressedImage) {
+void ImageCompressor::compressTaskDone_(MCE,
+    shared_ptr<CompressedImage> compressedImage,
+    steady_clock::duration compressionTime
+) {
     REQUIRE_API_THREAD();
     REQUIRE(compressionInProgress_);
 
+    compressionTime_ += compressionTime;
+
     compressionInProgress_ = false;
     compressedImageUpdated_ = true;
+    backlogged_ = imageUpdated_;
     compressedImage_ = compressedImage;
 
     flush(mce);
 }
 
+void ImageCompressor::cacheFrame_(shared_ptr<CompressedImage> frame) {
+    REQUIRE_API_THREAD();
+    REQUIRE(frameCacheSize_);
+    REQUIRE(!frame->hash.empty());
+
+    for(size_t i = 0; i < frameCache_.size(); ++i) {
+        if(frameCache_[i]->hash == frame->hash) {
+            frameCache_.erase(frameCache_.begin() + i);
+            break;
+        }
+    }
+    frameCache_.push_back(frame);
+
+    if(frameCache_.size() > frameCacheSize_) {
+        frameCache_.erase(
+            frameCache_.begin(),
+            frameCache_.end() - frameCacheSize_
+        );
+    }
+}
+
 }
@@ -6,6 +6,17 @@ class PNGCompressor;
 
 namespace retrojsvice {
 
+// Damage information for a fetched image, available if the program supports
+// API version 1000001.
+struct ImageDamage {
+    // Increases whenever the image differs from the previously fetched image.
+    uint64_t sequenceNumber;
+
+    // Rectangles (x, y, width, height) covering all the pixels that may differ
+    // from the previously fetched image.
+    vector<tuple<size_t, size_t, size_t, size_t>> dirtyRects;
+};
+
 class ImageCompressorEventHandler {
 public:
     // The handler must call func exactly once with the image specs before
@@ -13,19 +24,42 @@ public:
     // (image, width, height, pitch), where width > 0 and height > 0. For all
     // 0 <= y < height and 0 <= x < width, image[4 * (y * pitch + x) + c] is the
     // value for color blue, green and red for c = 0, 1, 2, respectively. The
-    // callback func will not retain the image pointer; it will copy the data
-    // before returning.
+    // fifth argument is the damage information of the image compared to the
+    // image fetched by the previous call, or empty if it is not available.
+    //
+    // The last argument (frameOwner) may be used to transfer the ownership of
+    // the image: if it is nonempty, the image must stay valid and unmodified as
+    // long as frameOwner (or a copy of it) is alive, and the compressor may
+    // read it in a background thread instead of copying it (frameOwner may
+    // also be destroyed in the background thread). Otherwise, func will not
+    // retain the image pointer; it will copy the data before returning.
     virtual void onImageCompressorFetchImage(
-        function<void(const uint8_t*, size_t, size_t, size_t)> func
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
     ) = 0;
 
+    // Returns true if onImageCompressorRenderGUI would draw something on top
+    // of the image.
+    virtual bool onImageCompressorHasGUI() = 0;
+
     virtual void onImageCompressorRenderGUI(
         vector<uint8_t>& data, size_t width, size_t height
     ) = 0;
 };
 
+struct CompressedImage;
+struct FetchedImage;
+class CompressionEffortGovernor;
 class DelayedTaskTag;
+class FrameCaptureWriter;
 class HTTPRequest;
+class ShadowCompressor;
 
 // Image compressor service for a single browser window. The image pipeline is
 // run asynchronously: when an updated image is available, the service is
@@ -35,13 +69,33 @@ class HTTPRequest;
 // background thread. At most one HTTP request is kept waiting for a new image
 // to complete at a time; the previous requests are responded to upon each
 // sendCompressedImage* call.
+//
+// If frame caching is enabled (frameCacheSize > 0), the image requests are not
+// answered with the image itself; instead, the client is redirected to a
+// content-addressed frame URL framePathPrefix + HASH + "/" that may be cached
+// by the client indefinitely. The frameCacheSize most recently sent frames are
+// retained so that serveFrame can respond to the redirected requests.
+//
+// If shadowCompressor is nonempty, the frames it samples are submitted to it
+// after compression for evaluating alternative encoder settings. If
+// compressionEffortGovernor is nonempty, it chooses the encoder settings for
+// each frame; otherwise, the fastest settings are always used. If frameCapture
+// is nonempty, all the fetched images are recorded to it.
+//
+// If the fetched images come with damage information, a fetched image that is
+// identical to the image previously compressed is not compressed again.
 class ImageCompressor : public enable_shared_from_this<ImageCompressor> {
 SHARED_ONLY_CLASS(ImageCompressor);
 public:
     ImageCompressor(CKey,
         weak_ptr<ImageCompressorEventHandler> eventHandler,
         steady_clock::duration sendTimeout,
-        int quality
+        int quality,
+        string framePathPrefix,
+        size_t frameCacheSize,
+        shared_ptr<ShadowCompressor> shadowCompressor,
+        shared_ptr<CompressionEffortGovernor> compressionEffortGovernor,
+        shared_ptr<FrameCaptureWriter> frameCapture
     );
     ~ImageCompressor();
 
@@ -58,6 +112,25 @@ public:
     // sendTimeout (given in constructor) is reached.
     void sendCompressedImageWait(MCE, shared_ptr<HTTPRequest> httpRequest);
 
+    // Returns an estimate of how many frames per second the client currently
+    // consumes (1..MaxFrameDemand), based on the time it takes for the client
+    // to request the next image after receiving one. Returns 0 if the client
+    // has not requested images for a while (longer than the idle limit
+    // max(5s, 2 * sendTimeout)), which means that it is likely gone or in the
+    // background.
+    static constexpr int MaxFrameDemand = 60;
+    int frameDemand();
+
+    // Serve the frame with given content hash (as referred to by the redirects
+    // sent by sendCompressedImage*) with caching allowed.
+    void serveFrame(shared_ptr<HTTPRequest> httpRequest, string hash);
+
+    // Total time spent compressing images in the background thread (including
+    // the time spent waiting for the PNG compressor helper threads), and the
+    // total size of the images sent to the client.
+    steady_clock::duration compressionTime();
+    uint64_t bytesSent();
+
     // Make sure that the compressor will never call onImageCompressorFetchImage
     // again (effectively stopping the compressor from starting to compress new
     // images).
@@ -85,12 +158,25 @@ public:
 private:
     void afterConstruct_(shared_ptr<ImageCompressor> self);
 
-    typedef function<void(shared_ptr<HTTPRequest>)> CompressedImage;
+    // Sets unchanged to true if the fetched image is known to be identical to
+    // the image fetched by the previous call.
+    FetchedImage fetchImage_(MCE, bool& unchanged);
+
+    // Updates the client turnaround estimate upon an image request.
+    void recordRequest_();
 
-    tuple<vector<uint8_t>, size_t, size_t> fetchImage_(MCE);
+    // Time without requests after which the client is considered idle (see
+    // frameDemand).
+    steady_clock::duration idleLimit_();
+    void sendCompressedImage_(MCE, shared_ptr<HTTPRequest> httpRequest);
 
     void pump_(MCE);
-    void compressTaskDone_(MCE, CompressedImage compressedImage);
+    void compressTaskDone_(MCE,
+        shared_ptr<CompressedImage> compressedImage,
+        steady_clock::duration compressionTime
+    );
+
+    void cacheFrame_(shared_ptr<CompressedImage> frame);
 
     weak_ptr<ImageCompressorEventHandler> eventHandler_;
     steady_clock::duration sendTimeout_;
@@ -100,6 +186,9 @@ private:
     int cursorSignal_;
 
     shared_ptr<PNGCompressor> pngCompressor_;
+    shared_ptr<ShadowCompressor> shadowCompressor_;
+    shared_ptr<CompressionEffortGovernor> compressionEffortGovernor_;
+    shared_ptr<FrameCaptureWriter> frameCapture_;
 
     thread compressorThread_;
     mutex compressorMutex_;
@@ -109,12 +198,41 @@ private:
     function<void()> compressorTask_;
 
     shared_ptr<DelayedTaskTag> waitTag_;
-    CompressedImage compressedImage_;
+    shared_ptr<CompressedImage> compressedImage_;
+
+    string framePathPrefix_;
+    size_t frameCacheSize_;
+
+    // Recently sent frames, least recently used first.
+    vector<shared_ptr<CompressedImage>> frameCache_;
 
     bool fetchingStopped_;
     bool imageUpdated_;
     bool compressedImageUpdated_;
     bool compressionInProgress_;
+
+    // True if a new image was already available when the previous compression
+    // finished.
+    bool backlogged_;
+
+    // Sequence number of the previously fetched image if it had damage
+    // information and no GUI drawn on top of it.
+    optional<uint64_t> lastSequenceNumber_;
+    size_t lastWidth_;
+    size_t lastHeight_;
+    int lastQuality_;
+
+    // State for frameDemand(): whether an image request is currently waiting
+    // for a new image, when the previous image response was sent (or when the
+    // compressor was created) and an exponentially weighted moving average of
+    // the time in seconds from sending an image to receiving the next request.
+    bool requestWaiting_;
+    bool responseSent_;
+    steady_clock::time_point lastResponseTime_;
+    optional<double> turnaroundEstimate_;
+
+    steady_clock::duration compressionTime_;
+    uint64_t bytesSent_;
 };
 
 }
@@ -30,6 +30,19 @@ JPEGData compressJPEG(
     size_t pitch,
     int quality
 ) {
+    JPEGSettings settings;
+    settings.quality = quality;
+    return compressJPEG(image, width, height, pitch, settings);
+}
+
+JPEGData compressJPEG(
+    const uint8_t* image,
+    size_t width,
+    size_t height,
+    size_t pitch,
+    const JPEGSettings& settings
+) {
+    int quality = settings.quality;
     CHECK(width > 0 && height > 0);
     CHECK(quality >= 1 && quality <= 100);
 
@@ -51,9 +64,19 @@ JPEGData compressJPEG(
 
     jpeg_set_defaults(&jpegCtx);
     jpeg_set_quality(&jpegCtx, quality, true);
-    if(quality <= 90) {
+    if(settings.dctMethod == JPEGDCTMethod::Auto) {
+        if(quality <= 90) {
+            jpegCtx.dct_method = JDCT_IFAST;
+        }
+    } else if(settings.dctMethod == JPEGDCTMethod::Fast) {
         jpegCtx.dct_method = JDCT_IFAST;
+    } else if(settings.dctMethod == JPEGDCTMethod::Accurate) {
+        jpegCtx.dct_method = JDCT_ISLOW;
+    } else {
+        CHECK(settings.dctMethod == JPEGDCTMethod::Float);
+        jpegCtx.dct_method = JDCT_FLOAT;
     }
+    jpegCtx.optimize_coding = settings.optimizeCoding;
 
     jpeg_start_compress(&jpegCtx, true);
 
@@ -84,3 +107,38 @@ JPEGData compressJPEG(
 
     return jpegData;
 }
+
+std::vector<uint8_t> decompressJPEG(
+    const uint8_t* data,
+    size_t length,
+    size_t& width,
+    size_t& height
+) {
+    struct jpeg_decompress_struct jpegCtx;
+
+    struct jpeg_error_mgr jpegErrorManager;
+    jpegCtx.err = jpeg_std_error(&jpegErrorManager);
+
+    jpeg_create_decompress(&jpegCtx);
+    jpeg_mem_src(&jpegCtx, data, length);
+
+    CHECK(jpeg_read_header(&jpegCtx, true) == JPEG_HEADER_OK);
+    jpegCtx.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&jpegCtx);
+    CHECK(jpegCtx.output_components == 3);
+
+    width = jpegCtx.output_width;
+    height = jpegCtx.output_height;
+    std::vector<uint8_t> image(3 * width * height);
+
+    while(jpegCtx.output_scanline < height) {
+        JSAMPROW rowPointer[1];
+        rowPointer[0] = image.data() + 3 * width * jpegCtx.output_scanline;
+        (void)jpeg_read_scanlines(&jpegCtx, rowPointer, 1);
+    }
+
+    jpeg_finish_decompress(&jpegCtx);
+    jpeg_destroy_decompress(&jpegCtx);
+
+    return image;
+}
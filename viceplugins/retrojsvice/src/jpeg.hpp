@@ -2,6 +2,7 @@
 
 #include <cstdlib>
 #include <memory>
+#include <vector>
 
 struct JPEGData {
     struct Free {
@@ -16,6 +17,23 @@ struct JPEGData {
     size_t length;
 };
 
+enum class JPEGDCTMethod {
+    // Fast integer DCT for quality <= 90, accurate integer DCT otherwise.
+    Auto,
+    Fast,
+    Accurate,
+    Float
+};
+
+struct JPEGSettings {
+    // Quality in range 1..100.
+    int quality = 80;
+    JPEGDCTMethod dctMethod = JPEGDCTMethod::Auto;
+
+    // Compute optimal Huffman tables (slower, smaller output).
+    bool optimizeCoding = false;
+};
+
 // Compress given image into JPEG. The image data should be in a format where
 // for all 0 <= y < height and 0 <= x < width, image[4 * (y * pitch + x) + c]
 // is the value for color blue, green and red for c = 0, 1, 2, respectively.
@@ -27,3 +45,21 @@ JPEGData compressJPEG(
     size_t pitch,
     int quality = 80
 );
+
+// Same as above, using custom encoder settings.
+JPEGData compressJPEG(
+    const uint8_t* image,
+    size_t width,
+    size_t height,
+    size_t pitch,
+    const JPEGSettings& settings
+);
+
+// Decompress given JPEG data into a tightly packed RGB image (3 bytes per
+// pixel), storing the dimensions to width and height.
+std::vector<uint8_t> decompressJPEG(
+    const uint8_t* data,
+    size_t length,
+    size_t& width,
+    size_t& height
+);
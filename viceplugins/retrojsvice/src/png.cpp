@@ -26,6 +26,7 @@ SOFTWARE.
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <future>
 #include <iostream>
@@ -126,6 +127,9 @@ struct JobData {
     size_t startY;
     size_t endY;
     bool endStream;
+    int level;
+    int strategy;
+    bool profile;
 };
 
 struct Job {
@@ -139,6 +143,7 @@ struct Result {
     size_t uncompressedBytes;
     uint32_t adler32;
     std::vector<uint8_t> chunk;
+    PNGCompressor::StageTimes stageTimes;
 };
 
 struct Worker {
@@ -160,6 +165,52 @@ int paeth(int leftVal, int upVal, int upLeftVal) {
     }
 }
 
+// Appends the filtered version of the scanline with pixels starting at linePos
+// to rawData. The pixels are PixelSize bytes apart, and the red, green and blue
+// values are in the first three bytes of each pixel in order blue, green, red
+// if BGR is true and red, green, blue otherwise. If upLinePos is null, the line
+// is the first line of the image.
+template <size_t PixelSize, bool BGR>
+void filterLine(
+    const uint8_t* linePos,
+    const uint8_t* upLinePos,
+    size_t width,
+    std::vector<uint8_t>& rawData
+) {
+    const uint8_t* imagePos = linePos;
+    if(upLinePos == nullptr) {
+        // First line is filtered by left subtraction
+        rawData.push_back(1);
+        int leftVal[3] = {0, 0, 0};
+        for(size_t x = 0; x < width; ++x) {
+            for(size_t c = 0; c < 3; ++c) {
+                int val = *(imagePos + (BGR ? 2 - c : c));
+                rawData.push_back((uint8_t)(val - leftVal[c]));
+                leftVal[c] = val;
+            }
+            imagePos += PixelSize;
+        }
+    } else {
+        // The rest of the lines are filtered using Paeth
+        const uint8_t* upImagePos = upLinePos;
+        rawData.push_back(4);
+        int leftVal[3] = {0, 0, 0};
+        int upLeftVal[3] = {0, 0, 0};
+        for(size_t x = 0; x < width; ++x) {
+            for(size_t c = 0; c < 3; ++c) {
+                int val = *(imagePos + (BGR ? 2 - c : c));
+                int upVal = *(upImagePos + (BGR ? 2 - c : c));
+                int pred = paeth(leftVal[c], upVal, upLeftVal[c]);
+                rawData.push_back((uint8_t)(val - pred));
+                leftVal[c] = val;
+                upLeftVal[c] = upVal;
+            }
+            imagePos += PixelSize;
+            upImagePos += PixelSize;
+        }
+    }
+}
+
 Result runJob(JobData jobData) {
     const uint8_t* image = jobData.image;
     size_t width = jobData.width;
@@ -167,48 +218,61 @@ Result runJob(JobData jobData) {
     size_t startY = jobData.startY;
     size_t endY = jobData.endY;
     bool endStream = jobData.endStream;
+    int level = jobData.level;
+    int strategy = jobData.strategy;
+    bool profile = jobData.profile;
 
     CHECK(startY < endY);
 
+    PNGCompressor::StageTimes stageTimes;
+    std::chrono::steady_clock::time_point stageStart =
+        std::chrono::steady_clock::now();
+    auto endStage = [&](std::chrono::nanoseconds& stageTime) {
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        stageTime += now - stageStart;
+        stageStart = now;
+    };
+
     size_t heightOut = endY - startY;
     size_t uncompressedBytes = heightOut * (1 + 3 * width);
 
     std::vector<uint8_t> rawData;
     rawData.reserve(uncompressedBytes);
 
-    for(size_t y = startY; y < endY; ++y) {
-        const uint8_t* imagePos = &image[4 * y * pitch];
-        if(y == 0) {
-            // First line is filtered by left subtraction
-            rawData.push_back(1);
-            int leftVal[3] = {0, 0, 0};
-            for(size_t x = 0; x < width; ++x) {
-                for(size_t c = 0; c < 3; ++c) {
-                    int val = *(imagePos + 2 - c);
-                    rawData.push_back((uint8_t)(val - leftVal[c]));
-                    leftVal[c] = val;
-                }
-                imagePos += 4;
-            }
-        } else {
-            // The rest of the lines are filtered using Paeth
-            const uint8_t* upImagePos = imagePos - 4 * pitch;
-            rawData.push_back(4);
-            int leftVal[3] = {0, 0, 0};
-            int upLeftVal[3] = {0, 0, 0};
+    if(profile) {
+        // Convert the lines (including the line above the first line, if any)
+        // to RGB in a separate pass to be able to measure the time taken by
+        // the filtering separately
+        size_t rgbStartY = startY ? startY - 1 : 0;
+        std::vector<uint8_t> rgb(3 * width * (endY - rgbStartY));
+        uint8_t* rgbPos = rgb.data();
+        for(size_t y = rgbStartY; y < endY; ++y) {
+            const uint8_t* imagePos = &image[4 * y * pitch];
             for(size_t x = 0; x < width; ++x) {
-                for(size_t c = 0; c < 3; ++c) {
-                    int val = *(imagePos + 2 - c);
-                    int upVal = *(upImagePos + 2 - c);
-                    int pred = paeth(leftVal[c], upVal, upLeftVal[c]);
-                    rawData.push_back((uint8_t)(val - pred));
-                    leftVal[c] = val;
-                    upLeftVal[c] = upVal;
-                }
+                rgbPos[0] = imagePos[2];
+                rgbPos[1] = imagePos[1];
+                rgbPos[2] = imagePos[0];
+                rgbPos += 3;
                 imagePos += 4;
-                upImagePos += 4;
             }
         }
+        endStage(stageTimes.swizzle);
+
+        for(size_t y = startY; y < endY; ++y) {
+            const uint8_t* linePos = &rgb[3 * width * (y - rgbStartY)];
+            filterLine<3, false>(
+                linePos, y ? linePos - 3 * width : nullptr, width, rawData
+            );
+        }
+        endStage(stageTimes.filter);
+    } else {
+        for(size_t y = startY; y < endY; ++y) {
+            const uint8_t* linePos = &image[4 * y * pitch];
+            filterLine<4, true>(
+                linePos, y ? linePos - 4 * pitch : nullptr, width, rawData
+            );
+        }
     }
 
     CHECK(rawData.size() == uncompressedBytes);
@@ -217,7 +281,7 @@ Result runJob(JobData jobData) {
     zStream.zalloc = nullptr;
     zStream.zfree = nullptr;
     zStream.opaque = nullptr;
-    CHECK(deflateInit2(&zStream, 1, Z_DEFLATED, 15, 8, Z_RLE) == Z_OK);
+    CHECK(deflateInit2(&zStream, level, Z_DEFLATED, 15, 8, strategy) == Z_OK);
 
     zStream.avail_in = uncompressedBytes;
     zStream.next_in = rawData.data();
@@ -280,10 +344,29 @@ Result runJob(JobData jobData) {
         chunk.resize(chunk.size() - 4);
     }
 
+    if(profile) {
+        endStage(stageTimes.deflate);
+    }
+
     writer.registerWrite(zStreamStart);
     writer.finish();
 
-    return {uncompressedBytes, adler32, std::move(chunk)};
+    if(profile) {
+        endStage(stageTimes.crc);
+    }
+
+    return {uncompressedBytes, adler32, std::move(chunk), stageTimes};
+}
+
+int zlibStrategy(PNGCompressor::Strategy strategy) {
+    switch(strategy) {
+    case PNGCompressor::Strategy::Default: return Z_DEFAULT_STRATEGY;
+    case PNGCompressor::Strategy::Filtered: return Z_FILTERED;
+    case PNGCompressor::Strategy::HuffmanOnly: return Z_HUFFMAN_ONLY;
+    case PNGCompressor::Strategy::RLE: return Z_RLE;
+    }
+    CHECK(false);
+    return Z_RLE;
 }
 
 void workerThread(std::future<Job> jobFuture) {
@@ -308,7 +391,9 @@ public:
         const uint8_t* image,
         size_t width,
         size_t height,
-        size_t pitch
+        size_t pitch,
+        const Settings& settings,
+        StageTimes* stageTimes
     );
 
 private:
@@ -339,40 +424,72 @@ std::vector<std::vector<uint8_t>> PNGCompressor::Impl::compress(
     const uint8_t* image,
     size_t width,
     size_t height,
-    size_t pitch
+    size_t pitch,
+    const Settings& settings,
+    StageTimes* stageTimes
 ) {
     CHECK(width > 0 && height > 0);
+    CHECK(settings.level >= 0 && settings.level <= 9);
 
-    size_t threadCount = std::min(workers_.size() + 1, height);
+    size_t stripCount = settings.stripCount;
+    if(stripCount == 0) {
+        stripCount = workers_.size() + 1;
+    }
+    stripCount = std::min(stripCount, height);
+    size_t threadCount = std::min(workers_.size() + 1, stripCount);
 
-    std::vector<JobData> jobDatas(threadCount);
-    for(size_t i = 0; i < threadCount; ++i) {
+    std::vector<JobData> jobDatas(stripCount);
+    for(size_t i = 0; i < stripCount; ++i) {
         JobData& jobData = jobDatas[i];
         jobData.image = image;
         jobData.width = width;
         jobData.pitch = pitch;
-        jobData.startY = height * i / threadCount;
-        jobData.endY = height * (i + 1) / threadCount;
-        jobData.endStream = i + 1 == threadCount;
+        jobData.startY = height * i / stripCount;
+        jobData.endY = height * (i + 1) / stripCount;
+        jobData.endStream = i + 1 == stripCount;
+        jobData.level = settings.level;
+        jobData.strategy = zlibStrategy(settings.strategy);
+        jobData.profile = stageTimes != nullptr;
     }
 
-    std::vector<std::future<Result>> resultFutures(threadCount - 1);
-    for(size_t i = 1; i < threadCount; ++i) {
+    // Strip i is compressed by thread i % threadCount, where thread 0 is the
+    // calling thread and thread t > 0 is worker t - 1. The jobs for each worker
+    // are queued in order.
+    std::vector<std::future<Result>> resultFutures(stripCount);
+    for(size_t i = 0; i < stripCount; ++i) {
+        size_t t = i % threadCount;
+        if(t == 0) {
+            continue;
+        }
+
         std::promise<Job> nextJobPromise;
         Job job;
         job.shutdown = false;
-        resultFutures[i - 1] = job.resultPromise.get_future();
+        resultFutures[i] = job.resultPromise.get_future();
         job.nextJobFuture = nextJobPromise.get_future();
         job.data = std::move(jobDatas[i]);
 
-        workers_[i - 1].jobPromise.set_value(std::move(job));
-        workers_[i - 1].jobPromise = std::move(nextJobPromise);
+        workers_[t - 1].jobPromise.set_value(std::move(job));
+        workers_[t - 1].jobPromise = std::move(nextJobPromise);
     }
 
-    std::vector<Result> results(threadCount);
-    results[0] = runJob(std::move(jobDatas[0]));
-    for(size_t i = 1; i < threadCount; ++i) {
-        results[i] = resultFutures[i - 1].get();
+    std::vector<Result> results(stripCount);
+    for(size_t i = 0; i < stripCount; i += threadCount) {
+        results[i] = runJob(std::move(jobDatas[i]));
+    }
+    for(size_t i = 0; i < stripCount; ++i) {
+        if(i % threadCount != 0) {
+            results[i] = resultFutures[i].get();
+        }
+    }
+
+    if(stageTimes != nullptr) {
+        for(const Result& result : results) {
+            stageTimes->swizzle += result.stageTimes.swizzle;
+            stageTimes->filter += result.stageTimes.filter;
+            stageTimes->deflate += result.stageTimes.deflate;
+            stageTimes->crc += result.stageTimes.crc;
+        }
     }
 
     std::vector<std::vector<uint8_t>> chunks;
@@ -448,5 +565,26 @@ std::vector<std::vector<uint8_t>> PNGCompressor::compress(
     size_t height,
     size_t pitch
 ) {
-    return impl_->compress(image, width, height, pitch);
+    return impl_->compress(image, width, height, pitch, Settings(), nullptr);
+}
+
+std::vector<std::vector<uint8_t>> PNGCompressor::compress(
+    const uint8_t* image,
+    size_t width,
+    size_t height,
+    size_t pitch,
+    const Settings& settings
+) {
+    return impl_->compress(image, width, height, pitch, settings, nullptr);
+}
+
+std::vector<std::vector<uint8_t>> PNGCompressor::compressProfiled(
+    const uint8_t* image,
+    size_t width,
+    size_t height,
+    size_t pitch,
+    const Settings& settings,
+    StageTimes& stageTimes
+) {
+    return impl_->compress(image, width, height, pitch, settings, &stageTimes);
 }
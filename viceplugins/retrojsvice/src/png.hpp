@@ -24,12 +24,40 @@ SOFTWARE.
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <vector>
 
 class PNGCompressor {
 public:
+    // Deflate strategies, corresponding to the zlib strategies Z_DEFAULT_STRATEGY,
+    // Z_FILTERED, Z_HUFFMAN_ONLY and Z_RLE.
+    enum class Strategy {
+        Default,
+        Filtered,
+        HuffmanOnly,
+        RLE
+    };
+
+    struct Settings {
+        // Deflate compression level in range 0..9.
+        int level = 1;
+        Strategy strategy = Strategy::RLE;
+
+        // Number of horizontal strips compressed independently; the strips are
+        // distributed evenly to the threads. 0 means one strip per thread.
+        size_t stripCount = 0;
+    };
+
+    // Time spent in each stage of compression, summed over all threads.
+    struct StageTimes {
+        std::chrono::nanoseconds swizzle{0};
+        std::chrono::nanoseconds filter{0};
+        std::chrono::nanoseconds deflate{0};
+        std::chrono::nanoseconds crc{0};
+    };
+
     PNGCompressor(size_t threadCount);
     ~PNGCompressor();
 
@@ -48,6 +76,28 @@ public:
         size_t pitch
     );
 
+    // Same as above, using custom encoder settings instead of the defaults.
+    std::vector<std::vector<uint8_t>> compress(
+        const uint8_t* image,
+        size_t width,
+        size_t height,
+        size_t pitch,
+        const Settings& settings
+    );
+
+    // Same as above, but also adds the time spent in each stage to stageTimes.
+    // To make the stages measurable, the pixel format conversion (swizzle) and
+    // filtering are run as separate passes, which makes this function somewhat
+    // slower than compress.
+    std::vector<std::vector<uint8_t>> compressProfiled(
+        const uint8_t* image,
+        size_t width,
+        size_t height,
+        size_t pitch,
+        const Settings& settings,
+        StageTimes& stageTimes
+    );
+
 private:
     class Impl;
     std::unique_ptr<Impl> impl_;
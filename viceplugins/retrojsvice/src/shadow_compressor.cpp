@@ -0,0 +1,305 @@
+#include "shadow_compressor.hpp"
+
+#include "jpeg.hpp"
+#include "png.hpp"
+
+#include <cmath>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace retrojsvice {
+
+namespace {
+
+// Log a report after this many samples have been processed.
+const size_t ReportInterval = 100;
+
+struct PNGConfig {
+    string name;
+    PNGCompressor::Settings settings;
+};
+
+const vector<PNGConfig> pngConfigs = {
+    {"png-l1-rle-strips1", {1, PNGCompressor::Strategy::RLE, 1}},
+    {"png-l1-rle-strips16", {1, PNGCompressor::Strategy::RLE, 16}},
+    {"png-l1-huffman", {1, PNGCompressor::Strategy::HuffmanOnly, 0}},
+    {"png-l3-filtered", {3, PNGCompressor::Strategy::Filtered, 0}},
+    {"png-l6-default", {6, PNGCompressor::Strategy::Default, 0}}
+};
+
+struct JPEGConfig {
+    string name;
+    JPEGDCTMethod dctMethod;
+    bool optimizeCoding;
+};
+
+const vector<JPEGConfig> jpegConfigs = {
+    {"jpeg-accurate", JPEGDCTMethod::Accurate, false},
+    {"jpeg-float", JPEGDCTMethod::Float, false},
+    {"jpeg-optimized", JPEGDCTMethod::Auto, true},
+    {"jpeg-accurate-optimized", JPEGDCTMethod::Accurate, true}
+};
+
+size_t totalSize(const vector<vector<uint8_t>>& chunks) {
+    size_t ret = 0;
+    for(const vector<uint8_t>& chunk : chunks) {
+        ret += chunk.size();
+    }
+    return ret;
+}
+
+// PSNR of given JPEG compressed image compared to the original BGRA image,
+// capped at 100 dB.
+double jpegPSNR(
+    const uint8_t* data,
+    size_t length,
+    const vector<uint8_t>& image,
+    size_t width,
+    size_t height
+) {
+    size_t decodedWidth;
+    size_t decodedHeight;
+    vector<uint8_t> decoded =
+        decompressJPEG(data, length, decodedWidth, decodedHeight);
+    REQUIRE(decodedWidth == width && decodedHeight == height);
+
+    uint64_t squareErrorSum = 0;
+    const uint8_t* src = image.data();
+    const uint8_t* dec = decoded.data();
+    for(size_t i = 0; i < width * height; ++i) {
+        for(int c = 0; c < 3; ++c) {
+            int diff = (int)src[2 - c] - (int)dec[c];
+            squareErrorSum += (uint64_t)(diff * diff);
+        }
+        src += 4;
+        dec += 3;
+    }
+
+    if(squareErrorSum == 0) {
+        return 100.0;
+    }
+    double mse = (double)squareErrorSum / (double)(3 * width * height);
+    return min(10.0 * std::log10(255.0 * 255.0 / mse), 100.0);
+}
+
+double toMs(steady_clock::duration duration) {
+    return (double)duration_cast<std::chrono::microseconds>(duration).count()
+        / 1000.0;
+}
+
+}
+
+ShadowCompressor::ShadowCompressor(CKey, double sampleRate) {
+    REQUIRE_API_THREAD();
+    REQUIRE(sampleRate > 0.0 && sampleRate <= 1.0);
+
+    sampleRate_ = sampleRate;
+
+    shutdown_ = false;
+    busy_ = false;
+    rng_.seed(random_device()());
+
+    unreportedCount_ = 0;
+}
+
+ShadowCompressor::~ShadowCompressor() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    cv_.notify_one();
+    workerThread_.join();
+}
+
+bool ShadowCompressor::sample() {
+    lock_guard<mutex> lock(mutex_);
+    if(busy_ || shutdown_) {
+        return false;
+    }
+    return uniform_real_distribution<double>(0.0, 1.0)(rng_) < sampleRate_;
+}
+
+void ShadowCompressor::submit(
+    vector<uint8_t> image,
+    size_t width,
+    size_t height,
+    int quality,
+    vector<uint8_t> productionData,
+    steady_clock::duration productionTime
+) {
+    REQUIRE(width && height);
+    REQUIRE(image.size() == 4 * width * height);
+    REQUIRE(quality >= 10 && quality <= 101);
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        if(busy_ || shutdown_) {
+            return;
+        }
+        busy_ = true;
+        pendingSample_.reset(new Sample{
+            move(image),
+            width,
+            height,
+            quality,
+            move(productionData),
+            productionTime
+        });
+    }
+    cv_.notify_one();
+}
+
+void ShadowCompressor::afterConstruct_(shared_ptr<ShadowCompressor> self) {
+    workerThread_ = thread([this]() { runWorker_(); });
+}
+
+void ShadowCompressor::runWorker_() {
+    // Only use CPU time that would otherwise be left unused. The PNG compressor
+    // worker threads created below inherit the scheduling policy.
+    sched_param schedParam;
+    schedParam.sched_priority = 0;
+    if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &schedParam)) {
+        WARNING_LOG(
+            "Could not set idle scheduling policy for shadow compressor thread"
+        );
+    }
+
+    int pngThreadCount = (int)thread::hardware_concurrency();
+    pngThreadCount = min(pngThreadCount, 4);
+    pngThreadCount = max(pngThreadCount, 1);
+    PNGCompressor pngCompressor(pngThreadCount);
+
+    unique_lock<mutex> lock(mutex_);
+    while(true) {
+        if(shutdown_) {
+            break;
+        } else if(pendingSample_) {
+            unique_ptr<Sample> sample = move(pendingSample_);
+
+            lock.unlock();
+            processSample_(*sample, pngCompressor);
+            sample.reset();
+            lock.lock();
+
+            busy_ = false;
+        } else {
+            cv_.wait(lock);
+        }
+    }
+    lock.unlock();
+
+    if(unreportedCount_) {
+        logReport_();
+    }
+}
+
+void ShadowCompressor::processSample_(
+    const Sample& sample,
+    PNGCompressor& pngCompressor
+) {
+    auto addResult = [&](
+        const string& name,
+        size_t size,
+        steady_clock::duration time
+    ) -> Stats& {
+        Stats& stats = stats_[name];
+        ++stats.sampleCount;
+        stats.totalSize += size;
+        stats.totalProductionSize += sample.productionData.size();
+        stats.totalTime += time;
+        stats.totalProductionTime += sample.productionTime;
+        return stats;
+    };
+
+    if(sample.quality == 101) {
+        for(const PNGConfig& config : pngConfigs) {
+            steady_clock::time_point start = steady_clock::now();
+            vector<vector<uint8_t>> png = pngCompressor.compress(
+                sample.image.data(),
+                sample.width,
+                sample.height,
+                sample.width,
+                config.settings
+            );
+            steady_clock::duration time = steady_clock::now() - start;
+
+            addResult(config.name, totalSize(png), time);
+        }
+    } else {
+        double productionPSNR = jpegPSNR(
+            sample.productionData.data(),
+            sample.productionData.size(),
+            sample.image,
+            sample.width,
+            sample.height
+        );
+
+        for(const JPEGConfig& config : jpegConfigs) {
+            JPEGSettings settings;
+            settings.quality = sample.quality;
+            settings.dctMethod = config.dctMethod;
+            settings.optimizeCoding = config.optimizeCoding;
+
+            steady_clock::time_point start = steady_clock::now();
+            JPEGData jpeg = compressJPEG(
+                sample.image.data(),
+                sample.width,
+                sample.height,
+                sample.width,
+                settings
+            );
+            steady_clock::duration time = steady_clock::now() - start;
+
+            Stats& stats = addResult(config.name, jpeg.length, time);
+            ++stats.psnrCount;
+            stats.totalPSNR += jpegPSNR(
+                jpeg.data.get(),
+                jpeg.length,
+                sample.image,
+                sample.width,
+                sample.height
+            );
+            stats.totalProductionPSNR += productionPSNR;
+        }
+    }
+
+    ++unreportedCount_;
+    if(unreportedCount_ >= ReportInterval) {
+        logReport_();
+    }
+}
+
+void ShadowCompressor::logReport_() {
+    unreportedCount_ = 0;
+
+    for(const pair<const string, Stats>& item : stats_) {
+        const string& name = item.first;
+        const Stats& stats = item.second;
+        if(!stats.sampleCount) {
+            continue;
+        }
+
+        double count = (double)stats.sampleCount;
+        double avgSize = (double)stats.totalSize / count;
+        double avgProductionSize = (double)stats.totalProductionSize / count;
+
+        stringstream msg;
+        msg << std::fixed;
+        msg.precision(2);
+        msg << "Shadow compression " << name << " (" << stats.sampleCount;
+        msg << " samples): size " << (uint64_t)avgSize << " B (production ";
+        msg << (uint64_t)avgProductionSize << " B, ";
+        msg << 100.0 * (avgSize / avgProductionSize - 1.0) << "%), time ";
+        msg << toMs(stats.totalTime) / count << " ms (production ";
+        msg << toMs(stats.totalProductionTime) / count << " ms)";
+        if(stats.psnrCount) {
+            double psnrCount = (double)stats.psnrCount;
+            msg << ", PSNR " << stats.totalPSNR / psnrCount << " dB (production ";
+            msg << stats.totalProductionPSNR / psnrCount << " dB)";
+        }
+        INFO_LOG(msg.str());
+    }
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "common.hpp"
+
+class PNGCompressor;
+
+namespace retrojsvice {
+
+// Shadow compression experiment shared by all windows for evaluating
+// alternative encoder settings on live traffic. A randomly sampled fraction of
+// the frames compressed by the ImageCompressors is re-encoded in a background
+// thread running at idle priority using each of a fixed set of alternative
+// encoder configurations. The re-encoded images are discarded; only their
+// size, encoding time and (for JPEG) PSNR are compared to the production
+// encoding, aggregated per configuration and logged periodically.
+//
+// At most one sample is processed at a time; frames are not sampled while the
+// background thread is busy, so the experiment never delays the production
+// pipeline. Note that the encoding times of the alternative configurations are
+// measured at idle priority and thus may be overestimated on a loaded system.
+class ShadowCompressor {
+SHARED_ONLY_CLASS(ShadowCompressor);
+public:
+    // sampleRate is the fraction of frames to sample, in range (0, 1].
+    ShadowCompressor(CKey, double sampleRate);
+    ~ShadowCompressor();
+
+    // Returns true if the frame about to be compressed should be submitted
+    // using submit(). May be called from any thread.
+    bool sample();
+
+    // Submit a sampled frame for re-encoding. The image is given in the tightly
+    // packed BGRA format used by ImageCompressor, and productionData contains
+    // the compressed image sent to the client, produced using given quality
+    // (101 = PNG) in productionTime. May be called from any thread.
+    void submit(
+        vector<uint8_t> image,
+        size_t width,
+        size_t height,
+        int quality,
+        vector<uint8_t> productionData,
+        steady_clock::duration productionTime
+    );
+
+private:
+    void afterConstruct_(shared_ptr<ShadowCompressor> self);
+
+    struct Sample {
+        vector<uint8_t> image;
+        size_t width;
+        size_t height;
+        int quality;
+        vector<uint8_t> productionData;
+        steady_clock::duration productionTime;
+    };
+
+    // Aggregate results of an alternative configuration. The PSNR sums only
+    // include JPEG samples.
+    struct Stats {
+        uint64_t sampleCount = 0;
+        uint64_t totalSize = 0;
+        uint64_t totalProductionSize = 0;
+        steady_clock::duration totalTime = steady_clock::duration::zero();
+        steady_clock::duration totalProductionTime =
+            steady_clock::duration::zero();
+        uint64_t psnrCount = 0;
+        double totalPSNR = 0.0;
+        double totalProductionPSNR = 0.0;
+    };
+
+    void runWorker_();
+    void processSample_(const Sample& sample, PNGCompressor& pngCompressor);
+    void logReport_();
+
+    double sampleRate_;
+
+    thread workerThread_;
+    mutex mutex_;
+    condition_variable cv_;
+    bool shutdown_;
+    bool busy_;
+    unique_ptr<Sample> pendingSample_;
+    mt19937 rng_;
+
+    // Accessed only by the worker thread.
+    map<string, Stats> stats_;
+    size_t unreportedCount_;
+};
+
+}
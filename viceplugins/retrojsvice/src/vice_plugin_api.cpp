@@ -8,6 +8,17 @@ using namespace retrojsvice;
 
 const char* RetrojsviceVersion = "0.9.2.1";
 
+// API versions 1000001, 1000002, 1000003 and 1000004 are extensions of version
+// 1000000.
+bool isSupportedAPIVersion(uint64_t apiVersion) {
+    return
+        apiVersion == (uint64_t)1000000 ||
+        apiVersion == (uint64_t)1000001 ||
+        apiVersion == (uint64_t)1000002 ||
+        apiVersion == (uint64_t)1000003 ||
+        apiVersion == (uint64_t)1000004;
+}
+
 template <typename T>
 class GlobalCallback {
 private:
@@ -70,13 +81,14 @@ void setOutString(char** out, string val) {
 extern "C" {
 
 struct VicePluginAPI_Context {
+    uint64_t apiVersion;
     shared_ptr<Context> impl;
 };
 
 API_EXPORT int vicePluginAPI_isAPIVersionSupported(uint64_t apiVersion) {
 API_FUNC_START
 
-    return (int)(apiVersion == (uint64_t)1000000);
+    return (int)isSupportedAPIVersion(apiVersion);
 
 API_FUNC_END
 }
@@ -99,7 +111,7 @@ API_EXPORT VicePluginAPI_Context* vicePluginAPI_initContext(
 ) {
 API_FUNC_START
 
-    REQUIRE(apiVersion == (uint64_t)1000000);
+    REQUIRE(isSupportedAPIVersion(apiVersion));
 
     REQUIRE(programName != nullptr);
 
@@ -126,6 +138,7 @@ API_FUNC_START
     }
 
     VicePluginAPI_Context* ctx = new VicePluginAPI_Context;
+    ctx->apiVersion = apiVersion;
     ctx->impl = impl;
     return ctx;
 
@@ -155,8 +168,97 @@ API_EXPORT void vicePluginAPI_start(
     VicePluginAPI_Context* ctx,
     VicePluginAPI_Callbacks callbacks,
     void* callbackData
-)
-WRAP_CTX_API(start, callbacks, callbackData)
+) {
+API_FUNC_START
+
+    REQUIRE(ctx != nullptr);
+    REQUIRE(ctx->apiVersion == (uint64_t)1000000);
+    ctx->impl->start(callbacks, {}, {}, {}, {}, callbackData);
+
+API_FUNC_END
+}
+
+API_EXPORT void vicePluginAPI_startWithDamageCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    void* callbackData
+) {
+API_FUNC_START
+
+    REQUIRE(ctx != nullptr);
+    REQUIRE(ctx->apiVersion == (uint64_t)1000001);
+    ctx->impl->start(callbacks, damageCallbacks, {}, {}, {}, callbackData);
+
+API_FUNC_END
+}
+
+API_EXPORT void vicePluginAPI_startWithFrameCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    VicePluginAPI_FrameCallbacks frameCallbacks,
+    void* callbackData
+) {
+API_FUNC_START
+
+    REQUIRE(ctx != nullptr);
+    REQUIRE(ctx->apiVersion == (uint64_t)1000002);
+    ctx->impl->start(
+        callbacks, damageCallbacks, frameCallbacks, {}, {}, callbackData
+    );
+
+API_FUNC_END
+}
+
+API_EXPORT void vicePluginAPI_startWithDemandCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    VicePluginAPI_FrameCallbacks frameCallbacks,
+    VicePluginAPI_DemandCallbacks demandCallbacks,
+    void* callbackData
+) {
+API_FUNC_START
+
+    REQUIRE(ctx != nullptr);
+    REQUIRE(ctx->apiVersion == (uint64_t)1000003);
+    ctx->impl->start(
+        callbacks,
+        damageCallbacks,
+        frameCallbacks,
+        demandCallbacks,
+        {},
+        callbackData
+    );
+
+API_FUNC_END
+}
+
+API_EXPORT void vicePluginAPI_startWithStatsCallbacks(
+    VicePluginAPI_Context* ctx,
+    VicePluginAPI_Callbacks callbacks,
+    VicePluginAPI_DamageCallbacks damageCallbacks,
+    VicePluginAPI_FrameCallbacks frameCallbacks,
+    VicePluginAPI_DemandCallbacks demandCallbacks,
+    VicePluginAPI_StatsCallbacks statsCallbacks,
+    void* callbackData
+) {
+API_FUNC_START
+
+    REQUIRE(ctx != nullptr);
+    REQUIRE(ctx->apiVersion == (uint64_t)1000004);
+    ctx->impl->start(
+        callbacks,
+        damageCallbacks,
+        frameCallbacks,
+        demandCallbacks,
+        statsCallbacks,
+        callbackData
+    );
+
+API_FUNC_END
+}
 
 API_EXPORT void vicePluginAPI_shutdown(VicePluginAPI_Context* ctx)
 WRAP_CTX_API(shutdown)
@@ -261,7 +363,7 @@ API_EXPORT void vicePluginAPI_getOptionDocs(
 ) {
 API_FUNC_START
 
-    REQUIRE(apiVersion == (uint64_t)1000000);
+    REQUIRE(isSupportedAPIVersion(apiVersion));
     REQUIRE(callback != nullptr);
 
     vector<tuple<string, string, string, string>> docs =
@@ -295,7 +397,7 @@ API_EXPORT void vicePluginAPI_setGlobalLogCallback(
 ) {
 API_FUNC_START
 
-    REQUIRE(apiVersion == (uint64_t)1000000);
+    REQUIRE(isSupportedAPIVersion(apiVersion));
 
     if(callback == nullptr) {
         setLogCallback({});
@@ -334,7 +436,7 @@ API_EXPORT void vicePluginAPI_setGlobalPanicCallback(
 ) {
 API_FUNC_START
 
-    REQUIRE(apiVersion == (uint64_t)1000000);
+    REQUIRE(isSupportedAPIVersion(apiVersion));
 
     if(callback == nullptr) {
         setPanicCallback({});
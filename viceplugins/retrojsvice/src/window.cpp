@@ -1,6 +1,7 @@
 #include "window.hpp"
 
 #include "download.hpp"
+#include "frame_capture.hpp"
 #include "gui.hpp"
 #include "html.hpp"
 #include "http.hpp"
@@ -8,6 +9,8 @@
 #include "secrets.hpp"
 #include "upload.hpp"
 
+#include <ctime>
+
 namespace retrojsvice {
 
 namespace {
@@ -15,6 +18,9 @@ namespace {
 regex imagePathRegex(
     "/image/([0-9]+)/([0-9]+)/([01])/([0-9]+)/([0-9]+)/([0-9]+)/(([A-Z0-9_-]+/)*)"
 );
+regex framePathRegex(
+    "/frame/([0-9a-f]+)/"
+);
 regex iframePathRegex(
     "/iframe/([0-9]+)/[0-9]+/"
 );
@@ -33,7 +39,11 @@ Window::Window(CKey,
     shared_ptr<SecretGenerator> secretGen,
     string programName,
     bool allowPNG,
-    int initialQuality
+    int initialQuality,
+    size_t frameCacheSize,
+    shared_ptr<ShadowCompressor> shadowCompressor,
+    shared_ptr<CompressionEffortGovernor> compressionEffortGovernor,
+    string frameCaptureDir
 ) {
     REQUIRE_API_THREAD();
     REQUIRE(handle);
@@ -46,6 +56,10 @@ Window::Window(CKey,
     programName_ = move(programName);
     allowPNG_ = allowPNG;
     initialQuality_ = initialQuality;
+    frameCacheSize_ = frameCacheSize;
+    shadowCompressor_ = shadowCompressor;
+    compressionEffortGovernor_ = compressionEffortGovernor;
+    frameCaptureDir_ = move(frameCaptureDir);
     secretGen_ = secretGen;
     snakeOilKeyCipherKey_ = secretGen_->generateSnakeOilCipherKey();
 
@@ -68,6 +82,8 @@ Window::Window(CKey,
     curEventIdx_ = 0;
     curDownloadIdx_ = 0;
 
+    frameDemand_ = -1;
+
     lastNavigateOperationTime_ = steady_clock::now();
 
     inFileUploadMode_ = false;
@@ -164,6 +180,12 @@ void Window::handleHTTPRequest(MCE, shared_ptr<HTTPRequest> request) {
         }
     }
 
+    if(method == "GET" && regex_match(path, match, framePathRegex)) {
+        REQUIRE(match.size() == 2);
+        imageCompressor_->serveFrame(request, match[1]);
+        return;
+    }
+
     if(method == "GET" && regex_match(path, match, iframePathRegex)) {
         REQUIRE(match.size() == 2);
         optional<uint64_t> mainIdx = parseString<uint64_t>(match[1]);
@@ -234,7 +256,11 @@ shared_ptr<Window> Window::createPopup(uint64_t popupHandle) {
         secretGen_,
         programName_,
         allowPNG_,
-        imageCompressor_->quality()
+        imageCompressor_->quality(),
+        frameCacheSize_,
+        shadowCompressor_,
+        compressionEffortGovernor_,
+        frameCaptureDir_
     );
 
     shared_ptr<Window> self = shared_from_this();
@@ -268,6 +294,17 @@ void Window::notifyViewChanged() {
     });
 }
 
+WindowStats Window::stats() {
+    REQUIRE_API_THREAD();
+    REQUIRE(!closed_);
+
+    WindowStats ret;
+    ret.compressionTime = imageCompressor_->compressionTime();
+    ret.bytesSent = imageCompressor_->bytesSent();
+    ret.frameDemand = max(frameDemand_, 0);
+    return ret;
+}
+
 void Window::setCursor(int cursorSignal) {
     REQUIRE_API_THREAD();
     REQUIRE(!closed_);
@@ -413,19 +450,31 @@ void Window::cancelFileUpload() {
 }
 
 void Window::onImageCompressorFetchImage(
-    function<void(const uint8_t*, size_t, size_t, size_t)> func
+    function<void(
+        const uint8_t*,
+        size_t,
+        size_t,
+        size_t,
+        const optional<ImageDamage>&,
+        shared_ptr<void>
+    )> func
 ) {
     REQUIRE_API_THREAD();
 
     if(closed_) {
         vector<uint8_t> data(4, (uint8_t)255);
-        func(data.data(), 1, 1, 1);
+        func(data.data(), 1, 1, 1, {}, {});
     } else {
         REQUIRE(eventHandler_);
         eventHandler_->onWindowFetchImage(handle_, func);
     }
 }
 
+bool Window::onImageCompressorHasGUI() {
+    REQUIRE_API_THREAD();
+    return !closed_ && inFileUploadMode_;
+}
+
 void Window::onImageCompressorRenderGUI(
     vector<uint8_t>& data, size_t width, size_t height
 ) {
@@ -437,11 +486,27 @@ void Window::onImageCompressorRenderGUI(
 }
 
 void Window::afterConstruct_(shared_ptr<Window> self) {
+    shared_ptr<FrameCaptureWriter> frameCapture;
+    if(!frameCaptureDir_.empty()) {
+        frameCapture = FrameCaptureWriter::tryCreate(
+            frameCaptureDir_ + "/window_" + toString(time(nullptr)) + "_" +
+            toString(handle_) + ".rjvcap"
+        );
+    }
+
     imageCompressor_ = ImageCompressor::create(
-        self, milliseconds(2000), initialQuality_
+        self,
+        milliseconds(2000),
+        initialQuality_,
+        pathPrefix_ + "/frame/",
+        frameCacheSize_,
+        shadowCompressor_,
+        compressionEffortGovernor_,
+        frameCapture
     );
 
     updateInactivityTimeout_();
+    scheduleFrameDemandCheck_();
     notifyViewChanged();
 }
 
@@ -477,6 +542,53 @@ void Window::inactivityTimeoutReached_(MCE, bool shortened) {
     selfClose_(mce);
 }
 
+void Window::updateFrameDemand_(MCE) {
+    REQUIRE_API_THREAD();
+    if(closed_) return;
+
+    // Quantize the demand so that small fluctuations in the client turnaround
+    // time are not reported.
+    const int Levels[] = {1, 2, 5, 10, 15, 20, 30};
+    int demand = imageCompressor_->frameDemand();
+    if(demand > 0) {
+        int quantized = ImageCompressor::MaxFrameDemand;
+        for(int level : Levels) {
+            if(demand <= level) {
+                quantized = level;
+                break;
+            }
+        }
+        demand = quantized;
+    }
+
+    if(demand != frameDemand_) {
+        frameDemand_ = demand;
+
+        REQUIRE(eventHandler_);
+        eventHandler_->onWindowFrameDemand(handle_, demand);
+    }
+}
+
+void Window::scheduleFrameDemandCheck_() {
+    REQUIRE_API_THREAD();
+    if(closed_) return;
+
+    frameDemandCheckTag_ = postDelayedTask(
+        milliseconds(1000),
+        weak_ptr<Window>(shared_from_this()),
+        &Window::frameDemandCheckTimerExpired_,
+        mce
+    );
+}
+
+void Window::frameDemandCheckTimerExpired_(MCE) {
+    REQUIRE_API_THREAD();
+    if(closed_) return;
+
+    updateFrameDemand_(mce);
+    scheduleFrameDemandCheck_();
+}
+
 int Window::decodeKey_(uint64_t eventIdx, int key) {
     REQUIRE(!snakeOilKeyCipherKey_.empty());
     size_t i = (size_t)eventIdx % snakeOilKeyCipherKey_.size();
@@ -850,6 +962,10 @@ void Window::handleImageRequest_(MCE,
         } else {
             imageCompressor_->sendCompressedImageWait(mce, request);
         }
+
+        // Report the demand immediately so that a client returning from the
+        // background does not have to wait for the periodic check.
+        updateFrameDemand_(mce);
     }
 }
 
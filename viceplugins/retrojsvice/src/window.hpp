@@ -17,7 +17,14 @@ public:
     // See ImageCompressorEventHandler::onImageCompressorFetchImage
     virtual void onWindowFetchImage(
         uint64_t window,
-        function<void(const uint8_t*, size_t, size_t, size_t)> func
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
     ) = 0;
 
     virtual void onWindowResize(
@@ -26,6 +33,11 @@ public:
         size_t height
     ) = 0;
 
+    // Called when the estimated rate at which the client consumes the images
+    // of the window changes significantly (see
+    // ImageCompressor::frameDemand); 0 means that there is no consumer.
+    virtual void onWindowFrameDemand(uint64_t window, int framesPerSecond) = 0;
+
     virtual void onWindowMouseDown(uint64_t window, int x, int y, int button) = 0;
     virtual void onWindowMouseUp(uint64_t window, int x, int y, int button) = 0;
     virtual void onWindowMouseMove(uint64_t window, int x, int y) = 0;
@@ -46,9 +58,18 @@ public:
     virtual void onWindowCancelFileUpload(uint64_t window) = 0;
 };
 
+class CompressionEffortGovernor;
 class FileDownload;
 class HTTPRequest;
 class SecretGenerator;
+class ShadowCompressor;
+
+// Cost of serving a window to the client, as shown on the status page.
+struct WindowStats {
+    steady_clock::duration compressionTime;
+    uint64_t bytesSent;
+    int frameDemand;
+};
 
 // Must be closed before destruction (as signaled by the onWindowClose, caused
 // by the Window itself or initiated using Window::close)
@@ -64,7 +85,11 @@ public:
         shared_ptr<SecretGenerator> secretGen,
         string programName,
         bool allowPNG,
-        int initialQuality
+        int initialQuality,
+        size_t frameCacheSize,
+        shared_ptr<ShadowCompressor> shadowCompressor,
+        shared_ptr<CompressionEffortGovernor> compressionEffortGovernor,
+        string frameCaptureDir
     );
     ~Window();
 
@@ -92,10 +117,21 @@ public:
     bool startFileUpload();
     void cancelFileUpload();
 
+    // frameDemand is 0 if the demand has not been measured yet.
+    WindowStats stats();
+
     // ImageCompressorEventHandler:
     virtual void onImageCompressorFetchImage(
-        function<void(const uint8_t*, size_t, size_t, size_t)> func
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
     ) override;
+    virtual bool onImageCompressorHasGUI() override;
     virtual void onImageCompressorRenderGUI(
         vector<uint8_t>& data, size_t width, size_t height
     ) override;
@@ -109,6 +145,13 @@ private:
     void updateInactivityTimeout_(bool shorten = false);
     void inactivityTimeoutReached_(MCE, bool shortened);
 
+    // Reports the current frame demand of the client to the event handler if
+    // it has changed. The demand is checked after each image request and
+    // periodically to detect clients that have stopped requesting images.
+    void updateFrameDemand_(MCE);
+    void scheduleFrameDemandCheck_();
+    void frameDemandCheckTimerExpired_(MCE);
+
     int decodeKey_(uint64_t eventIdx, int key);
     bool handleTokenizedEvent_(MCE,
         uint64_t eventIdx,
@@ -156,6 +199,10 @@ private:
     string programName_;
     bool allowPNG_;
     int initialQuality_;
+    size_t frameCacheSize_;
+    shared_ptr<ShadowCompressor> shadowCompressor_;
+    shared_ptr<CompressionEffortGovernor> compressionEffortGovernor_;
+    string frameCaptureDir_;
     shared_ptr<SecretGenerator> secretGen_;
 
     // The key codes sent by the client are XOR "encrypted" using this key. Note
@@ -212,6 +259,11 @@ private:
 
     shared_ptr<DelayedTaskTag> inactivityTimeoutTag_;
 
+    // The frame demand most recently reported to the event handler, or -1 if
+    // it has not been reported yet.
+    int frameDemand_;
+    shared_ptr<DelayedTaskTag> frameDemandCheckTag_;
+
     steady_clock::time_point lastNavigateOperationTime_;
 
     queue<function<void(shared_ptr<HTTPRequest>)>> iframeQueue_;
@@ -14,7 +14,11 @@ WindowManager::WindowManager(CKey,
     shared_ptr<WindowManagerEventHandler> eventHandler,
     shared_ptr<SecretGenerator> secretGen,
     string programName,
-    int defaultQuality
+    int defaultQuality,
+    size_t frameCacheSize,
+    shared_ptr<ShadowCompressor> shadowCompressor,
+    shared_ptr<CompressionEffortGovernor> compressionEffortGovernor,
+    string frameCaptureDir
 ) {
     REQUIRE_API_THREAD();
     REQUIRE(defaultQuality >= 10 && defaultQuality <= 101);
@@ -25,6 +29,10 @@ WindowManager::WindowManager(CKey,
     secretGen_ = secretGen;
     programName_ = move(programName);
     defaultQuality_ = defaultQuality;
+    frameCacheSize_ = frameCacheSize;
+    shadowCompressor_ = shadowCompressor;
+    compressionEffortGovernor_ = compressionEffortGovernor;
+    frameCaptureDir_ = move(frameCaptureDir);
 }
 
 WindowManager::~WindowManager() {
@@ -140,6 +148,16 @@ void WindowManager::notifyViewChanged(uint64_t window) {
     it->second->notifyViewChanged();
 }
 
+vector<pair<uint64_t, WindowStats>> WindowManager::windowStats() {
+    REQUIRE_API_THREAD();
+
+    vector<pair<uint64_t, WindowStats>> ret;
+    for(pair<uint64_t, shared_ptr<Window>> p : windows_) {
+        ret.emplace_back(p.first, p.second->stats());
+    }
+    return ret;
+}
+
 void WindowManager::setCursor(uint64_t window, int cursorSignal) {
     REQUIRE_API_THREAD();
 
@@ -226,7 +244,14 @@ void WindowManager::onWindowClose(uint64_t window) {
 FORWARD_WINDOW_EVENT(
     onWindowFetchImage(
         uint64_t window,
-        function<void(const uint8_t*, size_t, size_t, size_t)> func
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
     ),
     onWindowManagerFetchImage(window, func)
 )
@@ -234,6 +259,10 @@ FORWARD_WINDOW_EVENT(
     onWindowResize(uint64_t window, size_t width, size_t height),
     onWindowManagerResizeWindow(window, width, height)
 )
+FORWARD_WINDOW_EVENT(
+    onWindowFrameDemand(uint64_t window, int framesPerSecond),
+    onWindowManagerFrameDemand(window, framesPerSecond)
+)
 FORWARD_WINDOW_EVENT(
     onWindowMouseDown(uint64_t window, int x, int y, int button),
     onWindowManagerMouseDown(window, x, y, button)
@@ -322,7 +351,11 @@ void WindowManager::handleNewWindowRequest_(MCE, shared_ptr<HTTPRequest> request
                 secretGen_,
                 programName_,
                 allowPNG,
-                defaultQuality_
+                defaultQuality_,
+                frameCacheSize_,
+                shadowCompressor_,
+                compressionEffortGovernor_,
+                frameCaptureDir_
             );
             REQUIRE(windows_.emplace(handle, window).second);
 
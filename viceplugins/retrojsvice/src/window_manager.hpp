@@ -12,7 +12,14 @@ public:
     // See ImageCompressorEventHandler::onImageCompressorFetchImage
     virtual void onWindowManagerFetchImage(
         uint64_t window,
-        function<void(const uint8_t*, size_t, size_t, size_t)> func
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
     ) = 0;
 
     virtual void onWindowManagerResizeWindow(
@@ -21,6 +28,11 @@ public:
         size_t height
     ) = 0;
 
+    virtual void onWindowManagerFrameDemand(
+        uint64_t window,
+        int framesPerSecond
+    ) = 0;
+
     virtual void onWindowManagerMouseDown(
         uint64_t window, int x, int y, int button
     ) = 0;
@@ -49,9 +61,11 @@ public:
     virtual void onWindowManagerCancelFileUpload(uint64_t window) = 0;
 };
 
+class CompressionEffortGovernor;
 class FileDownload;
 class HTTPRequest;
 class SecretGenerator;
+class ShadowCompressor;
 
 // Must be closed with close() prior to destruction.
 class WindowManager :
@@ -64,7 +78,11 @@ public:
         shared_ptr<WindowManagerEventHandler> eventHandler,
         shared_ptr<SecretGenerator> secretGen,
         string programName,
-        int defaultQuality
+        int defaultQuality,
+        size_t frameCacheSize,
+        shared_ptr<ShadowCompressor> shadowCompressor,
+        shared_ptr<CompressionEffortGovernor> compressionEffortGovernor,
+        string frameCaptureDir
     );
     ~WindowManager();
 
@@ -99,17 +117,31 @@ public:
     bool startFileUpload(uint64_t window);
     void cancelFileUpload(uint64_t window);
 
+    // Stats of all the open windows, ordered by handle.
+    vector<pair<uint64_t, WindowStats>> windowStats();
+
     // WindowEventHandler:
     virtual void onWindowClose(uint64_t window) override;
     virtual void onWindowFetchImage(
         uint64_t window,
-        function<void(const uint8_t*, size_t, size_t, size_t)> func
+        function<void(
+            const uint8_t*,
+            size_t,
+            size_t,
+            size_t,
+            const optional<ImageDamage>&,
+            shared_ptr<void>
+        )> func
     ) override;
     virtual void onWindowResize(
         uint64_t window,
         size_t width,
         size_t height
     ) override;
+    virtual void onWindowFrameDemand(
+        uint64_t window,
+        int framesPerSecond
+    ) override;
     virtual void onWindowMouseDown(
         uint64_t window, int x, int y, int button
     ) override;
@@ -144,6 +176,10 @@ private:
     shared_ptr<SecretGenerator> secretGen_;
     string programName_;
     int defaultQuality_;
+    size_t frameCacheSize_;
+    shared_ptr<ShadowCompressor> shadowCompressor_;
+    shared_ptr<CompressionEffortGovernor> compressionEffortGovernor_;
+    string frameCaptureDir_;
 };
 
 }